@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdlib.h>
+
+#define ARENA_INITLIST          \
+    {                           \
+        .slabs         = NULL,  \
+        .used          = 0,     \
+        .slab_capacity = 0,     \
+        .slabs_cnt     = 0,     \
+        .tsize         = 0,     \
+        .free_list     = NULL,  \
+        .allocated     = 0      \
+    }
+
+enum ArenaErr
+{
+    ARENA_ERR_NONE,
+    ARENA_ERR_NULL,
+    ARENA_ERR_BAD_TSIZE,
+    ARENA_ERR_ALLOC_FAIL
+};
+
+struct ArenaSlab;
+
+/// @brief bump-pointer slab allocator with free list for fixed-size objects
+struct Arena
+{
+    ArenaSlab* slabs;
+    size_t used;
+    size_t slab_capacity;
+    size_t slabs_cnt;
+    size_t tsize;
+
+    void* free_list;
+
+    size_t allocated;
+};
+
+/// @param tsize object size, must be at least sizeof(void*)
+ArenaErr arena_ctor(Arena* arena, size_t tsize);
+
+void* arena_alloc(Arena* arena);
+
+/// @brief returns object to arena free list, memory is kept until arena_dtor
+void arena_free(Arena* arena, void* ptr);
+
+/// @brief releases all objects at once, O(slabs)
+void arena_dtor(Arena* arena);
+
+const char* arena_strerr(const ArenaErr err);
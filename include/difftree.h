@@ -1,8 +1,11 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "ptr_map.h"
 #include "vector.h"
 #include "types.h"
 #include "variable.h"
@@ -13,12 +16,48 @@
         .size = 0,                    \
         .buf = {                      \
             .ptr = NULL,              \
+            .owned = NULL,            \
             .len = 0,                 \
             .pos = 0,                 \
             .filename = NULL          \
         },                            \
         .vars = VECTOR_INITLIST,      \
-        .to_delete = VECTOR_INITLIST  \
+        .vars_index = {               \
+            .slots = NULL,            \
+            .capacity = 0             \
+        },                            \
+        .to_delete = VECTOR_INITLIST, \
+        .nodes = ARENA_INITLIST,      \
+        .is_dag = false,              \
+        .use_jit = false,             \
+        .use_kernel = false,          \
+        .kernel_dir = NULL,           \
+        .interned = {                 \
+            .buffer = NULL,           \
+            .size = 0,                \
+            .capacity = 0             \
+        },                            \
+        .dag_memo = {                 \
+            .var = (size_t) -1,       \
+            .diff = PTR_MAP_INITLIST, \
+            .optimized = PTR_MAP_INITLIST, \
+            .normalized = PTR_MAP_INITLIST, \
+            .eval = PTR_MAP_INITLIST  \
+        },                            \
+        .diff_memo = {                \
+            .buffer = NULL,           \
+            .size = 0,                \
+            .capacity = 0             \
+        },                            \
+        .stats = {                    \
+            .cse_temps = 0,           \
+            .cse_nodes_eliminated = 0,\
+            .opt_visits = 0,          \
+            .opt_rewrites = 0,        \
+            .norm_merged = 0,         \
+            .diff_lookups = 0,        \
+            .diff_hits = 0            \
+        }                             \
     };                      
 
 typedef enum DiffTreeErr
@@ -32,6 +71,10 @@ typedef enum DiffTreeErr
 
 } DiffTreeErr;
 
+/// @brief bit i is set if a subtree depends on DiffTree::vars[i],
+///        variables past the last bit share it
+typedef uint32_t DiffTreeVarMask;
+
 typedef struct DiffTreeNode
 {
     DiffTreeNode* left;
@@ -39,56 +82,195 @@ typedef struct DiffTreeNode
     DiffTreeNode* parent;
     
     NodeType type;
+    /// computed on creation, passes that relink children refresh it;
+    /// fits next to type without growing the node
+    DiffTreeVarMask var_mask;
     NodeValue value;
 
 } DiffTreeNode;
 
+/// @brief counters filled in by passes over the tree, printed with --stats
+typedef struct DiffTreeStats
+{
+    /// temporaries allocated by the tape compiler for repeated subexpressions
+    size_t cse_temps;
+    /// tree nodes not evaluated because their subexpression was loaded from a temporary
+    size_t cse_nodes_eliminated;
+    /// nodes examined by diff_tree_optimize, replacements are examined again
+    size_t opt_visits;
+    size_t opt_rewrites;
+    /// like terms and powers of the same base combined by diff_tree_normalize
+    size_t norm_merged;
+    /// subtrees looked up in memo of diff_tree_differentiate and derivatives found there
+    size_t diff_lookups;
+    size_t diff_hits;
+
+} DiffTreeStats;
+
+/// @brief derivative remembered by diff_tree_differentiate in tree mode
+typedef struct DiffTreeDiffMemoEntry
+{
+    /// diff_tree_subtree_hash of node, 0 is an empty entry
+    utils_hash_t hash;
+    size_t var;
+    DiffTreeNode* node;
+    DiffTreeNode* deriv;
+
+} DiffTreeDiffMemoEntry;
+
 typedef struct DiffTree
 {
     DiffTreeNode* root;
     size_t size;
 
+    /// view of the expression being parsed, detached once it is parsed
     struct {
-        char* ptr;
+        const char* ptr;
+        /// copy of an expression that was not terminated by \n
+        char* owned;
         ssize_t len;
         ssize_t pos;
         const char* filename;
     } buf;
 
+    /// Variable, in order of first occurrence
     Vector vars;
 
+    /// open addressing table from name hash to slot + 1, 0 is an empty entry
+    struct {
+        size_t* slots;
+        size_t capacity;
+    } vars_index;
+
     Vector to_delete;
 
+    Arena nodes;
+
+    /// in DAG mode nodes are hash-consed: structurally equal subtrees
+    /// are the same node, nodes are immutable and parent is not maintained
+    bool is_dag;
+
+    /// plots sample through native code generated by diff_tree_jit_compile
+    bool use_jit;
+
+    /// plots sample through C kernels built by diff_tree_kernel_load,
+    /// cached in kernel_dir, NULL is the default cache directory
+    bool use_kernel;
+    const char* kernel_dir;
+
+    struct {
+        DiffTreeNode** buffer;
+        size_t size;
+        size_t capacity;
+    } interned;
+
+    /// memo tables for DAG mode, keyed by node
+    struct {
+        size_t var;
+        PtrMap diff;
+        PtrMap optimized;
+        PtrMap normalized;
+        PtrMap eval;
+    } dag_memo;
+
+    /// open addressing memo of diff_tree_differentiate for tree mode, keyed by
+    /// structure of subtrees; kept for one differentiation, nothing it links changes until it returns
+    struct {
+        DiffTreeDiffMemoEntry* buffer;
+        size_t size;
+        size_t capacity;
+    } diff_memo;
+
+    DiffTreeStats stats;
+
 } DiffTree;
 
 DiffTreeErr diff_tree_ctor(DiffTree* diff_tree);
 
+/// @brief switches tree to hash-consed DAG mode, 
+///        must be called before any node is created
+DiffTreeErr diff_tree_enable_dag(DiffTree* dtree);
+
 DiffTreeErr diff_tree_copy_tree(DiffTree* from, DiffTree* to);
 
 void diff_tree_dtor(DiffTree* diff_tree);
 
+struct DiffTreeSink;
+
 DiffTreeErr diff_tree_init_latex_file(const char* filename);
 
+/// @brief writes the end of the document and closes the file
 void diff_tree_end_latex_file();
 
+/// @brief starts a document in sink, LaTeX dumps go there until diff_tree_end_latex,
+///        a memory sink renders it without touching the filesystem
+void diff_tree_init_latex(DiffTreeSink* sink);
+
+/// @brief writes the end of the document and flushes the sink
+DiffTreeErr diff_tree_end_latex();
+
+/// @brief bytes written to the current LaTeX sink, 0 if there is none
+size_t diff_tree_latex_size();
+
+/// @brief expressions of more than max_nodes nodes are dumped cut with \dots,
+///        0 for no limit; in DAG mode shared nodes count at every use
+void diff_tree_set_latex_max_nodes(size_t max_nodes);
+
+/// @brief redirects LaTeX dumps, for example to render one expression into memory
+/// @return previous sink to restore
+DiffTreeSink* diff_tree_set_latex_sink(DiffTreeSink* sink);
+
 const char* diff_tree_strerr(DiffTreeErr err);
 
 void diff_tree_node_print(FILE* stream, void* node);
 
+/// @brief writes the expression as a binary image, diff_tree_fread_image reads it back
 DiffTreeErr diff_tree_fwrite(DiffTree* diff_tree, const char* filename);
 
+/// @brief reads the expression of a file written by diff_tree_fwrite, see difftree_image.h
+DiffTreeErr diff_tree_fread_image(DiffTree* diff_tree, const char* filename);
+
+/// @brief parses the first line of the file without loading the rest of it
+/// @param filename NULL or "-" reads stdin
 DiffTreeErr diff_tree_fread(DiffTree* diff_tree, const char* filename);
 
-DiffTreeNode* diff_tree_new_node(NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right, DiffTreeNode *parent);
+/// @brief parses one expression from str, the terminating \n may be omitted
+DiffTreeErr diff_tree_sread(DiffTree* diff_tree, const char* str, size_t len);
+
+/// @brief prints subtree in plain infix form, without trailing \n
+DiffTreeErr diff_tree_fprint_node(DiffTree* dtree, DiffTreeNode* node, FILE* file);
 
+DiffTreeNode* diff_tree_new_node(DiffTree* dtree, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right, DiffTreeNode *parent);
+
+/// @brief in DAG mode returns node itself since nodes are shared
 DiffTreeNode* diff_tree_copy_subtree(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* parent);
 
-void diff_tree_free_subtree(DiffTreeNode* node);
+void diff_tree_free_subtree(DiffTree* dtree, DiffTreeNode* node);
+
+/// @brief hash of the structure that does not depend on node addresses or DAG mode,
+///        variables are hashed by name and constants bitwise; never 0
+utils_hash_t diff_tree_subtree_hash(DiffTree* dtree, DiffTreeNode* node);
+
+/// @brief structural equality of subtrees of dtree, constants are compared bitwise
+bool diff_tree_subtree_equal(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* other);
+
+/// @brief slot of the variable, it is appended to dtree->vars on first occurrence
+DiffTreeErr diff_tree_add_variable(DiffTree* dtree, const char* name, size_t len, size_t* slot);
+
+/// @return NULL if the expression has no variable with this name
+Variable* diff_tree_find_variable(DiffTree* dtree, const char* name, size_t len);
 
-Variable* diff_tree_find_variable(DiffTree* dtree, utils_hash_t hash);
+/// @brief O(1), slot is the value of a NODE_TYPE_VAR node
+Variable* diff_tree_variable(const DiffTree* dtree, size_t slot);
+
+DiffTreeVarMask diff_tree_var_mask(DiffTree* dtree, size_t slot);
 
 void diff_tree_mark_to_delete(DiffTree* dtree, DiffTreeNode* node);
 
+/// @brief returns all subtrees marked to delete to node arena,
+///        must be called only when none of them is referenced
+void diff_tree_release_marked(DiffTree* dtree);
+
 void diff_tree_dump_latex(const char* fmt, ...)
     __attribute__((format(printf, 1, 2)));
 
@@ -118,4 +300,10 @@ void diff_tree_dump(DiffTree* diff_tree, DiffTreeNode* node, DiffTreeErr err, co
 #define DIFF_TREE_DUMP_MSG(diff_tree, err, msg) \
     diff_tree_dump(diff_tree, (diff_tree)->root, err, msg, __FILE__, __LINE__, __func__); 
 
+#else // _DEBUG
+
+#define DIFF_TREE_DUMP_NODE(diff_tree, node, err)
+#define DIFF_TREE_DUMP(diff_tree, err)
+#define DIFF_TREE_DUMP_MSG(diff_tree, err, msg)
+
 #endif // _DEBUG
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "difftree.h"
+
+/// @brief differentiates every line of input by its first variable and writes
+///        derivatives in plain infix form, one per line in input order;
+///        lines are spread over threads_cnt workers, each with its own tree
+/// @param threads_cnt 0 means one worker per online processor
+DiffTreeErr diff_tree_batch(const char* in, const char* out, size_t threads_cnt, bool is_dag);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "difftree.h"
+#include "hashutils.h"
+
+/// room for the directory of a cache, file names of entries are appended to it
+const size_t DIFF_TREE_CACHE_DIR_LEN_MAX = 960;
+
+/// @brief what a run computes from the expression, entries are named by hash of it
+typedef struct DiffTreeCacheKey
+{
+    /// diff_tree_subtree_hash of the optimized expression
+    utils_hash_t expr_hash;
+
+    /// variable to differentiate by and the order of the derivative
+    size_t slot;
+    size_t order;
+
+    /// Taylor polynom of order power at x0, other variables keep their values
+    size_t power;
+    double x0;
+    bool symbolic;
+
+} DiffTreeCacheKey;
+
+/// @brief nodes stored in an entry, expr tells hash collisions apart on load
+typedef struct DiffTreeCacheEntry
+{
+    DiffTreeNode* expr;
+    DiffTreeNode* deriv;
+    DiffTreeNode* taylor;
+
+} DiffTreeCacheEntry;
+
+/// @brief resolves the directory and creates it with its parents
+/// @param cache_dir NULL for $XDG_CACHE_HOME/difftree or ~/.cache/difftree
+/// @param dir DIFF_TREE_CACHE_DIR_LEN_MAX bytes
+DiffTreeErr diff_tree_cache_dir(const char* cache_dir, char* dir);
+
+/// @brief loads the entry of key into dtree if it holds expr and was made
+///        with the same variables and values
+/// @return false on a miss, dtree is left as it was
+bool diff_tree_cache_load(const char* dir, const DiffTreeCacheKey* key, DiffTree* dtree, DiffTreeNode* expr, DiffTreeCacheEntry* entry);
+
+/// @brief writes the entry under a temporary name and renames it, so concurrent
+///        runs see either no entry or a whole one; nodes may belong to copies of dtree
+DiffTreeErr diff_tree_cache_store(const char* dir, const DiffTreeCacheKey* key, DiffTree* dtree, const DiffTreeCacheEntry* entry);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "difftree.h"
+#include "hashutils.h"
+
+/// @brief function of a generated kernel, name must be a C identifier
+typedef struct DiffTreeCodegenFn
+{
+    const char* name;
+    DiffTreeNode* node;
+
+} DiffTreeCodegenFn;
+
+/// @param vars values of variables, indexed as DiffTree::vars
+typedef double (*DiffTreeKernelFn)(const double* vars);
+
+/// @brief evaluates at n points, variable slot takes values from xs
+typedef void (*DiffTreeKernelBatchFn)(const double* vars, size_t slot, const double* xs, double* res, size_t n);
+
+/// @brief shared object built from generated C source and loaded with dlopen
+typedef struct DiffTreeKernel
+{
+    void* handle;
+    /// hash of the source, the object is cached under it
+    utils_hash_t hash;
+    /// loaded from cache without running the compiler
+    bool cached;
+
+} DiffTreeKernel;
+
+/// @brief writes self-contained C source, for every fn
+///        double <name>(const double* vars) and its <name>_batch
+DiffTreeErr diff_tree_codegen_fwrite(DiffTree* dtree, const DiffTreeCodegenFn* fns, size_t fns_cnt, FILE* file);
+
+/// @brief generates source, compiles it with $CC (cc by default) unless
+///        the cache already has it, and loads it
+/// @param cache_dir NULL for $XDG_CACHE_HOME/difftree or ~/.cache/difftree
+DiffTreeErr diff_tree_kernel_load(DiffTreeKernel* kernel, DiffTree* dtree, const DiffTreeCodegenFn* fns, size_t fns_cnt, const char* cache_dir);
+
+/// @return NULL if the kernel has no such function
+DiffTreeKernelFn diff_tree_kernel_fn(const DiffTreeKernel* kernel, const char* name);
+
+DiffTreeKernelBatchFn diff_tree_kernel_batch_fn(const DiffTreeKernel* kernel, const char* name);
+
+void diff_tree_kernel_unload(DiffTreeKernel* kernel);
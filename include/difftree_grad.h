@@ -0,0 +1,10 @@
+#pragma once
+
+#include "difftree.h"
+#include "difftree_tape.h"
+
+/// @brief value and partial derivatives over all variables in one forward
+///        and one backward sweep over the tape
+/// @param vars values of variables, indexed as DiffTree::vars
+/// @param grad tape->vars_cnt partial derivatives, indexed as DiffTree::vars
+DiffTreeErr diff_tree_grad_eval(DiffTreeTape* tape, const double* vars, double* value, double* grad);
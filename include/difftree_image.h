@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "difftree.h"
+
+/// @brief bumped on any change of the layout below
+const uint32_t DIFF_TREE_IMAGE_VERSION = 1;
+
+/// @brief child index of a leaf or of a unary operator's right side
+const uint32_t DIFF_TREE_IMAGE_NIL = UINT32_MAX;
+
+/// @brief file starts with it, then go vars, nums, roots and nodes arrays;
+///        all of them are in host byte order and aligned for direct use
+typedef struct DiffTreeImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+
+    uint64_t vars_cnt;
+    uint64_t nums_cnt;
+    uint64_t roots_cnt;
+    uint64_t nodes_cnt;
+
+    /// of everything after the header
+    uint64_t checksum;
+
+} DiffTreeImageHeader;
+
+typedef struct DiffTreeImageVar
+{
+    char name[VARIABLE_NAME_LEN_MAX + 1];
+    double val;
+
+} DiffTreeImageVar;
+
+/// @brief nodes are in post-order, children are indices of earlier nodes,
+///        so a node shared in DAG mode is written once
+typedef struct DiffTreeImageNode
+{
+    uint32_t left;
+    uint32_t right;
+
+    /// NodeType
+    uint32_t type  : 4;
+    /// OperatorType, index in vars or index in nums
+    uint32_t value : 28;
+
+} DiffTreeImageNode;
+
+/// @brief read-only view of a memory mapped image, checked once on open
+typedef struct DiffTreeImage
+{
+    void* map;
+    size_t map_len;
+
+    const DiffTreeImageHeader* header;
+    const DiffTreeImageVar* vars;
+    const double* nums;
+    const uint32_t* roots;
+    const DiffTreeImageNode* nodes;
+
+} DiffTreeImage;
+
+/// @brief writes subtrees of dtree with its variables and distinct constants
+DiffTreeErr diff_tree_image_fwrite(DiffTree* dtree, DiffTreeNode* const* roots, size_t roots_cnt, const char* filename);
+
+/// @brief maps the file and checks its header, checksum and every node
+DiffTreeErr diff_tree_image_open(DiffTreeImage* image, const char* filename);
+
+/// @brief builds nodes of the image in dtree, variables are matched by name;
+///        in DAG mode nodes are interned, otherwise shared ones are copied
+/// @param roots image->header->roots_cnt subtrees, in the order they were written
+DiffTreeErr diff_tree_image_load(const DiffTreeImage* image, DiffTree* dtree, DiffTreeNode** roots);
+
+void diff_tree_image_close(DiffTreeImage* image);
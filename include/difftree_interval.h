@@ -0,0 +1,28 @@
+#pragma once
+
+#include "difftree.h"
+#include "difftree_tape.h"
+
+/// @brief closed interval of values; lo > hi if the function is undefined on all of it
+typedef struct DiffTreeInterval
+{
+    double lo;
+    double hi;
+
+    /// the function may be undefined or unbounded somewhere inside
+    bool partial;
+
+} DiffTreeInterval;
+
+/// @brief encloses values of the compiled tape while variables range over vars,
+///        bounds are widened by an ulp after every operator to cover rounding
+/// @param vars intervals of variables, indexed as DiffTree::vars
+DiffTreeErr diff_tree_interval_eval(DiffTreeTape* tape, const DiffTreeInterval* vars, DiffTreeInterval* res);
+
+/// @brief finds by bisection down to x_step the narrowest [*x_min, *x_max] in [x_begin, x_end]
+///        out of which the tape takes no values in (y_min, y_max)
+/// @param vars values of variables, indexed as DiffTree::vars, slot ranges over x
+/// @return false if there are no such values or evaluation failed
+bool diff_tree_interval_find_range(DiffTreeTape* tape, const double* vars, size_t slot,
+                                   double x_begin, double x_end, double x_step,
+                                   double y_min, double y_max, double* x_min, double* x_max);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "difftree.h"
+#include "difftree_tape.h"
+
+/// @brief propagates truncated power series in variable slot through the tape,
+///        coeffs[k] = f^(k)(x0) / k! for k = 0..order, where x0 = vars[slot]
+DiffTreeErr diff_tree_jet_eval(DiffTreeTape* tape, const double* vars, size_t slot, size_t order, double* coeffs);
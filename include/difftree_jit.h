@@ -0,0 +1,41 @@
+#pragma once
+
+#include "difftree.h"
+#include "difftree_tape.h"
+#include "vector.h"
+
+/// @brief compiled tape, evaluates VMATH_LANES points per iteration over n points
+typedef void (*DiffTreeJitFn)(const double* vars, const double* xs, double* res, size_t n, double* frame);
+
+/// @brief native x86-64 code for a tape sampled over one variable; where
+///        it can't be generated evaluation falls back to the tape itself
+typedef struct DiffTreeJit
+{
+    /// not owned, must outlive the jit
+    DiffTreeTape* tape;
+    /// variable taking values from xs
+    size_t slot;
+
+    /// NULL if evaluation falls back to the tape
+    DiffTreeJitFn fn;
+    void* code;
+    size_t code_size;
+
+    /// spilled stack, temporaries and constants of fn, VMATH_LANES doubles per entry
+    double* frame;
+
+} DiffTreeJit;
+
+void diff_tree_jit_ctor(DiffTreeJit* jit, DiffTreeTape* tape, size_t slot);
+
+/// @brief generates code for the compiled tape; falling back to the tape is not
+///        an error, it happens on CPUs without AVX or for too deep stacks
+DiffTreeErr diff_tree_jit_compile(DiffTreeJit* jit);
+
+bool diff_tree_jit_is_native(const DiffTreeJit* jit);
+
+/// @brief same as diff_tree_tape_eval_batch without per-point status
+/// @param vars values of variables, indexed as DiffTree::vars
+void diff_tree_jit_eval_batch(DiffTreeJit* jit, const double* vars, const double* xs, double* res, size_t n);
+
+void diff_tree_jit_dtor(DiffTreeJit* jit);
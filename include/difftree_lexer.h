@@ -0,0 +1,36 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "difftree.h"
+
+typedef enum DiffTreeTokenType
+{
+    DIFF_TREE_TOKEN_NUM,
+    /// variable name, buf.ptr + pos of len characters
+    DIFF_TREE_TOKEN_VAR,
+    /// function name, value.op_type is its operator
+    DIFF_TREE_TOKEN_FUNC,
+    /// binary operator, value.op_type is its operator
+    DIFF_TREE_TOKEN_OP,
+    DIFF_TREE_TOKEN_LPAREN,
+    DIFF_TREE_TOKEN_RPAREN,
+    /// terminating \n, always the last token
+    DIFF_TREE_TOKEN_END,
+
+} DiffTreeTokenType;
+
+typedef struct DiffTreeToken
+{
+    DiffTreeTokenType type;
+    NodeValue value;
+
+    /// position in dtree->buf, for syntax errors and variable names
+    ssize_t pos;
+    ssize_t len;
+
+} DiffTreeToken;
+
+/// @brief reads the token at dtree->buf.pos and moves past it,
+///        so the buffer is scanned once as the parser asks for tokens
+DiffTreeErr diff_tree_lex_next(DiffTree* dtree, DiffTreeToken* token);
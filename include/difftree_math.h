@@ -3,19 +3,49 @@
 
 void diff_tree_set_latex_dump_enabled(bool enabled);
 
+typedef enum DiffTreeSteps
+{
+    /// only the expression and its derivatives
+    DIFF_TREE_STEPS_NONE,
+    /// rules applied to the expression and its operands
+    DIFF_TREE_STEPS_TOP,
+    /// every rule applied
+    DIFF_TREE_STEPS_ALL,
+
+} DiffTreeSteps;
+
+/// @brief how much of the derivation is dumped, DIFF_TREE_STEPS_ALL by default
+/// @param max_steps, max_bytes 0 for no limit, once one is reached the rest of steps is skipped
+void diff_tree_set_latex_steps(DiffTreeSteps steps, size_t max_steps, size_t max_bytes);
+
 DiffTreeErr diff_tree_differentiate_tree_n(DiffTree* dtree, Variable* var, size_t n);
 
 DiffTreeNode* diff_tree_differentiate(DiffTree* dtree, DiffTreeNode* node, Variable* var);
 
+/// @brief dumps expr and its derivative like diff_tree_differentiate_tree_n, without steps
+void diff_tree_dump_derivative_latex(DiffTree* dtree, DiffTreeNode* expr, DiffTreeNode* deriv);
+
 /// @brief all variables must be set before evaluating
 double diff_tree_evaluate_tree(DiffTree* dtree);
 
 /// @brief all variables must be set before evaluating
 double diff_tree_evaluate(DiffTree* dtree, DiffTreeNode* node);
 
+/// @brief reentrant, variables are read from vals by slot and dtree is not modified
+double diff_tree_evaluate_at(const DiffTree* dtree, DiffTreeNode* node, const double* vals);
+
 double diff_tree_evaluate_op(DiffTree* dtree, DiffTreeNode* node);
 
 
-bool diff_tree_subtree_holds_var(DiffTreeNode* node, Variable* var);
+/// @brief O(1), reads the variable mask kept in every node
+bool diff_tree_subtree_holds_var(DiffTree* dtree, DiffTreeNode* node, Variable* var);
 
+/// @brief Taylor polynom of order n at x0, coefficients are computed
+///        by propagating truncated power series through the tree; not dumped
 DiffTreeNode* diff_tree_taylor_expansion(DiffTree* dtree, Variable* var, double x0, size_t n);
+
+/// @brief same polynom built by differentiating the tree n times, slow for large n
+DiffTreeNode* diff_tree_taylor_expansion_symbolic(DiffTree* dtree, Variable* var, double x0, size_t n);
+
+/// @brief dumps polynom of order n at x0 like the expansions do
+void diff_tree_dump_taylor_latex(DiffTree* dtree, DiffTreeNode* polynom, Variable* var, double x0, size_t n);
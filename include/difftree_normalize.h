@@ -0,0 +1,8 @@
+#pragma once
+
+#include "difftree.h"
+
+/// @brief rewrites sums and products into canonical form: chains are flattened,
+///        operands sorted, numbers merged into one coefficient, like monomials
+///        and powers of the same base combined
+DiffTreeErr diff_tree_normalize(DiffTree* dtree);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "difftree.h"
+
+/// @brief growable text buffer; with a file it is written out by large blocks,
+///        without one everything stays in memory until diff_tree_sink_str
+typedef struct DiffTreeSink
+{
+    char* buf;
+    size_t len;
+    size_t capacity;
+    /// text already written to the file
+    size_t flushed;
+
+    /// not owned, NULL keeps the output in memory
+    FILE* file;
+
+    /// first failed allocation or write, later output is dropped
+    DiffTreeErr err;
+
+} DiffTreeSink;
+
+/// @param file NULL renders into memory
+void diff_tree_sink_ctor(DiffTreeSink* sink, FILE* file);
+
+void diff_tree_sink_write(DiffTreeSink* sink, const char* str, size_t len);
+
+void diff_tree_sink_puts(DiffTreeSink* sink, const char* str);
+
+void diff_tree_sink_putc(DiffTreeSink* sink, char ch);
+
+void diff_tree_sink_printf(DiffTreeSink* sink, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void diff_tree_sink_vprintf(DiffTreeSink* sink, const char* fmt, va_list args)
+    __attribute__((format(printf, 2, 0)));
+
+/// @brief same text as printf("%.<prec>f", x) without going through printf
+///        for ordinary values, prec is at most 9
+void diff_tree_sink_fixed(DiffTreeSink* sink, double x, unsigned prec);
+
+/// @brief writes buffered text to the file, no-op for a memory sink
+/// @return first error of the sink, output was incomplete if not none
+DiffTreeErr diff_tree_sink_flush(DiffTreeSink* sink);
+
+/// @brief bytes written to the sink so far, flushed or not
+size_t diff_tree_sink_size(const DiffTreeSink* sink);
+
+/// @brief text of a memory sink, \0-terminated, valid until the next write
+/// @param len may be NULL
+const char* diff_tree_sink_str(DiffTreeSink* sink, size_t* len);
+
+void diff_tree_sink_dtor(DiffTreeSink* sink);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "difftree.h"
+
+/// @brief line reader over a memory mapped file or, for pipes and stdin,
+///        over a window filled by chunks; lines are returned as views into
+///        it and are never copied or modified
+typedef struct DiffTreeSource
+{
+    const char* filename;
+    int fd;
+
+    /// whole file if it could be mapped, map_addr is the same mapping for munmap
+    const char* map;
+    void* map_addr;
+    size_t map_len;
+    /// mapped pages before it are dropped from memory
+    size_t map_released;
+
+    /// chunks read from fd, also holds the last line of a file not terminated by \n
+    char* window;
+    size_t window_len;
+    size_t window_cap;
+
+    /// next byte to scan, in map or in window
+    size_t pos;
+    /// first byte of lines not discarded yet
+    size_t kept;
+
+    bool read_eof;
+    bool eof;
+
+} DiffTreeSource;
+
+/// @param filename NULL or "-" reads stdin
+DiffTreeErr diff_tree_source_open(DiffTreeSource* src, const char* filename);
+
+/// @brief next line with its terminating \n, valid until diff_tree_source_discard
+/// @param line NULL if all lines were returned or the window is full of lines
+///             not discarded yet, diff_tree_source_eof tells them apart
+DiffTreeErr diff_tree_source_next(DiffTreeSource* src, const char** line, size_t* len);
+
+/// @brief lines returned so far are not used anymore
+void diff_tree_source_discard(DiffTreeSource* src);
+
+bool diff_tree_source_eof(const DiffTreeSource* src);
+
+void diff_tree_source_close(DiffTreeSource* src);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "difftree.h"
+#include "vector.h"
+
+/// @brief order of operator opcodes follows OperatorType
+typedef enum DiffTreeTapeOpcode
+{
+    TAPE_OPCODE_NUM,
+    TAPE_OPCODE_VAR,
+    TAPE_OPCODE_ADD,
+    TAPE_OPCODE_SUB,
+    TAPE_OPCODE_MUL,
+    TAPE_OPCODE_DIV,
+    TAPE_OPCODE_POW,
+    TAPE_OPCODE_EXP,
+    TAPE_OPCODE_SQRT,
+    TAPE_OPCODE_LOG,
+    TAPE_OPCODE_SIN,
+    TAPE_OPCODE_COS,
+    TAPE_OPCODE_TAN,
+    TAPE_OPCODE_CTG,
+    TAPE_OPCODE_SH,
+    TAPE_OPCODE_CH,
+    TAPE_OPCODE_TH,
+    TAPE_OPCODE_ASIN,
+    TAPE_OPCODE_ACOS,
+    TAPE_OPCODE_ATAN,
+    TAPE_OPCODE_ACTG,
+
+    /// POW with small integer constant exponent inlined into arg.power
+    TAPE_OPCODE_POWI,
+
+    /// copies top of stack to temporary arg.slot, stack is left unchanged
+    TAPE_OPCODE_STORE,
+    /// pushes temporary arg.slot
+    TAPE_OPCODE_LOAD,
+
+} DiffTreeTapeOpcode;
+
+typedef struct DiffTreeTapeInstr
+{
+    DiffTreeTapeOpcode opcode;
+
+    union {
+        double num;
+        size_t slot;
+        long power;
+    } arg;
+
+} DiffTreeTapeInstr;
+
+/// @brief number of points evaluated together by diff_tree_tape_eval_batch
+const size_t TAPE_BATCH_BLOCK = 64;
+
+/// @brief per-point status of batch evaluation
+typedef enum DiffTreeLaneErr
+{
+    DIFF_TREE_LANE_OK,
+    /// result is NaN for a non-NaN argument, e.g. log(-1) or sqrt(-1)
+    DIFF_TREE_LANE_DOMAIN,
+    /// result is infinite for a finite argument, e.g. 1/0 or exp(1000)
+    DIFF_TREE_LANE_RANGE,
+
+} DiffTreeLaneErr;
+
+/// @brief postfix instruction tape, constants are inlined and
+///        variables are resolved to indices in DiffTree::vars;
+///        repeated subexpressions are evaluated once and kept in temporaries
+typedef struct DiffTreeTape
+{
+    Vector code;
+
+    size_t stack_max;
+    double* stack;
+
+    size_t temps_cnt;
+    double* temps;
+
+    /// stack_max + temps_cnt rows of TAPE_BATCH_BLOCK values
+    double* batch_stack;
+
+    /// values and adjoints of reverse sweep, allocated on first diff_tree_grad_eval
+    double* grad_vals;
+    /// operand links and operand stack of reverse sweep
+    size_t* grad_links;
+
+    size_t vars_cnt;
+
+} DiffTreeTape;
+
+DiffTreeErr diff_tree_tape_ctor(DiffTreeTape* tape);
+
+DiffTreeErr diff_tree_tape_compile(DiffTreeTape* tape, DiffTree* dtree, DiffTreeNode* node);
+
+/// @param vars values of variables, indexed as DiffTree::vars
+double diff_tree_tape_eval(DiffTreeTape* tape, const double* vars);
+
+/// @brief evaluates the tape at n points, variable slot takes values from xs,
+///        other variables are taken from vars
+/// @param errs per-point status, may be NULL
+void diff_tree_tape_eval_batch(DiffTreeTape* tape, const double* vars, size_t slot,
+                               const double* xs, double* res, DiffTreeLaneErr* errs, size_t n);
+
+/// @brief base ^ power by repeated squaring, used for TAPE_OPCODE_POWI
+double diff_tree_tape_powi(double base, long power);
+
+/// @brief fills vals with current values of DiffTree::vars
+void diff_tree_tape_load_vars(DiffTree* dtree, double* vals);
+
+void diff_tree_tape_dtor(DiffTreeTape* tape);
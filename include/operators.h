@@ -3,8 +3,6 @@
 #include "types.h"
 #include "utils.h"
 
-const size_t MAX_OP_NAME_LEN = 10;
-
 typedef enum OperatorArgnum
 {
     OPERATOR_ARGNUM_NONE = 0x00,
@@ -34,37 +32,42 @@ typedef struct Operator
     const char* latex_str_inf;
     const char* latex_str_post;
 
+    /// C expression around the operands, for generated kernels
+    const char* c_str_pref;
+    const char* c_str_inf;
+    const char* c_str_post;
+
     utils_hash_t hash;
 
 } Operator;
 
-#define MAKE_OPERATOR(str, pref, inf, post, type, argnum, precedance) \
-    { type, argnum, precedance, str, pref, inf, post, utils_djb2_hash(str, SIZEOF(str)) }
+#define MAKE_OPERATOR(str, pref, inf, post, c_pref, c_inf, c_post, type, argnum, precedance) \
+    { type, argnum, precedance, str, pref, inf, post, c_pref, c_inf, c_post, utils_djb2_hash(str, SIZEOF(str)) }
 
 static Operator op_arr[] = 
 {
-    MAKE_OPERATOR("+"     , ""          , "+"         , ""   , OPERATOR_TYPE_ADD  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_1),
-    MAKE_OPERATOR("-"     , ""          , "-"         , ""   , OPERATOR_TYPE_SUB  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_1),
-    MAKE_OPERATOR("*"     , "{"         , "}\\cdot{"  , "}"  , OPERATOR_TYPE_MUL  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_2),
-    MAKE_OPERATOR("/"     , "\\frac{"   , "}{"        , "}"  , OPERATOR_TYPE_DIV  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_2),
-    MAKE_OPERATOR("^"     , "{"         , "}^{"       , "}"  , OPERATOR_TYPE_POW  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_3),
-    MAKE_OPERATOR("exp"   , "e^{"       , ""          , "}"  , OPERATOR_TYPE_EXP  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("sqrt"  , "\\sqrt{"   , ""          , "}"  , OPERATOR_TYPE_SQRT , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("ln"    , "\\ln{"     , ""          , "}"  , OPERATOR_TYPE_LOG  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("sin"   , "\\sin{"    , ""          , "}"  , OPERATOR_TYPE_SIN  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("cos"   , "\\cos{"    , ""          , "}"  , OPERATOR_TYPE_COS  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("tan"   , "\\tg{"     , ""          , "}"  , OPERATOR_TYPE_TAN  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("ctg"   , "\\ctg{"    , ""          , "}"  , OPERATOR_TYPE_CTG  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("sh"    , "\\sh{"     , ""          , "}"  , OPERATOR_TYPE_SH   , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("ch"    , "\\ch{"     , ""          , "}"  , OPERATOR_TYPE_CH   , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("th"    , "\\th{"     , ""          , "}"  , OPERATOR_TYPE_TH   , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("arcsin", "\\arcsin{" , ""          , "}"  , OPERATOR_TYPE_ASIN , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("arccos", "\\arccos{" , ""          , "}"  , OPERATOR_TYPE_ACOS , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
-    MAKE_OPERATOR("arctg" , "\\arctan{" , ""          , "}"  , OPERATOR_TYPE_ATAN , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("+"     , ""          , "+"         , ""   , ""           , " + ", ""  , OPERATOR_TYPE_ADD  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_1),
+    MAKE_OPERATOR("-"     , ""          , "-"         , ""   , ""           , " - ", ""  , OPERATOR_TYPE_SUB  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_1),
+    MAKE_OPERATOR("*"     , "{"         , "}\\cdot{"  , "}"  , ""           , " * ", ""  , OPERATOR_TYPE_MUL  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_2),
+    MAKE_OPERATOR("/"     , "\\frac{"   , "}{"        , "}"  , ""           , " / ", ""  , OPERATOR_TYPE_DIV  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_2),
+    MAKE_OPERATOR("^"     , "{"         , "}^{"       , "}"  , "pow("       , ", " , ")" , OPERATOR_TYPE_POW  , OPERATOR_ARGNUM_2 , OPERATOR_PRECEDANCE_3),
+    MAKE_OPERATOR("exp"   , "e^{"       , ""          , "}"  , "exp("       , ""   , ")" , OPERATOR_TYPE_EXP  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("sqrt"  , "\\sqrt{"   , ""          , "}"  , "sqrt("      , ""   , ")" , OPERATOR_TYPE_SQRT , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("ln"    , "\\ln{"     , ""          , "}"  , "log("       , ""   , ")" , OPERATOR_TYPE_LOG  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("sin"   , "\\sin{"    , ""          , "}"  , "sin("       , ""   , ")" , OPERATOR_TYPE_SIN  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("cos"   , "\\cos{"    , ""          , "}"  , "cos("       , ""   , ")" , OPERATOR_TYPE_COS  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("tan"   , "\\tg{"     , ""          , "}"  , "tan("       , ""   , ")" , OPERATOR_TYPE_TAN  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("ctg"   , "\\ctg{"    , ""          , "}"  , "1.0 / tan(" , ""   , ")" , OPERATOR_TYPE_CTG  , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("sh"    , "\\sh{"     , ""          , "}"  , "sinh("      , ""   , ")" , OPERATOR_TYPE_SH   , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("ch"    , "\\ch{"     , ""          , "}"  , "cosh("      , ""   , ")" , OPERATOR_TYPE_CH   , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("th"    , "\\th{"     , ""          , "}"  , "tanh("      , ""   , ")" , OPERATOR_TYPE_TH   , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("arcsin", "\\arcsin{" , ""          , "}"  , "asin("      , ""   , ")" , OPERATOR_TYPE_ASIN , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("arccos", "\\arccos{" , ""          , "}"  , "acos("      , ""   , ")" , OPERATOR_TYPE_ACOS , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
+    MAKE_OPERATOR("arctg" , "\\arctan{" , ""          , "}"  , "atan("      , ""   , ")" , OPERATOR_TYPE_ATAN , OPERATOR_ARGNUM_1 , OPERATOR_PRECEDANCE_4),
 };
 
-// int operators_prepare_op_arr();
-
 const Operator* get_operator(OperatorType op_type);
 
-const Operator* match_function(char* str);
+/// @brief finds function by name through a perfect hash built from op_arr
+/// @param str name, not necessarily null-terminated
+const Operator* match_function(const char* str, size_t len);
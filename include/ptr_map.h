@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdlib.h>
+
+#define PTR_MAP_INITLIST      \
+    {                         \
+        .buffer   = NULL,     \
+        .size     = 0,        \
+        .capacity = 0,        \
+        .gen      = 1         \
+    }
+
+enum PtrMapErr
+{
+    PTR_MAP_ERR_NONE,
+    PTR_MAP_ERR_NULL,
+    PTR_MAP_ERR_ALLOC_FAIL
+};
+
+union PtrMapVal
+{
+    void* ptr;
+    double num;
+    size_t u;
+};
+
+struct PtrMapEntry
+{
+    const void* key;
+    PtrMapVal val;
+    unsigned gen;
+};
+
+/// @brief open addressing hash map from pointer to value, 
+///        cleared in O(1) by bumping generation
+struct PtrMap
+{
+    PtrMapEntry* buffer;
+    size_t size;
+    size_t capacity;
+    unsigned gen;
+};
+
+PtrMapErr ptr_map_ctor(PtrMap* map, size_t capacity);
+
+/// @return pointer to value or NULL if key is absent, valid until next insert
+PtrMapVal* ptr_map_find(PtrMap* map, const void* key);
+
+PtrMapErr ptr_map_insert(PtrMap* map, const void* key, PtrMapVal val);
+
+void ptr_map_clear(PtrMap* map);
+
+void ptr_map_dtor(PtrMap* map);
+
+const char* ptr_map_strerr(const PtrMapErr err);
@@ -37,7 +37,8 @@ OperatorType;
 
 typedef union NodeValue
 {
-    utils_hash_t var_hash;
+    /// slot of the variable in dtree->vars
+    size_t var;
     OperatorType op_type;
     double num;
 }
@@ -3,10 +3,17 @@
 #include "utils.h"
 #include "hashutils.h"
 
+/// longer names are rejected by the parser
+const size_t VARIABLE_NAME_LEN_MAX = 31;
+
 typedef struct Variable
 {
-    char c;
+    char name[VARIABLE_NAME_LEN_MAX + 1];
     utils_hash_t hash;
+
+    /// index in dtree->vars, NODE_TYPE_VAR nodes hold it
+    size_t slot;
+
     double val;
 
 } Variable;
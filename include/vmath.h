@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdlib.h>
+
+/// @brief doubles processed by one vector instruction (AVX2 register width),
+///        array lengths passed to vmath_* must be multiples of it
+const size_t VMATH_LANES = 4;
+
+void vmath_add(const double* a, const double* b, double* res, size_t n);
+
+void vmath_sub(const double* a, const double* b, double* res, size_t n);
+
+void vmath_mul(const double* a, const double* b, double* res, size_t n);
+
+void vmath_div(const double* a, const double* b, double* res, size_t n);
+
+void vmath_pow(const double* a, const double* b, double* res, size_t n);
+
+/// @brief a ^ power for integer power, by repeated squaring
+void vmath_powi(const double* a, long power, double* res, size_t n);
+
+void vmath_exp(const double* a, double* res, size_t n);
+
+void vmath_sqrt(const double* a, double* res, size_t n);
+
+void vmath_log(const double* a, double* res, size_t n);
+
+void vmath_sin(const double* a, double* res, size_t n);
+
+void vmath_cos(const double* a, double* res, size_t n);
+
+void vmath_tan(const double* a, double* res, size_t n);
+
+void vmath_ctg(const double* a, double* res, size_t n);
+
+void vmath_sh(const double* a, double* res, size_t n);
+
+void vmath_ch(const double* a, double* res, size_t n);
+
+void vmath_th(const double* a, double* res, size_t n);
+
+void vmath_asin(const double* a, double* res, size_t n);
+
+void vmath_acos(const double* a, double* res, size_t n);
+
+void vmath_atan(const double* a, double* res, size_t n);
+
+/// @brief 1 / atan(a), same as scalar evaluator
+void vmath_actg(const double* a, double* res, size_t n);
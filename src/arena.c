@@ -0,0 +1,135 @@
+#include "arena.h"
+
+#include <stddef.h>
+
+#include "logutils.h"
+#include "assertutils.h"
+
+static const size_t SLAB_CAPACITY_MIN = 64;
+static const size_t SLAB_CAPACITY_MAX = 1 << 16;
+static const size_t SLAB_CAPACITY_EXP = 2;
+static const char*  LOG_CATEGORY_ARENA = "ARENA";
+
+struct ArenaSlab
+{
+    ArenaSlab* next;
+    size_t capacity;
+    max_align_t data[];
+};
+
+static ArenaErr arena_new_slab_(Arena* arena);
+
+ArenaErr arena_ctor(Arena* arena, size_t tsize)
+{
+    if(!arena)
+        return ARENA_ERR_NULL;
+
+    if(tsize < sizeof(void*))
+        return ARENA_ERR_BAD_TSIZE;
+
+    arena->slabs         = NULL;
+    arena->used          = 0;
+    arena->slab_capacity = 0;
+    arena->slabs_cnt     = 0;
+    arena->tsize         = tsize;
+    arena->free_list     = NULL;
+    arena->allocated     = 0;
+
+    return ARENA_ERR_NONE;
+}
+
+void* arena_alloc(Arena* arena)
+{
+    utils_assert(arena);
+    utils_assert(arena->tsize >= sizeof(void*));
+
+    arena->allocated++;
+
+    if(arena->free_list) {
+        void* ptr = arena->free_list;
+        arena->free_list = *(void**)ptr;
+        return ptr;
+    }
+
+    if(arena->used == arena->slab_capacity) {
+        ArenaErr err = arena_new_slab_(arena);
+        if(err != ARENA_ERR_NONE) {
+            UTILS_LOGE(LOG_CATEGORY_ARENA, "%s", arena_strerr(err));
+            arena->allocated--;
+            return NULL;
+        }
+    }
+
+    return (char*)arena->slabs->data + arena->tsize * arena->used++;
+}
+
+void arena_free(Arena* arena, void* ptr)
+{
+    utils_assert(arena);
+
+    if(!ptr) return;
+
+    *(void**)ptr = arena->free_list;
+    arena->free_list = ptr;
+
+    arena->allocated--;
+}
+
+void arena_dtor(Arena* arena)
+{
+    utils_assert(arena);
+
+    ArenaSlab* slab = arena->slabs;
+    while(slab) {
+        ArenaSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
+    arena->slabs         = NULL;
+    arena->used          = 0;
+    arena->slab_capacity = 0;
+    arena->slabs_cnt     = 0;
+    arena->free_list     = NULL;
+    arena->allocated     = 0;
+}
+
+static ArenaErr arena_new_slab_(Arena* arena)
+{
+    utils_assert(arena);
+
+    size_t capacity = arena->slab_capacity * SLAB_CAPACITY_EXP;
+    if(capacity < SLAB_CAPACITY_MIN) capacity = SLAB_CAPACITY_MIN;
+    if(capacity > SLAB_CAPACITY_MAX) capacity = SLAB_CAPACITY_MAX;
+
+    ArenaSlab* slab = (ArenaSlab*) malloc(sizeof(ArenaSlab) + capacity * arena->tsize);
+    if(!slab)
+        return ARENA_ERR_ALLOC_FAIL;
+
+    slab->next     = arena->slabs;
+    slab->capacity = capacity;
+
+    arena->slabs         = slab;
+    arena->slab_capacity = capacity;
+    arena->used          = 0;
+    arena->slabs_cnt++;
+
+    return ARENA_ERR_NONE;
+}
+
+const char* arena_strerr(const ArenaErr err)
+{
+    switch(err)
+    {
+        case ARENA_ERR_NONE:
+            return "none";
+        case ARENA_ERR_NULL:
+            return "arena pointer is null";
+        case ARENA_ERR_BAD_TSIZE:
+            return "object size is less than pointer size";
+        case ARENA_ERR_ALLOC_FAIL:
+            return "memory allocation failed";
+        default:
+            return "unknown";
+    }
+}
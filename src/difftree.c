@@ -8,8 +8,18 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <math.h>
-
+#include <stdint.h>
+#include <float.h>
+
+#include "difftree_codegen.h"
+#include "difftree_image.h"
+#include "difftree_interval.h"
+#include "difftree_jit.h"
+#include "difftree_lexer.h"
 #include "difftree_math.h"
+#include "difftree_sink.h"
+#include "difftree_source.h"
+#include "difftree_tape.h"
 #include "hashutils.h"
 #include "logutils.h"
 #include "mathutils.h"
@@ -24,10 +34,31 @@
 #include "vector.h"
 
 #define LOG_CTG_DIFF_TREE "DIFFTREE"
-#define NIL_STR "nil"
 
+static const utils_hash_t SUBTREE_HASH_SEED  = 0x9E3779B97F4A7C15ull;
+static const utils_hash_t SUBTREE_HASH_PRIME = 0xC2B2AE3D27D4EB4Full;
+
+/// denominators tried before a fraction is printed exactly as m/2^k
+static const int FPRINT_NUM_DEN_MAX = 1000;
+/// 2^k with a larger k overflows a double
+static const int FPRINT_NUM_EXP_MAX = DBL_MAX_EXP - 1;
+
+static inline utils_hash_t diff_tree_subtree_hash_mix_(utils_hash_t hash, uint64_t word)
+{
+    hash = (hash ^ word) * SUBTREE_HASH_PRIME;
+
+    return hash ^ (hash >> 29);
+}
+
+/// LaTeX dumps go to tex_sink, tex_file_sink is the one of diff_tree_init_latex_file
+static DiffTreeSink* tex_sink = NULL;
+static DiffTreeSink tex_file_sink = {};
 static FILE* file_tex = NULL;
 
+/// longer expressions are cut, 0 for no limit; tex_nodes_left counts down within one dump
+static size_t tex_max_nodes  = 0;
+static size_t tex_nodes_left = 0;
+
 #ifdef _DEBUG
 
 #define DIFF_TREE_ASSERT_OK_(diff_tree)                      \
@@ -45,41 +76,89 @@ static FILE* file_tex = NULL;
 
 #endif // _DEBUG
 
-static DiffTreeErr diff_tree_fwrite_node_(DiffTreeNode* node, FILE* file);
-
-static void diff_tree_add_variable_(DiffTree* dtree, Variable new_var);
+static DiffTreeErr diff_tree_vars_index_realloc_(DiffTree* dtree, size_t capacity);
 
 
 static char* diff_tree_node_value_str_(DiffTree* dtree, NodeType node_type, NodeValue val);
 
 
-static DiffTreeErr diff_tree_scan_node_name_(DiffTree* dtree);
 
-static int diff_tree_advance_buf_pos_(DiffTree* dtree);
+ATTR_UNUSED static void diff_tree_print_node_ptr_(FILE* file, void* ptr);
+
+static bool diff_tree_node_need_parentheses_(DiffTreeNode* node, DiffTreeNode* parent);
 
-static void diff_tree_skip_spaces_(DiffTree* dtree);
+static void diff_tree_dump_node_latex_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* parent);
 
-ATTR_UNUSED static void diff_tree_print_node_ptr_(FILE* file, void* ptr);
+static bool diff_tree_node_need_parentheses_infix_(DiffTreeNode* node, DiffTreeNode* parent, bool is_right);
 
-static bool diff_tree_node_need_parentheses_(DiffTreeNode* node);
+static void diff_tree_fprint_node_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* parent, bool is_right, FILE* file);
 
-// PARSING //
+static void diff_tree_fprint_num_(double num, FILE* file);
+
+static bool diff_tree_num_equal_(double a, double b);
+
+static DiffTreeErr diff_tree_parse_buf_(DiffTree* dtree);
+
+static DiffTreeErr diff_tree_attach_buf_(DiffTree* dtree, const char* str, size_t len, const char* filename);
+
+static void diff_tree_detach_buf_(DiffTree* dtree);
+
+static DiffTreeNode* diff_tree_intern_node_(DiffTree* dtree, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right);
+
+static DiffTreeErr diff_tree_intern_realloc_(DiffTree* dtree, size_t capacity);
+
+static DiffTreeNode* diff_tree_import_subtree_(DiffTree* to, DiffTreeNode* node, PtrMap* imported);
 
-DiffTreeNode* diff_tree_parse_get_general_(DiffTree* dtree);
+static utils_hash_t diff_tree_subtree_hash_(DiffTree* dtree, DiffTreeNode* node, PtrMap* memo);
 
-DiffTreeNode* diff_tree_parse_get_expr_(DiffTree* dtree);
+static bool diff_tree_subtree_equal_(DiffTreeNode* node, DiffTreeNode* other, PtrMap* memo);
 
-DiffTreeNode* diff_tree_parse_get_mul_div_(DiffTree* dtree);
+static DiffTreeVarMask diff_tree_node_var_mask_(DiffTree* dtree, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right);
 
-DiffTreeNode* diff_tree_parse_get_pow_(DiffTree* dtree);
+/// @brief evaluates a plotted node over the first variable through a compiled
+///        C kernel, the JIT or the tape, whichever is enabled and available
+typedef struct DiffTreePlotSampler
+{
+    DiffTreeTape tape;
+    DiffTreeJit jit;
+
+    DiffTreeKernel kernel;
+    DiffTreeKernelBatchFn kernel_fn;
+
+    double* vals;
+
+} DiffTreePlotSampler;
+
+static void diff_tree_plot_sampler_ctor_(DiffTreePlotSampler* sampler, DiffTree* dtree, DiffTreeNode* node);
+
+static void diff_tree_plot_point_(double x, double y, unsigned prec);
+
+static void diff_tree_plot_sampler_eval_(DiffTreePlotSampler* sampler, const double* xs, double* ys, size_t n);
+
+static void diff_tree_plot_sampler_dtor_(DiffTreePlotSampler* sampler);
+
+static size_t diff_tree_plot_adaptive_(DiffTreePlotSampler* sampler, double x_begin, double x_end, double x_step, double y_tol, double** xs, double** ys);
+
+static void diff_tree_plot_points_(const double* xs, const double* ys, size_t n);
 
-DiffTreeNode* diff_tree_parse_get_primary_(DiffTree* dtree);
+// PARSING //
+
+/// operands and pending operators of diff_tree_parse_tokens_
+typedef struct DiffTreeParseStacks
+{
+    DiffTreeNode** nodes;
+    size_t nodes_size;
+    size_t nodes_capacity;
 
-DiffTreeNode* diff_tree_parse_get_number_(DiffTree* dtree);
+    DiffTreeToken* ops;
+    size_t ops_size;
+    size_t ops_capacity;
 
-DiffTreeNode* diff_tree_parse_get_var_(DiffTree* dtree);
+} DiffTreeParseStacks;
 
-DiffTreeNode* diff_tree_parse_get_func_(DiffTree* dtree);
+static const size_t PARSE_STACK_CAPACITY_MIN = 16;
+
+static DiffTreeErr diff_tree_parse_tokens_(DiffTree* dtree, DiffTreeNode** root);
 
 
 #ifdef _DEBUG
@@ -93,30 +172,81 @@ DiffTreeErr diff_tree_verify_(DiffTree* diff_tree);
 #endif // _DEBUG
 
 #define DEFAULT_VAR_VECTOR_CAPACITY       10
+#define DEFAULT_VARS_INDEX_CAPACITY       16
 #define DEFAULT_TO_DELETE_VECTOR_CAPACITY 10
+#define DEFAULT_INTERN_TABLE_CAPACITY     256
 
 DiffTreeErr diff_tree_ctor(DiffTree* diff_tree)
 {
     utils_assert(diff_tree);
 
-    diff_tree->size = 0;
+    diff_tree->size  = 0;
+    diff_tree->stats = {};
     
     vector_ctor(&diff_tree->vars, DEFAULT_VAR_VECTOR_CAPACITY, sizeof(Variable));
     vector_ctor(&diff_tree->to_delete, DEFAULT_TO_DELETE_VECTOR_CAPACITY, sizeof(DiffTreeNode*));
 
+    if(arena_ctor(&diff_tree->nodes, sizeof(DiffTreeNode)) != ARENA_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+DiffTreeErr diff_tree_enable_dag(DiffTree* dtree)
+{
+    utils_assert(dtree);
+    utils_assert(!dtree->root);
+
+    if(dtree->is_dag)
+        return DIFF_TREE_ERR_NONE;
+
+    DiffTreeErr err = diff_tree_intern_realloc_(dtree, DEFAULT_INTERN_TABLE_CAPACITY);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
+
+    dtree->is_dag = true;
+
     return DIFF_TREE_ERR_NONE;
 }
 
 DiffTreeErr diff_tree_copy_tree(DiffTree* from, DiffTree* to)
 {
-    to->size = from->size;
-    to->root = diff_tree_copy_subtree(from, from->root, NULL);
+    DiffTreeErr err = diff_tree_ctor(to);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
+
+    to->size    = from->size;
+    to->use_jit = from->use_jit;
+
+    to->use_kernel = from->use_kernel;
+    to->kernel_dir = from->kernel_dir;
+
+    // same names in the same order, so slots of imported nodes stay valid
+    for(size_t i = 0; i < from->vars.size; ++i) {
+        Variable* var = diff_tree_variable(from, i);
+        size_t slot = 0;
+
+        err = diff_tree_add_variable(to, var->name, strlen(var->name), &slot);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
 
-    vector_ctor(&to->vars, DEFAULT_VAR_VECTOR_CAPACITY, sizeof(Variable));
-    vector_ctor(&to->to_delete, DEFAULT_TO_DELETE_VECTOR_CAPACITY, sizeof(DiffTreeNode*));
+        diff_tree_variable(to, slot)->val = var->val;
+    }
+
+    if(from->is_dag) {
+        err = diff_tree_enable_dag(to);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+
+        PtrMap imported = PTR_MAP_INITLIST;
+        ptr_map_ctor(&imported, from->interned.size);
 
-    for(size_t i = 0; i < from->vars.size; ++i)
-        vector_push(&to->vars, vector_at(&from->vars, i));
+        to->root = diff_tree_import_subtree_(to, from->root, &imported);
+
+        ptr_map_dtor(&imported);
+    }
+    else
+        to->root = diff_tree_copy_subtree(to, from->root, NULL);
 
     return DIFF_TREE_ERR_NONE;
 }
@@ -125,103 +255,328 @@ void diff_tree_dtor(DiffTree* diff_tree)
 {
     utils_assert(diff_tree);
 
-    diff_tree_free_subtree(diff_tree->root); 
-
-    diff_tree->size = 0;
+    diff_tree->size  = 0;
+    diff_tree->stats = {};
     diff_tree->root = NULL;
 
-    NFREE(diff_tree->buf.ptr);
+    NFREE(diff_tree->buf.owned);
+    diff_tree->buf.ptr = NULL;
     diff_tree->buf.pos = 0;
     diff_tree->buf.len = 0;
 
     vector_dtor(&diff_tree->vars);
 
-    for(size_t i = 0; i < diff_tree->to_delete.size; ++i)
-        diff_tree_free_subtree(*(DiffTreeNode**)vector_at(&diff_tree->to_delete, i));
+    NFREE(diff_tree->vars_index.slots);
+    diff_tree->vars_index.capacity = 0;
 
     vector_dtor(&diff_tree->to_delete);
+
+    arena_dtor(&diff_tree->nodes);
+
+    NFREE(diff_tree->interned.buffer);
+    diff_tree->interned.size = 0;
+    diff_tree->interned.capacity = 0;
+
+    ptr_map_dtor(&diff_tree->dag_memo.diff);
+    ptr_map_dtor(&diff_tree->dag_memo.optimized);
+    ptr_map_dtor(&diff_tree->dag_memo.normalized);
+    ptr_map_dtor(&diff_tree->dag_memo.eval);
+
+    NFREE(diff_tree->diff_memo.buffer);
+    diff_tree->diff_memo.size = 0;
+    diff_tree->diff_memo.capacity = 0;
+
+    diff_tree->is_dag = false;
 }
 
-void diff_tree_free_subtree(DiffTreeNode* node)
+void diff_tree_free_subtree(DiffTree* dtree, DiffTreeNode* node)
 {
-    if(!node) return;
+    // shared nodes live until the tree is destroyed
+    if(!node || dtree->is_dag) return;
 
     if(node->left)
-        diff_tree_free_subtree(node->left);
+        diff_tree_free_subtree(dtree, node->left);
     if(node->right)
-        diff_tree_free_subtree(node->right);
+        diff_tree_free_subtree(dtree, node->right);
+
+    arena_free(&dtree->nodes, node);
+}
+
+utils_hash_t diff_tree_subtree_hash(DiffTree* dtree, DiffTreeNode* node)
+{
+    utils_assert(dtree);
+    utils_assert(node);
+
+    PtrMap memo = PTR_MAP_INITLIST;
+
+    // shared nodes are hashed once, otherwise a DAG takes exponential time
+    if(dtree->is_dag && ptr_map_ctor(&memo, dtree->interned.size) != PTR_MAP_ERR_NONE)
+        return 1;
+
+    utils_hash_t hash = diff_tree_subtree_hash_(dtree, node, dtree->is_dag ? &memo : NULL);
+
+    ptr_map_dtor(&memo);
+
+    return hash;
+}
+
+static utils_hash_t diff_tree_subtree_hash_(DiffTree* dtree, DiffTreeNode* node, PtrMap* memo)
+{
+    if(!node)
+        return 0;
+
+    PtrMapVal* found = memo ? ptr_map_find(memo, node) : NULL;
+    if(found)
+        return found->u;
 
-    NFREE(node);
+    uint64_t value = 0;
+
+    switch(node->type) {
+        case NODE_TYPE_OP:
+            value = (uint64_t) node->value.op_type;
+            break;
+        case NODE_TYPE_VAR:
+            value = diff_tree_variable(dtree, node->value.var)->hash;
+            break;
+        case NODE_TYPE_NUM:
+            memcpy(&value, &node->value.num, sizeof(value));
+            break;
+        case NODE_TYPE_FAKE:
+        default:
+            break;
+    }
+
+    utils_hash_t hash = diff_tree_subtree_hash_mix_(SUBTREE_HASH_SEED, (uint64_t) node->type);
+    hash = diff_tree_subtree_hash_mix_(hash, value);
+    hash = diff_tree_subtree_hash_mix_(hash, diff_tree_subtree_hash_(dtree, node->left,  memo));
+    hash = diff_tree_subtree_hash_mix_(hash, diff_tree_subtree_hash_(dtree, node->right, memo));
+
+    // 0 stands for a missing child and for an empty memo entry
+    if(hash == 0)
+        hash = 1;
+
+    // a failed insert only costs hashing the node again
+    if(memo)
+        ptr_map_insert(memo, node, PtrMapVal { .u = hash });
+
+    return hash;
+}
+
+bool diff_tree_subtree_equal(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* other)
+{
+    utils_assert(dtree);
+
+    // equal nodes are the same node only within one interning, pairs found equal are kept
+    PtrMap memo = PTR_MAP_INITLIST;
+
+    if(dtree->is_dag && ptr_map_ctor(&memo, dtree->interned.size) != PTR_MAP_ERR_NONE)
+        return false;
+
+    bool is_equal = diff_tree_subtree_equal_(node, other, dtree->is_dag ? &memo : NULL);
+
+    ptr_map_dtor(&memo);
+
+    return is_equal;
+}
+
+static bool diff_tree_subtree_equal_(DiffTreeNode* node, DiffTreeNode* other, PtrMap* memo)
+{
+    if(node == other)
+        return true;
+
+    if(!node || !other || node->type != other->type)
+        return false;
+
+    PtrMapVal* found = memo ? ptr_map_find(memo, node) : NULL;
+    if(found && found->ptr == other)
+        return true;
+
+    bool is_equal = false;
+
+    switch(node->type) {
+        case NODE_TYPE_OP:
+            is_equal = node->value.op_type == other->value.op_type;
+            break;
+        case NODE_TYPE_VAR:
+            is_equal = node->value.var == other->value.var;
+            break;
+        case NODE_TYPE_NUM:
+            is_equal = memcmp(&node->value.num, &other->value.num, sizeof(node->value.num)) == 0;
+            break;
+        case NODE_TYPE_FAKE:
+        default:
+            break;
+    }
+
+    is_equal = is_equal && diff_tree_subtree_equal_(node->left,  other->left,  memo)
+                        && diff_tree_subtree_equal_(node->right, other->right, memo);
+
+    if(is_equal && memo)
+        ptr_map_insert(memo, node, PtrMapVal { .ptr = other });
+
+    return is_equal;
 }
 
 void diff_tree_mark_to_delete(DiffTree* dtree, DiffTreeNode* node)
 {
+    if(dtree->is_dag) return;
+
     vector_push(&dtree->to_delete, &node);
 }
 
+void diff_tree_release_marked(DiffTree* dtree)
+{
+    utils_assert(dtree);
+
+    for(size_t i = 0; i < dtree->to_delete.size; ++i)
+        diff_tree_free_subtree(dtree, *(DiffTreeNode**)vector_at(&dtree->to_delete, i));
+
+    vector_free(&dtree->to_delete);
+}
+
 DiffTreeErr diff_tree_fwrite(DiffTree* diff_tree, const char* filename)
 {
+    utils_assert(diff_tree);
+    utils_assert(diff_tree->root);
     utils_assert(filename);
 
-    FILE* file = open_file(filename, "w");
-    file verified(return DIFF_TREE_IO_ERR);
-
-    DiffTreeErr err = diff_tree_fwrite_node_(diff_tree->root, file);
+    DiffTreeErr err = diff_tree_image_fwrite(diff_tree, &diff_tree->root->left, 1, filename);
 
     UTILS_LOGD(LOG_CTG_DIFF_TREE, "Writing done");
 
-    fclose(file);
-
     return err;
 }
 
-DiffTreeErr diff_tree_fwrite_node_(DiffTreeNode* node, FILE* file)
+DiffTreeErr diff_tree_fprint_node(DiffTree* dtree, DiffTreeNode* node, FILE* file)
 {
+    utils_assert(dtree);
     utils_assert(node);
     utils_assert(file);
 
-    DiffTreeErr err = DIFF_TREE_ERR_NONE;
-    int io_err = 0;
+    diff_tree_fprint_node_(dtree, node, NULL, false, file);
 
-    io_err = fprintf(file, "(");
-    io_err >= 0 verified(return DIFF_TREE_IO_ERR);
+    return ferror(file) ? DIFF_TREE_IO_ERR : DIFF_TREE_ERR_NONE;
+}
 
-    if(node->left)
-        err = diff_tree_fwrite_node_(node->left, file);
-    else
-        fprintf(file, NIL_STR);
+/// @brief functions are printed with their own parentheses and never need more
+static bool diff_tree_node_need_parentheses_infix_(DiffTreeNode* node, DiffTreeNode* parent, bool is_right)
+{
+    if(!parent || parent->type != NODE_TYPE_OP)
+        return false;
 
-    if(node->right)
-        err = diff_tree_fwrite_node_(node->right, file);
-    else
-        fprintf(file, " " NIL_STR " ");
+    // a number but a non-negative integer is printed as an expression
+    if(node->type == NODE_TYPE_NUM)
+        return signbit(node->value.num) || isinf(node->value.num) || !diff_tree_num_equal_(node->value.num, floor(node->value.num));
 
-    io_err = fprintf(file, ")");
-    io_err >= 0 verified(return DIFF_TREE_IO_ERR);
+    if(node->type != NODE_TYPE_OP || get_operator(node->value.op_type)->argnum == OPERATOR_ARGNUM_1)
+        return false;
 
-    return err;
+    const Operator* op_node   = get_operator(node->value.op_type);
+    const Operator* op_parent = get_operator(parent->value.op_type);
+
+    if(op_parent->type == OPERATOR_TYPE_POW || op_parent->precedance > op_node->precedance)
+        return true;
+
+    return op_parent->precedance == op_node->precedance && is_right &&
+           (op_parent->type == OPERATOR_TYPE_SUB || op_parent->type == OPERATOR_TYPE_DIV);
 }
 
-int diff_tree_advance_buf_pos_(DiffTree* dtree)
+static void diff_tree_fprint_node_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* parent, bool is_right, FILE* file)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    bool need_parentheses = diff_tree_node_need_parentheses_infix_(node, parent, is_right);
 
-    if(dtree->buf.pos < dtree->buf.len - 1) {
-        dtree->buf.pos++;
-        return 0;
+    if(need_parentheses) fprintf(file, "(");
+
+    switch(node->type) {
+        case NODE_TYPE_VAR:
+            fprintf(file, "%s", diff_tree_variable(dtree, node->value.var)->name);
+            break;
+
+        case NODE_TYPE_NUM:
+            diff_tree_fprint_num_(node->value.num, file);
+            break;
+
+        case NODE_TYPE_OP:
+        {
+            const Operator* op = get_operator(node->value.op_type);
+
+            if(op->argnum == OPERATOR_ARGNUM_1) {
+                fprintf(file, "%s(", op->str);
+                diff_tree_fprint_node_(dtree, node->left, NULL, false, file);
+                fprintf(file, ")");
+            }
+            else {
+                diff_tree_fprint_node_(dtree, node->left, node, false, file);
+                fprintf(file, "%s", op->str);
+                diff_tree_fprint_node_(dtree, node->right, node, true, file);
+            }
+            break;
+        }
+
+        case NODE_TYPE_FAKE:
+        default:
+            UTILS_LOGW(LOG_CTG_DIFF_TREE, "unexpected node type %d", node->type);
+            break;
     }
-    else
-        return 1;
+
+    if(need_parentheses) fprintf(file, ")");
 }
 
-void diff_tree_skip_spaces_(DiffTree* dtree)
+/// @brief exact in the grammar of diff_tree_sread, which knows non-negative integers only:
+///        -c is 0-c, a fraction is p/q with a small q if there is one, else m/2^k
+static void diff_tree_fprint_num_(double num, FILE* file)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    if(isnan(num)) {
+        fprintf(file, "0/0");
+        return;
+    }
 
-    while(isspace(dtree->buf.ptr[dtree->buf.pos])) {
-        if(diff_tree_advance_buf_pos_(dtree))
-            break;
+    if(signbit(num)) {
+        fprintf(file, "0-");
+        num = -num;
+    }
+
+    if(isinf(num)) {
+        fprintf(file, "1/0");
+        return;
+    }
+
+    if(diff_tree_num_equal_(num, floor(num))) {
+        fprintf(file, "%.0f", num);
+        return;
+    }
+
+    for(int den = 2; den <= FPRINT_NUM_DEN_MAX; ++den) {
+        double numer = round(num * den);
+
+        if(diff_tree_num_equal_(numer / den, num)) {
+            fprintf(file, "%.0f/%d", numer, den);
+            return;
+        }
+    }
+
+    // num = mant / 2^exp with an odd integer mant
+    int exp = 0;
+    double mant = ldexp(frexp(num, &exp), DBL_MANT_DIG);
+    exp = DBL_MANT_DIG - exp;
+
+    while(diff_tree_num_equal_(fmod(mant, 2), 0)) {
+        mant /= 2;
+        exp--;
     }
+
+    fprintf(file, "%.0f", mant);
+
+    for(; exp > FPRINT_NUM_EXP_MAX; exp -= FPRINT_NUM_EXP_MAX)
+        fprintf(file, "/2^%d", FPRINT_NUM_EXP_MAX);
+
+    fprintf(file, "/2^%d", exp);
+}
+
+/// @brief exact, false for nan and for infinities of different signs
+static bool diff_tree_num_equal_(double a, double b)
+{
+    return islessequal(a, b) && isgreaterequal(a, b);
 }
 
 static void diff_tree_print_node_ptr_(FILE* file, void* ptr)
@@ -229,44 +584,103 @@ static void diff_tree_print_node_ptr_(FILE* file, void* ptr)
     fprintf(file, "%p", *(DiffTreeNode**)ptr);
 }
 
-DiffTreeErr diff_tree_scan_node_name_(DiffTree* dtree)
+DiffTreeErr diff_tree_add_variable(DiffTree* dtree, const char* name, size_t len, size_t* slot)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    Variable* found = diff_tree_find_variable(dtree, name, len);
+    if(found) {
+        *slot = found->slot;
+        return DIFF_TREE_ERR_NONE;
+    }
+
+    if(len > VARIABLE_NAME_LEN_MAX)
+        return DIFF_TREE_SYNTAX_ERR;
+
+    if((dtree->vars.size + 1) * 2 > dtree->vars_index.capacity) {
+        size_t capacity = dtree->vars_index.capacity ? dtree->vars_index.capacity * 2 : DEFAULT_VARS_INDEX_CAPACITY;
+
+        DiffTreeErr err = diff_tree_vars_index_realloc_(dtree, capacity);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+    }
+
+    Variable var = { .name = "", .hash = utils_djb2_hash(name, len), .slot = dtree->vars.size, .val = 0 };
+    memcpy(var.name, name, len);
+
+    if(vector_push(&dtree->vars, &var) != VECTOR_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    size_t mask = dtree->vars_index.capacity - 1;
+    size_t ind = var.hash & mask;
 
-    int name_len = 0;
-    sscanf(dtree->buf.ptr + dtree->buf.pos, " %*[^ ]%n", &name_len);
+    while(dtree->vars_index.slots[ind])
+        ind = (ind + 1) & mask;
 
-    dtree->buf.pos += (ssize_t) name_len;
+    dtree->vars_index.slots[ind] = var.slot + 1;
+    *slot = var.slot;
 
-    dtree->buf.ptr[dtree->buf.pos] = '\0';
+    IF_DEBUG(VECTOR_DUMP(&dtree->vars, VECTOR_ERR_NONE, NULL, variable_print_callback));
 
     return DIFF_TREE_ERR_NONE;
 }
 
-static void diff_tree_add_variable_(DiffTree* dtree, Variable new_var)
+static DiffTreeErr diff_tree_vars_index_realloc_(DiffTree* dtree, size_t capacity)
 {
-    for(size_t i = 0; i < dtree->vars.size; ++i)
-        if(((Variable*)vector_at(&dtree->vars, i))->c == new_var.c)
-            return;
+    size_t* slots = TYPED_CALLOC(capacity, size_t);
+    slots verified(return DIFF_TREE_ALLOC_FAIL);
+
+    NFREE(dtree->vars_index.slots);
+    dtree->vars_index.slots    = slots;
+    dtree->vars_index.capacity = capacity;
+
+    for(size_t i = 0; i < dtree->vars.size; ++i) {
+        size_t ind = diff_tree_variable(dtree, i)->hash & (capacity - 1);
+
+        while(slots[ind])
+            ind = (ind + 1) & (capacity - 1);
+
+        slots[ind] = i + 1;
+    }
 
-    vector_push(&dtree->vars, &new_var);
-    VECTOR_DUMP(&dtree->vars, VECTOR_ERR_NONE, NULL, variable_print_callback);
+    return DIFF_TREE_ERR_NONE;
 }
 
-Variable* diff_tree_find_variable(DiffTree* dtree, utils_hash_t hash) 
+Variable* diff_tree_find_variable(DiffTree* dtree, const char* name, size_t len)
 {
-    // FIXME use binsearch
+    utils_assert(dtree);
+    utils_assert(name);
+
+    if(!dtree->vars_index.capacity)
+        return NULL;
 
-    Vector* vars = &dtree->vars;
-    for(size_t i = 0; i < vars->size; ++i) {
-        Variable* var = (Variable*)vector_at(vars, i);
-        if(hash == var->hash)
+    size_t mask = dtree->vars_index.capacity - 1;
+    utils_hash_t hash = utils_djb2_hash(name, len);
+
+    for(size_t ind = hash & mask; dtree->vars_index.slots[ind]; ind = (ind + 1) & mask) {
+        Variable* var = diff_tree_variable(dtree, dtree->vars_index.slots[ind] - 1);
+
+        if(var->hash == hash && strncmp(var->name, name, len) == 0 && var->name[len] == '\0')
             return var;
     }
 
     return NULL;
 }
 
+Variable* diff_tree_variable(const DiffTree* dtree, size_t slot)
+{
+    utils_assert(dtree);
+    utils_assert(slot < dtree->vars.size);
+
+    return (Variable*) dtree->vars.buffer + slot;
+}
+
+DiffTreeVarMask diff_tree_var_mask(ATTR_UNUSED DiffTree* dtree, size_t slot)
+{
+    const size_t last_bit = sizeof(DiffTreeVarMask) * 8 - 1;
+
+    // variables past the last bit conservatively share it
+    return (DiffTreeVarMask) 1 << (slot < last_bit ? slot : last_bit);
+}
+
 #define LOG_SYNTAX_ERR_(msg, ...)           \
     UTILS_LOGE(                             \
         LOG_CTG_DIFF_TREE,                  \
@@ -277,283 +691,340 @@ Variable* diff_tree_find_variable(DiffTree* dtree, utils_hash_t hash)
 
 #define BUF_AT_POS_ dtree->buf.ptr[dtree->buf.pos]
 
-#define BUF_AT_PREV_POS_ dtree->buf.ptr[pos_prev]
-
 #define POS_ dtree->buf.pos
 
-#define LEN_ dtree->buf.len
-
-#define INCREMENT_POS_                 \
-    diff_tree_advance_buf_pos_(dtree); \
-    diff_tree_skip_spaces_(dtree);     
-
-#define ADD_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_ADD }, left, right, NULL)
+#define CONST_(num_) \
+    diff_tree_new_node(dtree, NODE_TYPE_NUM, NodeValue { .num = num_ }, NULL, NULL, NULL)
 
-#define SUB_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SUB }, left, right, NULL)
 
-#define MUL_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_MUL }, left, right, NULL)
+static DiffTreeErr diff_tree_parse_push_node_(DiffTreeParseStacks* stacks, DiffTreeNode* node)
+{
+    if(!node)
+        return DIFF_TREE_ALLOC_FAIL;
 
-#define DIV_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_DIV }, left, right, NULL)
+    if(stacks->nodes_size == stacks->nodes_capacity) {
+        size_t capacity = stacks->nodes_capacity ? stacks->nodes_capacity * 2 : PARSE_STACK_CAPACITY_MIN;
 
-#define POW_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_POW }, left, right, NULL)
+        DiffTreeNode** nodes = (DiffTreeNode**) realloc(stacks->nodes, capacity * sizeof(DiffTreeNode*));
+        nodes verified(return DIFF_TREE_ALLOC_FAIL);
 
-#define CONST_(num_) \
-    diff_tree_new_node(NODE_TYPE_NUM, NodeValue { .num = num_ }, NULL, NULL, NULL)
+        stacks->nodes = nodes;
+        stacks->nodes_capacity = capacity;
+    }
 
-#define VAR_(var) \
-    diff_tree_new_node(NODE_TYPE_VAR, NodeValue { .var_hash = var->hash }, NULL, NULL, NULL)
+    stacks->nodes[stacks->nodes_size++] = node;
 
+    return DIFF_TREE_ERR_NONE;
+}
 
-DiffTreeNode* diff_tree_parse_get_number_(DiffTree* dtree)
+static DiffTreeErr diff_tree_parse_push_op_(DiffTreeParseStacks* stacks, const DiffTreeToken* tok)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    if(stacks->ops_size == stacks->ops_capacity) {
+        size_t capacity = stacks->ops_capacity ? stacks->ops_capacity * 2 : PARSE_STACK_CAPACITY_MIN;
 
-    int val = 0;
-    ssize_t pos_prev = dtree->buf.pos;
-    DiffTreeNode* node = NULL;
+        DiffTreeToken* ops = (DiffTreeToken*) realloc(stacks->ops, capacity * sizeof(DiffTreeToken));
+        ops verified(return DIFF_TREE_ALLOC_FAIL);
 
-    while('0' <= BUF_AT_POS_ && BUF_AT_POS_ <= '9') {
-        val = (BUF_AT_POS_ - '0') + val * 10;
-        INCREMENT_POS_;
+        stacks->ops = ops;
+        stacks->ops_capacity = capacity;
     }
 
-    if(pos_prev != POS_) {
-        node = CONST_(val);
-        diff_tree_mark_to_delete(dtree, node);
-    }
+    stacks->ops[stacks->ops_size++] = *tok;
 
-    return node;
+    return DIFF_TREE_ERR_NONE;
 }
 
-DiffTreeNode* diff_tree_parse_get_var_(DiffTree* dtree)
+/// @brief replaces two topmost operands by the binary operator on top of ops
+static DiffTreeErr diff_tree_parse_reduce_(DiffTree* dtree, DiffTreeParseStacks* stacks)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    utils_assert(stacks->nodes_size >= 2);
 
-    ssize_t pos_prev = dtree->buf.pos;
-    Variable var = { .c = ' ', .hash = 0, .val = 0 };
-    DiffTreeNode* node = NULL;
+    OperatorType op_type = stacks->ops[--stacks->ops_size].value.op_type;
 
-    if(isalpha(BUF_AT_POS_)) {
-        var.c = BUF_AT_POS_;
-        var.hash = utils_djb2_hash(dtree->buf.ptr + dtree->buf.pos, sizeof(char));
+    DiffTreeNode* right = stacks->nodes[--stacks->nodes_size];
+    DiffTreeNode* left  = stacks->nodes[--stacks->nodes_size];
 
-        diff_tree_add_variable_(dtree, var);
-
-        INCREMENT_POS_;
-
-        node = diff_tree_new_node(
-                NODE_TYPE_VAR, 
-                NodeValue { .var_hash = var.hash },
-                NULL,
-                NULL,
-                NULL );
-        diff_tree_mark_to_delete(dtree, node);
-    }
-
-    return node;
+    return diff_tree_parse_push_node_(stacks, 
+        diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { .op_type = op_type }, left, right, NULL));
 }
 
-DiffTreeNode* diff_tree_parse_get_expr_(DiffTree* dtree)
+/// @brief reduces pending binary operators binding at least as tight as min_precedance,
+///        never past the innermost open parenthesis
+static DiffTreeErr diff_tree_parse_reduce_until_(DiffTree* dtree, DiffTreeParseStacks* stacks, 
+                                                 OperatorPrecedance min_precedance)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
-
-    DiffTreeNode* node = diff_tree_parse_get_mul_div_(dtree);
-
-    while(BUF_AT_POS_ == '+' || BUF_AT_POS_ == '-') {
-        ssize_t pos_prev = POS_;
-        INCREMENT_POS_;
+    while(stacks->ops_size > 0) {
+        const DiffTreeToken* top = &stacks->ops[stacks->ops_size - 1];
 
-        DiffTreeNode* node_new = diff_tree_parse_get_mul_div_(dtree);
-
-        if(BUF_AT_PREV_POS_ == '+')
-            node = ADD_(node, node_new);
-        else
-            node = SUB_(node, node_new);
+        if(top->type != DIFF_TREE_TOKEN_OP || get_operator(top->value.op_type)->precedance < min_precedance)
+            break;
 
-        diff_tree_mark_to_delete(dtree, node);
+        DiffTreeErr err = diff_tree_parse_reduce_(dtree, stacks);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
     }
 
-    return node;
+    return DIFF_TREE_ERR_NONE;
 }
 
-DiffTreeNode* diff_tree_parse_get_mul_div_(DiffTree* dtree)
+/* 
+ * Operator-precedence parser. Operands and pending operators live on explicit 
+ * stacks, so nesting depth is bounded by memory, not by the call stack. 
+ * Every binary operator is left associative, a^b^c is (a^b)^c. 
+ * An open parenthesis is kept on the operator stack as its ( or function token.
+ */
+static DiffTreeErr diff_tree_parse_tokens_(DiffTree* dtree, DiffTreeNode** root)
 {
     DIFF_TREE_ASSERT_OK_(dtree);
 
-    DiffTreeNode* node = diff_tree_parse_get_pow_(dtree);
-
-    while(BUF_AT_POS_ == '*' || BUF_AT_POS_ == '/') {
-        ssize_t pos_prev = POS_;
-        INCREMENT_POS_;
-        DiffTreeNode* node_right = diff_tree_parse_get_pow_(dtree);
+    DiffTreeParseStacks stacks = {};
+    DiffTreeToken tok = {};
+    DiffTreeErr err = DIFF_TREE_ERR_NONE;
 
-        if(BUF_AT_PREV_POS_ == '*')
-            node = MUL_(node, node_right);
-        else
-            node = DIV_(node, node_right);
+    const char* expected = NULL;
+    bool expect_operand = true;
+    bool is_end = false;
+
+    while((err = diff_tree_lex_next(dtree, &tok)) == DIFF_TREE_ERR_NONE) {
+        if(expect_operand) {
+            switch(tok.type) {
+                case DIFF_TREE_TOKEN_NUM:
+                    err = diff_tree_parse_push_node_(&stacks, CONST_(tok.value.num));
+                    expect_operand = false;
+                    break;
+
+                case DIFF_TREE_TOKEN_VAR: {
+                    size_t slot = 0;
+                    err = diff_tree_add_variable(dtree, dtree->buf.ptr + tok.pos, (size_t) tok.len, &slot);
+
+                    if(err == DIFF_TREE_ERR_NONE)
+                        err = diff_tree_parse_push_node_(&stacks, 
+                            diff_tree_new_node(dtree, NODE_TYPE_VAR, NodeValue { .var = slot }, NULL, NULL, NULL));
+                    expect_operand = false;
+                    break;
+                }
+
+                case DIFF_TREE_TOKEN_FUNC:
+                    err = diff_tree_parse_push_op_(&stacks, &tok);
+
+                    if(err == DIFF_TREE_ERR_NONE)
+                        err = diff_tree_lex_next(dtree, &tok);
+
+                    if(err == DIFF_TREE_ERR_NONE && tok.type != DIFF_TREE_TOKEN_LPAREN)
+                        expected = "(";
+                    break;
+
+                case DIFF_TREE_TOKEN_LPAREN:
+                    err = diff_tree_parse_push_op_(&stacks, &tok);
+                    break;
+
+                case DIFF_TREE_TOKEN_OP:
+                case DIFF_TREE_TOKEN_RPAREN:
+                case DIFF_TREE_TOKEN_END:
+                default:
+                    expected = "operand";
+                    break;
+            }
+        }
+        else {
+            switch(tok.type) {
+                case DIFF_TREE_TOKEN_OP:
+                    err = diff_tree_parse_reduce_until_(dtree, &stacks, get_operator(tok.value.op_type)->precedance);
+
+                    if(err == DIFF_TREE_ERR_NONE)
+                        err = diff_tree_parse_push_op_(&stacks, &tok);
+
+                    expect_operand = true;
+                    break;
+
+                case DIFF_TREE_TOKEN_RPAREN: {
+                    err = diff_tree_parse_reduce_until_(dtree, &stacks, OPERATOR_PRECEDANCE_0);
+                    if(err != DIFF_TREE_ERR_NONE)
+                        break;
+
+                    if(stacks.ops_size == 0) {
+                        expected = "\\n";
+                        break;
+                    }
+
+                    const DiffTreeToken* open = &stacks.ops[--stacks.ops_size];
+
+                    if(open->type == DIFF_TREE_TOKEN_FUNC) {
+                        DiffTreeNode* arg = stacks.nodes[--stacks.nodes_size];
+
+                        err = diff_tree_parse_push_node_(&stacks, 
+                            diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { .op_type = open->value.op_type }, arg, NULL, NULL));
+                    }
+                    break;
+                }
+
+                case DIFF_TREE_TOKEN_END:
+                    err = diff_tree_parse_reduce_until_(dtree, &stacks, OPERATOR_PRECEDANCE_0);
+
+                    if(err == DIFF_TREE_ERR_NONE && stacks.ops_size > 0)
+                        expected = ")";
+
+                    is_end = true;
+                    break;
+
+                case DIFF_TREE_TOKEN_NUM:
+                case DIFF_TREE_TOKEN_VAR:
+                case DIFF_TREE_TOKEN_FUNC:
+                case DIFF_TREE_TOKEN_LPAREN:
+                default:
+                    expected = stacks.ops_size > 0 ? ")" : "\\n";
+                    break;
+            }
+        }
 
-        diff_tree_mark_to_delete(dtree, node);
+        if(err != DIFF_TREE_ERR_NONE || expected || is_end)
+            break;
     }
-    
-    return node;
-}
-
-DiffTreeNode* diff_tree_parse_get_pow_(DiffTree* dtree)
-{
-    DIFF_TREE_ASSERT_OK_(dtree);
 
-    DiffTreeNode* node = diff_tree_parse_get_primary_(dtree);
-    
-    while(BUF_AT_POS_ == '^') {
+    if(expected) {
+        POS_ = tok.pos;
+        LOG_SYNTAX_ERR_("expected: %s, got: (ASCII) %d", expected, (int) BUF_AT_POS_);
+        err = DIFF_TREE_SYNTAX_ERR;
+    }
 
-        INCREMENT_POS_;
-        DiffTreeNode* node_new = diff_tree_parse_get_primary_(dtree);
+    *root = err == DIFF_TREE_ERR_NONE ? stacks.nodes[0] : NULL;
 
-        node = POW_(node, node_new);
-        diff_tree_mark_to_delete(dtree, node);
-    }
+    NFREE(stacks.nodes);
+    NFREE(stacks.ops);
 
-    return node;
+    return err;
 }
 
-DiffTreeNode* diff_tree_parse_get_func_(DiffTree* dtree)
+#undef LOG_SYNTAX_ERR_
+#undef BUF_AT_POS_
+#undef POS_
+#undef CONST_
+
+DiffTreeErr diff_tree_fread(DiffTree* dtree, const char* filename)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    utils_assert(dtree);
 
-    ssize_t bufpos = 0;
-    char buf[MAX_OP_NAME_LEN] = "";
+    DiffTreeSource src = {};
 
-    ssize_t pos_prev = POS_;
-    DiffTreeNode* node = NULL;
+    DiffTreeErr err = diff_tree_source_open(&src, filename);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
 
-    while(POS_ < LEN_ && isalpha(BUF_AT_POS_)) {
-        buf[bufpos++] = BUF_AT_POS_;
-        INCREMENT_POS_;
-    }
-    
-    const Operator* op = match_function(buf);
-    if(!op) {
-        POS_ = pos_prev;
-        return NULL;
-    }
+    const char* line = NULL;
+    size_t len = 0;
+
+    // the expression is the first line of the file, the rest is never read
+    err = diff_tree_source_next(&src, &line, &len);
 
-    if(BUF_AT_POS_ == '(') {
-        INCREMENT_POS_;
+    if(err == DIFF_TREE_ERR_NONE && !line)
+        err = DIFF_TREE_SYNTAX_ERR;
 
-        node = diff_tree_parse_get_expr_(dtree);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_attach_buf_(dtree, line, len, src.filename);
 
-        INCREMENT_POS_;
+    if(err == DIFF_TREE_ERR_NONE) {
+        err = diff_tree_parse_buf_(dtree);
 
-        node = diff_tree_new_node(NODE_TYPE_OP, NodeValue { .op_type = op->type }, node, NULL, NULL);
-        diff_tree_mark_to_delete(dtree, node);
+        DIFF_TREE_DUMP(dtree, err);
     }
-    
-    return node;
+
+    diff_tree_detach_buf_(dtree);
+    diff_tree_source_close(&src);
+
+    return err;
 }
 
-DiffTreeNode* diff_tree_parse_get_primary_(DiffTree* dtree)
+DiffTreeErr diff_tree_fread_image(DiffTree* dtree, const char* filename)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
+    utils_assert(dtree);
+    utils_assert(filename);
 
-    DiffTreeNode* node = NULL;
+    DiffTreeImage image = {};
 
-    if(BUF_AT_POS_ == '(') {
-        INCREMENT_POS_;
+    DiffTreeErr err = diff_tree_image_open(&image, filename);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
 
-        node = diff_tree_parse_get_expr_(dtree);
+    DiffTreeNode* root = NULL;
 
-        INCREMENT_POS_;
+    if(image.header->roots_cnt == 0)
+        err = DIFF_TREE_SYNTAX_ERR;
+    else {
+        DiffTreeNode** roots = TYPED_CALLOC(image.header->roots_cnt, DiffTreeNode*);
 
-        return node;
+        err = roots ? diff_tree_image_load(&image, dtree, roots) : DIFF_TREE_ALLOC_FAIL;
+        if(err == DIFF_TREE_ERR_NONE)
+            root = roots[0];
+
+        NFREE(roots);
     }
 
-    node = diff_tree_parse_get_number_(dtree);
-    if(node) return node;
+    diff_tree_image_close(&image);
 
-    node = diff_tree_parse_get_func_(dtree);
-    if(node) return node;
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
 
-    node = diff_tree_parse_get_var_(dtree);
+    dtree->root = diff_tree_new_node(dtree, NODE_TYPE_FAKE, NodeValue { .num = NAN }, root, NULL, NULL);
 
-    return node;
+    return dtree->root ? DIFF_TREE_ERR_NONE : DIFF_TREE_ALLOC_FAIL;
 }
 
-DiffTreeNode* diff_tree_parse_get_general_(DiffTree* dtree)
+DiffTreeErr diff_tree_sread(DiffTree* dtree, const char* str, size_t len)
 {
-    DIFF_TREE_ASSERT_OK_(dtree);
-
-    DiffTreeNode* node = diff_tree_parse_get_expr_(dtree);
-
-    if(dtree->buf.ptr[dtree->buf.pos] != '\n') {
-        LOG_SYNTAX_ERR_("expected: \\n, got: (ASCII) %d", (int)BUF_AT_POS_);
-        return NULL;
-    }
-    INCREMENT_POS_;
+    utils_assert(dtree);
+    utils_assert(str);
 
-    return node;
-}
+    DiffTreeErr err = diff_tree_attach_buf_(dtree, str, len, "<string>");
 
-#undef LOG_SYNTAX_ERR_
-#undef BUF_AT_POS_
-#undef BUF_AT_PREV_POS_
-#undef POS_
-#undef LEN_
-#undef INCREMENT_POS_
-#undef ADD_
-#undef SUB_
-#undef MUL_
-#undef DIV_
-#undef POW_
-#undef CONST_
-#undef VAR_
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_parse_buf_(dtree);
 
-DiffTreeErr diff_tree_fread(DiffTree* dtree, const char* filename)
+    diff_tree_detach_buf_(dtree);
+
+    return err;
+}
+
+/// @brief parser reads str in place, it is copied only if not terminated by \n
+static DiffTreeErr diff_tree_attach_buf_(DiffTree* dtree, const char* str, size_t len, const char* filename)
 {
-    utils_assert(dtree);
-    utils_assert(filename);
+    if(len == 0 || str[len - 1] != '\n') {
+        dtree->buf.owned = TYPED_CALLOC(len + 1, char);
+        dtree->buf.owned verified(return DIFF_TREE_ALLOC_FAIL);
 
-    FILE* file = open_file(filename, "r");
-    file verified(return DIFF_TREE_IO_ERR);
-    
-    size_t fsize = get_file_size(file);
+        memcpy(dtree->buf.owned, str, len);
+        dtree->buf.owned[len++] = '\n';
 
-    dtree->buf.ptr = TYPED_CALLOC(fsize, char);
-    dtree->buf.ptr verified(return DIFF_TREE_ALLOC_FAIL);
+        str = dtree->buf.owned;
+    }
 
+    dtree->buf.ptr      = str;
+    dtree->buf.len      = (ssize_t) len;
+    dtree->buf.pos      = 0;
     dtree->buf.filename = filename;
 
-    size_t bytes_transferred = fread(dtree->buf.ptr, sizeof(dtree->buf.ptr[0]), fsize, file);
-    fclose(file);
-    // TODO check for errors
-    dtree->buf.len = (unsigned) bytes_transferred;
-    
-    DiffTreeErr err = DIFF_TREE_ERR_NONE;
+    return DIFF_TREE_ERR_NONE;
+}
 
-    dtree->root = diff_tree_parse_get_general_(dtree);
+/// @brief nodes never point into the buffer, so it is not kept after parsing
+static void diff_tree_detach_buf_(DiffTree* dtree)
+{
+    NFREE(dtree->buf.owned);
 
-    if(!dtree->root) {
-        err = DIFF_TREE_SYNTAX_ERR;
-        DIFF_TREE_DUMP(dtree, err);
-        
-        for(size_t i = 0; i < dtree->to_delete.size; ++i)
-            NFREE(*(DiffTreeNode**)vector_at(&dtree->to_delete, i));
+    dtree->buf.ptr = NULL;
+    dtree->buf.len = 0;
+    dtree->buf.pos = 0;
+}
 
+static DiffTreeErr diff_tree_parse_buf_(DiffTree* dtree)
+{
+    DiffTreeErr err = diff_tree_parse_tokens_(dtree, &dtree->root);
+    if(err != DIFF_TREE_ERR_NONE)
         return err;
-    }
 
-    vector_free(&dtree->to_delete);
-
-    dtree->root = diff_tree_new_node(NODE_TYPE_FAKE, NodeValue { .num = NAN }, 
+    dtree->root = diff_tree_new_node(dtree, NODE_TYPE_FAKE, NodeValue { .num = NAN }, 
                                      dtree->root, NULL, NULL);
 
-    DIFF_TREE_DUMP(dtree, err);
-
-    return DIFF_TREE_ERR_NONE;
+    return dtree->root ? DIFF_TREE_ERR_NONE : DIFF_TREE_ALLOC_FAIL;
 }
 
 const char* diff_tree_strerr(DiffTreeErr err)
@@ -585,9 +1056,14 @@ void diff_tree_node_print(FILE* stream, void* node)
     fprintf(stream, "[%p; l: %p; r: %p; p: %p]", node_, node_->left, node_->right, node_->parent);
 }
 
-DiffTreeNode* diff_tree_new_node(NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right, DiffTreeNode *parent)
+DiffTreeNode* diff_tree_new_node(DiffTree* dtree, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right, DiffTreeNode *parent)
 {
-    DiffTreeNode* node = TYPED_CALLOC(1, DiffTreeNode);
+    utils_assert(dtree);
+
+    if(dtree->is_dag && node_type != NODE_TYPE_FAKE)
+        return diff_tree_intern_node_(dtree, node_type, node_value, left, right);
+
+    DiffTreeNode* node = (DiffTreeNode*) arena_alloc(&dtree->nodes);
 
     if(!node) return NULL;
 
@@ -596,9 +1072,13 @@ DiffTreeNode* diff_tree_new_node(NodeType node_type, NodeValue node_value, DiffT
         .right = right,
         .parent = parent,
         .type = node_type,
+        .var_mask = diff_tree_node_var_mask_(dtree, node_type, node_value, left, right),
         .value = node_value,
     };
 
+    if(dtree->is_dag)
+        return node;
+
     if(right)
         node->right->parent = node;
 
@@ -610,7 +1090,10 @@ DiffTreeNode* diff_tree_new_node(NodeType node_type, NodeValue node_value, DiffT
 
 DiffTreeNode* diff_tree_copy_subtree(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* parent)
 {
-    DiffTreeNode *new_node = diff_tree_new_node(node->type, node->value, NULL, NULL, NULL);
+    if(dtree->is_dag)
+        return node;
+
+    DiffTreeNode *new_node = diff_tree_new_node(dtree, node->type, node->value, NULL, NULL, NULL);
 
     if(node->left)
         new_node->left = diff_tree_copy_subtree(dtree, node->left, new_node);
@@ -618,7 +1101,155 @@ DiffTreeNode* diff_tree_copy_subtree(DiffTree* dtree, DiffTreeNode* node, DiffTr
     if(node->right)
         new_node->right = diff_tree_copy_subtree(dtree, node->right, new_node);
 
-    new_node->parent = parent;
+    new_node->parent   = parent;
+    new_node->var_mask = node->var_mask;
+
+    return new_node;
+}
+
+static utils_hash_t diff_tree_node_hash_(NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right)
+{
+    utils_hash_t hash = (utils_hash_t) node_type;
+
+    switch(node_type) {
+        case NODE_TYPE_OP:
+            hash = hash * 31 + (utils_hash_t) node_value.op_type;
+            break;
+        case NODE_TYPE_VAR:
+            hash = hash * 31 + node_value.var;
+            break;
+        case NODE_TYPE_NUM:
+            hash = hash * 31 + utils_djb2_hash(&node_value.num, sizeof(node_value.num));
+            break;
+        case NODE_TYPE_FAKE:
+        default:
+            break;
+    }
+
+    hash = hash * 31 + (uintptr_t) left;
+    hash = hash * 31 + (uintptr_t) right;
+
+    return hash ^ (hash >> 29);
+}
+
+static bool diff_tree_node_equal_(DiffTreeNode* node, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right)
+{
+    if(node->type != node_type || node->left != left || node->right != right)
+        return false;
+
+    switch(node_type) {
+        case NODE_TYPE_OP:
+            return node->value.op_type == node_value.op_type;
+        case NODE_TYPE_VAR:
+            return node->value.var == node_value.var;
+        case NODE_TYPE_NUM:
+            return !memcmp(&node->value.num, &node_value.num, sizeof(node_value.num));
+        case NODE_TYPE_FAKE:
+        default:
+            return false;
+    }
+}
+
+static DiffTreeNode* diff_tree_intern_node_(DiffTree* dtree, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right)
+{
+    utils_assert(dtree);
+    utils_assert(dtree->is_dag);
+
+    if((dtree->interned.size + 1) * 4 > dtree->interned.capacity * 3) {
+        if(diff_tree_intern_realloc_(dtree, dtree->interned.capacity * 2) != DIFF_TREE_ERR_NONE)
+            return NULL;
+    }
+
+    size_t mask = dtree->interned.capacity - 1;
+    size_t ind  = diff_tree_node_hash_(node_type, node_value, left, right) & mask;
+
+    for(; dtree->interned.buffer[ind]; ind = (ind + 1) & mask) {
+        DiffTreeNode* node = dtree->interned.buffer[ind];
+        if(diff_tree_node_equal_(node, node_type, node_value, left, right))
+            return node;
+    }
+
+    DiffTreeNode* node = (DiffTreeNode*) arena_alloc(&dtree->nodes);
+    if(!node) return NULL;
+
+    *node = {
+        .left = left,
+        .right = right,
+        .parent = NULL,
+        .type = node_type,
+        .var_mask = diff_tree_node_var_mask_(dtree, node_type, node_value, left, right),
+        .value = node_value,
+    };
+
+    dtree->interned.buffer[ind] = node;
+    dtree->interned.size++;
+
+    return node;
+}
+
+static DiffTreeErr diff_tree_intern_realloc_(DiffTree* dtree, size_t capacity)
+{
+    utils_assert(dtree);
+
+    DiffTreeNode** buffer_old = dtree->interned.buffer;
+    size_t capacity_old = dtree->interned.capacity;
+
+    DiffTreeNode** buffer_new = TYPED_CALLOC(capacity, DiffTreeNode*);
+    buffer_new verified(return DIFF_TREE_ALLOC_FAIL);
+
+    size_t mask = capacity - 1;
+    for(size_t i = 0; i < capacity_old; ++i) {
+        DiffTreeNode* node = buffer_old[i];
+        if(!node) continue;
+
+        size_t ind = diff_tree_node_hash_(node->type, node->value, node->left, node->right) & mask;
+        while(buffer_new[ind])
+            ind = (ind + 1) & mask;
+
+        buffer_new[ind] = node;
+    }
+
+    free(buffer_old);
+
+    dtree->interned.buffer = buffer_new;
+    dtree->interned.capacity = capacity;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static DiffTreeVarMask diff_tree_node_var_mask_(DiffTree* dtree, NodeType node_type, NodeValue node_value, DiffTreeNode *left, DiffTreeNode *right)
+{
+    DiffTreeVarMask mask = 0;
+
+    if(node_type == NODE_TYPE_VAR)
+        mask = diff_tree_var_mask(dtree, node_value.var);
+
+    if(left)  mask |= left->var_mask;
+    if(right) mask |= right->var_mask;
+
+    return mask;
+}
+
+static DiffTreeNode* diff_tree_import_subtree_(DiffTree* to, DiffTreeNode* node, PtrMap* imported)
+{
+    utils_assert(to);
+    utils_assert(node);
+    utils_assert(imported);
+
+    PtrMapVal* found = ptr_map_find(imported, node);
+    if(found) return (DiffTreeNode*) found->ptr;
+
+    DiffTreeNode *left = NULL, *right = NULL;
+
+    if(node->left)
+        left = diff_tree_import_subtree_(to, node->left, imported);
+
+    if(node->right)
+        right = diff_tree_import_subtree_(to, node->right, imported);
+
+    DiffTreeNode* new_node = diff_tree_new_node(to, node->type, node->value, left, right, NULL);
+
+    ptr_map_insert(imported, node, PtrMapVal { .ptr = new_node });
 
     return new_node;
 }
@@ -633,12 +1264,7 @@ static char* diff_tree_node_value_str_(DiffTree* dtree, NodeType node_type, Node
             return const_cast<char*>(node_op_type_str(val.op_type));
         case NODE_TYPE_VAR: 
         {
-            Variable* var = diff_tree_find_variable(dtree, val.var_hash);
-            if(var) {
-                sprintf(buffer, "%c", var->c);
-                return buffer;
-            }
-            break;
+            return diff_tree_variable(dtree, val.var)->name;
         }
         case NODE_TYPE_NUM:
             strfromd(buffer, BUF_LEN_, "%f", val.num);
@@ -667,9 +1293,51 @@ DiffTreeErr diff_tree_init_latex_file(const char* filename)
 {
     file_tex = open_file(filename, "w");
     file_tex verified(return DIFF_TREE_IO_ERR);
-    
-    fprintf(
-        file_tex, 
+
+    diff_tree_sink_ctor(&tex_file_sink, file_tex);
+    diff_tree_init_latex(&tex_file_sink);
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+void diff_tree_end_latex_file()
+{
+    utils_assert(file_tex);
+    utils_assert(tex_sink == &tex_file_sink);
+
+    diff_tree_end_latex();
+
+    diff_tree_sink_dtor(&tex_file_sink);
+    fclose(file_tex);
+    file_tex = NULL;
+}
+
+DiffTreeSink* diff_tree_set_latex_sink(DiffTreeSink* sink)
+{
+    DiffTreeSink* prev = tex_sink;
+    tex_sink = sink;
+
+    return prev;
+}
+
+size_t diff_tree_latex_size()
+{
+    return tex_sink ? diff_tree_sink_size(tex_sink) : 0;
+}
+
+void diff_tree_set_latex_max_nodes(size_t max_nodes)
+{
+    tex_max_nodes = max_nodes;
+}
+
+void diff_tree_init_latex(DiffTreeSink* sink)
+{
+    utils_assert(sink);
+
+    tex_sink = sink;
+
+    diff_tree_sink_puts(
+        tex_sink,
         "\\documentclass[a4paper,12pt]{article}\n"
         "\\usepackage[a4paper,top=1.3cm,bottom=2cm,left=1.5cm,right=1.5cm]{geometry}\n"
         "\\usepackage[T2A, T1]{fontenc}\n"
@@ -686,37 +1354,41 @@ DiffTreeErr diff_tree_init_latex_file(const char* filename)
         "\\maketitle\n"
         "\\tableofcontents\n"
     );
-
-    return DIFF_TREE_ERR_NONE;
 }
 
-void diff_tree_end_latex_file()
+DiffTreeErr diff_tree_end_latex()
 {
-    utils_assert(file_tex);
+    utils_assert(tex_sink);
 
-    fprintf(file_tex,
+    diff_tree_sink_puts(tex_sink,
             "\n\\end{document}\n");
 
-    fclose(file_tex);
+    DiffTreeErr err = diff_tree_sink_flush(tex_sink);
+    if(err != DIFF_TREE_ERR_NONE)
+        UTILS_LOGE(LOG_CTG_DIFF_TREE, "latex output is incomplete: %s", diff_tree_strerr(err));
+
+    tex_sink = NULL;
+
+    return err;
 }
 
 
-static bool diff_tree_node_need_parentheses_(DiffTreeNode* node)
+static bool diff_tree_node_need_parentheses_(DiffTreeNode* node, DiffTreeNode* parent)
 {
     utils_assert(node);
 
-    if (!node->parent || node->parent->type == NODE_TYPE_FAKE)
+    if (!parent || parent->type == NODE_TYPE_FAKE)
         return false;
 
-    if (node->type != NODE_TYPE_OP || node->parent->type != NODE_TYPE_OP)
+    if (node->type != NODE_TYPE_OP || parent->type != NODE_TYPE_OP)
         return false;
 
-    if(node->parent->value.op_type == OPERATOR_TYPE_DIV ||
-       node->parent->value.op_type == OPERATOR_TYPE_SQRT)
+    if(parent->value.op_type == OPERATOR_TYPE_DIV ||
+       parent->value.op_type == OPERATOR_TYPE_SQRT)
         return false;
 
     const Operator* op_node = get_operator(node->value.op_type);
-    const Operator* op_parent = get_operator(node->parent->value.op_type);
+    const Operator* op_parent = get_operator(parent->value.op_type);
 
     if(op_node->argnum == OPERATOR_ARGNUM_1 && op_parent->type == OPERATOR_TYPE_POW)
         return true;
@@ -725,9 +1397,9 @@ static bool diff_tree_node_need_parentheses_(DiffTreeNode* node)
         return true;
 
     if(op_parent->precedance == op_node->precedance)
-        if((node->parent->value.op_type == OPERATOR_TYPE_SUB ||
-           node->parent->value.op_type == OPERATOR_TYPE_POW) &&
-           node == node->parent->right)
+        if((parent->value.op_type == OPERATOR_TYPE_SUB ||
+           parent->value.op_type == OPERATOR_TYPE_POW) &&
+           node == parent->right)
             return true;
 
     return false;
@@ -737,25 +1409,47 @@ void diff_tree_dump_node_latex(DiffTree* dtree, DiffTreeNode* node)
 {
     DIFF_TREE_ASSERT_OK_(dtree);
     utils_assert(node);
-    utils_assert(file_tex);
+
+    tex_nodes_left = tex_max_nodes;
+    diff_tree_dump_node_latex_(dtree, node, node->parent);
+}
+
+static void diff_tree_dump_node_latex_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* parent)
+{
+    utils_assert(node);
+    utils_assert(tex_sink);
+
+    if(tex_max_nodes) {
+        if(tex_nodes_left == 0) {
+            diff_tree_sink_puts(tex_sink, " \\dots ");
+            return;
+        }
+        --tex_nodes_left;
+    }
+
+    bool need_parentheses = diff_tree_node_need_parentheses_(node, parent);
 
     if(node->type == NODE_TYPE_OP) {
-        if(diff_tree_node_need_parentheses_(node)) fprintf(file_tex, "\\left (");
-        fprintf(file_tex, "%s", get_operator(node->value.op_type)->latex_str_pref);
+        if(need_parentheses) diff_tree_sink_puts(tex_sink, "\\left (");
+        diff_tree_sink_puts(tex_sink, get_operator(node->value.op_type)->latex_str_pref);
     }
 
     if(node->left)
-        diff_tree_dump_node_latex(dtree, node->left);
+        diff_tree_dump_node_latex_(dtree, node->left, node);
 
     switch(node->type) {
         case NODE_TYPE_VAR:
-            fprintf(file_tex, " %c ", diff_tree_find_variable(dtree, node->value.var_hash)->c);
+            diff_tree_sink_putc(tex_sink, ' ');
+            diff_tree_sink_puts(tex_sink, diff_tree_variable(dtree, node->value.var)->name);
+            diff_tree_sink_putc(tex_sink, ' ');
             break;
         case NODE_TYPE_OP:
-            fprintf(file_tex, " %s ", get_operator(node->value.op_type)->latex_str_inf);
+            diff_tree_sink_putc(tex_sink, ' ');
+            diff_tree_sink_puts(tex_sink, get_operator(node->value.op_type)->latex_str_inf);
+            diff_tree_sink_putc(tex_sink, ' ');
             break;
         case NODE_TYPE_NUM:
-            fprintf(file_tex, " %g ", node->value.num);
+            diff_tree_sink_printf(tex_sink, " %g ", node->value.num);
         case NODE_TYPE_FAKE:
             UTILS_LOGW(LOG_CTG_DIFF_TREE, "fake node occured");
             break;
@@ -765,24 +1459,29 @@ void diff_tree_dump_node_latex(DiffTree* dtree, DiffTreeNode* node)
     }
 
     if(node->right)
-        diff_tree_dump_node_latex(dtree, node->right);
+        diff_tree_dump_node_latex_(dtree, node->right, node);
 
     if(node->type == NODE_TYPE_OP) {
-        fprintf(file_tex, "%s", get_operator(node->value.op_type)->latex_str_post);
-        if(diff_tree_node_need_parentheses_(node)) fprintf(file_tex, "\\right )");
+        diff_tree_sink_puts(tex_sink, get_operator(node->value.op_type)->latex_str_post);
+        if(need_parentheses) diff_tree_sink_puts(tex_sink, "\\right )");
     }
 }
 
 void diff_tree_dump_randphrase_latex()
 {
-    fprintf(file_tex, "%s\n", phrases[(unsigned) rand() % SIZEOF(phrases)]);
+    utils_assert(tex_sink);
+
+    diff_tree_sink_puts(tex_sink, phrases[(unsigned) rand() % SIZEOF(phrases)]);
+    diff_tree_sink_putc(tex_sink, '\n');
 }
 
 void diff_tree_dump_latex(const char* fmt, ...)
 {
+    utils_assert(tex_sink);
+
     va_list va_arg_list;
     va_start(va_arg_list, fmt);
-    vfprintf(file_tex, fmt, va_arg_list);
+    diff_tree_sink_vprintf(tex_sink, fmt, va_arg_list);
     va_end(va_arg_list);
 }
 
@@ -796,9 +1495,255 @@ void diff_tree_dump_end_math()
     diff_tree_dump_latex("\\end{dmath}\n\n");
 }
 
+/// adaptive sampling starts from a uniform grid and halves intervals
+/// until they are as fine as the plot step, at most PLOT_MAX_DEPTH times
+static const size_t PLOT_INIT_INTERVALS = 64;
+static const size_t PLOT_MAX_DEPTH      = 12;
+/// vertical resolution the tolerance is derived from, a chord may be off by a pixel
+static const double PLOT_PIXELS         = 500;
+/// halving a smooth interval shrinks the deviation from its chord about 4 times,
+/// at the finest level one shrinking less than this contains a jump or a pole
+static const double PLOT_JUMP_RATIO     = 0.5;
+
+/// @brief pgfplots coordinate "(x,y)\n", prec digits after the point
+static void diff_tree_plot_point_(double x, double y, unsigned prec)
+{
+    diff_tree_sink_putc(tex_sink, '(');
+    diff_tree_sink_fixed(tex_sink, x, prec);
+    diff_tree_sink_putc(tex_sink, ',');
+    diff_tree_sink_fixed(tex_sink, y, prec);
+    diff_tree_sink_puts(tex_sink, ")\n");
+}
+
+/// @brief distance from the midpoint to the chord of the interval with ends ys[0], ys[1],
+///        infinite where the curve becomes undefined, so that such boundaries are refined
+static double diff_tree_plot_deviation_(const double* ys, double y_mid)
+{
+    bool finite0 = isfinite(ys[0]), finite1 = isfinite(ys[1]);
+
+    if(finite0 != finite1 || finite0 != isfinite(y_mid))
+        return INFINITY;
+
+    if(!finite0)
+        return 0;
+
+    return fabs(y_mid - (ys[0] + ys[1]) / 2);
+}
+
+/// points of a curve being refined, intervals starting at split points are checked
+/// next pass and dev is the deviation their parent interval had
+typedef struct DiffTreePlotCurve
+{
+    double* xs;
+    double* ys;
+    bool* split;
+    double* dev;
+    size_t cnt;
+
+} DiffTreePlotCurve;
+
+static bool diff_tree_plot_curve_ctor_(DiffTreePlotCurve* curve, size_t capacity)
+{
+    curve->xs    = TYPED_CALLOC(capacity, double);
+    curve->ys    = TYPED_CALLOC(capacity, double);
+    curve->split = TYPED_CALLOC(capacity, bool);
+    curve->dev   = TYPED_CALLOC(capacity, double);
+    curve->cnt   = 0;
+
+    return curve->xs && curve->ys && curve->split && curve->dev;
+}
+
+static void diff_tree_plot_curve_dtor_(DiffTreePlotCurve* curve)
+{
+    NFREE(curve->xs);
+    NFREE(curve->ys);
+    NFREE(curve->split);
+    NFREE(curve->dev);
+}
+
+static void diff_tree_plot_curve_push_(DiffTreePlotCurve* curve, double x, double y, bool split, double dev)
+{
+    curve->xs[curve->cnt]    = x;
+    curve->ys[curve->cnt]    = y;
+    curve->split[curve->cnt] = split;
+    curve->dev[curve->cnt]   = dev;
+    ++curve->cnt;
+}
+
+/// @brief tolerance of a pixel of the height the initial samples span
+static double diff_tree_plot_y_tol_(const double* ys, size_t n)
+{
+    double y_min = INFINITY, y_max = -INFINITY;
+
+    for(size_t i = 0; i < n; ++i) {
+        if(!isfinite(ys[i]))
+            continue;
+        y_min = ys[i] < y_min ? ys[i] : y_min;
+        y_max = ys[i] > y_max ? ys[i] : y_max;
+    }
+
+    return y_min < y_max ? (y_max - y_min) / PLOT_PIXELS : 1;
+}
+
+/// @brief samples [x_begin, x_end] halving intervals where the curve is off the chord by more
+///        than y_tol, down to x_step; jumps and poles found at the finest level get a NAN point
+/// @param y_tol 0 for a pixel of the height spanned by the initial samples
+/// @return points count, 0 if allocation failed
+static size_t diff_tree_plot_adaptive_(DiffTreePlotSampler* sampler, double x_begin, double x_end, double x_step, double y_tol, double** xs, double** ys)
+{
+    utils_assert(sampler);
+    utils_assert(xs);
+    utils_assert(ys);
+
+    NFREE(*xs);
+    NFREE(*ys);
+
+    if(!(x_begin < x_end))
+        return 0;
+
+    size_t max_depth = 0;
+    for(double width = (x_end - x_begin) / (double) PLOT_INIT_INTERVALS;
+        width > x_step && max_depth < PLOT_MAX_DEPTH; width /= 2)
+        ++max_depth;
+
+    // the last pass adds a midpoint to every interval of the finest level
+    size_t capacity = (PLOT_INIT_INTERVALS << (max_depth + 1)) + 1;
+
+    DiffTreePlotCurve cur = {}, next = {}, mid = {};
+    if(!diff_tree_plot_curve_ctor_(&cur, capacity) ||
+       !diff_tree_plot_curve_ctor_(&next, capacity) ||
+       !diff_tree_plot_curve_ctor_(&mid, capacity)) {
+        UTILS_LOGE(LOG_CTG_DIFF_TREE, "plot sampling allocation failed");
+        diff_tree_plot_curve_dtor_(&cur);
+        diff_tree_plot_curve_dtor_(&next);
+        diff_tree_plot_curve_dtor_(&mid);
+        return 0;
+    }
+
+    for(size_t i = 0; i <= PLOT_INIT_INTERVALS; ++i) {
+        double x = x_begin + (x_end - x_begin) * (double) i / (double) PLOT_INIT_INTERVALS;
+        diff_tree_plot_curve_push_(&cur, x, 0, true, INFINITY);
+    }
+    diff_tree_plot_sampler_eval_(sampler, cur.xs, cur.ys, cur.cnt);
+
+    if(y_tol <= 0)
+        y_tol = diff_tree_plot_y_tol_(cur.ys, cur.cnt);
+
+    // every pass evaluates midpoints of all intervals left to check in one batch,
+    // the last one only adds them or marks jumps
+    for(size_t depth = 0; depth <= max_depth; ++depth) {
+        mid.cnt = 0;
+        for(size_t i = 0; i + 1 < cur.cnt; ++i)
+            if(cur.split[i])
+                diff_tree_plot_curve_push_(&mid, (cur.xs[i] + cur.xs[i + 1]) / 2, 0, false, 0);
+
+        if(mid.cnt == 0)
+            break;
+
+        diff_tree_plot_sampler_eval_(sampler, mid.xs, mid.ys, mid.cnt);
+
+        next.cnt = 0;
+        for(size_t i = 0, m = 0; i + 1 < cur.cnt; ++i) {
+            if(!cur.split[i]) {
+                diff_tree_plot_curve_push_(&next, cur.xs[i], cur.ys[i], false, 0);
+                continue;
+            }
+
+            double dev    = diff_tree_plot_deviation_(cur.ys + i, mid.ys[m]);
+            bool   bent   = dev > y_tol;
+            bool   finest = depth == max_depth;
+
+            diff_tree_plot_curve_push_(&next, cur.xs[i], cur.ys[i], bent && !finest, dev);
+
+            if(bent && finest && isfinite(dev) && dev > PLOT_JUMP_RATIO * cur.dev[i])
+                diff_tree_plot_curve_push_(&next, mid.xs[m], NAN, false, 0);
+            else if(bent)
+                diff_tree_plot_curve_push_(&next, mid.xs[m], mid.ys[m], !finest, dev);
+            ++m;
+        }
+        diff_tree_plot_curve_push_(&next, cur.xs[cur.cnt - 1], cur.ys[cur.cnt - 1], false, 0);
+
+        DiffTreePlotCurve tmp = cur;
+        cur  = next;
+        next = tmp;
+    }
+
+    size_t cnt = cur.cnt;
+    *xs = cur.xs;
+    *ys = cur.ys;
+    cur.xs = NULL;
+    cur.ys = NULL;
+
+    diff_tree_plot_curve_dtor_(&cur);
+    diff_tree_plot_curve_dtor_(&next);
+    diff_tree_plot_curve_dtor_(&mid);
+
+    return cnt;
+}
+
+/// @brief coordinates with undefined values replaced by one break of the line
+static void diff_tree_plot_points_(const double* xs, const double* ys, size_t n)
+{
+    bool is_break = false;
+
+    for(size_t i = 0; i < n; ++i) {
+        if(isfinite(ys[i])) {
+            diff_tree_plot_point_(xs[i], ys[i], 6);
+            is_break = false;
+        }
+        else if(!is_break) {
+            diff_tree_sink_putc(tex_sink, '(');
+            diff_tree_sink_fixed(tex_sink, xs[i], 6);
+            diff_tree_sink_puts(tex_sink, ",nan)\n");
+            is_break = true;
+        }
+    }
+}
+
+static void diff_tree_plot_sampler_ctor_(DiffTreePlotSampler* sampler, DiffTree* dtree, DiffTreeNode* node)
+{
+    diff_tree_tape_ctor(&sampler->tape);
+    diff_tree_tape_compile(&sampler->tape, dtree, node);
+
+    diff_tree_jit_ctor(&sampler->jit, &sampler->tape, 0);
+    if(dtree->use_jit)
+        diff_tree_jit_compile(&sampler->jit);
+
+    sampler->kernel    = {};
+    sampler->kernel_fn = NULL;
+    if(dtree->use_kernel) {
+        DiffTreeCodegenFn fn = { .name = "difftree_plot", .node = node };
+
+        if(diff_tree_kernel_load(&sampler->kernel, dtree, &fn, 1, dtree->kernel_dir) == DIFF_TREE_ERR_NONE)
+            sampler->kernel_fn = diff_tree_kernel_batch_fn(&sampler->kernel, fn.name);
+    }
+
+    sampler->vals = TYPED_CALLOC(dtree->vars.size + 1, double);
+    if(sampler->vals)
+        diff_tree_tape_load_vars(dtree, sampler->vals);
+}
+
+static void diff_tree_plot_sampler_eval_(DiffTreePlotSampler* sampler, const double* xs, double* ys, size_t n)
+{
+    if(sampler->kernel_fn)
+        sampler->kernel_fn(sampler->vals, 0, xs, ys, n);
+    else
+        diff_tree_jit_eval_batch(&sampler->jit, sampler->vals, xs, ys, n);
+}
+
+static void diff_tree_plot_sampler_dtor_(DiffTreePlotSampler* sampler)
+{
+    diff_tree_kernel_unload(&sampler->kernel);
+    diff_tree_jit_dtor(&sampler->jit);
+    diff_tree_tape_dtor(&sampler->tape);
+    NFREE(sampler->vals);
+}
+
 void diff_tree_dump_taylor_graph_latex(DiffTree* dtree, DiffTreeNode* taylor, double x_begin, double x_end, double x_step, double y_min, double y_max)
 {
-    fprintf(file_tex,
+    utils_assert(tex_sink);
+
+    diff_tree_sink_printf(tex_sink,
         "\\begin{figure}[h]\n"
         "\\centering\n"
         "\\begin{tikzpicture}\n"
@@ -808,6 +1753,7 @@ void diff_tree_dump_taylor_graph_latex(DiffTree* dtree, DiffTreeNode* taylor, do
             "width=0.5\\textwidth,\n"
             "height=0.4\\textwidth,\n"
             "grid=major,\n"
+            "unbounded coords=jump,\n"
             "ymin=%f,\n"
             "ymax=%f,\n"
         "]\n\n"
@@ -817,48 +1763,43 @@ void diff_tree_dump_taylor_graph_latex(DiffTree* dtree, DiffTreeNode* taylor, do
         "] coordinates {\n",
         y_min, y_max);
 
-    for(double x = x_begin; x < x_end; x += 0.01) {
-        ((Variable*)vector_at(&dtree->vars, 0))->val = x;
-        double val = diff_tree_evaluate_tree(dtree);
-        fprintf(file_tex, "(%.2f,%.2f)\n", x, val);
-    }
+    DiffTreePlotSampler func = {}, taylor_poly = {};
+    diff_tree_plot_sampler_ctor_(&func, dtree, dtree->root->left);
+    diff_tree_plot_sampler_ctor_(&taylor_poly, dtree, taylor);
+
+    double y_tol = (y_max - y_min) / PLOT_PIXELS;
 
-    fprintf(file_tex, 
+    double* xs = NULL;
+    double* ys = NULL;
+    size_t points_cnt = diff_tree_plot_adaptive_(&func, x_begin, x_end, x_step, y_tol, &xs, &ys);
+    diff_tree_plot_points_(xs, ys, points_cnt);
+
+    diff_tree_sink_puts(tex_sink, 
         "};\n \\addlegendentry{$f(x)$}\n");
 
-    fprintf(file_tex,
+    diff_tree_sink_puts(tex_sink,
         "\\addplot[\n"
         "    mark size=0pt,\n"
         "    color=red\n"
         "] coordinates {\n");
 
-    double x_min = INFINITY, x_max = 0;
-    for(double x = x_begin; x <= x_end; x += 0.005) {
-        ((Variable*)vector_at(&dtree->vars, 0))->val = x;
-        double val = diff_tree_evaluate(dtree, taylor);
-        if(val < y_max && val > y_min)
-        {
-            x_min = x < x_min ? x : x_min;
-            x_max = x > x_max ? x : x_max;
-        }
-        // fprintf(file_tex, "(%.2f,%.2f)\n", x, val);
+    // P grows fast away from the point, so it is plotted only where it can be in the window
+    double x_min = 0, x_max = 0;
+    if(taylor_poly.vals && diff_tree_interval_find_range(&taylor_poly.tape, taylor_poly.vals, 0, x_begin, x_end,
+                                                         x_step, y_min, y_max, &x_min, &x_max)) {
+        points_cnt = diff_tree_plot_adaptive_(&taylor_poly, x_min, x_max, x_step, y_tol, &xs, &ys);
+        diff_tree_plot_points_(xs, ys, points_cnt);
     }
 
-    for(double x = x_min; x < x_max; x += 0.01) {
-        ((Variable*)vector_at(&dtree->vars, 0))->val = x;
-        double val = diff_tree_evaluate(dtree, taylor);
-        if(val < y_max && val > y_min)
-        {
-            x_min = x < x_min ? x : x_min;
-            x_max = x > x_max ? x : x_max;
-        }
-        fprintf(file_tex, "(%f,%f)\n", x, val);
-    }
+    NFREE(xs);
+    NFREE(ys);
+    diff_tree_plot_sampler_dtor_(&func);
+    diff_tree_plot_sampler_dtor_(&taylor_poly);
 
-    fprintf(file_tex, 
+    diff_tree_sink_puts(tex_sink, 
         "};\n \\addlegendentry{$P(x)$}\n");
 
-    fprintf(file_tex, 
+    diff_tree_sink_puts(tex_sink, 
         "\\end{axis}\n"
         "\\end{tikzpicture}\n"
         "\\caption{Сравнительный график функции и многочлена Тейлора}\n"
@@ -867,7 +1808,9 @@ void diff_tree_dump_taylor_graph_latex(DiffTree* dtree, DiffTreeNode* taylor, do
 
 void diff_tree_dump_graph_latex(DiffTree* dtree, double x_begin, double x_end, double x_step)
 {
-    fprintf(file_tex,
+    utils_assert(tex_sink);
+
+    diff_tree_sink_puts(tex_sink,
         "\\begin{figure}[h]\n"
         "\\centering\n"
         "\\begin{tikzpicture}\n"
@@ -877,6 +1820,7 @@ void diff_tree_dump_graph_latex(DiffTree* dtree, double x_begin, double x_end, d
             "width=0.5\\textwidth,\n"
             "height=0.4\\textwidth,\n"
             "grid=major,\n"
+            "unbounded coords=jump,\n"
             "legend pos=north west\n"
         "]\n\n"
         "\\addplot[\n"
@@ -884,16 +1828,22 @@ void diff_tree_dump_graph_latex(DiffTree* dtree, double x_begin, double x_end, d
         "    color=blue\n"
         "] coordinates {\n");
 
-    for(double x = x_begin; x < x_end; x += x_step) {
-        ((Variable*)vector_at(&dtree->vars, 0))->val = x;
-        double val = diff_tree_evaluate_tree(dtree);
-        fprintf(file_tex, "(%f,%f)\n", x, val);
-    }
+    DiffTreePlotSampler sampler = {};
+    diff_tree_plot_sampler_ctor_(&sampler, dtree, dtree->root->left);
+
+    double* xs = NULL;
+    double* ys = NULL;
+    size_t points_cnt = diff_tree_plot_adaptive_(&sampler, x_begin, x_end, x_step, 0, &xs, &ys);
+    diff_tree_plot_points_(xs, ys, points_cnt);
+
+    NFREE(xs);
+    NFREE(ys);
+    diff_tree_plot_sampler_dtor_(&sampler);
 
-    fprintf(file_tex, 
+    diff_tree_sink_puts(tex_sink, 
         "};\n \\addlegendentry{$\\frac{df}{dx}$}\n");
 
-    fprintf(file_tex, 
+    diff_tree_sink_puts(tex_sink, 
         "\\end{axis}\n"
         "\\end{tikzpicture}\n"
         "\\caption{График производной}\n"
@@ -0,0 +1,352 @@
+#include "difftree_batch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "assertutils.h"
+#include "difftree_math.h"
+#include "difftree_source.h"
+#include "ioutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+ATTR_UNUSED static const char* LOG_CTG_BATCH = "DIFFTREE BATCH";
+
+/// lines taken by a worker at once, keeps the lock out of the hot path
+static const size_t BATCH_CHUNK = 16;
+
+/// lines read at once, bounds memory regardless of input size;
+/// two windows are alive, one is differentiated while the other is written
+static const size_t BATCH_WINDOW = 4096;
+
+typedef struct DiffTreeBatchLine
+{
+    /// view into the source, with terminating \n
+    const char* str;
+    size_t len;
+
+    /// derivative or error message, written by the worker that took the line
+    char* res;
+    size_t res_len;
+
+} DiffTreeBatchLine;
+
+/// @brief state shared by the workers, guarded by lock
+typedef struct DiffTreeBatch
+{
+    /// window being differentiated
+    DiffTreeBatchLine* lines;
+    size_t lines_cnt;
+
+    /// first line not taken by anyone yet
+    size_t next;
+    /// lines differentiated
+    size_t done;
+
+    /// workers exit once they see it
+    bool stop;
+
+    pthread_mutex_t lock;
+    /// a window was given or stop was set
+    pthread_cond_t work_cond;
+    /// all lines of the window are differentiated
+    pthread_cond_t done_cond;
+
+    bool is_dag;
+
+} DiffTreeBatch;
+
+static DiffTreeErr diff_tree_batch_read_(DiffTreeSource* src, DiffTreeBatchLine* lines, size_t* lines_cnt);
+
+static size_t diff_tree_batch_start_(DiffTreeBatch* batch, pthread_t* threads, size_t threads_cnt);
+
+static void diff_tree_batch_stop_(DiffTreeBatch* batch, pthread_t* threads, size_t started);
+
+static void diff_tree_batch_submit_(DiffTreeBatch* batch, DiffTreeBatchLine* lines, size_t lines_cnt);
+
+static void diff_tree_batch_wait_(DiffTreeBatch* batch);
+
+static DiffTreeErr diff_tree_batch_write_(DiffTreeBatchLine* lines, size_t lines_cnt, FILE* file);
+
+static void* diff_tree_batch_worker_(void* arg);
+
+static bool diff_tree_batch_take_(DiffTreeBatch* batch);
+
+static void diff_tree_batch_line_(DiffTreeBatch* batch, DiffTreeBatchLine* line);
+
+DiffTreeErr diff_tree_batch(const char* in, const char* out, size_t threads_cnt, bool is_dag)
+{
+    DiffTreeBatch batch = {
+        .lines     = NULL,
+        .lines_cnt = 0,
+        .next      = 0,
+        .done      = 0,
+        .stop      = false,
+        .lock      = PTHREAD_MUTEX_INITIALIZER,
+        .work_cond = PTHREAD_COND_INITIALIZER,
+        .done_cond = PTHREAD_COND_INITIALIZER,
+        .is_dag    = is_dag,
+    };
+
+    if(threads_cnt == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_cnt = online > 0 ? (size_t) online : 1;
+    }
+
+    // trees are drawn only by the single-expression report
+    diff_tree_set_latex_dump_enabled(false);
+
+    DiffTreeSource src = {};
+
+    DiffTreeErr err = diff_tree_source_open(&src, in);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
+
+    FILE* file = out ? open_file(out, "w") : stdout;
+
+    DiffTreeBatchLine* windows[2] = {
+        TYPED_CALLOC(BATCH_WINDOW, DiffTreeBatchLine),
+        TYPED_CALLOC(BATCH_WINDOW, DiffTreeBatchLine),
+    };
+    pthread_t* threads = TYPED_CALLOC(threads_cnt, pthread_t);
+
+    if(!file)
+        err = DIFF_TREE_IO_ERR;
+    else if(!windows[0] || !windows[1] || !threads)
+        err = DIFF_TREE_ALLOC_FAIL;
+
+    size_t started = err == DIFF_TREE_ERR_NONE ? diff_tree_batch_start_(&batch, threads, threads_cnt) : 0;
+
+    DiffTreeBatchLine* prev = NULL;
+    size_t prev_cnt = 0;
+
+    // workers differentiate a window while the previous one is written,
+    // the source is reused once no line of it is in use
+    for(size_t cur = 0;; cur ^= 1) {
+        DiffTreeBatchLine* lines = windows[cur];
+        size_t lines_cnt = 0;
+
+        if(err == DIFF_TREE_ERR_NONE)
+            err = diff_tree_batch_read_(&src, lines, &lines_cnt);
+
+        diff_tree_batch_submit_(&batch, lines, lines_cnt);
+
+        DiffTreeErr write_err = diff_tree_batch_write_(prev, prev_cnt, file);
+        if(err == DIFF_TREE_ERR_NONE)
+            err = write_err;
+
+        diff_tree_batch_wait_(&batch);
+        diff_tree_source_discard(&src);
+
+        if(lines_cnt == 0)
+            break;
+
+        prev     = lines;
+        prev_cnt = lines_cnt;
+    }
+
+    diff_tree_batch_stop_(&batch, threads, started);
+
+    if(file && file != stdout)
+        fclose(file);
+
+    NFREE(threads);
+    NFREE(windows[0]);
+    NFREE(windows[1]);
+
+    diff_tree_source_close(&src);
+
+    return err;
+}
+
+/// @brief takes up to BATCH_WINDOW lines, fewer if the source window is full
+static DiffTreeErr diff_tree_batch_read_(DiffTreeSource* src, DiffTreeBatchLine* lines, size_t* lines_cnt)
+{
+    *lines_cnt = 0;
+
+    while(*lines_cnt < BATCH_WINDOW) {
+        DiffTreeBatchLine* line = &lines[*lines_cnt];
+
+        DiffTreeErr err = diff_tree_source_next(src, &line->str, &line->len);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+
+        if(!line->str)
+            break;
+
+        line->res     = NULL;
+        line->res_len = 0;
+
+        ++*lines_cnt;
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief workers live for the whole input, the caller takes lines too,
+///        so none of them started is not an error
+static size_t diff_tree_batch_start_(DiffTreeBatch* batch, pthread_t* threads, size_t threads_cnt)
+{
+    size_t started = 0;
+
+    for(; started < threads_cnt; ++started) {
+        if(pthread_create(&threads[started], NULL, diff_tree_batch_worker_, batch) != 0) {
+            UTILS_LOGW(LOG_CTG_BATCH, "started %zu of %zu workers", started, threads_cnt);
+            break;
+        }
+    }
+
+    return started;
+}
+
+static void diff_tree_batch_stop_(DiffTreeBatch* batch, pthread_t* threads, size_t started)
+{
+    pthread_mutex_lock(&batch->lock);
+    batch->stop = true;
+    pthread_cond_broadcast(&batch->work_cond);
+    pthread_mutex_unlock(&batch->lock);
+
+    for(size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&batch->work_cond);
+    pthread_cond_destroy(&batch->done_cond);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+/// @brief the previous window must be waited for
+static void diff_tree_batch_submit_(DiffTreeBatch* batch, DiffTreeBatchLine* lines, size_t lines_cnt)
+{
+    pthread_mutex_lock(&batch->lock);
+
+    batch->lines     = lines;
+    batch->lines_cnt = lines_cnt;
+    batch->next      = 0;
+    batch->done      = 0;
+
+    pthread_cond_broadcast(&batch->work_cond);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/// @brief takes lines left, then waits for those taken by workers
+static void diff_tree_batch_wait_(DiffTreeBatch* batch)
+{
+    while(diff_tree_batch_take_(batch))
+        ;
+
+    pthread_mutex_lock(&batch->lock);
+
+    while(batch->done < batch->lines_cnt)
+        pthread_cond_wait(&batch->done_cond, &batch->lock);
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/// @brief frees results as they are written
+static DiffTreeErr diff_tree_batch_write_(DiffTreeBatchLine* lines, size_t lines_cnt, FILE* file)
+{
+    if(lines_cnt == 0)
+        return DIFF_TREE_ERR_NONE;
+
+    for(size_t i = 0; i < lines_cnt; ++i) {
+        if(lines[i].res)
+            fwrite(lines[i].res, sizeof(char), lines[i].res_len, file);
+        fputc('\n', file);
+
+        NFREE(lines[i].res);
+    }
+
+    return ferror(file) ? DIFF_TREE_IO_ERR : DIFF_TREE_ERR_NONE;
+}
+
+static void* diff_tree_batch_worker_(void* arg)
+{
+    DiffTreeBatch* batch = (DiffTreeBatch*) arg;
+
+    pthread_mutex_lock(&batch->lock);
+
+    while(!batch->stop) {
+        if(batch->next < batch->lines_cnt) {
+            pthread_mutex_unlock(&batch->lock);
+            diff_tree_batch_take_(batch);
+            pthread_mutex_lock(&batch->lock);
+        }
+        else
+            pthread_cond_wait(&batch->work_cond, &batch->lock);
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+/// @brief differentiates one chunk of lines
+/// @return false if no lines were left to take
+static bool diff_tree_batch_take_(DiffTreeBatch* batch)
+{
+    pthread_mutex_lock(&batch->lock);
+
+    DiffTreeBatchLine* lines = batch->lines;
+    size_t begin = batch->next;
+    size_t end   = begin + BATCH_CHUNK < batch->lines_cnt ? begin + BATCH_CHUNK : batch->lines_cnt;
+
+    batch->next = end;
+
+    pthread_mutex_unlock(&batch->lock);
+
+    if(begin >= end)
+        return false;
+
+    for(size_t i = begin; i < end; ++i)
+        diff_tree_batch_line_(batch, &lines[i]);
+
+    pthread_mutex_lock(&batch->lock);
+
+    batch->done += end - begin;
+    if(batch->done == batch->lines_cnt)
+        pthread_cond_signal(&batch->done_cond);
+
+    pthread_mutex_unlock(&batch->lock);
+
+    return true;
+}
+
+/// @brief blank lines stay blank in the output
+static void diff_tree_batch_line_(DiffTreeBatch* batch, DiffTreeBatchLine* line)
+{
+    if(line->len <= 1)
+        return;
+
+    DiffTree dtree = DIFF_TREE_INIT_LIST;
+
+    DiffTreeErr err = diff_tree_ctor(&dtree);
+
+    if(err == DIFF_TREE_ERR_NONE && batch->is_dag)
+        err = diff_tree_enable_dag(&dtree);
+
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_sread(&dtree, line->str, line->len);
+
+    // an expression without variables is a constant
+    if(err == DIFF_TREE_ERR_NONE && dtree.vars.size > 0)
+        err = diff_tree_differentiate_tree_n(&dtree, (Variable*) vector_at(&dtree.vars, 0), 1);
+
+    FILE* stream = open_memstream(&line->res, &line->res_len);
+
+    if(stream) {
+        if(err != DIFF_TREE_ERR_NONE)
+            fprintf(stream, "error: %s", diff_tree_strerr(err));
+        else if(dtree.vars.size == 0)
+            fprintf(stream, "0");
+        else
+            diff_tree_fprint_node(&dtree, dtree.root->left, stream);
+
+        fclose(stream);
+    }
+    else
+        UTILS_LOGE(LOG_CTG_BATCH, "failed to allocate result of line %.*s", (int) line->len - 1, line->str);
+
+    diff_tree_dtor(&dtree);
+}
@@ -0,0 +1,193 @@
+#include "difftree_cache.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+
+#include "difftree_image.h"
+#include "variable.h"
+
+#define LOG_CTG_CACHE "DIFFTREE_CACHE"
+
+/* An entry is an image of three roots: the optimized expression, its
+ * derivative and the Taylor polynom. It is named by hash of the key and of
+ * values of the variables, on load the stored expression and variables are
+ * compared with the current ones, so a hash collision is only a miss. */
+
+/// room for the directory and a file name of hash, pid and suffix
+static const size_t CACHE_PATH_LEN_MAX = DIFF_TREE_CACHE_DIR_LEN_MAX + 64;
+
+static const size_t CACHE_ROOTS_CNT = 3;
+
+static const utils_hash_t CACHE_HASH_SEED  = 0x9E3779B97F4A7C15ull;
+static const utils_hash_t CACHE_HASH_PRIME = 0xC2B2AE3D27D4EB4Full;
+
+static utils_hash_t diff_tree_cache_key_hash_(const DiffTreeCacheKey* key, const DiffTree* dtree);
+
+static bool diff_tree_cache_same_vars_(const DiffTreeImage* image, const DiffTree* dtree);
+
+static inline utils_hash_t diff_tree_cache_mix_(utils_hash_t hash, uint64_t word)
+{
+    hash = (hash ^ word) * CACHE_HASH_PRIME;
+
+    return hash ^ (hash >> 29);
+}
+
+DiffTreeErr diff_tree_cache_dir(const char* cache_dir, char* dir)
+{
+    utils_assert(dir);
+
+    const char* xdg  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    int len = 0;
+    if(cache_dir)
+        len = snprintf(dir, DIFF_TREE_CACHE_DIR_LEN_MAX, "%s", cache_dir);
+    else if(xdg && *xdg)
+        len = snprintf(dir, DIFF_TREE_CACHE_DIR_LEN_MAX, "%s/difftree", xdg);
+    else if(home && *home)
+        len = snprintf(dir, DIFF_TREE_CACHE_DIR_LEN_MAX, "%s/.cache/difftree", home);
+    else
+        len = snprintf(dir, DIFF_TREE_CACHE_DIR_LEN_MAX, "/tmp/difftree");
+
+    if(len <= 0 || (size_t) len >= DIFF_TREE_CACHE_DIR_LEN_MAX) {
+        UTILS_LOGE(LOG_CTG_CACHE, "cache directory name is too long");
+        return DIFF_TREE_IO_ERR;
+    }
+
+    for(char* sep = strchr(dir + 1, '/'); ; sep = strchr(sep + 1, '/')) {
+        if(sep) *sep = '\0';
+
+        if(mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            UTILS_LOGE(LOG_CTG_CACHE, "can't create %s", dir);
+            return DIFF_TREE_IO_ERR;
+        }
+
+        if(!sep) break;
+        *sep = '/';
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief also covers values of variables, Taylor coefficients depend on them
+static utils_hash_t diff_tree_cache_key_hash_(const DiffTreeCacheKey* key, const DiffTree* dtree)
+{
+    uint64_t x0_bits = 0;
+    memcpy(&x0_bits, &key->x0, sizeof(x0_bits));
+
+    utils_hash_t hash = diff_tree_cache_mix_(CACHE_HASH_SEED, key->expr_hash);
+    hash = diff_tree_cache_mix_(hash, key->slot);
+    hash = diff_tree_cache_mix_(hash, key->order);
+    hash = diff_tree_cache_mix_(hash, key->power);
+    hash = diff_tree_cache_mix_(hash, x0_bits);
+    hash = diff_tree_cache_mix_(hash, key->symbolic);
+
+    for(size_t i = 0; i < dtree->vars.size; ++i) {
+        const Variable* var = diff_tree_variable(dtree, i);
+
+        uint64_t val_bits = 0;
+        memcpy(&val_bits, &var->val, sizeof(val_bits));
+
+        hash = diff_tree_cache_mix_(hash, var->hash);
+        hash = diff_tree_cache_mix_(hash, val_bits);
+    }
+
+    return hash;
+}
+
+bool diff_tree_cache_load(const char* dir, const DiffTreeCacheKey* key, DiffTree* dtree, DiffTreeNode* expr, DiffTreeCacheEntry* entry)
+{
+    utils_assert(dir);
+    utils_assert(key);
+    utils_assert(dtree);
+    utils_assert(expr);
+    utils_assert(entry);
+
+    char path[CACHE_PATH_LEN_MAX] = "";
+    if(snprintf(path, sizeof(path), "%s/%016lx.img", dir, diff_tree_cache_key_hash_(key, dtree)) < 0)
+        return false;
+
+    // a missing entry is an ordinary miss, not worth an error of diff_tree_image_open
+    if(access(path, R_OK) != 0)
+        return false;
+
+    DiffTreeImage image = {};
+    if(diff_tree_image_open(&image, path) != DIFF_TREE_ERR_NONE)
+        return false;
+
+    DiffTreeNode* roots[CACHE_ROOTS_CNT] = {};
+
+    bool is_hit = image.header->roots_cnt == CACHE_ROOTS_CNT && diff_tree_cache_same_vars_(&image, dtree) &&
+                  diff_tree_image_load(&image, dtree, roots) == DIFF_TREE_ERR_NONE;
+
+    diff_tree_image_close(&image);
+
+    is_hit = is_hit && diff_tree_subtree_equal(dtree, roots[0], expr);
+
+    for(size_t i = 0; i < CACHE_ROOTS_CNT; ++i)
+        if(roots[i] && (!is_hit || i == 0))
+            diff_tree_mark_to_delete(dtree, roots[i]);
+
+    if(!is_hit) {
+        UTILS_LOGW(LOG_CTG_CACHE, "%s is not an entry of this expression", path);
+        return false;
+    }
+
+    entry->expr   = expr;
+    entry->deriv  = roots[1];
+    entry->taylor = roots[2];
+
+    return true;
+}
+
+/// @brief same names in the same order, so slots of the key and of the nodes match
+static bool diff_tree_cache_same_vars_(const DiffTreeImage* image, const DiffTree* dtree)
+{
+    if(image->header->vars_cnt != dtree->vars.size)
+        return false;
+
+    for(size_t i = 0; i < dtree->vars.size; ++i) {
+        const Variable* var = diff_tree_variable(dtree, i);
+
+        if(strcmp(image->vars[i].name, var->name) != 0 ||
+           memcmp(&image->vars[i].val, &var->val, sizeof(var->val)) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+DiffTreeErr diff_tree_cache_store(const char* dir, const DiffTreeCacheKey* key, DiffTree* dtree, const DiffTreeCacheEntry* entry)
+{
+    utils_assert(dir);
+    utils_assert(key);
+    utils_assert(dtree);
+    utils_assert(entry);
+
+    utils_hash_t hash = diff_tree_cache_key_hash_(key, dtree);
+
+    char path[CACHE_PATH_LEN_MAX] = "", tmp[CACHE_PATH_LEN_MAX] = "";
+
+    if(snprintf(path, sizeof(path), "%s/%016lx.img",    dir, hash) < 0 ||
+       snprintf(tmp,  sizeof(tmp),  "%s/%016lx.%d.img", dir, hash, getpid()) < 0)
+        return DIFF_TREE_IO_ERR;
+
+    DiffTreeNode* roots[CACHE_ROOTS_CNT] = { entry->expr, entry->deriv, entry->taylor };
+
+    DiffTreeErr err = diff_tree_image_fwrite(dtree, roots, CACHE_ROOTS_CNT, tmp);
+
+    if(err == DIFF_TREE_ERR_NONE && rename(tmp, path) != 0)
+        err = DIFF_TREE_IO_ERR;
+
+    if(err != DIFF_TREE_ERR_NONE) {
+        UTILS_LOGE(LOG_CTG_CACHE, "can't store %s", path);
+        unlink(tmp);
+    }
+
+    return err;
+}
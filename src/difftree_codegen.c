@@ -0,0 +1,436 @@
+#include "difftree_codegen.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#include "difftree_cache.h"
+#include "difftree_tape.h"
+#include "operators.h"
+
+#define LOG_CTG_CODEGEN "DIFFTREE_CODEGEN"
+
+/* Source is generated from the compiled tape, so repeated subexpressions
+ * are computed once: every operator is one statement assigning a new
+ * temporary, leaves are inlined into the statements using them. Kernels
+ * are cached by hash of their source, the source is kept next to the
+ * shared object and compared on a hit. Files are written under temporary
+ * names and renamed, so concurrent runs never see a partial file. */
+
+static_assert(sizeof(DiffTreeKernelFn) == sizeof(void*), "symbol must fit a function pointer");
+
+static const size_t KERNEL_NAME_LEN_MAX = 256;
+
+/// room for the directory and a file name of hash, pid and suffix
+static const size_t KERNEL_PATH_LEN_MAX = DIFF_TREE_CACHE_DIR_LEN_MAX + 64;
+
+typedef enum DiffTreeCodegenValKind
+{
+    CODEGEN_VAL_TEMP,
+    CODEGEN_VAL_VAR,
+    CODEGEN_VAL_NUM,
+
+} DiffTreeCodegenValKind;
+
+/// @brief operand of a statement
+typedef struct DiffTreeCodegenVal
+{
+    DiffTreeCodegenValKind kind;
+    size_t id;
+    double num;
+
+} DiffTreeCodegenVal;
+
+static DiffTreeErr diff_tree_codegen_fn_(DiffTree* dtree, const DiffTreeCodegenFn* fn, FILE* file);
+
+static void diff_tree_codegen_val_(FILE* file, DiffTreeCodegenVal val);
+
+static bool diff_tree_kernel_same_source_(const char* path, const char* src, size_t len);
+
+static DiffTreeErr diff_tree_kernel_compile_(const char* c_path, const char* so_path);
+
+static void* diff_tree_kernel_sym_(const DiffTreeKernel* kernel, const char* name);
+
+DiffTreeErr diff_tree_codegen_fwrite(DiffTree* dtree, const DiffTreeCodegenFn* fns, size_t fns_cnt, FILE* file)
+{
+    utils_assert(dtree);
+    utils_assert(fns);
+    utils_assert(file);
+
+    fprintf(file, "/* generated by difftree\n");
+    for(size_t i = 0; i < dtree->vars.size; ++i)
+        fprintf(file, " * vars[%zu] = %s\n", i, diff_tree_variable(dtree, i)->name);
+    fprintf(file, " */\n\n");
+
+    fprintf(file,
+        "#include <math.h>\n"
+        "#include <stddef.h>\n"
+        "\n"
+        "static inline double difftree_powi_(double base, long power)\n"
+        "{\n"
+        "    unsigned long n = (unsigned long)(power < 0 ? -power : power);\n"
+        "    double res = 1;\n"
+        "\n"
+        "    while(n) {\n"
+        "        if(n & 1) res *= base;\n"
+        "        base *= base;\n"
+        "        n >>= 1;\n"
+        "    }\n"
+        "\n"
+        "    return power < 0 ? 1 / res : res;\n"
+        "}\n");
+
+    for(size_t i = 0; i < fns_cnt; ++i) {
+        DiffTreeErr err = diff_tree_codegen_fn_(dtree, &fns[i], file);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+    }
+
+    return ferror(file) ? DIFF_TREE_IO_ERR : DIFF_TREE_ERR_NONE;
+}
+
+static DiffTreeErr diff_tree_codegen_fn_(DiffTree* dtree, const DiffTreeCodegenFn* fn, FILE* file)
+{
+    utils_assert(fn->name);
+    utils_assert(fn->node);
+
+    DiffTreeTape tape = {};
+    DiffTreeErr err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, dtree, fn->node);
+
+    DiffTreeCodegenVal* stack = TYPED_CALLOC(tape.stack_max + 1, DiffTreeCodegenVal);
+    DiffTreeCodegenVal* temps = TYPED_CALLOC(tape.temps_cnt + 1, DiffTreeCodegenVal);
+    if(err == DIFF_TREE_ERR_NONE && (!stack || !temps))
+        err = DIFF_TREE_ALLOC_FAIL;
+
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) tape.code.buffer;
+    const DiffTreeTapeInstr* end  = code + tape.code.size;
+
+    size_t top = 0;
+    size_t next_temp = 0;
+
+    if(err == DIFF_TREE_ERR_NONE)
+        fprintf(file, "\ndouble %s(const double* vars)\n{\n", fn->name);
+
+    for(const DiffTreeTapeInstr* ip = code; err == DIFF_TREE_ERR_NONE && ip < end; ++ip) {
+        DiffTreeCodegenVal res = { .kind = CODEGEN_VAL_TEMP, .id = next_temp, .num = 0 };
+
+        switch(ip->opcode) {
+            case TAPE_OPCODE_NUM:
+                stack[top++] = { .kind = CODEGEN_VAL_NUM, .id = 0, .num = ip->arg.num };
+                continue;
+
+            case TAPE_OPCODE_VAR:
+                stack[top++] = { .kind = CODEGEN_VAL_VAR, .id = ip->arg.slot, .num = 0 };
+                continue;
+
+            case TAPE_OPCODE_STORE:
+                temps[ip->arg.slot] = stack[top - 1];
+                continue;
+
+            case TAPE_OPCODE_LOAD:
+                stack[top++] = temps[ip->arg.slot];
+                continue;
+
+            case TAPE_OPCODE_POWI:
+                fprintf(file, "    const double t%zu = difftree_powi_(", next_temp++);
+                diff_tree_codegen_val_(file, stack[top - 1]);
+                fprintf(file, ", %ld);\n", ip->arg.power);
+                break;
+
+            case TAPE_OPCODE_ACTG:
+                // not in op_arr, it is never parsed
+                fprintf(file, "    const double t%zu = 1.0 / atan(", next_temp++);
+                diff_tree_codegen_val_(file, stack[top - 1]);
+                fprintf(file, ");\n");
+                break;
+
+            case TAPE_OPCODE_ADD:
+            case TAPE_OPCODE_SUB:
+            case TAPE_OPCODE_MUL:
+            case TAPE_OPCODE_DIV:
+            case TAPE_OPCODE_POW:
+            case TAPE_OPCODE_EXP:
+            case TAPE_OPCODE_SQRT:
+            case TAPE_OPCODE_LOG:
+            case TAPE_OPCODE_SIN:
+            case TAPE_OPCODE_COS:
+            case TAPE_OPCODE_TAN:
+            case TAPE_OPCODE_CTG:
+            case TAPE_OPCODE_SH:
+            case TAPE_OPCODE_CH:
+            case TAPE_OPCODE_TH:
+            case TAPE_OPCODE_ASIN:
+            case TAPE_OPCODE_ACOS:
+            case TAPE_OPCODE_ATAN: {
+                const Operator* op = get_operator((OperatorType) (ip->opcode - TAPE_OPCODE_ADD));
+
+                fprintf(file, "    const double t%zu = %s", next_temp++, op->c_str_pref);
+                if(op->argnum == OPERATOR_ARGNUM_2) {
+                    diff_tree_codegen_val_(file, stack[top - 2]);
+                    fprintf(file, "%s", op->c_str_inf);
+                }
+                diff_tree_codegen_val_(file, stack[top - 1]);
+                fprintf(file, "%s;\n", op->c_str_post);
+
+                if(op->argnum == OPERATOR_ARGNUM_2)
+                    top--;
+                break;
+            }
+
+            default:
+                UTILS_LOGE(LOG_CTG_CODEGEN, "unknown opcode %d", ip->opcode);
+                err = DIFF_TREE_SYNTAX_ERR;
+                continue;
+        }
+
+        stack[top - 1] = res;
+    }
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        fprintf(file, "    return ");
+        diff_tree_codegen_val_(file, stack[0]);
+        fprintf(file, ";\n}\n");
+
+        // slot past the variables is written to a spare element, nothing reads it
+        size_t vars_cnt = dtree->vars.size;
+        fprintf(file,
+            "\nvoid %s_batch(const double* vars, size_t slot, const double* xs, double* res, size_t n)\n"
+            "{\n"
+            "    double v[%zu + 1];\n"
+            "    for(size_t i = 0; i < %zu; ++i) v[i] = vars[i];\n"
+            "\n"
+            "    if(slot > %zu) slot = %zu;\n"
+            "\n"
+            "    for(size_t i = 0; i < n; ++i) {\n"
+            "        v[slot] = xs[i];\n"
+            "        res[i] = %s(v);\n"
+            "    }\n"
+            "}\n",
+            fn->name, vars_cnt, vars_cnt, vars_cnt, vars_cnt, fn->name);
+    }
+
+    NFREE(stack);
+    NFREE(temps);
+    diff_tree_tape_dtor(&tape);
+
+    return err;
+}
+
+static void diff_tree_codegen_val_(FILE* file, DiffTreeCodegenVal val)
+{
+    switch(val.kind) {
+        case CODEGEN_VAL_TEMP:
+            fprintf(file, "t%zu", val.id);
+            break;
+
+        case CODEGEN_VAL_VAR:
+            fprintf(file, "vars[%zu]", val.id);
+            break;
+
+        case CODEGEN_VAL_NUM: {
+            if(isnan(val.num)) {
+                fprintf(file, "NAN");
+                break;
+            }
+            if(isinf(val.num)) {
+                fprintf(file, "%sINFINITY", val.num < 0 ? "-" : "");
+                break;
+            }
+
+            char num[32] = "";
+            snprintf(num, sizeof(num), "%.17g", val.num);
+
+            // integral values would be int literals, and 1 / 3 an integer division
+            const char* suffix = num[strcspn(num, ".e")] ? "" : ".0";
+
+            if(signbit(val.num))
+                fprintf(file, "(%s%s)", num, suffix);
+            else
+                fprintf(file, "%s%s", num, suffix);
+            break;
+        }
+
+        default:
+            utils_assert(false && "unknown operand kind");
+            break;
+    }
+}
+
+DiffTreeErr diff_tree_kernel_load(DiffTreeKernel* kernel, DiffTree* dtree, const DiffTreeCodegenFn* fns, size_t fns_cnt, const char* cache_dir)
+{
+    utils_assert(kernel);
+    utils_assert(dtree);
+
+    kernel->handle = NULL;
+    kernel->hash   = 0;
+    kernel->cached = false;
+
+    char* src = NULL;
+    size_t len = 0;
+
+    FILE* stream = open_memstream(&src, &len);
+    stream verified(return DIFF_TREE_ALLOC_FAIL);
+
+    DiffTreeErr err = diff_tree_codegen_fwrite(dtree, fns, fns_cnt, stream);
+    fclose(stream);
+
+    char dir[DIFF_TREE_CACHE_DIR_LEN_MAX] = "";
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_cache_dir(cache_dir, dir);
+
+    if(err != DIFF_TREE_ERR_NONE) {
+        NFREE(src);
+        return err;
+    }
+
+    kernel->hash = utils_djb2_hash(src, len);
+
+    char c_path[KERNEL_PATH_LEN_MAX] = "", so_path[KERNEL_PATH_LEN_MAX] = "";
+    char c_tmp[KERNEL_PATH_LEN_MAX]  = "", so_tmp[KERNEL_PATH_LEN_MAX]  = "";
+
+    // dir is short enough for all of them
+    pid_t pid = getpid();
+    if(snprintf(c_path,  sizeof(c_path),  "%s/%016lx.c",     dir, kernel->hash) < 0
+    || snprintf(so_path, sizeof(so_path), "%s/%016lx.so",    dir, kernel->hash) < 0
+    || snprintf(c_tmp,   sizeof(c_tmp),   "%s/%016lx.%d.c",  dir, kernel->hash, pid) < 0
+    || snprintf(so_tmp,  sizeof(so_tmp),  "%s/%016lx.%d.so", dir, kernel->hash, pid) < 0) {
+        NFREE(src);
+        return DIFF_TREE_IO_ERR;
+    }
+
+    if(diff_tree_kernel_same_source_(c_path, src, len)) {
+        kernel->handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+        kernel->cached = kernel->handle != NULL;
+    }
+
+    if(!kernel->handle) {
+        FILE* file = fopen(c_tmp, "w");
+        if(!file || fwrite(src, 1, len, file) != len)
+            err = DIFF_TREE_IO_ERR;
+        if(file && fclose(file) != 0)
+            err = DIFF_TREE_IO_ERR;
+
+        if(err == DIFF_TREE_ERR_NONE)
+            err = diff_tree_kernel_compile_(c_tmp, so_tmp);
+
+        // object goes first, a source without its object is only a miss
+        if(err == DIFF_TREE_ERR_NONE && (rename(so_tmp, so_path) != 0 || rename(c_tmp, c_path) != 0))
+            err = DIFF_TREE_IO_ERR;
+
+        if(err == DIFF_TREE_ERR_NONE) {
+            kernel->handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+            if(!kernel->handle) {
+                UTILS_LOGE(LOG_CTG_CODEGEN, "dlopen %s: %s", so_path, dlerror());
+                err = DIFF_TREE_IO_ERR;
+            }
+        }
+        else {
+            UTILS_LOGE(LOG_CTG_CODEGEN, "can't build kernel %s", c_path);
+            unlink(c_tmp);
+            unlink(so_tmp);
+        }
+    }
+
+    NFREE(src);
+
+    return err;
+}
+
+DiffTreeKernelFn diff_tree_kernel_fn(const DiffTreeKernel* kernel, const char* name)
+{
+    void* sym = diff_tree_kernel_sym_(kernel, name);
+
+    DiffTreeKernelFn fn = NULL;
+    memcpy(&fn, &sym, sizeof(sym));
+
+    return fn;
+}
+
+DiffTreeKernelBatchFn diff_tree_kernel_batch_fn(const DiffTreeKernel* kernel, const char* name)
+{
+    char batch_name[KERNEL_NAME_LEN_MAX] = "";
+    snprintf(batch_name, sizeof(batch_name), "%s_batch", name);
+
+    void* sym = diff_tree_kernel_sym_(kernel, batch_name);
+
+    DiffTreeKernelBatchFn fn = NULL;
+    memcpy(&fn, &sym, sizeof(sym));
+
+    return fn;
+}
+
+void diff_tree_kernel_unload(DiffTreeKernel* kernel)
+{
+    utils_assert(kernel);
+
+    if(kernel->handle)
+        dlclose(kernel->handle);
+
+    kernel->handle = NULL;
+}
+
+static void* diff_tree_kernel_sym_(const DiffTreeKernel* kernel, const char* name)
+{
+    utils_assert(kernel);
+    utils_assert(name);
+
+    if(!kernel->handle)
+        return NULL;
+
+    return dlsym(kernel->handle, name);
+}
+
+static bool diff_tree_kernel_same_source_(const char* path, const char* src, size_t len)
+{
+    FILE* file = fopen(path, "r");
+    if(!file)
+        return false;
+
+    char* cached = TYPED_CALLOC(len + 1, char);
+
+    // one byte more than expected tells a longer file apart
+    bool same = cached && fread(cached, 1, len + 1, file) == len && memcmp(cached, src, len) == 0;
+
+    NFREE(cached);
+    fclose(file);
+
+    return same;
+}
+
+static DiffTreeErr diff_tree_kernel_compile_(const char* c_path, const char* so_path)
+{
+    const char* cc = getenv("CC");
+    if(!cc || !*cc)
+        cc = "cc";
+
+    const char* argv[] = { cc, "-O2", "-shared", "-fPIC", "-o", so_path, c_path, "-lm", NULL };
+
+    pid_t pid = 0;
+    if(posix_spawnp(&pid, cc, NULL, NULL, const_cast<char* const*>(argv), environ) != 0) {
+        UTILS_LOGE(LOG_CTG_CODEGEN, "can't run %s", cc);
+        return DIFF_TREE_IO_ERR;
+    }
+
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0)
+        if(errno != EINTR)
+            return DIFF_TREE_IO_ERR;
+
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        UTILS_LOGE(LOG_CTG_CODEGEN, "%s failed on %s", cc, c_path);
+        return DIFF_TREE_IO_ERR;
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
@@ -0,0 +1,174 @@
+#include "difftree_grad.h"
+
+#include <math.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#define LOG_CTG_GRAD "DIFFTREE_GRAD"
+
+#define BINARY_(expr)                               \
+    {                                               \
+        rhs[i] = stack[--top];                      \
+        lhs[i] = stack[--top];                      \
+        double l = vals[lhs[i]], r = vals[rhs[i]];  \
+        vals[i] = (expr);                           \
+        break;                                      \
+    }
+
+#define UNARY_(expr)                                \
+    {                                               \
+        lhs[i] = stack[--top];                      \
+        double l = vals[lhs[i]];                    \
+        vals[i] = (expr);                           \
+        break;                                      \
+    }
+
+DiffTreeErr diff_tree_grad_eval(DiffTreeTape* tape, const double* vars, double* value, double* grad)
+{
+    utils_assert(tape);
+    utils_assert(vars);
+    utils_assert(value);
+    utils_assert(grad);
+
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) tape->code.buffer;
+    size_t size = tape->code.size;
+
+    if(size == 0)
+        return DIFF_TREE_NULLPTR;
+
+    // forward sweep keeps every intermediate value and the instructions that produced the operands
+    if(!tape->grad_vals) {
+        tape->grad_vals  = TYPED_CALLOC(2 * size, double);
+        tape->grad_links = TYPED_CALLOC(2 * size + tape->stack_max + tape->temps_cnt, size_t);
+        if(!tape->grad_vals || !tape->grad_links) {
+            NFREE(tape->grad_vals);
+            NFREE(tape->grad_links);
+            return DIFF_TREE_ALLOC_FAIL;
+        }
+    }
+
+    double* vals  = tape->grad_vals;
+    size_t* lhs   = tape->grad_links;
+    double* adj   = vals + size;
+    size_t* rhs   = lhs + size;
+    size_t* stack = rhs + size;
+    size_t* temps = stack + tape->stack_max;
+    size_t  top   = 0;
+
+    for(size_t i = 0; i < size; ++i) {
+        switch(code[i].opcode) {
+            case TAPE_OPCODE_NUM:  vals[i] = code[i].arg.num;        break;
+            case TAPE_OPCODE_VAR:  vals[i] = vars[code[i].arg.slot]; break;
+
+            // a temporary is an identity link to the instruction that stored it
+            case TAPE_OPCODE_STORE:
+                lhs[i] = stack[--top];
+                vals[i] = vals[lhs[i]];
+                temps[code[i].arg.slot] = i;
+                break;
+
+            case TAPE_OPCODE_LOAD:
+                lhs[i] = temps[code[i].arg.slot];
+                vals[i] = vals[lhs[i]];
+                break;
+
+            case TAPE_OPCODE_ADD:  BINARY_(l + r);
+            case TAPE_OPCODE_SUB:  BINARY_(l - r);
+            case TAPE_OPCODE_MUL:  BINARY_(l * r);
+            case TAPE_OPCODE_DIV:  BINARY_(l / r);
+            case TAPE_OPCODE_POW:  BINARY_(pow(l, r));
+
+            case TAPE_OPCODE_EXP:  UNARY_(exp(l));
+            case TAPE_OPCODE_SQRT: UNARY_(sqrt(l));
+            case TAPE_OPCODE_LOG:  UNARY_(log(l));
+            case TAPE_OPCODE_SIN:  UNARY_(sin(l));
+            case TAPE_OPCODE_COS:  UNARY_(cos(l));
+            case TAPE_OPCODE_TAN:  UNARY_(tan(l));
+            case TAPE_OPCODE_CTG:  UNARY_(1.f / tan(l));
+            case TAPE_OPCODE_SH:   UNARY_(sinh(l));
+            case TAPE_OPCODE_CH:   UNARY_(cosh(l));
+            case TAPE_OPCODE_TH:   UNARY_(tanh(l));
+            case TAPE_OPCODE_ASIN: UNARY_(asin(l));
+            case TAPE_OPCODE_ACOS: UNARY_(acos(l));
+            case TAPE_OPCODE_ATAN: UNARY_(atan(l));
+            case TAPE_OPCODE_ACTG: UNARY_(1.f / atan(l));
+
+            case TAPE_OPCODE_POWI: UNARY_(diff_tree_tape_powi(l, code[i].arg.power));
+
+            default:
+                UTILS_LOGE(LOG_CTG_GRAD, "unknown opcode %d", code[i].opcode);
+                return DIFF_TREE_SYNTAX_ERR;
+        }
+
+        stack[top++] = i;
+    }
+
+    // backward sweep, adj[i] = df / d(vals[i]); partials follow diff_tree_differentiate
+    for(size_t i = 0; i < tape->vars_cnt; ++i)
+        grad[i] = 0;
+
+    for(size_t i = 0; i < size; ++i)
+        adj[i] = 0;
+
+    adj[size - 1] = 1;
+
+    for(size_t i = size; i-- > 0;) {
+        double a = adj[i];
+        double v = vals[i];
+
+        // operands of NUM, VAR and unary instructions default to instruction 0
+        double l = vals[lhs[i]];
+        double r = vals[rhs[i]];
+
+        switch(code[i].opcode) {
+            case TAPE_OPCODE_STORE:
+            case TAPE_OPCODE_LOAD: adj[lhs[i]] += a;                              break;
+
+            case TAPE_OPCODE_ADD:  adj[lhs[i]] += a;      adj[rhs[i]] += a;          break;
+            case TAPE_OPCODE_SUB:  adj[lhs[i]] += a;      adj[rhs[i]] -= a;          break;
+            case TAPE_OPCODE_MUL:  adj[lhs[i]] += a * r;  adj[rhs[i]] += a * l;      break;
+            case TAPE_OPCODE_DIV:  adj[lhs[i]] += a / r;  adj[rhs[i]] -= a * v / r;  break;
+            case TAPE_OPCODE_POW:
+                adj[lhs[i]] += a * r * pow(l, r - 1);
+                if(code[rhs[i]].opcode != TAPE_OPCODE_NUM)
+                    adj[rhs[i]] += a * v * log(l);
+                break;
+
+            case TAPE_OPCODE_EXP:  adj[lhs[i]] += a * v;                  break;
+            case TAPE_OPCODE_SQRT: adj[lhs[i]] += a / (2 * v);            break;
+            case TAPE_OPCODE_LOG:  adj[lhs[i]] += a / l;                  break;
+            case TAPE_OPCODE_SIN:  adj[lhs[i]] += a * cos(l);             break;
+            case TAPE_OPCODE_COS:  adj[lhs[i]] -= a * sin(l);             break;
+            case TAPE_OPCODE_TAN:  adj[lhs[i]] += a * (1 + v * v);        break;
+            case TAPE_OPCODE_CTG:  adj[lhs[i]] -= a / (sin(l) * sin(l));  break;
+            case TAPE_OPCODE_SH:   adj[lhs[i]] += a * cosh(l);            break;
+            case TAPE_OPCODE_CH:   adj[lhs[i]] += a * sinh(l);            break;
+            case TAPE_OPCODE_TH:   adj[lhs[i]] += a * (1 - v * v);        break;
+            case TAPE_OPCODE_ASIN: adj[lhs[i]] += a / sqrt(1 - l * l);    break;
+            case TAPE_OPCODE_ACOS: adj[lhs[i]] -= a / sqrt(1 - l * l);    break;
+            case TAPE_OPCODE_ATAN: adj[lhs[i]] += a / (1 + l * l);        break;
+            case TAPE_OPCODE_ACTG: adj[lhs[i]] -= a / (1 + l * l);        break;
+
+            case TAPE_OPCODE_POWI:
+                adj[lhs[i]] += a * (double) code[i].arg.power * diff_tree_tape_powi(l, code[i].arg.power - 1);
+                break;
+
+            case TAPE_OPCODE_VAR:
+                grad[code[i].arg.slot] += a;
+                break;
+
+            case TAPE_OPCODE_NUM:
+            default:
+                break;
+        }
+    }
+
+    *value = vals[size - 1];
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+#undef BINARY_
+#undef UNARY_
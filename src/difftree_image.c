@@ -0,0 +1,647 @@
+#include "difftree_image.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assertutils.h"
+#include "ioutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#include "operators.h"
+#include "ptr_map.h"
+#include "types.h"
+#include "variable.h"
+
+#define LOG_CTG_IMAGE "DIFFTREE_IMAGE"
+
+static const char IMAGE_MAGIC[8] = { 'D', 'I', 'F', 'F', 'T', 'R', 'E', 'E' };
+
+static const uint32_t IMAGE_VALUE_MAX = (1u << 28) - 1;
+
+static const size_t IMAGE_CAPACITY_MIN = 64;
+
+/// nodes are checksummed by blocks, so the reader checks each block while it is in cache
+static const size_t IMAGE_CHECK_BLOCK = 4096;
+
+static const uint64_t CHECKSUM_SEED  = 0x9E3779B97F4A7C15ull;
+static const uint64_t CHECKSUM_PRIME = 0xC2B2AE3D27D4EB4Full;
+
+static_assert(sizeof(DiffTreeImageHeader) % sizeof(double) == 0, "vars must stay aligned");
+static_assert(sizeof(DiffTreeImageVar) % sizeof(double) == 0, "nums must stay aligned");
+static_assert(sizeof(DiffTreeImageNode) == 3 * sizeof(uint32_t), "nodes must stay packed");
+
+/// node waiting in diff_tree_image_fwrite for its children to be written
+typedef struct DiffTreeImageFrame
+{
+    DiffTreeNode* node;
+    bool is_expanded;
+
+} DiffTreeImageFrame;
+
+/// arrays of the image built in memory before it is written
+typedef struct DiffTreeImageWriter
+{
+    DiffTreeImageNode* nodes;
+    size_t nodes_cnt;
+    size_t nodes_capacity;
+
+    double* nums;
+    size_t nums_cnt;
+    size_t nums_capacity;
+
+    /// open addressing from bits of a constant to its index + 1, 0 is empty
+    size_t* nums_table;
+    size_t nums_table_capacity;
+
+    DiffTreeImageFrame* frames;
+    size_t frames_cnt;
+    size_t frames_capacity;
+
+    /// indices of written subtrees whose parents are not written yet
+    uint32_t* results;
+    size_t results_cnt;
+    size_t results_capacity;
+
+    /// node -> index, nodes are shared in DAG mode
+    PtrMap ids;
+
+} DiffTreeImageWriter;
+
+static DiffTreeErr diff_tree_image_write_subtree_(DiffTreeImageWriter* writer, DiffTree* dtree, DiffTreeNode* root, uint32_t* index);
+
+static DiffTreeErr diff_tree_image_write_node_(DiffTreeImageWriter* writer, DiffTree* dtree, DiffTreeNode* node, uint32_t* index);
+
+static DiffTreeErr diff_tree_image_num_index_(DiffTreeImageWriter* writer, double num, uint32_t* index);
+
+static size_t diff_tree_image_num_hash_(uint64_t bits);
+
+static bool diff_tree_image_grow_(void** arr, size_t* capacity, size_t size, size_t tsize);
+
+static void diff_tree_image_writer_dtor_(DiffTreeImageWriter* writer);
+
+static inline uint64_t diff_tree_image_checksum_round_(uint64_t lane, uint64_t word)
+{
+    lane = (lane ^ word) * CHECKSUM_PRIME;
+
+    return (lane << 31) | (lane >> 33);
+}
+
+static uint64_t diff_tree_image_checksum_(uint64_t hash, const void* data, size_t len);
+
+static uint64_t diff_tree_image_tables_checksum_(const DiffTreeImageHeader* header, const DiffTreeImageVar* vars,
+                                                 const double* nums, const uint32_t* roots);
+
+static uint64_t diff_tree_image_nodes_checksum_(uint64_t hash, const DiffTreeImageNode* nodes, size_t begin, size_t end);
+
+static bool diff_tree_image_check_node_(const DiffTreeImageNode* node, size_t index, const uint32_t* limits, const bool* is_binary);
+
+static DiffTreeErr diff_tree_image_check_(DiffTreeImage* image);
+
+static DiffTreeNode* diff_tree_image_take_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* sibling);
+
+#define GROW_(arr, size)                                                                            \
+    diff_tree_image_grow_((void**) &writer->arr, &writer->arr##_capacity, size, sizeof(*writer->arr))
+
+DiffTreeErr diff_tree_image_fwrite(DiffTree* dtree, DiffTreeNode* const* roots, size_t roots_cnt, const char* filename)
+{
+    utils_assert(dtree);
+    utils_assert(roots);
+    utils_assert(filename);
+
+    DiffTreeImageWriter writer = {};
+    writer.ids = PTR_MAP_INITLIST;
+
+    DiffTreeErr err = DIFF_TREE_ERR_NONE;
+
+    if(dtree->is_dag && ptr_map_ctor(&writer.ids, dtree->interned.size) != PTR_MAP_ERR_NONE)
+        err = DIFF_TREE_ALLOC_FAIL;
+
+    uint32_t* root_ids = TYPED_CALLOC(roots_cnt + 1, uint32_t);
+    if(!root_ids)
+        err = DIFF_TREE_ALLOC_FAIL;
+
+    for(size_t i = 0; i < roots_cnt && err == DIFF_TREE_ERR_NONE; ++i)
+        err = diff_tree_image_write_subtree_(&writer, dtree, roots[i], &root_ids[i]);
+
+    DiffTreeImageVar* vars = TYPED_CALLOC(dtree->vars.size + 1, DiffTreeImageVar);
+    if(!vars && err == DIFF_TREE_ERR_NONE)
+        err = DIFF_TREE_ALLOC_FAIL;
+
+    FILE* file = NULL;
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        for(size_t i = 0; i < dtree->vars.size; ++i) {
+            Variable* var = diff_tree_variable(dtree, i);
+
+            memcpy(vars[i].name, var->name, sizeof(vars[i].name));
+            vars[i].val = var->val;
+        }
+
+        DiffTreeImageHeader header = {
+            .magic     = {},
+            .version   = DIFF_TREE_IMAGE_VERSION,
+            .node_size = sizeof(DiffTreeImageNode),
+            .vars_cnt  = dtree->vars.size,
+            .nums_cnt  = writer.nums_cnt,
+            .roots_cnt = roots_cnt,
+            .nodes_cnt = writer.nodes_cnt,
+            .checksum  = 0,
+        };
+        memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+        header.checksum = diff_tree_image_tables_checksum_(&header, vars, writer.nums, root_ids);
+        header.checksum = diff_tree_image_nodes_checksum_(header.checksum, writer.nodes, 0, writer.nodes_cnt);
+
+        file = open_file(filename, "wb");
+        if(!file)
+            err = DIFF_TREE_IO_ERR;
+
+        if(file && (fwrite(&header,       sizeof(header),            1,                file) != 1                ||
+                    fwrite(vars,          sizeof(*vars),             header.vars_cnt,  file) != header.vars_cnt ||
+                    fwrite(writer.nums,   sizeof(*writer.nums),      header.nums_cnt,  file) != header.nums_cnt ||
+                    fwrite(root_ids,      sizeof(*root_ids),         header.roots_cnt, file) != header.roots_cnt ||
+                    fwrite(writer.nodes,  sizeof(*writer.nodes),     header.nodes_cnt, file) != header.nodes_cnt))
+            err = DIFF_TREE_IO_ERR;
+
+        if(file && fclose(file) != 0)
+            err = DIFF_TREE_IO_ERR;
+
+        if(err == DIFF_TREE_IO_ERR)
+            UTILS_LOGE(LOG_CTG_IMAGE, "can't write %s", filename);
+    }
+
+    NFREE(vars);
+    NFREE(root_ids);
+    diff_tree_image_writer_dtor_(&writer);
+
+    return err;
+}
+
+/// @brief post-order walk with an explicit stack, derivatives may be deeper than the call stack allows
+static DiffTreeErr diff_tree_image_write_subtree_(DiffTreeImageWriter* writer, DiffTree* dtree, DiffTreeNode* root, uint32_t* index)
+{
+    writer->frames_cnt  = 0;
+    writer->results_cnt = 0;
+
+    if(!GROW_(frames, 1))
+        return DIFF_TREE_ALLOC_FAIL;
+
+    writer->frames[writer->frames_cnt++] = { root, false };
+
+    while(writer->frames_cnt > 0) {
+        DiffTreeImageFrame* frame = &writer->frames[writer->frames_cnt - 1];
+        DiffTreeNode* node = frame->node;
+
+        if(!GROW_(results, writer->results_cnt + 1))
+            return DIFF_TREE_ALLOC_FAIL;
+
+        PtrMapVal* id = dtree->is_dag ? ptr_map_find(&writer->ids, node) : NULL;
+        if(id) {
+            writer->results[writer->results_cnt++] = (uint32_t) id->u;
+            --writer->frames_cnt;
+            continue;
+        }
+
+        if(!frame->is_expanded && (node->left || node->right)) {
+            frame->is_expanded = true;
+
+            if(!GROW_(frames, writer->frames_cnt + 2))
+                return DIFF_TREE_ALLOC_FAIL;
+
+            // left is on top, so it is written first
+            if(node->right)
+                writer->frames[writer->frames_cnt++] = { node->right, false };
+            if(node->left)
+                writer->frames[writer->frames_cnt++] = { node->left, false };
+
+            continue;
+        }
+
+        --writer->frames_cnt;
+
+        uint32_t node_id = 0;
+        DiffTreeErr err = diff_tree_image_write_node_(writer, dtree, node, &node_id);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+
+        writer->results[writer->results_cnt++] = node_id;
+    }
+
+    *index = writer->results[0];
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief appends node, indices of its children are on top of writer->results
+static DiffTreeErr diff_tree_image_write_node_(DiffTreeImageWriter* writer, DiffTree* dtree, DiffTreeNode* node, uint32_t* index)
+{
+    if(writer->nodes_cnt >= DIFF_TREE_IMAGE_NIL) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "more than %u nodes", DIFF_TREE_IMAGE_NIL);
+        return DIFF_TREE_ALLOC_FAIL;
+    }
+
+    if(!GROW_(nodes, writer->nodes_cnt + 1))
+        return DIFF_TREE_ALLOC_FAIL;
+
+    DiffTreeImageNode out = { DIFF_TREE_IMAGE_NIL, DIFF_TREE_IMAGE_NIL, 0, 0 };
+
+    if(node->right)
+        out.right = writer->results[--writer->results_cnt];
+    if(node->left)
+        out.left  = writer->results[--writer->results_cnt];
+
+    uint32_t value = 0;
+
+    switch(node->type) {
+        case NODE_TYPE_OP:
+            value = (uint32_t) node->value.op_type;
+            break;
+
+        case NODE_TYPE_VAR:
+            value = (uint32_t) node->value.var;
+            break;
+
+        case NODE_TYPE_NUM: {
+            DiffTreeErr err = diff_tree_image_num_index_(writer, node->value.num, &value);
+            if(err != DIFF_TREE_ERR_NONE)
+                return err;
+
+            break;
+        }
+
+        case NODE_TYPE_FAKE:
+        default:
+            UTILS_LOGE(LOG_CTG_IMAGE, "can't write node of type %s", node_type_str(node->type));
+            return DIFF_TREE_SYNTAX_ERR;
+    }
+
+    if(value > IMAGE_VALUE_MAX) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "node value %u does not fit", value);
+        return DIFF_TREE_ALLOC_FAIL;
+    }
+
+    out.type  = (uint32_t) node->type & 0xF;
+    out.value = value & IMAGE_VALUE_MAX;
+
+    *index = (uint32_t) writer->nodes_cnt;
+    writer->nodes[writer->nodes_cnt++] = out;
+
+    if(dtree->is_dag && ptr_map_insert(&writer->ids, node, PtrMapVal { .u = *index }) != PTR_MAP_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief equal constants share one entry of nums, compared bitwise so -0 and NaNs are kept
+static DiffTreeErr diff_tree_image_num_index_(DiffTreeImageWriter* writer, double num, uint32_t* index)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, &num, sizeof(bits));
+
+    if((writer->nums_cnt + 1) * 2 > writer->nums_table_capacity) {
+        size_t capacity = writer->nums_table_capacity ? writer->nums_table_capacity * 2 : IMAGE_CAPACITY_MIN;
+
+        size_t* table = TYPED_CALLOC(capacity, size_t);
+        table verified(return DIFF_TREE_ALLOC_FAIL);
+
+        for(size_t i = 0; i < writer->nums_cnt; ++i) {
+            uint64_t key = 0;
+            memcpy(&key, &writer->nums[i], sizeof(key));
+
+            size_t ind = diff_tree_image_num_hash_(key) & (capacity - 1);
+            while(table[ind])
+                ind = (ind + 1) & (capacity - 1);
+
+            table[ind] = i + 1;
+        }
+
+        NFREE(writer->nums_table);
+        writer->nums_table          = table;
+        writer->nums_table_capacity = capacity;
+    }
+
+    size_t mask = writer->nums_table_capacity - 1;
+    size_t ind  = diff_tree_image_num_hash_(bits) & mask;
+
+    for(; writer->nums_table[ind]; ind = (ind + 1) & mask) {
+        size_t found = writer->nums_table[ind] - 1;
+
+        if(memcmp(&writer->nums[found], &num, sizeof(num)) == 0) {
+            *index = (uint32_t) found;
+            return DIFF_TREE_ERR_NONE;
+        }
+    }
+
+    if(!GROW_(nums, writer->nums_cnt + 1))
+        return DIFF_TREE_ALLOC_FAIL;
+
+    writer->nums_table[ind] = writer->nums_cnt + 1;
+    writer->nums[writer->nums_cnt] = num;
+    *index = (uint32_t) writer->nums_cnt++;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+#undef GROW_
+
+/// @brief exponent and high mantissa bits of small constants are folded into the low bits
+static size_t diff_tree_image_num_hash_(uint64_t bits)
+{
+    bits = (bits ^ (bits >> 32)) * CHECKSUM_PRIME;
+
+    return bits ^ (bits >> 29);
+}
+
+/// @brief doubles *capacity until size elements fit
+static bool diff_tree_image_grow_(void** arr, size_t* capacity, size_t size, size_t tsize)
+{
+    if(size <= *capacity)
+        return true;
+
+    size_t new_capacity = *capacity ? *capacity : IMAGE_CAPACITY_MIN;
+    while(new_capacity < size)
+        new_capacity *= 2;
+
+    void* new_arr = realloc(*arr, new_capacity * tsize);
+    if(!new_arr) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "can't grow array to %zu elements", new_capacity);
+        return false;
+    }
+
+    *arr      = new_arr;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+static void diff_tree_image_writer_dtor_(DiffTreeImageWriter* writer)
+{
+    NFREE(writer->nodes);
+    NFREE(writer->nums);
+    NFREE(writer->nums_table);
+    NFREE(writer->frames);
+    NFREE(writer->results);
+    ptr_map_dtor(&writer->ids);
+}
+
+/// @brief 64-bit hash of 8-byte words in four independent lanes, so it keeps up with memory
+static uint64_t diff_tree_image_checksum_(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+
+    uint64_t lane0 = hash, lane1 = hash + CHECKSUM_SEED, lane2 = hash ^ CHECKSUM_PRIME, lane3 = hash - CHECKSUM_SEED;
+
+    size_t pos = 0;
+    for(; pos + 4 * sizeof(uint64_t) <= len; pos += 4 * sizeof(uint64_t)) {
+        uint64_t words[4] = {};
+        memcpy(words, bytes + pos, sizeof(words));
+
+        lane0 = diff_tree_image_checksum_round_(lane0, words[0]);
+        lane1 = diff_tree_image_checksum_round_(lane1, words[1]);
+        lane2 = diff_tree_image_checksum_round_(lane2, words[2]);
+        lane3 = diff_tree_image_checksum_round_(lane3, words[3]);
+    }
+
+    hash = len;
+    hash = (hash ^ lane0) * CHECKSUM_PRIME;
+    hash = (hash ^ lane1) * CHECKSUM_PRIME;
+    hash = (hash ^ lane2) * CHECKSUM_PRIME;
+    hash = (hash ^ lane3) * CHECKSUM_PRIME;
+
+    for(; pos < len; ++pos)
+        hash = (hash ^ bytes[pos]) * CHECKSUM_PRIME;
+
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t diff_tree_image_tables_checksum_(const DiffTreeImageHeader* header, const DiffTreeImageVar* vars,
+                                                 const double* nums, const uint32_t* roots)
+{
+    uint64_t hash = CHECKSUM_SEED;
+
+    hash = diff_tree_image_checksum_(hash, vars,  header->vars_cnt  * sizeof(*vars));
+    hash = diff_tree_image_checksum_(hash, nums,  header->nums_cnt  * sizeof(*nums));
+    hash = diff_tree_image_checksum_(hash, roots, header->roots_cnt * sizeof(*roots));
+
+    return hash;
+}
+
+/// @brief continues hash over nodes [begin, end), begin is a multiple of IMAGE_CHECK_BLOCK
+static uint64_t diff_tree_image_nodes_checksum_(uint64_t hash, const DiffTreeImageNode* nodes, size_t begin, size_t end)
+{
+    for(size_t pos = begin; pos < end; pos += IMAGE_CHECK_BLOCK) {
+        size_t cnt = end - pos < IMAGE_CHECK_BLOCK ? end - pos : IMAGE_CHECK_BLOCK;
+        hash = diff_tree_image_checksum_(hash, nodes + pos, cnt * sizeof(*nodes));
+    }
+
+    return hash;
+}
+
+DiffTreeErr diff_tree_image_open(DiffTreeImage* image, const char* filename)
+{
+    utils_assert(image);
+    utils_assert(filename);
+
+    *image = {};
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "can't open %s", filename);
+        return DIFF_TREE_IO_ERR;
+    }
+
+    struct stat st = {};
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(DiffTreeImageHeader)) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "%s is not an image", filename);
+        close(fd);
+        return DIFF_TREE_SYNTAX_ERR;
+    }
+
+    void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "can't map %s", filename);
+        return DIFF_TREE_IO_ERR;
+    }
+
+    image->map     = map;
+    image->map_len = (size_t) st.st_size;
+    image->header  = (const DiffTreeImageHeader*) map;
+
+    DiffTreeErr err = diff_tree_image_check_(image);
+    if(err != DIFF_TREE_ERR_NONE) {
+        UTILS_LOGE(LOG_CTG_IMAGE, "%s is not a valid image of version %u", filename, DIFF_TREE_IMAGE_VERSION);
+        diff_tree_image_close(image);
+    }
+
+    return err;
+}
+
+/// @brief sets section pointers after checking that they fit the file exactly,
+///        then checks that every node can be built as is
+static DiffTreeErr diff_tree_image_check_(DiffTreeImage* image)
+{
+    const DiffTreeImageHeader* header = image->header;
+
+    if(memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+       header->version != DIFF_TREE_IMAGE_VERSION || header->node_size != sizeof(DiffTreeImageNode))
+        return DIFF_TREE_SYNTAX_ERR;
+
+    // counts are limited by node indices, so sizes below can't overflow
+    if(header->vars_cnt > IMAGE_VALUE_MAX || header->nums_cnt > IMAGE_VALUE_MAX ||
+       header->roots_cnt >= DIFF_TREE_IMAGE_NIL || header->nodes_cnt >= DIFF_TREE_IMAGE_NIL)
+        return DIFF_TREE_SYNTAX_ERR;
+
+    size_t vars_pos  = sizeof(DiffTreeImageHeader);
+    size_t nums_pos  = vars_pos  + header->vars_cnt  * sizeof(DiffTreeImageVar);
+    size_t roots_pos = nums_pos  + header->nums_cnt  * sizeof(double);
+    size_t nodes_pos = roots_pos + header->roots_cnt * sizeof(uint32_t);
+    size_t end       = nodes_pos + header->nodes_cnt * sizeof(DiffTreeImageNode);
+
+    if(end != image->map_len)
+        return DIFF_TREE_SYNTAX_ERR;
+
+    const char* base = (const char*) image->map;
+
+    image->vars  = (const DiffTreeImageVar*)  (const void*) (base + vars_pos);
+    image->nums  = (const double*)            (const void*) (base + nums_pos);
+    image->roots = (const uint32_t*)          (const void*) (base + roots_pos);
+    image->nodes = (const DiffTreeImageNode*) (const void*) (base + nodes_pos);
+
+    for(size_t i = 0; i < header->vars_cnt; ++i) {
+        const char* name = image->vars[i].name;
+
+        if(name[0] == '\0' || !memchr(name, '\0', sizeof(image->vars[i].name)))
+            return DIFF_TREE_SYNTAX_ERR;
+    }
+
+    for(size_t i = 0; i < header->roots_cnt; ++i)
+        if(image->roots[i] >= header->nodes_cnt)
+            return DIFF_TREE_SYNTAX_ERR;
+
+    // operators without an entry of op_arr are never parsed and can't be written
+    bool is_binary[OPERATOR_TYPE_NONE] = {};
+    for(size_t op = 0; op < SIZEOF(op_arr); ++op)
+        is_binary[op] = op_arr[op].argnum == OPERATOR_ARGNUM_2;
+
+    // node types are mixed at random, so values are checked by table rather than by switch
+    uint32_t limits[1 << 4] = {};
+    limits[NODE_TYPE_OP]  = (uint32_t) SIZEOF(op_arr);
+    limits[NODE_TYPE_VAR] = (uint32_t) header->vars_cnt;
+    limits[NODE_TYPE_NUM] = (uint32_t) header->nums_cnt;
+
+    uint64_t hash = diff_tree_image_tables_checksum_(header, image->vars, image->nums, image->roots);
+
+    // a single pass over nodes, each block is checked right after it is hashed
+    for(size_t pos = 0; pos < header->nodes_cnt; pos += IMAGE_CHECK_BLOCK) {
+        size_t block_end = header->nodes_cnt - pos < IMAGE_CHECK_BLOCK ? header->nodes_cnt : pos + IMAGE_CHECK_BLOCK;
+
+        hash = diff_tree_image_nodes_checksum_(hash, image->nodes, pos, block_end);
+
+        for(size_t i = pos; i < block_end; ++i)
+            if(!diff_tree_image_check_node_(&image->nodes[i], i, limits, is_binary))
+                return DIFF_TREE_SYNTAX_ERR;
+    }
+
+    return hash == header->checksum ? DIFF_TREE_ERR_NONE : DIFF_TREE_SYNTAX_ERR;
+}
+
+/// @brief children precede the node and its value and arity match its type
+static bool diff_tree_image_check_node_(const DiffTreeImageNode* node, size_t index, const uint32_t* limits, const bool* is_binary)
+{
+    bool has_left  = node->left  != DIFF_TREE_IMAGE_NIL;
+    bool has_right = node->right != DIFF_TREE_IMAGE_NIL;
+
+    bool is_op        = node->type == NODE_TYPE_OP;
+    bool is_binary_op = is_op && node->value < SIZEOF(op_arr) && is_binary[node->value];
+
+    return (!has_left  || node->left  < index) &&
+           (!has_right || node->right < index) &&
+           node->value < limits[node->type]    &&
+           has_left  == is_op                  &&
+           has_right == is_binary_op;
+}
+
+DiffTreeErr diff_tree_image_load(const DiffTreeImage* image, DiffTree* dtree, DiffTreeNode** roots)
+{
+    utils_assert(image);
+    utils_assert(image->header);
+    utils_assert(dtree);
+    utils_assert(roots);
+
+    const DiffTreeImageHeader* header = image->header;
+
+    size_t* slots = TYPED_CALLOC(header->vars_cnt + 1, size_t);
+    DiffTreeNode** nodes = TYPED_CALLOC(header->nodes_cnt + 1, DiffTreeNode*);
+
+    DiffTreeErr err = slots && nodes ? DIFF_TREE_ERR_NONE : DIFF_TREE_ALLOC_FAIL;
+
+    for(size_t i = 0; i < header->vars_cnt && err == DIFF_TREE_ERR_NONE; ++i) {
+        const DiffTreeImageVar* var = &image->vars[i];
+        bool is_new = !diff_tree_find_variable(dtree, var->name, strlen(var->name));
+
+        err = diff_tree_add_variable(dtree, var->name, strlen(var->name), &slots[i]);
+
+        if(err == DIFF_TREE_ERR_NONE && is_new)
+            diff_tree_variable(dtree, slots[i])->val = var->val;
+    }
+
+    // children precede parents, so one pass links everything
+    for(size_t i = 0; i < header->nodes_cnt && err == DIFF_TREE_ERR_NONE; ++i) {
+        const DiffTreeImageNode* in = &image->nodes[i];
+
+        DiffTreeNode* left  = in->left  == DIFF_TREE_IMAGE_NIL ? NULL : diff_tree_image_take_(dtree, nodes[in->left], NULL);
+        DiffTreeNode* right = in->right == DIFF_TREE_IMAGE_NIL ? NULL : diff_tree_image_take_(dtree, nodes[in->right], left);
+
+        NodeValue value = {};
+
+        switch((NodeType) in->type) {
+            case NODE_TYPE_OP:  value.op_type = (OperatorType) in->value; break;
+            case NODE_TYPE_VAR: value.var     = slots[in->value];         break;
+            case NODE_TYPE_NUM: value.num     = image->nums[in->value];   break;
+            case NODE_TYPE_FAKE:
+            default:
+                break;
+        }
+
+        nodes[i] = diff_tree_new_node(dtree, (NodeType) in->type, value, left, right, NULL);
+        if(!nodes[i])
+            err = DIFF_TREE_ALLOC_FAIL;
+    }
+
+    for(size_t i = 0; i < header->roots_cnt && err == DIFF_TREE_ERR_NONE; ++i) {
+        roots[i] = diff_tree_image_take_(dtree, nodes[image->roots[i]], NULL);
+
+        for(size_t j = 0; j < i && !dtree->is_dag; ++j)
+            if(roots[j] == roots[i])
+                roots[i] = diff_tree_copy_subtree(dtree, roots[i], NULL);
+    }
+
+    NFREE(slots);
+    NFREE(nodes);
+
+    return err;
+}
+
+/// @brief a node already linked to a parent, or used as the other child, is copied in tree mode
+static DiffTreeNode* diff_tree_image_take_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* sibling)
+{
+    if(dtree->is_dag || (!node->parent && node != sibling))
+        return node;
+
+    return diff_tree_copy_subtree(dtree, node, NULL);
+}
+
+void diff_tree_image_close(DiffTreeImage* image)
+{
+    utils_assert(image);
+
+    if(image->map)
+        munmap(image->map, image->map_len);
+
+    *image = {};
+}
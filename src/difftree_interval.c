@@ -0,0 +1,382 @@
+#include "difftree_interval.h"
+
+#include <math.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#define LOG_CTG_INTERVAL "DIFFTREE_INTERVAL"
+
+static const DiffTreeInterval INTERVAL_EMPTY = { INFINITY, -INFINITY, true };
+static const DiffTreeInterval INTERVAL_WHOLE = { -INFINITY, INFINITY, true };
+
+/// extrema of periodic functions are found with this relative slack for rounding of their positions
+static const double INTERVAL_PERIOD_EPS = 1e-12;
+
+/// powers of a constant exponent up to it are taken as integer powers
+static const double INTERVAL_POWI_MAX = 1 << 30;
+
+/// state of diff_tree_interval_find_range
+typedef struct DiffTreeIntervalSearch
+{
+    DiffTreeTape* tape;
+    DiffTreeInterval* vars;
+    size_t slot;
+    DiffTreeInterval* stack;
+
+    double x_step;
+    double y_min;
+    double y_max;
+
+} DiffTreeIntervalSearch;
+
+static DiffTreeErr diff_tree_interval_eval_(DiffTreeTape* tape, const DiffTreeInterval* vars, DiffTreeInterval* stack, DiffTreeInterval* res);
+
+static bool diff_tree_interval_find_edge_(DiffTreeIntervalSearch* search, double lo, double hi, bool is_left, double* edge);
+
+static bool diff_tree_interval_is_empty_(DiffTreeInterval a)
+{
+    return !(a.lo <= a.hi);
+}
+
+/// @brief NaN bounds become infinite, others are widened by an ulp
+static DiffTreeInterval diff_tree_interval_make_(double lo, double hi, bool partial)
+{
+    if(isnan(lo)) lo = -INFINITY;
+    if(isnan(hi)) hi = INFINITY;
+
+    return { nextafter(lo, -INFINITY), nextafter(hi, INFINITY), partial };
+}
+
+/// @brief product of bounds where 0 * inf is 0, as values themselves are finite
+static double diff_tree_interval_mul_bound_(double a, double b)
+{
+    if(!(a < 0 || a > 0) || !(b < 0 || b > 0))
+        return 0;
+
+    return a * b;
+}
+
+static DiffTreeInterval diff_tree_interval_add_(DiffTreeInterval a, DiffTreeInterval b)
+{
+    return diff_tree_interval_make_(a.lo + b.lo, a.hi + b.hi, a.partial || b.partial);
+}
+
+static DiffTreeInterval diff_tree_interval_sub_(DiffTreeInterval a, DiffTreeInterval b)
+{
+    return diff_tree_interval_make_(a.lo - b.hi, a.hi - b.lo, a.partial || b.partial);
+}
+
+static DiffTreeInterval diff_tree_interval_mul_(DiffTreeInterval a, DiffTreeInterval b)
+{
+    double p0 = diff_tree_interval_mul_bound_(a.lo, b.lo);
+    double p1 = diff_tree_interval_mul_bound_(a.lo, b.hi);
+    double p2 = diff_tree_interval_mul_bound_(a.hi, b.lo);
+    double p3 = diff_tree_interval_mul_bound_(a.hi, b.hi);
+
+    return diff_tree_interval_make_(fmin(fmin(p0, p1), fmin(p2, p3)),
+                                    fmax(fmax(p0, p1), fmax(p2, p3)),
+                                    a.partial || b.partial);
+}
+
+static DiffTreeInterval diff_tree_interval_div_(DiffTreeInterval a, DiffTreeInterval b)
+{
+    if(b.lo > 0 || b.hi < 0) {
+        DiffTreeInterval inv = { 1 / b.hi, 1 / b.lo, b.partial };
+        return diff_tree_interval_mul_(a, inv);
+    }
+
+    // division by zero itself is undefined, near it values are unbounded
+    if(!(b.lo < 0) && !(b.hi > 0))
+        return INTERVAL_EMPTY;
+
+    return INTERVAL_WHOLE;
+}
+
+static DiffTreeInterval diff_tree_interval_powi_(DiffTreeInterval a, long power)
+{
+    if(power == 0)
+        return { 1, 1, a.partial };
+
+    if(power < 0) {
+        DiffTreeInterval one = { 1, 1, false };
+        return diff_tree_interval_div_(one, diff_tree_interval_powi_(a, -power));
+    }
+
+    double lo = diff_tree_tape_powi(a.lo, power);
+    double hi = diff_tree_tape_powi(a.hi, power);
+
+    if(power % 2 != 0 || a.lo >= 0)
+        return diff_tree_interval_make_(lo, hi, a.partial);
+
+    if(a.hi <= 0)
+        return diff_tree_interval_make_(hi, lo, a.partial);
+
+    return diff_tree_interval_make_(0, fmax(lo, hi), a.partial);
+}
+
+static DiffTreeInterval diff_tree_interval_log_(DiffTreeInterval a)
+{
+    if(a.hi < 0)
+        return INTERVAL_EMPTY;
+
+    if(!(a.lo > 0))
+        return diff_tree_interval_make_(-INFINITY, log(a.hi), true);
+
+    return diff_tree_interval_make_(log(a.lo), log(a.hi), a.partial);
+}
+
+static DiffTreeInterval diff_tree_interval_exp_(DiffTreeInterval a)
+{
+    return diff_tree_interval_make_(exp(a.lo), exp(a.hi), a.partial);
+}
+
+/// @brief pow(a, b) is exp(b * ln(a)) unless b is an integer constant,
+///        negative a is defined only for integer b and is not narrowed down
+static DiffTreeInterval diff_tree_interval_pow_(DiffTreeInterval a, DiffTreeInterval b)
+{
+    if(!(b.lo < b.hi) && fabs(b.lo) < INTERVAL_POWI_MAX && !(nearbyint(b.lo) < b.lo || nearbyint(b.lo) > b.lo))
+        return diff_tree_interval_powi_(a, (long) b.lo);
+
+    if(a.lo < 0)
+        return INTERVAL_WHOLE;
+
+    DiffTreeInterval res = diff_tree_interval_exp_(diff_tree_interval_mul_(b, diff_tree_interval_log_(a)));
+    res.partial = res.partial || b.partial;
+
+    return res;
+}
+
+static DiffTreeInterval diff_tree_interval_sqrt_(DiffTreeInterval a)
+{
+    if(a.hi < 0)
+        return INTERVAL_EMPTY;
+
+    if(a.lo < 0)
+        return diff_tree_interval_make_(0, sqrt(a.hi), true);
+
+    return diff_tree_interval_make_(sqrt(a.lo), sqrt(a.hi), a.partial);
+}
+
+/// @brief whether a contains at + k * period for some integer k
+static bool diff_tree_interval_hits_(DiffTreeInterval a, double at, double period)
+{
+    double slack = (fabs(a.lo) + fabs(a.hi) + 1) * INTERVAL_PERIOD_EPS;
+    double k = ceil((a.lo - slack - at) / period);
+
+    return at + k * period <= a.hi + slack;
+}
+
+/// @brief sin or cos, whose maxima are at max_at and minima at max_at + pi modulo 2 pi
+static DiffTreeInterval diff_tree_interval_sincos_(DiffTreeInterval a, double (*func)(double), double max_at)
+{
+    if(!(a.hi - a.lo < 2 * M_PI))
+        return { -1, 1, a.partial };
+
+    double lo = func(a.lo), hi = func(a.hi);
+    DiffTreeInterval res = diff_tree_interval_make_(fmin(lo, hi), fmax(lo, hi), a.partial);
+
+    if(diff_tree_interval_hits_(a, max_at, 2 * M_PI))
+        res.hi = 1;
+    if(diff_tree_interval_hits_(a, max_at + M_PI, 2 * M_PI))
+        res.lo = -1;
+
+    return res;
+}
+
+/// @brief tan, or 1 / tan with is_inv, both monotonic between poles spaced by pi
+static DiffTreeInterval diff_tree_interval_tan_(DiffTreeInterval a, bool is_inv)
+{
+    if(!(a.hi - a.lo < M_PI) || diff_tree_interval_hits_(a, is_inv ? 0 : M_PI / 2, M_PI))
+        return INTERVAL_WHOLE;
+
+    if(is_inv)
+        return diff_tree_interval_make_(1.f / tan(a.hi), 1.f / tan(a.lo), a.partial);
+
+    return diff_tree_interval_make_(tan(a.lo), tan(a.hi), a.partial);
+}
+
+static DiffTreeInterval diff_tree_interval_ch_(DiffTreeInterval a)
+{
+    double lo = cosh(a.lo), hi = cosh(a.hi);
+
+    if(a.lo <= 0 && a.hi >= 0)
+        return diff_tree_interval_make_(1, fmax(lo, hi), a.partial);
+
+    return diff_tree_interval_make_(fmin(lo, hi), fmax(lo, hi), a.partial);
+}
+
+/// @brief asin or acos over the part of a within [-1, 1]
+static DiffTreeInterval diff_tree_interval_arc_(DiffTreeInterval a, double (*func)(double), bool is_increasing)
+{
+    if(a.hi < -1 || a.lo > 1)
+        return INTERVAL_EMPTY;
+
+    bool partial = a.partial || a.lo < -1 || a.hi > 1;
+    double lo = func(fmax(a.lo, -1)), hi = func(fmin(a.hi, 1));
+
+    return is_increasing ? diff_tree_interval_make_(lo, hi, partial) : diff_tree_interval_make_(hi, lo, partial);
+}
+
+/// @brief 1 / atan, with a pole at 0 like the scalar evaluator
+static DiffTreeInterval diff_tree_interval_actg_(DiffTreeInterval a)
+{
+    if(a.lo <= 0 && a.hi >= 0)
+        return INTERVAL_WHOLE;
+
+    return diff_tree_interval_make_(1.f / atan(a.hi), 1.f / atan(a.lo), a.partial);
+}
+
+/// @brief interval of a monotonically increasing function
+static DiffTreeInterval diff_tree_interval_increasing_(DiffTreeInterval a, double (*func)(double))
+{
+    return diff_tree_interval_make_(func(a.lo), func(a.hi), a.partial);
+}
+
+#define BINARY_(func)                                                               \
+    if(diff_tree_interval_is_empty_(sp[-2]) || diff_tree_interval_is_empty_(sp[-1])) \
+        sp[-2] = INTERVAL_EMPTY;                                                    \
+    else                                                                            \
+        sp[-2] = func(sp[-2], sp[-1]);                                              \
+    --sp;                                                                           \
+    break;
+
+#define UNARY_(expr)                                                                \
+    if(!diff_tree_interval_is_empty_(sp[-1]))                                       \
+        sp[-1] = (expr);                                                            \
+    break;
+
+DiffTreeErr diff_tree_interval_eval(DiffTreeTape* tape, const DiffTreeInterval* vars, DiffTreeInterval* res)
+{
+    utils_assert(tape);
+    utils_assert(vars);
+    utils_assert(res);
+
+    DiffTreeInterval* stack = TYPED_CALLOC(tape->stack_max + tape->temps_cnt, DiffTreeInterval);
+    stack verified(return DIFF_TREE_ALLOC_FAIL);
+
+    DiffTreeErr err = diff_tree_interval_eval_(tape, vars, stack, res);
+    NFREE(stack);
+
+    return err;
+}
+
+/// @param stack stack_max + temps_cnt intervals, temporaries go after the stack
+static DiffTreeErr diff_tree_interval_eval_(DiffTreeTape* tape, const DiffTreeInterval* vars, DiffTreeInterval* stack, DiffTreeInterval* res)
+{
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) tape->code.buffer;
+    const DiffTreeTapeInstr* end  = code + tape->code.size;
+
+    DiffTreeInterval* temps = stack + tape->stack_max;
+    DiffTreeInterval* sp    = stack;
+
+    for(const DiffTreeTapeInstr* ip = code; ip < end; ++ip) {
+        switch(ip->opcode) {
+            case TAPE_OPCODE_NUM:  *sp++ = { ip->arg.num, ip->arg.num, false }; break;
+            case TAPE_OPCODE_VAR:  *sp++ = vars[ip->arg.slot];                  break;
+
+            case TAPE_OPCODE_ADD:  BINARY_(diff_tree_interval_add_);
+            case TAPE_OPCODE_SUB:  BINARY_(diff_tree_interval_sub_);
+            case TAPE_OPCODE_MUL:  BINARY_(diff_tree_interval_mul_);
+            case TAPE_OPCODE_DIV:  BINARY_(diff_tree_interval_div_);
+            case TAPE_OPCODE_POW:  BINARY_(diff_tree_interval_pow_);
+
+            case TAPE_OPCODE_EXP:  UNARY_(diff_tree_interval_exp_(sp[-1]));
+            case TAPE_OPCODE_SQRT: UNARY_(diff_tree_interval_sqrt_(sp[-1]));
+            case TAPE_OPCODE_LOG:  UNARY_(diff_tree_interval_log_(sp[-1]));
+            case TAPE_OPCODE_SIN:  UNARY_(diff_tree_interval_sincos_(sp[-1], sin, M_PI / 2));
+            case TAPE_OPCODE_COS:  UNARY_(diff_tree_interval_sincos_(sp[-1], cos, 0));
+            case TAPE_OPCODE_TAN:  UNARY_(diff_tree_interval_tan_(sp[-1], false));
+            case TAPE_OPCODE_CTG:  UNARY_(diff_tree_interval_tan_(sp[-1], true));
+            case TAPE_OPCODE_SH:   UNARY_(diff_tree_interval_increasing_(sp[-1], sinh));
+            case TAPE_OPCODE_CH:   UNARY_(diff_tree_interval_ch_(sp[-1]));
+            case TAPE_OPCODE_TH:   UNARY_(diff_tree_interval_increasing_(sp[-1], tanh));
+            case TAPE_OPCODE_ASIN: UNARY_(diff_tree_interval_arc_(sp[-1], asin, true));
+            case TAPE_OPCODE_ACOS: UNARY_(diff_tree_interval_arc_(sp[-1], acos, false));
+            case TAPE_OPCODE_ATAN: UNARY_(diff_tree_interval_increasing_(sp[-1], atan));
+            case TAPE_OPCODE_ACTG: UNARY_(diff_tree_interval_actg_(sp[-1]));
+
+            case TAPE_OPCODE_POWI: UNARY_(diff_tree_interval_powi_(sp[-1], ip->arg.power));
+
+            case TAPE_OPCODE_STORE: temps[ip->arg.slot] = sp[-1]; break;
+            case TAPE_OPCODE_LOAD:  *sp++ = temps[ip->arg.slot];  break;
+
+            default:
+                UTILS_LOGE(LOG_CTG_INTERVAL, "unknown opcode %d", ip->opcode);
+                return DIFF_TREE_SYNTAX_ERR;
+        }
+    }
+
+    *res = sp[-1];
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+#undef BINARY_
+#undef UNARY_
+
+bool diff_tree_interval_find_range(DiffTreeTape* tape, const double* vars, size_t slot,
+                                   double x_begin, double x_end, double x_step,
+                                   double y_min, double y_max, double* x_min, double* x_max)
+{
+    utils_assert(tape);
+    utils_assert(vars);
+    utils_assert(x_min);
+    utils_assert(x_max);
+    utils_assert(x_step > 0);
+
+    if(!(x_begin < x_end))
+        return false;
+
+    DiffTreeInterval* stack = TYPED_CALLOC(tape->stack_max + tape->temps_cnt + tape->vars_cnt + 1, DiffTreeInterval);
+    stack verified(return false);
+
+    DiffTreeIntervalSearch search = {
+        .tape   = tape,
+        .vars   = stack + tape->stack_max + tape->temps_cnt,
+        .slot   = slot,
+        .stack  = stack,
+        .x_step = x_step,
+        .y_min  = y_min,
+        .y_max  = y_max,
+    };
+
+    for(size_t i = 0; i < tape->vars_cnt; ++i)
+        search.vars[i] = { vars[i], vars[i], false };
+
+    bool is_found = diff_tree_interval_find_edge_(&search, x_begin, x_end, true, x_min) &&
+                    diff_tree_interval_find_edge_(&search, *x_min, x_end, false, x_max);
+
+    NFREE(stack);
+
+    return is_found;
+}
+
+/// @brief outermost piece of [lo, hi] no wider than x_step where values may be in the window;
+///        pieces entirely out of it or with a singularity inside are pruned whole
+static bool diff_tree_interval_find_edge_(DiffTreeIntervalSearch* search, double lo, double hi, bool is_left, double* edge)
+{
+    search->vars[search->slot] = { lo, hi, false };
+
+    DiffTreeInterval res = {};
+    if(diff_tree_interval_eval_(search->tape, search->vars, search->stack, &res) != DIFF_TREE_ERR_NONE)
+        return false;
+
+    if(!(res.lo < search->y_max && res.hi > search->y_min))
+        return false;
+
+    if(hi - lo <= search->x_step) {
+        *edge = is_left ? lo : hi;
+        return !res.partial || (isfinite(res.lo) && isfinite(res.hi));
+    }
+
+    double mid = (lo + hi) / 2;
+
+    if(is_left)
+        return diff_tree_interval_find_edge_(search, lo, mid, true, edge) ||
+               diff_tree_interval_find_edge_(search, mid, hi, true, edge);
+
+    return diff_tree_interval_find_edge_(search, mid, hi, false, edge) ||
+           diff_tree_interval_find_edge_(search, lo, mid, false, edge);
+}
@@ -0,0 +1,325 @@
+#include "difftree_jet.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#define LOG_CTG_JET "DIFFTREE_JET"
+
+/// rows besides the value stack: result of unary operator and temporaries
+static const size_t JET_SCRATCH_ROWS = 3;
+
+static const double POW_SQUARING_MAX = 1e9;
+
+static void diff_tree_jet_mul_(const double* a, const double* b, double* res, size_t len);
+
+static void diff_tree_jet_div_(const double* a, const double* b, double* res, size_t len);
+
+static void diff_tree_jet_exp_(const double* a, double* res, size_t len);
+
+static void diff_tree_jet_log_(const double* a, double* res, size_t len);
+
+static void diff_tree_jet_sqrt_(const double* a, double* res, size_t len);
+
+static void diff_tree_jet_sincos_(const double* a, double* s, double* c, double s0, double c0, double sign, size_t len);
+
+static void diff_tree_jet_tan_(const double* a, double* t, double* u, double t0, double sign_u, double sign_d, size_t len);
+
+static void diff_tree_jet_arc_(const double* a, double* y, double* q, double* w, double y0, double sign, bool is_sqrt, size_t len);
+
+static void diff_tree_jet_pow_const_(const double* a, double* res, double* tmp, double power, size_t len);
+
+static bool diff_tree_jet_is_const_(const double* a, size_t len);
+
+static bool diff_tree_jet_num_equal_(double a, double b);
+
+#define BINARY_(stmt)                               \
+    {                                               \
+        double* a = sp - 2 * len;                   \
+        double* b = sp - len;                       \
+        stmt;                                       \
+        sp -= len;                                  \
+        break;                                      \
+    }
+
+#define UNARY_(stmt)                                \
+    {                                               \
+        double* a = sp - len;                       \
+        stmt;                                       \
+        memcpy(a, out, len * sizeof(double));       \
+        break;                                      \
+    }
+
+DiffTreeErr diff_tree_jet_eval(DiffTreeTape* tape, const double* vars, size_t slot, size_t order, double* coeffs)
+{
+    utils_assert(tape);
+    utils_assert(vars);
+    utils_assert(coeffs);
+
+    size_t len = order + 1;
+
+    double* stack = TYPED_CALLOC((tape->stack_max + tape->temps_cnt + JET_SCRATCH_ROWS) * len, double);
+    stack verified(return DIFF_TREE_ALLOC_FAIL);
+
+    double* temps = stack + tape->stack_max * len;
+    double* out   = temps + tape->temps_cnt * len;
+    double* tmp1  = out   + len;
+    double* tmp2 = tmp1 + len;
+
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) tape->code.buffer;
+    const DiffTreeTapeInstr* end  = code + tape->code.size;
+
+    double* sp = stack;
+
+    for(const DiffTreeTapeInstr* ip = code; ip < end; ++ip) {
+        switch(ip->opcode) {
+            case TAPE_OPCODE_NUM:
+                memset(sp, 0, len * sizeof(double));
+                sp[0] = ip->arg.num;
+                sp += len;
+                break;
+
+            case TAPE_OPCODE_VAR:
+                memset(sp, 0, len * sizeof(double));
+                sp[0] = vars[ip->arg.slot];
+                if(ip->arg.slot == slot && len > 1)
+                    sp[1] = 1;
+                sp += len;
+                break;
+
+            case TAPE_OPCODE_STORE:
+                memcpy(temps + ip->arg.slot * len, sp - len, len * sizeof(double));
+                break;
+
+            case TAPE_OPCODE_LOAD:
+                memcpy(sp, temps + ip->arg.slot * len, len * sizeof(double));
+                sp += len;
+                break;
+
+            case TAPE_OPCODE_ADD: BINARY_(for(size_t k = 0; k < len; ++k) a[k] += b[k]);
+            case TAPE_OPCODE_SUB: BINARY_(for(size_t k = 0; k < len; ++k) a[k] -= b[k]);
+            case TAPE_OPCODE_MUL: BINARY_(diff_tree_jet_mul_(a, b, a, len));
+            case TAPE_OPCODE_DIV: BINARY_(diff_tree_jet_div_(a, b, a, len));
+
+            case TAPE_OPCODE_POW:
+                BINARY_(
+                    if(diff_tree_jet_is_const_(b, len)) {
+                        diff_tree_jet_pow_const_(a, out, tmp1, b[0], len);
+                    }
+                    else {
+                        diff_tree_jet_log_(a, tmp1, len);
+                        diff_tree_jet_mul_(b, tmp1, tmp2, len);
+                        diff_tree_jet_exp_(tmp2, out, len);
+                    }
+                    memcpy(a, out, len * sizeof(double));
+                );
+
+            case TAPE_OPCODE_POWI: UNARY_(diff_tree_jet_pow_const_(a, out, tmp1, (double) ip->arg.power, len));
+
+            case TAPE_OPCODE_EXP:  UNARY_(diff_tree_jet_exp_(a, out, len));
+            case TAPE_OPCODE_SQRT: UNARY_(diff_tree_jet_sqrt_(a, out, len));
+            case TAPE_OPCODE_LOG:  UNARY_(diff_tree_jet_log_(a, out, len));
+
+            case TAPE_OPCODE_SIN:  UNARY_(diff_tree_jet_sincos_(a, out, tmp1, sin(a[0]), cos(a[0]), -1, len));
+            case TAPE_OPCODE_COS:  UNARY_(diff_tree_jet_sincos_(a, tmp1, out, sin(a[0]), cos(a[0]), -1, len));
+            case TAPE_OPCODE_SH:   UNARY_(diff_tree_jet_sincos_(a, out, tmp1, sinh(a[0]), cosh(a[0]), 1, len));
+            case TAPE_OPCODE_CH:   UNARY_(diff_tree_jet_sincos_(a, tmp1, out, sinh(a[0]), cosh(a[0]), 1, len));
+
+            case TAPE_OPCODE_TAN:  UNARY_(diff_tree_jet_tan_(a, out, tmp1, tan(a[0]), 1, 1, len));
+            case TAPE_OPCODE_CTG:  UNARY_(diff_tree_jet_tan_(a, out, tmp1, 1.f / tan(a[0]), 1, -1, len));
+            case TAPE_OPCODE_TH:   UNARY_(diff_tree_jet_tan_(a, out, tmp1, tanh(a[0]), -1, 1, len));
+
+            case TAPE_OPCODE_ASIN: UNARY_(diff_tree_jet_arc_(a, out, tmp1, tmp2, asin(a[0]), 1, true, len));
+            case TAPE_OPCODE_ACOS: UNARY_(diff_tree_jet_arc_(a, out, tmp1, tmp2, acos(a[0]), -1, true, len));
+            case TAPE_OPCODE_ATAN: UNARY_(diff_tree_jet_arc_(a, out, tmp1, tmp2, atan(a[0]), 1, false, len));
+            // value follows the scalar evaluator, derivatives follow diff_tree_differentiate
+            case TAPE_OPCODE_ACTG: UNARY_(diff_tree_jet_arc_(a, out, tmp1, tmp2, 1.f / atan(a[0]), -1, false, len));
+
+            default:
+                UTILS_LOGE(LOG_CTG_JET, "unknown opcode %d", ip->opcode);
+                NFREE(stack);
+                return DIFF_TREE_SYNTAX_ERR;
+        }
+    }
+
+    memcpy(coeffs, sp - len, len * sizeof(double));
+    NFREE(stack);
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+#undef BINARY_
+#undef UNARY_
+
+/// @brief Cauchy product, res may alias a or b
+static void diff_tree_jet_mul_(const double* a, const double* b, double* res, size_t len)
+{
+    for(size_t k = len; k-- > 0;) {
+        double sum = 0;
+        for(size_t i = 0; i <= k; ++i)
+            sum += a[i] * b[k - i];
+        res[k] = sum;
+    }
+}
+
+/// @brief res may alias a
+static void diff_tree_jet_div_(const double* a, const double* b, double* res, size_t len)
+{
+    for(size_t k = 0; k < len; ++k) {
+        double sum = a[k];
+        for(size_t i = 1; i <= k; ++i)
+            sum -= b[i] * res[k - i];
+        res[k] = sum / b[0];
+    }
+}
+
+static void diff_tree_jet_exp_(const double* a, double* res, size_t len)
+{
+    res[0] = exp(a[0]);
+
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t j = 1; j <= k; ++j)
+            sum += (double) j * a[j] * res[k - j];
+        res[k] = sum / (double) k;
+    }
+}
+
+static void diff_tree_jet_log_(const double* a, double* res, size_t len)
+{
+    res[0] = log(a[0]);
+
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t j = 1; j < k; ++j)
+            sum += (double) j * res[j] * a[k - j];
+        res[k] = (a[k] - sum / (double) k) / a[0];
+    }
+}
+
+static void diff_tree_jet_sqrt_(const double* a, double* res, size_t len)
+{
+    res[0] = sqrt(a[0]);
+
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t j = 1; j < k; ++j)
+            sum += res[j] * res[k - j];
+        res[k] = (a[k] - sum) / (2 * res[0]);
+    }
+}
+
+/// @brief s' = c a', c' = sign * s a'; sign is -1 for sin/cos and 1 for sh/ch
+static void diff_tree_jet_sincos_(const double* a, double* s, double* c, double s0, double c0, double sign, size_t len)
+{
+    s[0] = s0;
+    c[0] = c0;
+
+    for(size_t k = 1; k < len; ++k) {
+        double sum_s = 0, sum_c = 0;
+        for(size_t j = 1; j <= k; ++j) {
+            sum_s += (double) j * a[j] * c[k - j];
+            sum_c += (double) j * a[j] * s[k - j];
+        }
+        s[k] = sum_s / (double) k;
+        c[k] = sign * sum_c / (double) k;
+    }
+}
+
+/// @brief t' = sign_d * u a', u = 1 + sign_u * t^2; covers tan, ctg and th
+static void diff_tree_jet_tan_(const double* a, double* t, double* u, double t0, double sign_u, double sign_d, size_t len)
+{
+    t[0] = t0;
+    u[0] = 1 + sign_u * t0 * t0;
+
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t j = 1; j <= k; ++j)
+            sum += (double) j * a[j] * u[k - j];
+        t[k] = sign_d * sum / (double) k;
+
+        double sq = 0;
+        for(size_t i = 0; i <= k; ++i)
+            sq += t[i] * t[k - i];
+        u[k] = sign_u * sq;
+    }
+}
+
+/// @brief y' = sign * a' / q, q = sqrt(1 - a^2) if is_sqrt, else q = 1 + a^2
+static void diff_tree_jet_arc_(const double* a, double* y, double* q, double* w, double y0, double sign, bool is_sqrt, size_t len)
+{
+    diff_tree_jet_mul_(a, a, q, len);
+
+    if(is_sqrt) {
+        for(size_t k = 0; k < len; ++k) q[k] = -q[k];
+        q[0] += 1;
+        diff_tree_jet_sqrt_(q, w, len);
+        memcpy(q, w, len * sizeof(double));
+    }
+    else
+        q[0] += 1;
+
+    // w = 1 / q
+    w[0] = 1 / q[0];
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t i = 1; i <= k; ++i)
+            sum += q[i] * w[k - i];
+        w[k] = -sum / q[0];
+    }
+
+    y[0] = y0;
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t j = 1; j <= k; ++j)
+            sum += (double) j * a[j] * w[k - j];
+        y[k] = sign * sum / (double) k;
+    }
+}
+
+/// @brief a ^ power for constant power; the recurrence needs a[0] != 0,
+///        otherwise non-negative integer powers are taken by repeated squaring
+static void diff_tree_jet_pow_const_(const double* a, double* res, double* tmp, double power, size_t len)
+{
+    if(diff_tree_jet_num_equal_(a[0], 0) && power >= 0 && power <= POW_SQUARING_MAX
+       && diff_tree_jet_num_equal_(trunc(power), power)) {
+        unsigned long n = (unsigned long) power;
+
+        memset(res, 0, len * sizeof(double));
+        res[0] = 1;
+        memcpy(tmp, a, len * sizeof(double));
+
+        while(n) {
+            if(n & 1) diff_tree_jet_mul_(res, tmp, res, len);
+            diff_tree_jet_mul_(tmp, tmp, tmp, len);
+            n >>= 1;
+        }
+        return;
+    }
+
+    res[0] = pow(a[0], power);
+
+    for(size_t k = 1; k < len; ++k) {
+        double sum = 0;
+        for(size_t j = 1; j <= k; ++j)
+            sum += (power * (double) j - (double) (k - j)) * a[j] * res[k - j];
+        res[k] = sum / ((double) k * a[0]);
+    }
+}
+
+static bool diff_tree_jet_is_const_(const double* a, size_t len)
+{
+    for(size_t k = 1; k < len; ++k)
+        if(!diff_tree_jet_num_equal_(a[k], 0)) return false;
+
+    return true;
+}
+
+/// @brief exact, a tiny coefficient is still a coefficient
+static bool diff_tree_jet_num_equal_(double a, double b)
+{
+    return islessequal(a, b) && isgreaterequal(a, b);
+}
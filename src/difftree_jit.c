@@ -0,0 +1,577 @@
+#include "difftree_jit.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#include "vmath.h"
+
+#define LOG_CTG_JIT "DIFFTREE_JIT"
+
+/* Code is generated straight from the tape: stack entry i lives in ymm i,
+ * so every instruction becomes one or two AVX instructions on registers.
+ * Arithmetic, sqrt and integer powers are inlined, other functions are
+ * calls into vmath kernels, so results are the same as of the batch tape
+ * evaluator. Registers are spilled to the frame around a call, since every
+ * ymm register is caller-saved. The generated function keeps its pointers
+ * in callee-saved registers:
+ *   rbx - vars, r12 - xs, r13 - res, r14 - points left, r15 - frame */
+
+static_assert(sizeof(DiffTreeJitFn) == sizeof(void*), "code pointer must fit a function pointer");
+
+/// ymm14 and ymm15 are scratch registers
+static const size_t JIT_STACK_REGS = 14;
+
+static const unsigned JIT_SCRATCH_0 = 14;
+static const unsigned JIT_SCRATCH_1 = 15;
+
+static const size_t JIT_ENTRY_SIZE = VMATH_LANES * sizeof(double);
+
+#define DEFAULT_JIT_CODE_CAPACITY 256
+
+void diff_tree_jit_ctor(DiffTreeJit* jit, DiffTreeTape* tape, size_t slot)
+{
+    utils_assert(jit);
+    utils_assert(tape);
+
+    jit->tape      = tape;
+    jit->slot      = slot;
+    jit->fn        = NULL;
+    jit->code      = NULL;
+    jit->code_size = 0;
+    jit->frame     = NULL;
+}
+
+void diff_tree_jit_dtor(DiffTreeJit* jit)
+{
+    utils_assert(jit);
+
+    if(jit->code)
+        munmap(jit->code, jit->code_size);
+
+    NFREE(jit->frame);
+
+    jit->fn        = NULL;
+    jit->code      = NULL;
+    jit->code_size = 0;
+}
+
+bool diff_tree_jit_is_native(const DiffTreeJit* jit)
+{
+    utils_assert(jit);
+
+    return jit->fn != NULL;
+}
+
+void diff_tree_jit_eval_batch(DiffTreeJit* jit, const double* vars, const double* xs, double* res, size_t n)
+{
+    utils_assert(jit);
+
+    if(!jit->fn) {
+        diff_tree_tape_eval_batch(jit->tape, vars, jit->slot, xs, res, NULL, n);
+        return;
+    }
+
+    if(n == 0)
+        return;
+
+    utils_assert(xs);
+    utils_assert(res);
+
+    size_t whole = n - n % VMATH_LANES;
+    jit->fn(vars, xs, res, whole, jit->frame);
+
+    if(whole == n)
+        return;
+
+    // tail is padded with the last point so that padding lanes stay in domain
+    double padded_xs[VMATH_LANES]  = {};
+    double padded_res[VMATH_LANES] = {};
+
+    for(size_t j = 0; j < VMATH_LANES; ++j)
+        padded_xs[j] = xs[whole + j < n ? whole + j : n - 1];
+
+    jit->fn(vars, padded_xs, padded_res, VMATH_LANES, jit->frame);
+
+    memcpy(res + whole, padded_res, (n - whole) * sizeof(double));
+}
+
+#if defined(__x86_64__)
+
+typedef enum JitGpr
+{
+    JIT_RAX = 0,
+    JIT_RCX = 1,
+    JIT_RDX = 2,
+    JIT_RBX = 3,
+    JIT_RSI = 6,
+    JIT_RDI = 7,
+    JIT_R12 = 12,
+    JIT_R13 = 13,
+    JIT_R15 = 15,
+
+} JitGpr;
+
+typedef struct DiffTreeJitAsm
+{
+    Vector code;
+    bool failed;
+
+    /// frame offsets in bytes
+    size_t temps_off;
+    size_t consts_off;
+
+    /// 1 for integer powers, then constants in order of TAPE_OPCODE_NUM
+    double* consts;
+    size_t consts_cnt;
+
+} DiffTreeJitAsm;
+
+static void diff_tree_jit_byte_(DiffTreeJitAsm* as, uint8_t byte);
+
+static void diff_tree_jit_u32_(DiffTreeJitAsm* as, uint32_t val);
+
+static void diff_tree_jit_u64_(DiffTreeJitAsm* as, uint64_t val);
+
+static void diff_tree_jit_patch_rel32_(DiffTreeJitAsm* as, size_t at, size_t target);
+
+static void diff_tree_jit_vop_rr_(DiffTreeJitAsm* as, uint8_t opcode, unsigned dst, unsigned src1, unsigned src2);
+
+static void diff_tree_jit_vop_rm_(DiffTreeJitAsm* as, unsigned map, uint8_t opcode, unsigned reg, unsigned base, size_t disp);
+
+static void diff_tree_jit_load_(DiffTreeJitAsm* as, unsigned reg, unsigned base, size_t disp);
+
+static void diff_tree_jit_store_(DiffTreeJitAsm* as, unsigned reg, unsigned base, size_t disp);
+
+static void diff_tree_jit_broadcast_(DiffTreeJitAsm* as, unsigned reg, unsigned base, size_t disp);
+
+static void diff_tree_jit_lea_frame_(DiffTreeJitAsm* as, unsigned reg, size_t disp);
+
+static void diff_tree_jit_call_(DiffTreeJitAsm* as, uintptr_t fn, size_t top, size_t args);
+
+static void diff_tree_jit_powi_(DiffTreeJitAsm* as, unsigned reg, long power);
+
+static bool diff_tree_jit_emit_(DiffTreeJitAsm* as, DiffTreeJit* jit);
+
+static uintptr_t diff_tree_jit_kernel_(DiffTreeTapeOpcode opcode);
+
+DiffTreeErr diff_tree_jit_compile(DiffTreeJit* jit)
+{
+    utils_assert(jit);
+    utils_assert(jit->tape);
+
+    diff_tree_jit_dtor(jit);
+
+    DiffTreeTape* tape = jit->tape;
+
+    if(!__builtin_cpu_supports("avx")) {
+        UTILS_LOGW(LOG_CTG_JIT, "no AVX, falling back to tape");
+        return DIFF_TREE_ERR_NONE;
+    }
+
+    if(tape->stack_max > JIT_STACK_REGS) {
+        UTILS_LOGW(LOG_CTG_JIT, "stack of %zu entries does not fit registers, falling back to tape", tape->stack_max);
+        return DIFF_TREE_ERR_NONE;
+    }
+
+    DiffTreeJitAsm as = {
+        .code       = {},
+        .failed     = false,
+        .temps_off  = tape->stack_max * JIT_ENTRY_SIZE,
+        .consts_off = (tape->stack_max + tape->temps_cnt) * JIT_ENTRY_SIZE,
+        .consts     = NULL,
+        .consts_cnt = 0,
+    };
+
+    size_t frame_size = (tape->stack_max + tape->temps_cnt) * VMATH_LANES + tape->code.size + 1;
+
+    jit->frame = TYPED_CALLOC(frame_size, double);
+    jit->frame verified(return DIFF_TREE_ALLOC_FAIL);
+
+    as.consts = jit->frame + as.consts_off / sizeof(double);
+    as.consts[as.consts_cnt++] = 1;
+
+    if(vector_ctor(&as.code, DEFAULT_JIT_CODE_CAPACITY, sizeof(uint8_t)) != VECTOR_ERR_NONE) {
+        NFREE(jit->frame);
+        return DIFF_TREE_ALLOC_FAIL;
+    }
+
+    bool emitted = diff_tree_jit_emit_(&as, jit);
+
+    void* code = MAP_FAILED;
+    if(emitted && !as.failed)
+        code = mmap(NULL, as.code.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(code != MAP_FAILED) {
+        memcpy(code, as.code.buffer, as.code.size);
+
+        // pages are never writable and executable at once
+        if(mprotect(code, as.code.size, PROT_READ | PROT_EXEC) == 0) {
+            jit->code      = code;
+            jit->code_size = as.code.size;
+            memcpy(&jit->fn, &code, sizeof(code));
+        }
+        else
+            munmap(code, as.code.size);
+    }
+
+    vector_dtor(&as.code);
+
+    if(!jit->fn) {
+        UTILS_LOGW(LOG_CTG_JIT, "code generation failed, falling back to tape");
+        NFREE(jit->frame);
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static bool diff_tree_jit_emit_(DiffTreeJitAsm* as, DiffTreeJit* jit)
+{
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) jit->tape->code.buffer;
+    const DiffTreeTapeInstr* end  = code + jit->tape->code.size;
+
+    static const uint8_t PROLOGUE[] = {
+        0x53,                   // push rbx
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x89, 0xFB,       // mov rbx, rdi
+        0x49, 0x89, 0xF4,       // mov r12, rsi
+        0x49, 0x89, 0xD5,       // mov r13, rdx
+        0x49, 0x89, 0xCE,       // mov r14, rcx
+        0x4D, 0x89, 0xC7,       // mov r15, r8
+        0x4D, 0x85, 0xF6,       // test r14, r14
+        0x0F, 0x84,             // jz rel32
+    };
+
+    static const uint8_t LOOP_STEP[] = {
+        0x49, 0x83, 0xC4, 0x20, // add r12, 32
+        0x49, 0x83, 0xC5, 0x20, // add r13, 32
+        0x49, 0x83, 0xEE, 0x04, // sub r14, 4
+        0x0F, 0x85,             // jnz rel32
+    };
+
+    static const uint8_t EPILOGUE[] = {
+        0xC5, 0xF8, 0x77,       // vzeroupper
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5B,                   // pop rbx
+        0xC3,                   // ret
+    };
+
+    static_assert(JIT_ENTRY_SIZE == 0x20 && VMATH_LANES == 4, "loop step is encoded for 4 doubles");
+
+    for(size_t i = 0; i < sizeof(PROLOGUE); ++i)
+        diff_tree_jit_byte_(as, PROLOGUE[i]);
+
+    size_t skip_loop = as->code.size;
+    diff_tree_jit_u32_(as, 0);
+
+    size_t loop = as->code.size;
+    size_t top  = 0;
+
+    for(const DiffTreeTapeInstr* ip = code; ip < end; ++ip) {
+        unsigned reg = (unsigned) top;
+
+        switch(ip->opcode) {
+            case TAPE_OPCODE_NUM:
+                as->consts[as->consts_cnt] = ip->arg.num;
+                diff_tree_jit_broadcast_(as, reg, JIT_R15, as->consts_off + as->consts_cnt++ * sizeof(double));
+                top++;
+                break;
+
+            case TAPE_OPCODE_VAR:
+                if(ip->arg.slot == jit->slot)
+                    diff_tree_jit_load_(as, reg, JIT_R12, 0);
+                else
+                    diff_tree_jit_broadcast_(as, reg, JIT_RBX, ip->arg.slot * sizeof(double));
+                top++;
+                break;
+
+            case TAPE_OPCODE_ADD:  diff_tree_jit_vop_rr_(as, 0x58, reg - 2, reg - 2, reg - 1); top--; break;
+            case TAPE_OPCODE_SUB:  diff_tree_jit_vop_rr_(as, 0x5C, reg - 2, reg - 2, reg - 1); top--; break;
+            case TAPE_OPCODE_MUL:  diff_tree_jit_vop_rr_(as, 0x59, reg - 2, reg - 2, reg - 1); top--; break;
+            case TAPE_OPCODE_DIV:  diff_tree_jit_vop_rr_(as, 0x5E, reg - 2, reg - 2, reg - 1); top--; break;
+            case TAPE_OPCODE_SQRT: diff_tree_jit_vop_rr_(as, 0x51, reg - 1, 0, reg - 1);             break;
+
+            case TAPE_OPCODE_POW:
+                diff_tree_jit_call_(as, (uintptr_t) &vmath_pow, top, 2);
+                top--;
+                break;
+
+            case TAPE_OPCODE_EXP:
+            case TAPE_OPCODE_LOG:
+            case TAPE_OPCODE_SIN:
+            case TAPE_OPCODE_COS:
+            case TAPE_OPCODE_TAN:
+            case TAPE_OPCODE_CTG:
+            case TAPE_OPCODE_SH:
+            case TAPE_OPCODE_CH:
+            case TAPE_OPCODE_TH:
+            case TAPE_OPCODE_ASIN:
+            case TAPE_OPCODE_ACOS:
+            case TAPE_OPCODE_ATAN:
+            case TAPE_OPCODE_ACTG:
+                diff_tree_jit_call_(as, diff_tree_jit_kernel_(ip->opcode), top, 1);
+                break;
+
+            case TAPE_OPCODE_POWI:
+                diff_tree_jit_powi_(as, reg - 1, ip->arg.power);
+                break;
+
+            case TAPE_OPCODE_STORE:
+                diff_tree_jit_store_(as, reg - 1, JIT_R15, as->temps_off + ip->arg.slot * JIT_ENTRY_SIZE);
+                break;
+
+            case TAPE_OPCODE_LOAD:
+                diff_tree_jit_load_(as, reg, JIT_R15, as->temps_off + ip->arg.slot * JIT_ENTRY_SIZE);
+                top++;
+                break;
+
+            default:
+                UTILS_LOGE(LOG_CTG_JIT, "unknown opcode %d", ip->opcode);
+                return false;
+        }
+    }
+
+    if(top != 1)
+        return false;
+
+    diff_tree_jit_store_(as, 0, JIT_R13, 0);
+
+    for(size_t i = 0; i < sizeof(LOOP_STEP); ++i)
+        diff_tree_jit_byte_(as, LOOP_STEP[i]);
+
+    size_t jump_back = as->code.size;
+    diff_tree_jit_u32_(as, 0);
+    diff_tree_jit_patch_rel32_(as, jump_back, loop);
+
+    diff_tree_jit_patch_rel32_(as, skip_loop, as->code.size);
+
+    for(size_t i = 0; i < sizeof(EPILOGUE); ++i)
+        diff_tree_jit_byte_(as, EPILOGUE[i]);
+
+    return true;
+}
+
+static uintptr_t diff_tree_jit_kernel_(DiffTreeTapeOpcode opcode)
+{
+    void (*kernel)(const double* a, double* res, size_t n) = NULL;
+
+    switch(opcode) {
+        case TAPE_OPCODE_EXP:  kernel = vmath_exp;  break;
+        case TAPE_OPCODE_LOG:  kernel = vmath_log;  break;
+        case TAPE_OPCODE_SIN:  kernel = vmath_sin;  break;
+        case TAPE_OPCODE_COS:  kernel = vmath_cos;  break;
+        case TAPE_OPCODE_TAN:  kernel = vmath_tan;  break;
+        case TAPE_OPCODE_CTG:  kernel = vmath_ctg;  break;
+        case TAPE_OPCODE_SH:   kernel = vmath_sh;   break;
+        case TAPE_OPCODE_CH:   kernel = vmath_ch;   break;
+        case TAPE_OPCODE_TH:   kernel = vmath_th;   break;
+        case TAPE_OPCODE_ASIN: kernel = vmath_asin; break;
+        case TAPE_OPCODE_ACOS: kernel = vmath_acos; break;
+        case TAPE_OPCODE_ATAN: kernel = vmath_atan; break;
+        case TAPE_OPCODE_ACTG: kernel = vmath_actg; break;
+
+        case TAPE_OPCODE_NUM:
+        case TAPE_OPCODE_VAR:
+        case TAPE_OPCODE_ADD:
+        case TAPE_OPCODE_SUB:
+        case TAPE_OPCODE_MUL:
+        case TAPE_OPCODE_DIV:
+        case TAPE_OPCODE_POW:
+        case TAPE_OPCODE_SQRT:
+        case TAPE_OPCODE_POWI:
+        case TAPE_OPCODE_STORE:
+        case TAPE_OPCODE_LOAD:
+        default:
+            utils_assert(false && "not a unary kernel");
+            break;
+    }
+
+    return (uintptr_t) kernel;
+}
+
+/// @brief calls kernel on stack entries in the frame, all live registers are spilled and reloaded
+/// @param args 1 for unary kernel on top, 2 for binary kernel on two top entries
+static void diff_tree_jit_call_(DiffTreeJitAsm* as, uintptr_t fn, size_t top, size_t args)
+{
+    for(size_t i = 0; i < top; ++i)
+        diff_tree_jit_store_(as, (unsigned) i, JIT_R15, i * JIT_ENTRY_SIZE);
+
+    // kernels may be built without AVX
+    diff_tree_jit_byte_(as, 0xC5);
+    diff_tree_jit_byte_(as, 0xF8);
+    diff_tree_jit_byte_(as, 0x77);
+
+    size_t first = top - args;
+
+    if(args == 1) {
+        diff_tree_jit_lea_frame_(as, JIT_RDI, first * JIT_ENTRY_SIZE);
+        diff_tree_jit_lea_frame_(as, JIT_RSI, first * JIT_ENTRY_SIZE);
+        diff_tree_jit_byte_(as, 0xBA);  // mov edx, imm32
+    }
+    else {
+        diff_tree_jit_lea_frame_(as, JIT_RDI, first * JIT_ENTRY_SIZE);
+        diff_tree_jit_lea_frame_(as, JIT_RSI, (first + 1) * JIT_ENTRY_SIZE);
+        diff_tree_jit_lea_frame_(as, JIT_RDX, first * JIT_ENTRY_SIZE);
+        diff_tree_jit_byte_(as, 0xB9);  // mov ecx, imm32
+    }
+    diff_tree_jit_u32_(as, (uint32_t) VMATH_LANES);
+
+    diff_tree_jit_byte_(as, 0x48);      // mov rax, imm64
+    diff_tree_jit_byte_(as, 0xB8);
+    diff_tree_jit_u64_(as, fn);
+    diff_tree_jit_byte_(as, 0xFF);      // call rax
+    diff_tree_jit_byte_(as, 0xD0);
+
+    for(size_t i = 0; i <= first; ++i)
+        diff_tree_jit_load_(as, (unsigned) i, JIT_R15, i * JIT_ENTRY_SIZE);
+}
+
+/// @brief same squarings as diff_tree_tape_powi, unrolled for a constant power
+static void diff_tree_jit_powi_(DiffTreeJitAsm* as, unsigned reg, long power)
+{
+    unsigned long n = (unsigned long)(power < 0 ? -power : power);
+    size_t one = as->consts_off;
+
+    if(n == 0) {
+        diff_tree_jit_broadcast_(as, reg, JIT_R15, one);
+        return;
+    }
+
+    // res * 1 is exact, so the first factor is just copied
+    bool has_res = false;
+
+    while(n) {
+        if(n & 1) {
+            if(has_res)
+                diff_tree_jit_vop_rr_(as, 0x59, JIT_SCRATCH_0, JIT_SCRATCH_0, reg);
+            else
+                diff_tree_jit_vop_rr_(as, 0x28, JIT_SCRATCH_0, 0, reg);     // vmovapd
+            has_res = true;
+        }
+
+        n >>= 1;
+        if(n)
+            diff_tree_jit_vop_rr_(as, 0x59, reg, reg, reg);
+    }
+
+    if(power < 0) {
+        diff_tree_jit_broadcast_(as, JIT_SCRATCH_1, JIT_R15, one);
+        diff_tree_jit_vop_rr_(as, 0x5E, reg, JIT_SCRATCH_1, JIT_SCRATCH_0);
+    }
+    else
+        diff_tree_jit_vop_rr_(as, 0x28, reg, 0, JIT_SCRATCH_0);
+}
+
+/// @brief 3-byte VEX prefix, 256 bit, 66 prefix, W0
+static void diff_tree_jit_vex_(DiffTreeJitAsm* as, unsigned reg, unsigned rm, unsigned map, unsigned vvvv)
+{
+    diff_tree_jit_byte_(as, 0xC4);
+    diff_tree_jit_byte_(as, (uint8_t) ((reg & 8 ? 0 : 0x80) | 0x40 | (rm & 8 ? 0 : 0x20) | map));
+    diff_tree_jit_byte_(as, (uint8_t) (((~vvvv & 0xF) << 3) | 0x04 | 0x01));
+}
+
+/// @brief dst = src1 op src2, unary instructions ignore src1
+static void diff_tree_jit_vop_rr_(DiffTreeJitAsm* as, uint8_t opcode, unsigned dst, unsigned src1, unsigned src2)
+{
+    diff_tree_jit_vex_(as, dst, src2, 1, src1);
+    diff_tree_jit_byte_(as, opcode);
+    diff_tree_jit_byte_(as, (uint8_t) (0xC0 | (dst & 7) << 3 | (src2 & 7)));
+}
+
+/// @brief reg with [base + disp32]
+static void diff_tree_jit_vop_rm_(DiffTreeJitAsm* as, unsigned map, uint8_t opcode, unsigned reg, unsigned base, size_t disp)
+{
+    if(disp > INT32_MAX) {
+        as->failed = true;
+        return;
+    }
+
+    diff_tree_jit_vex_(as, reg, base, map, 0);
+    diff_tree_jit_byte_(as, opcode);
+    diff_tree_jit_byte_(as, (uint8_t) (0x80 | (reg & 7) << 3 | (base & 7)));
+    if((base & 7) == 4)
+        diff_tree_jit_byte_(as, 0x24);  // SIB for rsp and r12
+    diff_tree_jit_u32_(as, (uint32_t) disp);
+}
+
+static void diff_tree_jit_load_(DiffTreeJitAsm* as, unsigned reg, unsigned base, size_t disp)
+{
+    diff_tree_jit_vop_rm_(as, 1, 0x10, reg, base, disp);     // vmovupd
+}
+
+static void diff_tree_jit_store_(DiffTreeJitAsm* as, unsigned reg, unsigned base, size_t disp)
+{
+    diff_tree_jit_vop_rm_(as, 1, 0x11, reg, base, disp);     // vmovupd
+}
+
+static void diff_tree_jit_broadcast_(DiffTreeJitAsm* as, unsigned reg, unsigned base, size_t disp)
+{
+    diff_tree_jit_vop_rm_(as, 2, 0x19, reg, base, disp);     // vbroadcastsd
+}
+
+/// @brief lea reg, [r15 + disp32]
+static void diff_tree_jit_lea_frame_(DiffTreeJitAsm* as, unsigned reg, size_t disp)
+{
+    if(disp > INT32_MAX) {
+        as->failed = true;
+        return;
+    }
+
+    diff_tree_jit_byte_(as, (uint8_t) (0x49 | (reg & 8 ? 0x04 : 0)));
+    diff_tree_jit_byte_(as, 0x8D);
+    diff_tree_jit_byte_(as, (uint8_t) (0x80 | (reg & 7) << 3 | (JIT_R15 & 7)));
+    diff_tree_jit_u32_(as, (uint32_t) disp);
+}
+
+static void diff_tree_jit_byte_(DiffTreeJitAsm* as, uint8_t byte)
+{
+    if(vector_push(&as->code, &byte) != VECTOR_ERR_NONE)
+        as->failed = true;
+}
+
+static void diff_tree_jit_u32_(DiffTreeJitAsm* as, uint32_t val)
+{
+    for(size_t i = 0; i < sizeof(val); ++i)
+        diff_tree_jit_byte_(as, (uint8_t) (val >> (8 * i)));
+}
+
+static void diff_tree_jit_u64_(DiffTreeJitAsm* as, uint64_t val)
+{
+    for(size_t i = 0; i < sizeof(val); ++i)
+        diff_tree_jit_byte_(as, (uint8_t) (val >> (8 * i)));
+}
+
+/// @brief rel32 at offset at, relative to the end of the jump
+static void diff_tree_jit_patch_rel32_(DiffTreeJitAsm* as, size_t at, size_t target)
+{
+    if(as->failed)
+        return;
+
+    int32_t rel = (int32_t) ((int64_t) target - (int64_t) (at + sizeof(int32_t)));
+    memcpy((uint8_t*) as->code.buffer + at, &rel, sizeof(rel));
+}
+
+#else // !defined(__x86_64__)
+
+DiffTreeErr diff_tree_jit_compile(DiffTreeJit* jit)
+{
+    utils_assert(jit);
+
+    diff_tree_jit_dtor(jit);
+
+    UTILS_LOGW(LOG_CTG_JIT, "code generation is supported on x86-64 only, falling back to tape");
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+#endif // defined(__x86_64__)
@@ -0,0 +1,105 @@
+#include "difftree_lexer.h"
+
+#include <ctype.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "operators.h"
+
+ATTR_UNUSED static const char* LOG_CTG_LEXER = "DIFFTREE LEXER";
+
+static bool diff_tree_lex_op_(char c, OperatorType* op_type);
+
+DiffTreeErr diff_tree_lex_next(DiffTree* dtree, DiffTreeToken* token)
+{
+    utils_assert(dtree);
+    utils_assert(token);
+
+    const char* str = dtree->buf.ptr;
+    ssize_t len     = dtree->buf.len;
+    ssize_t pos     = dtree->buf.pos;
+
+    while(pos < len && str[pos] != '\n' && isspace((unsigned char) str[pos]))
+        pos++;
+
+    *token = {
+        .type  = DIFF_TREE_TOKEN_END,
+        .value = { .num = 0 },
+        .pos   = pos,
+        .len   = 1,
+    };
+
+    // the end is not consumed, so it is returned again if asked for more
+    if(pos >= len || str[pos] == '\n') {
+        dtree->buf.pos = pos;
+        return DIFF_TREE_ERR_NONE;
+    }
+
+    char c = str[pos];
+
+    if(isdigit((unsigned char) c)) {
+        double val = 0;
+
+        for(; pos < len && isdigit((unsigned char) str[pos]); ++pos)
+            val = val * 10 + (str[pos] - '0');
+
+        token->type      = DIFF_TREE_TOKEN_NUM;
+        token->value.num = val;
+        token->len       = pos - token->pos;
+    }
+    else if(isalpha((unsigned char) c)) {
+        ssize_t end = pos;
+        while(end < len && (isalnum((unsigned char) str[end]) || str[end] == '_'))
+            end++;
+
+        token->len = end - pos;
+
+        // any identifier but a function name is a variable
+        const Operator* op = match_function(str + pos, (size_t) token->len);
+
+        if(op) {
+            token->type          = DIFF_TREE_TOKEN_FUNC;
+            token->value.op_type = op->type;
+        }
+        else if((size_t) token->len <= VARIABLE_NAME_LEN_MAX)
+            token->type = DIFF_TREE_TOKEN_VAR;
+        else {
+            dtree->buf.pos = pos;
+            UTILS_LOGE(LOG_CTG_LEXER, "%s:1:%ld: syntax error: variable name is longer than %zu",
+                       dtree->buf.filename, pos, VARIABLE_NAME_LEN_MAX);
+            return DIFF_TREE_SYNTAX_ERR;
+        }
+
+        pos = end;
+    }
+    else if(c == '(' || c == ')') {
+        token->type = c == '(' ? DIFF_TREE_TOKEN_LPAREN : DIFF_TREE_TOKEN_RPAREN;
+        pos++;
+    }
+    else if(diff_tree_lex_op_(c, &token->value.op_type)) {
+        token->type = DIFF_TREE_TOKEN_OP;
+        pos++;
+    }
+    else {
+        dtree->buf.pos = pos;
+        UTILS_LOGE(LOG_CTG_LEXER, "%s:1:%ld: syntax error: unexpected: (ASCII) %d",
+                   dtree->buf.filename, pos, (int) c);
+        return DIFF_TREE_SYNTAX_ERR;
+    }
+
+    dtree->buf.pos = pos;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static bool diff_tree_lex_op_(char c, OperatorType* op_type)
+{
+    switch(c) {
+        case '+': *op_type = OPERATOR_TYPE_ADD; return true;
+        case '-': *op_type = OPERATOR_TYPE_SUB; return true;
+        case '*': *op_type = OPERATOR_TYPE_MUL; return true;
+        case '/': *op_type = OPERATOR_TYPE_DIV; return true;
+        case '^': *op_type = OPERATOR_TYPE_POW; return true;
+        default:  return false;
+    }
+}
@@ -3,23 +3,85 @@
 #include <cfenv>
 #include <math.h>
 #include <fenv.h>
+#include <string.h>
 
 #include "difftree.h"
+#include "difftree_jet.h"
 #include "difftree_optimize.h"
+#include "difftree_tape.h"
 #include "logutils.h"
 #include "mathutils.h"
+#include "memutils.h"
 #include "types.h"
 #include "operators.h"
 
 #define LOG_CTG_DMATH "DIFFTREE_MATH"
 
-static bool IS_FE_EXCEPTION_SET = false;
+/// evaluation may run in several threads, each with its own tree and FP environment
+static thread_local bool IS_FE_EXCEPTION_SET = false;
 static bool IS_DUMP_ENABLED = true;
 
+/// in DIFF_TREE_STEPS_TOP mode steps deeper than this are skipped
+static const size_t STEPS_TOP_DEPTH = 1;
+
+/// dumped steps and their budget
+typedef struct DiffTreeStepsBudget
+{
+    DiffTreeSteps mode;
+    size_t max_steps;
+    size_t max_bytes;
+
+    size_t steps;
+    size_t bytes;
+    /// the rest of steps was said to be skipped
+    bool skipped;
+
+} DiffTreeStepsBudget;
+
+static DiffTreeStepsBudget STEPS = { DIFF_TREE_STEPS_ALL, 0, 0, 0, 0, false };
+
+/// recursion depth of diff_tree_differentiate
+static thread_local size_t DIFF_DEPTH = 0;
+
+static const size_t DIFF_MEMO_CAPACITY_MIN = 64;
+
 static DiffTreeNode* diff_tree_differentiate_op_(DiffTree* dtree, DiffTreeNode* node, Variable* var);
 static DiffTreeNode* diff_tree_differentiate_var_(DiffTree* dtree, DiffTreeNode* node, Variable* var);
 static DiffTreeNode* diff_tree_differentiate_num_(DiffTree* dtree, DiffTreeNode* node, Variable* var);
 
+static void diff_tree_dag_memo_select_var_(DiffTree* dtree, Variable* var);
+
+static DiffTreeNode* diff_tree_differentiate_child_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* child, Variable* var);
+
+static DiffTreeNode* diff_tree_diff_memo_find_(DiffTree* dtree, DiffTreeNode* node, utils_hash_t hash, size_t var);
+
+static void diff_tree_diff_memo_insert_(DiffTree* dtree, DiffTreeNode* node, utils_hash_t hash, size_t var, DiffTreeNode* deriv);
+
+static void diff_tree_diff_memo_clear_(DiffTree* dtree);
+
+static bool diff_tree_step_dump_allowed_(size_t depth);
+
+static void diff_tree_dump_source_latex_(DiffTree* dtree, DiffTreeNode* expr);
+
+static void diff_tree_dump_result_latex_(DiffTree* dtree, DiffTreeNode* expr, DiffTreeNode* deriv);
+
+/// where an evaluation reads variables and keeps values of shared nodes
+typedef struct DiffTreeEvalCtx
+{
+    const DiffTree* dtree;
+    /// variable values by slot, NULL reads Variable::val
+    const double* vals;
+    /// NULL outside of DAG mode
+    PtrMap* memo;
+
+} DiffTreeEvalCtx;
+
+static double diff_tree_evaluate_(const DiffTreeEvalCtx* ctx, DiffTreeNode* node);
+
+static double diff_tree_evaluate_op_(const DiffTreeEvalCtx* ctx, DiffTreeNode* node);
+
+static void diff_tree_clear_fe_exception_(void);
+
 static const char* diff_tree_get_fe_exception_str(void);
 
 static void diff_tree_check_math_errors(DiffTreeNode* node, double left, double right);
@@ -29,85 +91,157 @@ void diff_tree_set_latex_dump_enabled(bool enabled)
     IS_DUMP_ENABLED = enabled;
 }
 
-DiffTreeErr diff_tree_differentiate_tree_n(DiffTree* dtree, Variable* var, size_t n)
+void diff_tree_set_latex_steps(DiffTreeSteps steps, size_t max_steps, size_t max_bytes)
 {
-    DiffTreeNode* copy = diff_tree_copy_subtree(dtree, dtree->root, NULL);
+    STEPS = {
+        .mode      = steps,
+        .max_steps = max_steps,
+        .max_bytes = max_bytes,
+        .steps     = 0,
+        .bytes     = 0,
+        .skipped   = false,
+    };
+}
 
-    if(IS_DUMP_ENABLED) {
-        diff_tree_dump_latex("Исходное выражение имеет вид"
-                             "\\begin{dmath}\n");
-        diff_tree_dump_node_latex(dtree, dtree->root->left);
-        diff_tree_dump_latex("\n\\end{dmath}\n\n");
+/// @brief whether a step at this recursion depth fits the mode and the budget,
+///        the first time the budget runs out says the rest is skipped
+static bool diff_tree_step_dump_allowed_(size_t depth)
+{
+    if(!IS_DUMP_ENABLED)
+        return false;
+
+    switch(STEPS.mode) {
+        case DIFF_TREE_STEPS_NONE:
+            return false;
+        case DIFF_TREE_STEPS_TOP:
+            if(depth > STEPS_TOP_DEPTH)
+                return false;
+            break;
+        case DIFF_TREE_STEPS_ALL:
+            break;
+        default:
+            UTILS_LOGW(LOG_CTG_DMATH, "unknown steps mode %d", STEPS.mode);
+            return false;
     }
 
+    if((STEPS.max_steps && STEPS.steps >= STEPS.max_steps) ||
+       (STEPS.max_bytes && STEPS.bytes >= STEPS.max_bytes)) {
+        if(!STEPS.skipped)
+            diff_tree_dump_latex("Остальные шаги оставим читателю.\n\n");
+
+        STEPS.skipped = true;
+        return false;
+    }
+
+    return true;
+}
+
+DiffTreeErr diff_tree_differentiate_tree_n(DiffTree* dtree, Variable* var, size_t n)
+{
+    DiffTreeNode* copy = diff_tree_copy_subtree(dtree, dtree->root->left, NULL);
+
+    if(IS_DUMP_ENABLED)
+        diff_tree_dump_source_latex_(dtree, dtree->root->left);
+
     diff_tree_optimize(dtree);
     for(size_t i = 0; i < n; ++i) {
         dtree->root->left = diff_tree_differentiate(dtree, dtree->root->left, var);
-        dtree->root->left->parent = dtree->root;
+        if(!dtree->root->left) {
+            UTILS_LOGE(LOG_CTG_DMATH, "expression can not be differentiated");
+            dtree->root->left = copy;
+            if(!dtree->is_dag)
+                copy->parent = dtree->root;
+
+            return DIFF_TREE_SYNTAX_ERR;
+        }
+
+        if(!dtree->is_dag)
+            dtree->root->left->parent = dtree->root;
 
         diff_tree_optimize(dtree);
 
-        if(IS_DUMP_ENABLED) {
-            diff_tree_dump_latex("Итого, взяв производную от исходного выражения, получим\n");
-            diff_tree_dump_begin_math();
-            diff_tree_dump_latex("\\frac{d}{dx} \\left (");
-            diff_tree_dump_node_latex(dtree, copy);
-            diff_tree_dump_latex("\\right ) = ");
-            diff_tree_dump_node_latex(dtree, dtree->root->left);
-            diff_tree_dump_end_math();
-        }
+        if(IS_DUMP_ENABLED)
+            diff_tree_dump_result_latex_(dtree, copy, dtree->root->left);
     }
     diff_tree_mark_to_delete(dtree, copy);
     return DIFF_TREE_ERR_NONE;
 }
 
+void diff_tree_dump_derivative_latex(DiffTree* dtree, DiffTreeNode* expr, DiffTreeNode* deriv)
+{
+    if(!IS_DUMP_ENABLED)
+        return;
+
+    diff_tree_dump_source_latex_(dtree, expr);
+    diff_tree_dump_result_latex_(dtree, expr, deriv);
+}
+
+static void diff_tree_dump_source_latex_(DiffTree* dtree, DiffTreeNode* expr)
+{
+    diff_tree_dump_latex("Исходное выражение имеет вид"
+                         "\\begin{dmath}\n");
+    diff_tree_dump_node_latex(dtree, expr);
+    diff_tree_dump_latex("\n\\end{dmath}\n\n");
+}
+
+static void diff_tree_dump_result_latex_(DiffTree* dtree, DiffTreeNode* expr, DiffTreeNode* deriv)
+{
+    diff_tree_dump_latex("Итого, взяв производную от исходного выражения, получим\n");
+    diff_tree_dump_begin_math();
+    diff_tree_dump_latex("\\frac{d}{dx} \\left (");
+    diff_tree_dump_node_latex(dtree, expr);
+    diff_tree_dump_latex("\\right ) = ");
+    diff_tree_dump_node_latex(dtree, deriv);
+    diff_tree_dump_end_math();
+}
+
 /* And here goes our DSL */
 #define cL diff_tree_copy_subtree(dtree, node->left, node)
 #define cR diff_tree_copy_subtree(dtree, node->right, node)
-#define dL diff_tree_differentiate(dtree, cL, var)
-#define dR diff_tree_differentiate(dtree, cR, var)
+#define dL diff_tree_differentiate_child_(dtree, node, node->left, var)
+#define dR diff_tree_differentiate_child_(dtree, node, node->right, var)
 
 #define ADD_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_ADD }, left, right, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_ADD }, left, right, NULL)
 
 #define SUB_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SUB }, left, right, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SUB }, left, right, NULL)
 
 #define MUL_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_MUL }, left, right, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_MUL }, left, right, NULL)
 
 #define DIV_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_DIV }, left, right, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_DIV }, left, right, NULL)
 
 #define SIN_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SIN }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SIN }, left, NULL, NULL)
 
 #define COS_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_COS }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_COS }, left, NULL, NULL)
 
 #define SH_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SH }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SH }, left, NULL, NULL)
 
 #define CH_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_CH }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_CH }, left, NULL, NULL)
 
 #define LOG_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_LOG }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_LOG }, left, NULL, NULL)
 
 #define EXP_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_EXP }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_EXP }, left, NULL, NULL)
 
 #define POW_(left, right) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_POW }, left, right, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_POW }, left, right, NULL)
 
 #define SQRT_(left) \
-    diff_tree_new_node(NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SQRT }, left, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { OPERATOR_TYPE_SQRT }, left, NULL, NULL)
 
 #define CONST_(num_) \
-    diff_tree_new_node(NODE_TYPE_NUM, NodeValue { .num = num_ }, NULL, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_NUM, NodeValue { .num = num_ }, NULL, NULL, NULL)
 
 #define VAR_(var) \
-    diff_tree_new_node(NODE_TYPE_VAR, NodeValue { .var_hash = var->hash }, NULL, NULL, NULL)
+    diff_tree_new_node(dtree, NODE_TYPE_VAR, NodeValue { .var = var->slot }, NULL, NULL, NULL)
 
 DiffTreeNode* diff_tree_differentiate(DiffTree* dtree, DiffTreeNode* node, Variable* var)
 {
@@ -115,8 +249,24 @@ DiffTreeNode* diff_tree_differentiate(DiffTree* dtree, DiffTreeNode* node, Varia
     utils_assert(node);
     utils_assert(var);
 
+    if(dtree->is_dag) {
+        diff_tree_dag_memo_select_var_(dtree, var);
+
+        ++dtree->stats.diff_lookups;
+
+        PtrMapVal* found = ptr_map_find(&dtree->dag_memo.diff, node);
+        if(found) {
+            ++dtree->stats.diff_hits;
+            return (DiffTreeNode*) found->ptr;
+        }
+    }
 
     DiffTreeNode* new_node = NULL;
+    size_t depth = DIFF_DEPTH++;
+
+    // derivatives in memo are linked into the result, which is changed once this call returns
+    if(!dtree->is_dag && depth == 0)
+        diff_tree_diff_memo_clear_(dtree);
 
     switch(node->type) {
         case NODE_TYPE_OP:
@@ -133,13 +283,17 @@ DiffTreeNode* diff_tree_differentiate(DiffTree* dtree, DiffTreeNode* node, Varia
 
         case NODE_TYPE_FAKE:
             UTILS_LOGE(LOG_CTG_DMATH, "fake node occured");
+            DIFF_DEPTH = depth;
             return NULL;
 
         default:
             UTILS_LOGE(LOG_CTG_DMATH, "unknown node type %d", node->type);
+            DIFF_DEPTH = depth;
             return NULL;
     }
 
+    DIFF_DEPTH = depth;
+
     if(node->parent) {
         if(node == node->parent->left)
             node->parent->left = new_node;
@@ -147,7 +301,9 @@ DiffTreeNode* diff_tree_differentiate(DiffTree* dtree, DiffTreeNode* node, Varia
             node->parent->right = new_node;
     }
 
-    if(IS_DUMP_ENABLED) {
+    if(diff_tree_step_dump_allowed_(depth)) {
+        size_t size = diff_tree_latex_size();
+
         diff_tree_dump_randphrase_latex();
         diff_tree_dump_begin_math();
         diff_tree_dump_latex("\\frac{d}{dx} \\left (");
@@ -156,13 +312,108 @@ DiffTreeNode* diff_tree_differentiate(DiffTree* dtree, DiffTreeNode* node, Varia
         diff_tree_dump_node_latex(dtree, new_node);
         diff_tree_dump_end_math();
         DIFF_TREE_DUMP(dtree, DIFF_TREE_ERR_NONE);
+
+        ++STEPS.steps;
+        STEPS.bytes += diff_tree_latex_size() - size;
     }
 
+    if(dtree->is_dag)
+        ptr_map_insert(&dtree->dag_memo.diff, node, PtrMapVal { .ptr = new_node });
+
     diff_tree_mark_to_delete(dtree, node);
 
     return new_node;
 }
 
+/// @brief dL and dR; in tree mode a derivative of an equal subtree found in memo
+///        is copied instead of copying the child and differentiating it again
+static DiffTreeNode* diff_tree_differentiate_child_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* child, Variable* var)
+{
+    // DAG mode has its own memo, equal subtrees are the same node there;
+    // leaves are differentiated faster than looked up
+    if(dtree->is_dag || !child->left)
+        return diff_tree_differentiate(dtree, diff_tree_copy_subtree(dtree, child, node), var);
+
+    utils_hash_t hash = diff_tree_subtree_hash(dtree, child);
+
+    ++dtree->stats.diff_lookups;
+
+    DiffTreeNode* found = diff_tree_diff_memo_find_(dtree, child, hash, var->slot);
+    if(found) {
+        ++dtree->stats.diff_hits;
+        return diff_tree_copy_subtree(dtree, found, NULL);
+    }
+
+    DiffTreeNode* deriv = diff_tree_differentiate(dtree, diff_tree_copy_subtree(dtree, child, node), var);
+
+    // children of nodes being differentiated stay as they are until the end of it
+    if(deriv)
+        diff_tree_diff_memo_insert_(dtree, child, hash, var->slot, deriv);
+
+    return deriv;
+}
+
+static DiffTreeNode* diff_tree_diff_memo_find_(DiffTree* dtree, DiffTreeNode* node, utils_hash_t hash, size_t var)
+{
+    if(!dtree->diff_memo.capacity)
+        return NULL;
+
+    size_t mask = dtree->diff_memo.capacity - 1;
+
+    for(size_t ind = hash & mask; dtree->diff_memo.buffer[ind].hash; ind = (ind + 1) & mask) {
+        DiffTreeDiffMemoEntry* entry = &dtree->diff_memo.buffer[ind];
+
+        if(entry->hash == hash && entry->var == var && diff_tree_subtree_equal(dtree, entry->node, node))
+            return entry->deriv;
+    }
+
+    return NULL;
+}
+
+/// @brief a derivative that does not fit is only not remembered
+static void diff_tree_diff_memo_insert_(DiffTree* dtree, DiffTreeNode* node, utils_hash_t hash, size_t var, DiffTreeNode* deriv)
+{
+    if((dtree->diff_memo.size + 1) * 2 > dtree->diff_memo.capacity) {
+        size_t capacity = dtree->diff_memo.capacity ? dtree->diff_memo.capacity * 2 : DIFF_MEMO_CAPACITY_MIN;
+
+        DiffTreeDiffMemoEntry* buffer = TYPED_CALLOC(capacity, DiffTreeDiffMemoEntry);
+        if(!buffer)
+            return;
+
+        for(size_t i = 0; i < dtree->diff_memo.capacity; ++i) {
+            DiffTreeDiffMemoEntry* entry = &dtree->diff_memo.buffer[i];
+            if(!entry->hash) continue;
+
+            size_t ind = entry->hash & (capacity - 1);
+            while(buffer[ind].hash)
+                ind = (ind + 1) & (capacity - 1);
+
+            buffer[ind] = *entry;
+        }
+
+        NFREE(dtree->diff_memo.buffer);
+        dtree->diff_memo.buffer   = buffer;
+        dtree->diff_memo.capacity = capacity;
+    }
+
+    size_t mask = dtree->diff_memo.capacity - 1;
+    size_t ind  = hash & mask;
+
+    while(dtree->diff_memo.buffer[ind].hash)
+        ind = (ind + 1) & mask;
+
+    dtree->diff_memo.buffer[ind] = { .hash = hash, .var = var, .node = node, .deriv = deriv };
+    dtree->diff_memo.size++;
+}
+
+static void diff_tree_diff_memo_clear_(DiffTree* dtree)
+{
+    if(dtree->diff_memo.size)
+        memset(dtree->diff_memo.buffer, 0, dtree->diff_memo.capacity * sizeof(*dtree->diff_memo.buffer));
+
+    dtree->diff_memo.size = 0;
+}
+
 static DiffTreeNode* diff_tree_differentiate_op_(DiffTree* dtree, DiffTreeNode* node, Variable* var)
 {
     utils_assert(node);
@@ -174,8 +425,8 @@ static DiffTreeNode* diff_tree_differentiate_op_(DiffTree* dtree, DiffTreeNode*
         case OPERATOR_TYPE_SUB:
             return SUB_(dL, dR);
         case OPERATOR_TYPE_DIV:
-            if(diff_tree_subtree_holds_var(node->right, var))
-                return DIV_(ADD_(MUL_(dL, cR), MUL_(cL, dR)), POW_(cR, CONST_(2)));
+            if(diff_tree_subtree_holds_var(dtree, node->right, var))
+                return DIV_(SUB_(MUL_(dL, cR), MUL_(cL, dR)), POW_(cR, CONST_(2)));
             else 
                 return DIV_(dL, cR);
 
@@ -183,8 +434,8 @@ static DiffTreeNode* diff_tree_differentiate_op_(DiffTree* dtree, DiffTreeNode*
             return ADD_(MUL_(dL, cR), MUL_(cL, dR));
         case OPERATOR_TYPE_POW:
         {
-            bool left = diff_tree_subtree_holds_var(node->left, var);
-            bool right = diff_tree_subtree_holds_var(node->right, var);
+            bool left = diff_tree_subtree_holds_var(dtree, node->left, var);
+            bool right = diff_tree_subtree_holds_var(dtree, node->right, var);
 
             if(left && right) {
                 DiffTreeNode* exp_f_1 = MUL_(cR, LOG_(cL));
@@ -195,10 +446,8 @@ static DiffTreeNode* diff_tree_differentiate_op_(DiffTree* dtree, DiffTreeNode*
                 return MUL_(MUL_(cR, POW_(cL, SUB_(cR, CONST_(1)))), dL);
             else if(right)
                 return MUL_(MUL_(POW_(cL, cR), LOG_(cL)), dR);
-            else {
-                UTILS_LOGE(LOG_CTG_DMATH, "constant folding was not run");
-                return NULL;
-            }
+            else
+                return CONST_(0);
         }
         case OPERATOR_TYPE_EXP:
             return MUL_(EXP_(cL), dL);
@@ -242,7 +491,7 @@ static DiffTreeNode* diff_tree_differentiate_var_(ATTR_UNUSED DiffTree* dtree, D
     utils_assert(node);
     utils_assert(node->type == NODE_TYPE_VAR);
 
-    if(node->value.var_hash == var->hash)
+    if(node->value.var == var->slot)
         return CONST_(1);
     else 
         return CONST_(0);
@@ -261,12 +510,72 @@ DiffTreeNode* diff_tree_taylor_expansion(DiffTree* dtree, Variable* var, double
     utils_assert(dtree);
     utils_assert(var);
 
+    // same polynom as the symbolic expansion, coefficients come from one jet pass
+
+    DiffTreeTape tape = {};
+    double* vals   = TYPED_CALLOC(dtree->vars.size, double);
+    double* coeffs = TYPED_CALLOC(n + 1, double);
+    size_t slot = var->slot;
+
+    DiffTreeErr err = vals && coeffs ? diff_tree_tape_ctor(&tape) : DIFF_TREE_ALLOC_FAIL;
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, dtree, dtree->root->left);
+    if(err == DIFF_TREE_ERR_NONE && slot >= dtree->vars.size)
+        err = DIFF_TREE_NULLPTR;
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        diff_tree_tape_load_vars(dtree, vals);
+        vals[slot] = x0;
+        err = diff_tree_jet_eval(&tape, vals, slot, n, coeffs);
+    }
+
+    diff_tree_tape_dtor(&tape);
+    NFREE(vals);
+
+    if(err != DIFF_TREE_ERR_NONE) {
+        UTILS_LOGE(LOG_CTG_DMATH, "taylor coefficients: %s", diff_tree_strerr(err));
+        NFREE(coeffs);
+        return NULL;
+    }
+
+    // jet coefficients are already divided by k!, which overflows past 170
+    DiffTreeNode* polynom = CONST_(coeffs[0]);
+
+    for(size_t k = 1; k <= n; ++k) {
+        polynom = ADD_(polynom, MUL_(
+            CONST_(coeffs[k]),
+            POW_(SUB_(VAR_(var), CONST_(x0)), CONST_((double)k))
+        ));
+    }
+
+    NFREE(coeffs);
+
+    return polynom;
+}
+
+void diff_tree_dump_taylor_latex(DiffTree* dtree, DiffTreeNode* polynom, Variable* var, double x0, size_t n)
+{
+    diff_tree_dump_begin_math();
+
+    diff_tree_dump_node_latex(dtree, polynom);
+
+    diff_tree_dump_latex("+o((%s-%g)^%lu)", var->name, x0, n);
+
+    diff_tree_dump_end_math();
+}
+
+DiffTreeNode* diff_tree_taylor_expansion_symbolic(DiffTree* dtree, Variable* var, double x0, size_t n)
+{
+    utils_assert(dtree);
+    utils_assert(var);
+
     // sum{ (df^(n)/dx^n)(x0)(x-x0)^k/(k!)}
     
     diff_tree_set_latex_dump_enabled(false);
     diff_tree_dump_begin_math();
     
-    var->val = x0;
+    // var may come from another tree with the same variables
+    diff_tree_variable(dtree, var->slot)->val = x0;
 
     double f = diff_tree_evaluate_tree(dtree);
     DiffTreeNode* polynom = CONST_(f);
@@ -276,9 +585,8 @@ DiffTreeNode* diff_tree_taylor_expansion(DiffTree* dtree, Variable* var, double
 
         double derivative = diff_tree_evaluate_tree(dtree);
         double k_fact = (double)utils_i64_factorial(k);
-        diff_tree_mark_to_delete(dtree, polynom);
 
-        polynom = ADD_(diff_tree_copy_subtree(dtree, polynom, NULL), MUL_(
+        polynom = ADD_(polynom, MUL_(
             DIV_(CONST_(derivative), CONST_(k_fact)), 
             POW_(SUB_(VAR_(var), CONST_(x0)), CONST_((double)k))
         ));
@@ -286,7 +594,7 @@ DiffTreeNode* diff_tree_taylor_expansion(DiffTree* dtree, Variable* var, double
 
     diff_tree_dump_node_latex(dtree, polynom);
 
-    diff_tree_dump_latex("+o((x-%g)^%lu)", x0, n);
+    diff_tree_dump_latex("+o((%s-%g)^%lu)", var->name, x0, n);
 
     diff_tree_dump_end_math();
     diff_tree_set_latex_dump_enabled(true);
@@ -305,24 +613,79 @@ DiffTreeNode* diff_tree_taylor_expansion(DiffTree* dtree, Variable* var, double
 
 double diff_tree_evaluate_tree(DiffTree* dtree)
 {
-    feclearexcept(FE_ALL_EXCEPT);
     return diff_tree_evaluate(dtree, dtree->root->left);
 }
 
 double diff_tree_evaluate(DiffTree* dtree, DiffTreeNode* node)
 {
     utils_assert(dtree);
+
+    diff_tree_clear_fe_exception_();
+
+    if(dtree->is_dag)
+        ptr_map_clear(&dtree->dag_memo.eval);
+
+    DiffTreeEvalCtx ctx = { .dtree = dtree, .vals = NULL, .memo = dtree->is_dag ? &dtree->dag_memo.eval : NULL };
+
+    return diff_tree_evaluate_(&ctx, node);
+}
+
+double diff_tree_evaluate_at(const DiffTree* dtree, DiffTreeNode* node, const double* vals)
+{
+    utils_assert(dtree);
+    utils_assert(vals);
+
+    diff_tree_clear_fe_exception_();
+
+    // shared nodes are evaluated once, the memo belongs to this call only
+    PtrMap memo = PTR_MAP_INITLIST;
+    if(dtree->is_dag && ptr_map_ctor(&memo, 0) != PTR_MAP_ERR_NONE)
+        return NAN;
+
+    DiffTreeEvalCtx ctx = { .dtree = dtree, .vals = vals, .memo = dtree->is_dag ? &memo : NULL };
+
+    double res = diff_tree_evaluate_(&ctx, node);
+
+    ptr_map_dtor(&memo);
+
+    return res;
+}
+
+double diff_tree_evaluate_op(DiffTree* dtree, DiffTreeNode* node)
+{
+    utils_assert(dtree);
+
+    diff_tree_clear_fe_exception_();
+
+    if(dtree->is_dag)
+        ptr_map_clear(&dtree->dag_memo.eval);
+
+    DiffTreeEvalCtx ctx = { .dtree = dtree, .vals = NULL, .memo = dtree->is_dag ? &dtree->dag_memo.eval : NULL };
+
+    return diff_tree_evaluate_op_(&ctx, node);
+}
+
+static double diff_tree_evaluate_(const DiffTreeEvalCtx* ctx, DiffTreeNode* node)
+{
+    utils_assert(ctx);
     utils_assert(node);
 
+    if(ctx->memo && node->type == NODE_TYPE_OP) {
+        PtrMapVal* found = ptr_map_find(ctx->memo, node);
+        if(found) return found->num;
+    }
+
     double res = NAN;
 
     switch(node->type) {
         case NODE_TYPE_OP:
-            res = diff_tree_evaluate_op(dtree, node);
+            res = diff_tree_evaluate_op_(ctx, node);
+            if(ctx->memo)
+                ptr_map_insert(ctx->memo, node, PtrMapVal { .num = res });
             break;
 
         case NODE_TYPE_VAR:
-            res = diff_tree_find_variable(dtree, node->value.var_hash)->val;
+            res = ctx->vals ? ctx->vals[node->value.var] : diff_tree_variable(ctx->dtree, node->value.var)->val;
             break;
 
         case NODE_TYPE_NUM:
@@ -348,7 +711,7 @@ double diff_tree_evaluate(DiffTree* dtree, DiffTreeNode* node)
     diff_tree_check_math_errors(node, left, right); \
     return res;
 
-double diff_tree_evaluate_op(DiffTree* dtree, DiffTreeNode* node)
+static double diff_tree_evaluate_op_(const DiffTreeEvalCtx* ctx, DiffTreeNode* node)
 {
     utils_assert(node);
     utils_assert(node->type == NODE_TYPE_OP);
@@ -356,12 +719,12 @@ double diff_tree_evaluate_op(DiffTree* dtree, DiffTreeNode* node)
     double left = NAN, right = NAN, res = NAN;
 
     if(node->left)
-       left = diff_tree_evaluate(dtree, node->left);
+       left = diff_tree_evaluate_(ctx, node->left);
 
     if(IS_FE_EXCEPTION_SET) return res;
 
     if(node->right)
-       right = diff_tree_evaluate(dtree, node->right);
+       right = diff_tree_evaluate_(ctx, node->right);
 
     if(IS_FE_EXCEPTION_SET) return res;
 
@@ -445,25 +808,34 @@ double diff_tree_evaluate_op(DiffTree* dtree, DiffTreeNode* node)
 #undef CHECK_MATH_ERR_AND_RET
 
 
-bool diff_tree_subtree_holds_var(DiffTreeNode* node, Variable* var)
+bool diff_tree_subtree_holds_var(DiffTree* dtree, DiffTreeNode* node, Variable* var)
 {
+    utils_assert(dtree);
     utils_assert(node);
-    bool ret = false;
+    utils_assert(var);
 
-    if(node->right) {
-        ret = diff_tree_subtree_holds_var(node->right, var);
-        if(ret) return true;
-    }
+    return node->var_mask & diff_tree_var_mask(dtree, var->slot);
+}
 
-    if(node->left) {
-        ret = diff_tree_subtree_holds_var(node->left, var);
-        if(ret) return true;
-    }
+static void diff_tree_dag_memo_select_var_(DiffTree* dtree, Variable* var)
+{
+    utils_assert(dtree);
+    utils_assert(var);
 
-    if(node->type == NODE_TYPE_VAR && node->value.var_hash == var->hash)
-        return true;
-    
-    return false;
+    if(dtree->dag_memo.var == var->slot)
+        return;
+
+    ptr_map_clear(&dtree->dag_memo.diff);
+
+    dtree->dag_memo.var = var->slot;
+}
+
+/// @brief every evaluation starts clean, an error of a previous one,
+///        maybe of another expression of the same thread, must not cut it short
+static void diff_tree_clear_fe_exception_(void)
+{
+    feclearexcept(FE_ALL_EXCEPT);
+    IS_FE_EXCEPTION_SET = false;
 }
 
 static const char* diff_tree_get_fe_exception_str(void)
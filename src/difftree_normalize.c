@@ -0,0 +1,691 @@
+#include "difftree_normalize.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "assertutils.h"
+#include "difftree.h"
+#include "difftree_math.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "operators.h"
+#include "types.h"
+#include "utils.h"
+
+ATTR_UNUSED static const char* LOG_CTG_DIFF_NORM = "DIFFTREE NORMALIZE";
+
+#define DEFAULT_TERMS_CAPACITY 64
+
+static const size_t CMP_MEMO_CAPACITY_MIN = 64;
+
+static const uint64_t CMP_MEMO_HASH_PRIME = 0xC2B2AE3D27D4EB4Full;
+
+/// @brief monomial with its coefficient in a sum, base with its exponent in a product
+typedef struct DiffTreeNormTerm
+{
+    double num;
+    /// sums are ordered by descending degree, so polynomials read as usual
+    double degree;
+    DiffTreeNode* node;
+    /// term is num / node
+    bool inverse;
+
+} DiffTreeNormTerm;
+
+/// @brief order of two operators remembered by diff_tree_node_cmp_, a < b by address
+typedef struct DiffTreeNormCmpEntry
+{
+    /// NULL is an empty entry
+    const DiffTreeNode* a;
+    const DiffTreeNode* b;
+    int cmp;
+
+} DiffTreeNormCmpEntry;
+
+typedef struct DiffTreeNormCtx
+{
+    DiffTree* dtree;
+    /// terms of the clusters being collected, a nested cluster is
+    /// pushed above its parent and popped before the parent continues
+    Vector terms;
+    bool failed;
+
+    /// open addressing memo of diff_tree_node_cmp_ for DAG mode, where nodes are
+    /// immutable; there a normalized product is flattened again by every product
+    /// it is a factor of, so the same deep subtrees are compared over and over
+    struct {
+        DiffTreeNormCmpEntry* buffer;
+        size_t size;
+        size_t capacity;
+    } cmp_memo;
+
+} DiffTreeNormCtx;
+
+static DiffTreeNode* diff_tree_normalize_(DiffTreeNormCtx* ctx, DiffTreeNode* node);
+
+static DiffTreeNode* diff_tree_normalize_sum_(DiffTreeNormCtx* ctx, DiffTreeNode* node);
+
+static DiffTreeNode* diff_tree_normalize_product_(DiffTreeNormCtx* ctx, DiffTreeNode* node);
+
+static void diff_tree_sum_children_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double sign, double* constant, bool normalized);
+
+static void diff_tree_sum_term_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double sign, double* constant);
+
+static void diff_tree_product_children_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double exp, double* coef, bool normalized);
+
+static void diff_tree_product_factor_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double exp, double* coef);
+
+static DiffTreeNode* diff_tree_emit_sum_(DiffTreeNormCtx* ctx, size_t base, double constant);
+
+static DiffTreeNode* diff_tree_emit_product_(DiffTreeNormCtx* ctx, size_t base, double coef);
+
+static DiffTreeNode* diff_tree_emit_op_(DiffTree* dtree, OperatorType op, DiffTreeNode* left, DiffTreeNode* right);
+
+static DiffTreeNode* diff_tree_emit_num_(DiffTree* dtree, double num);
+
+static DiffTreeNode* diff_tree_relink_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right);
+
+static void diff_tree_push_term_(DiffTreeNormCtx* ctx, double num, DiffTreeNode* node, bool inverse);
+
+static void diff_tree_release_node_(DiffTree* dtree, DiffTreeNode* node);
+
+static bool diff_tree_is_op_(const DiffTreeNode* node, OperatorType op);
+
+static bool diff_tree_is_sum_(const DiffTreeNode* node);
+
+static bool diff_tree_is_product_(const DiffTreeNode* node);
+
+static bool diff_tree_is_integer_(double num);
+
+static bool diff_tree_num_equal_(double a, double b);
+
+static double diff_tree_degree_(const DiffTreeNode* node);
+
+static int diff_tree_node_rank_(const DiffTreeNode* node);
+
+static int diff_tree_node_cmp_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b);
+
+static int diff_tree_node_cmp_children_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b);
+
+static DiffTreeNormCmpEntry* diff_tree_cmp_memo_find_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b);
+
+static void diff_tree_cmp_memo_insert_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b, int cmp);
+
+static size_t diff_tree_cmp_memo_ind_(const DiffTreeNode* a, const DiffTreeNode* b, size_t mask);
+
+static int diff_tree_sum_term_cmp_(const void* a, const void* b, void* ctx);
+
+static int diff_tree_product_term_cmp_(const void* a, const void* b, void* ctx);
+
+/* Sums (+, -) and products (*, /, ^ by a number) form clusters. A cluster
+ * is flattened into a list of terms, each term being normalized first,
+ * the list is sorted and equal terms are merged, then the cluster is
+ * rebuilt left-deep:
+ *
+ *     sum     = c1*m1 +- c2*m2 +- ... +- c0
+ *     product = c * f1^e1 * ... / (g1^d1 * ...)
+ *
+ * The result is a fixpoint, so a normalized child can be read back
+ * without normalizing it again. In tree mode internal nodes of a cluster
+ * are released one by one while its terms are moved into the result. */
+DiffTreeErr diff_tree_normalize(DiffTree* dtree)
+{
+    utils_assert(dtree);
+
+    DiffTreeNormCtx ctx = {
+        .dtree  = dtree,
+        .terms  = VECTOR_INITLIST,
+        .failed   = false,
+        .cmp_memo = {},
+    };
+
+    if(vector_ctor(&ctx.terms, DEFAULT_TERMS_CAPACITY, sizeof(DiffTreeNormTerm)) != VECTOR_ERR_NONE) {
+        UTILS_LOGE(LOG_CTG_DIFF_NORM, "failed to allocate terms, tree is left as is");
+        return DIFF_TREE_ALLOC_FAIL;
+    }
+
+    dtree->root->left = diff_tree_normalize_(&ctx, dtree->root->left);
+    if(!dtree->is_dag)
+        dtree->root->left->parent = dtree->root;
+
+    vector_dtor(&ctx.terms);
+    NFREE(ctx.cmp_memo.buffer);
+
+    diff_tree_release_marked(dtree);
+
+    if(ctx.failed) {
+        UTILS_LOGE(LOG_CTG_DIFF_NORM, "failed to allocate terms, some of them are lost");
+        return DIFF_TREE_ALLOC_FAIL;
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static DiffTreeNode* diff_tree_normalize_(DiffTreeNormCtx* ctx, DiffTreeNode* node)
+{
+    utils_assert(ctx);
+    utils_assert(node);
+
+    DiffTree* dtree = ctx->dtree;
+
+    if(node->type != NODE_TYPE_OP)
+        return node;
+
+    if(dtree->is_dag) {
+        PtrMapVal* found = ptr_map_find(&dtree->dag_memo.normalized, node);
+        if(found) return (DiffTreeNode*) found->ptr;
+    }
+
+    DiffTreeNode* new_node = NULL;
+
+    if(diff_tree_is_sum_(node))
+        new_node = diff_tree_normalize_sum_(ctx, node);
+    else if(diff_tree_is_product_(node))
+        new_node = diff_tree_normalize_product_(ctx, node);
+    else {
+        DiffTreeNode* left  = node->left  ? diff_tree_normalize_(ctx, node->left)  : NULL;
+        DiffTreeNode* right = node->right ? diff_tree_normalize_(ctx, node->right) : NULL;
+
+        new_node = diff_tree_relink_(dtree, node, left, right);
+
+        // u^v where v turned into a number is a product now
+        if(diff_tree_is_product_(new_node))
+            new_node = diff_tree_normalize_product_(ctx, new_node);
+    }
+
+    if(dtree->is_dag) {
+        ptr_map_insert(&dtree->dag_memo.normalized, node, PtrMapVal { .ptr = new_node });
+        ptr_map_insert(&dtree->dag_memo.normalized, new_node, PtrMapVal { .ptr = new_node });
+    }
+
+    return new_node;
+}
+
+static DiffTreeNode* diff_tree_normalize_sum_(DiffTreeNormCtx* ctx, DiffTreeNode* node)
+{
+    size_t base = ctx->terms.size;
+    double constant = 0;
+
+    diff_tree_sum_children_(ctx, node, 1, &constant, false);
+
+    DiffTreeNode* new_node = diff_tree_emit_sum_(ctx, base, constant);
+
+    ctx->terms.size = base;
+
+    return new_node;
+}
+
+static DiffTreeNode* diff_tree_normalize_product_(DiffTreeNormCtx* ctx, DiffTreeNode* node)
+{
+    size_t base = ctx->terms.size;
+    double coef = 1;
+
+    diff_tree_product_children_(ctx, node, 1, &coef, false);
+
+    DiffTreeNode* new_node = diff_tree_emit_product_(ctx, base, coef);
+
+    ctx->terms.size = base;
+
+    return new_node;
+}
+
+/// @param normalized children are normalized already, as in a result of diff_tree_normalize_
+static void diff_tree_sum_children_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double sign, double* constant, bool normalized)
+{
+    DiffTreeNode* child[] = { node->left, node->right };
+    double child_sign[]   = { sign, diff_tree_is_op_(node, OPERATOR_TYPE_SUB) ? -sign : sign };
+
+    diff_tree_release_node_(ctx->dtree, node);
+
+    for(size_t i = 0; i < SIZEOF(child); ++i) {
+        // in DAG mode a nested sum may be shared, it is normalized once and read back
+        if(!normalized && !ctx->dtree->is_dag && diff_tree_is_sum_(child[i]))
+            diff_tree_sum_children_(ctx, child[i], child_sign[i], constant, false);
+        else
+            diff_tree_sum_term_(ctx, normalized ? child[i] : diff_tree_normalize_(ctx, child[i]), child_sign[i], constant);
+    }
+}
+
+/// @param node normalized term
+static void diff_tree_sum_term_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double sign, double* constant)
+{
+    DiffTree* dtree = ctx->dtree;
+
+    if(diff_tree_is_sum_(node)) {
+        diff_tree_sum_children_(ctx, node, sign, constant, true);
+        return;
+    }
+
+    // constant terms are folded, as diff_tree_optimize folds a binary node of two of them
+    if(!node->var_mask) {
+        *constant += sign * diff_tree_evaluate(dtree, node);
+        diff_tree_mark_to_delete(dtree, node);
+        return;
+    }
+
+    bool is_mul = diff_tree_is_op_(node, OPERATOR_TYPE_MUL);
+    bool is_div = diff_tree_is_op_(node, OPERATOR_TYPE_DIV);
+
+    if((is_mul || is_div) && node->left->type == NODE_TYPE_NUM) {
+        diff_tree_push_term_(ctx, sign * node->left->value.num, node->right, is_div);
+        diff_tree_release_node_(dtree, node->left);
+        diff_tree_release_node_(dtree, node);
+        return;
+    }
+
+    diff_tree_push_term_(ctx, sign, node, false);
+}
+
+/// @param exp integer, so powers can be distributed over the factors
+static void diff_tree_product_children_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double exp, double* coef, bool normalized)
+{
+    DiffTreeNode* child[] = { node->left, node->right };
+    double child_exp[]    = { exp, exp };
+    size_t child_cnt      = SIZEOF(child);
+
+    if(diff_tree_is_op_(node, OPERATOR_TYPE_DIV))
+        child_exp[1] = -exp;
+
+    if(diff_tree_is_op_(node, OPERATOR_TYPE_POW)) {
+        child_exp[0] = exp * node->right->value.num;
+        child_cnt = 1;
+        diff_tree_release_node_(ctx->dtree, node->right);
+    }
+
+    diff_tree_release_node_(ctx->dtree, node);
+
+    for(size_t i = 0; i < child_cnt; ++i) {
+        if(!normalized && !ctx->dtree->is_dag && diff_tree_is_integer_(child_exp[i]) && diff_tree_is_product_(child[i]))
+            diff_tree_product_children_(ctx, child[i], child_exp[i], coef, false);
+        else
+            diff_tree_product_factor_(ctx, normalized ? child[i] : diff_tree_normalize_(ctx, child[i]), child_exp[i], coef);
+    }
+}
+
+/// @param node normalized factor
+static void diff_tree_product_factor_(DiffTreeNormCtx* ctx, DiffTreeNode* node, double exp, double* coef)
+{
+    if(!node->var_mask) {
+        *coef *= pow(diff_tree_evaluate(ctx->dtree, node), exp);
+        diff_tree_mark_to_delete(ctx->dtree, node);
+        return;
+    }
+
+    // (u^a)^n = u^(a*n) only for integer n
+    if(diff_tree_is_integer_(exp) && diff_tree_is_product_(node)) {
+        diff_tree_product_children_(ctx, node, exp, coef, true);
+        return;
+    }
+
+    diff_tree_push_term_(ctx, exp, node, false);
+}
+
+static DiffTreeNode* diff_tree_emit_sum_(DiffTreeNormCtx* ctx, size_t base, double constant)
+{
+    DiffTree* dtree = ctx->dtree;
+    DiffTreeNormTerm* terms = (DiffTreeNormTerm*) ctx->terms.buffer;
+    size_t size = ctx->terms.size;
+
+    for(size_t i = base; i < size; ++i)
+        terms[i].degree = (terms[i].inverse ? -1 : 1) * diff_tree_degree_(terms[i].node);
+
+    qsort_r(terms + base, size - base, sizeof(*terms), diff_tree_sum_term_cmp_, ctx);
+
+    DiffTreeNode* acc = NULL;
+
+    for(size_t i = base; i < size;) {
+        DiffTreeNormTerm term = terms[i];
+
+        for(++i; i < size && !diff_tree_sum_term_cmp_(&term, &terms[i], ctx); ++i) {
+            term.num += terms[i].num;
+            diff_tree_mark_to_delete(dtree, terms[i].node);
+            dtree->stats.norm_merged++;
+        }
+
+        if(diff_tree_num_equal_(term.num, 0)) {
+            diff_tree_mark_to_delete(dtree, term.node);
+            continue;
+        }
+
+        double num = acc ? fabs(term.num) : term.num;
+        DiffTreeNode* node = term.node;
+
+        if(term.inverse)
+            node = diff_tree_emit_op_(dtree, OPERATOR_TYPE_DIV, diff_tree_emit_num_(dtree, num), node);
+        else if(!diff_tree_num_equal_(num, 1))
+            node = diff_tree_emit_op_(dtree, OPERATOR_TYPE_MUL, diff_tree_emit_num_(dtree, num), node);
+
+        if(!acc)
+            acc = node;
+        else
+            acc = diff_tree_emit_op_(dtree, term.num < 0 ? OPERATOR_TYPE_SUB : OPERATOR_TYPE_ADD, acc, node);
+    }
+
+    if(!acc)
+        return diff_tree_emit_num_(dtree, constant);
+
+    if(diff_tree_num_equal_(constant, 0))
+        return acc;
+
+    return diff_tree_emit_op_(dtree, constant < 0 ? OPERATOR_TYPE_SUB : OPERATOR_TYPE_ADD,
+                              acc, diff_tree_emit_num_(dtree, fabs(constant)));
+}
+
+static DiffTreeNode* diff_tree_emit_product_(DiffTreeNormCtx* ctx, size_t base, double coef)
+{
+    DiffTree* dtree = ctx->dtree;
+    DiffTreeNormTerm* terms = (DiffTreeNormTerm*) ctx->terms.buffer;
+    size_t size = ctx->terms.size;
+
+    qsort_r(terms + base, size - base, sizeof(*terms), diff_tree_product_term_cmp_, ctx);
+
+    // numerator and denominator
+    DiffTreeNode* frac[2] = {};
+    bool is_zero = diff_tree_num_equal_(coef, 0);
+
+    for(size_t i = base; i < size;) {
+        DiffTreeNormTerm term = terms[i];
+
+        for(++i; i < size && !diff_tree_product_term_cmp_(&term, &terms[i], ctx); ++i) {
+            term.num += terms[i].num;
+            diff_tree_mark_to_delete(dtree, terms[i].node);
+            dtree->stats.norm_merged++;
+        }
+
+        if(is_zero || diff_tree_num_equal_(term.num, 0)) {
+            diff_tree_mark_to_delete(dtree, term.node);
+            continue;
+        }
+
+        size_t part = term.num < 0;
+        DiffTreeNode* node = term.node;
+
+        if(!diff_tree_num_equal_(fabs(term.num), 1))
+            node = diff_tree_emit_op_(dtree, OPERATOR_TYPE_POW, node, diff_tree_emit_num_(dtree, fabs(term.num)));
+
+        frac[part] = frac[part] ? diff_tree_emit_op_(dtree, OPERATOR_TYPE_MUL, frac[part], node) : node;
+    }
+
+    if(is_zero)
+        return diff_tree_emit_num_(dtree, 0);
+
+    // a lone denominator takes the coefficient as numerator
+    if(frac[1] && !frac[0])
+        return diff_tree_emit_op_(dtree, OPERATOR_TYPE_DIV, diff_tree_emit_num_(dtree, coef), frac[1]);
+
+    DiffTreeNode* core = frac[1] ? diff_tree_emit_op_(dtree, OPERATOR_TYPE_DIV, frac[0], frac[1]) : frac[0];
+
+    if(!core)
+        return diff_tree_emit_num_(dtree, coef);
+
+    if(diff_tree_num_equal_(coef, 1))
+        return core;
+
+    return diff_tree_emit_op_(dtree, OPERATOR_TYPE_MUL, diff_tree_emit_num_(dtree, coef), core);
+}
+
+static DiffTreeNode* diff_tree_emit_op_(DiffTree* dtree, OperatorType op, DiffTreeNode* left, DiffTreeNode* right)
+{
+    return diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { .op_type = op }, left, right, NULL);
+}
+
+static DiffTreeNode* diff_tree_emit_num_(DiffTree* dtree, double num)
+{
+    return diff_tree_new_node(dtree, NODE_TYPE_NUM, NodeValue { .num = num }, NULL, NULL, NULL);
+}
+
+/// @brief tree nodes are relinked in place, DAG nodes are immutable and rebuilt if a child changed
+static DiffTreeNode* diff_tree_relink_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right)
+{
+    if(dtree->is_dag) {
+        if(left == node->left && right == node->right)
+            return node;
+
+        return diff_tree_new_node(dtree, NODE_TYPE_OP, node->value, left, right, NULL);
+    }
+
+    node->left  = left;
+    node->right = right;
+
+    if(left)  left->parent  = node;
+    if(right) right->parent = node;
+
+    node->var_mask = (left ? left->var_mask : 0) | (right ? right->var_mask : 0);
+
+    return node;
+}
+
+static void diff_tree_push_term_(DiffTreeNormCtx* ctx, double num, DiffTreeNode* node, bool inverse)
+{
+    DiffTreeNormTerm term = {
+        .num     = num,
+        .degree  = 0,
+        .node    = node,
+        .inverse = inverse,
+    };
+
+    if(vector_push(&ctx->terms, &term) != VECTOR_ERR_NONE)
+        ctx->failed = true;
+}
+
+/// @brief frees node itself but not its children, which are moved elsewhere
+static void diff_tree_release_node_(DiffTree* dtree, DiffTreeNode* node)
+{
+    if(dtree->is_dag)
+        return;
+
+    node->left  = NULL;
+    node->right = NULL;
+
+    diff_tree_mark_to_delete(dtree, node);
+}
+
+static bool diff_tree_is_op_(const DiffTreeNode* node, OperatorType op)
+{
+    return node->type == NODE_TYPE_OP && node->value.op_type == op;
+}
+
+static bool diff_tree_is_sum_(const DiffTreeNode* node)
+{
+    return diff_tree_is_op_(node, OPERATOR_TYPE_ADD) || diff_tree_is_op_(node, OPERATOR_TYPE_SUB);
+}
+
+static bool diff_tree_is_product_(const DiffTreeNode* node)
+{
+    return diff_tree_is_op_(node, OPERATOR_TYPE_MUL) || diff_tree_is_op_(node, OPERATOR_TYPE_DIV)
+        || (diff_tree_is_op_(node, OPERATOR_TYPE_POW) && node->right->type == NODE_TYPE_NUM);
+}
+
+static bool diff_tree_is_integer_(double num)
+{
+    return diff_tree_num_equal_(num, round(num));
+}
+
+/// @brief exact, a tiny coefficient is still a coefficient
+static bool diff_tree_num_equal_(double a, double b)
+{
+    return islessequal(a, b) && isgreaterequal(a, b);
+}
+
+/// @brief sum of exponents of a monomial, other operators count as one
+static double diff_tree_degree_(const DiffTreeNode* node)
+{
+    switch(node->type) {
+        case NODE_TYPE_VAR:
+            return 1;
+
+        case NODE_TYPE_OP:
+            break;
+
+        case NODE_TYPE_NUM:
+        case NODE_TYPE_FAKE:
+        default:
+            return 0;
+    }
+
+    if(diff_tree_is_op_(node, OPERATOR_TYPE_MUL))
+        return diff_tree_degree_(node->left) + diff_tree_degree_(node->right);
+
+    if(diff_tree_is_op_(node, OPERATOR_TYPE_DIV))
+        return diff_tree_degree_(node->left) - diff_tree_degree_(node->right);
+
+    if(diff_tree_is_op_(node, OPERATOR_TYPE_POW) && node->right->type == NODE_TYPE_NUM)
+        return node->right->value.num * diff_tree_degree_(node->left);
+
+    return node->var_mask ? 1 : 0;
+}
+
+static int diff_tree_node_rank_(const DiffTreeNode* node)
+{
+    switch(node->type) {
+        case NODE_TYPE_VAR:  return 0;
+        case NODE_TYPE_OP:   return 1;
+        case NODE_TYPE_NUM:  return 2;
+        case NODE_TYPE_FAKE:
+        default:             return 3;
+    }
+}
+
+/// @brief total structural order: variables, then operators, then numbers
+static int diff_tree_node_cmp_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b)
+{
+    if(a == b)
+        return 0;
+
+    if(a->type != b->type)
+        return diff_tree_node_rank_(a) - diff_tree_node_rank_(b);
+
+    switch(a->type) {
+        case NODE_TYPE_VAR:
+            return (a->value.var > b->value.var) - (a->value.var < b->value.var);
+
+        case NODE_TYPE_NUM:
+            return (a->value.num > b->value.num) - (a->value.num < b->value.num);
+
+        case NODE_TYPE_OP:
+            break;
+
+        case NODE_TYPE_FAKE:
+        default:
+            return 0;
+    }
+
+    if(a->value.op_type != b->value.op_type)
+        return (int) a->value.op_type - (int) b->value.op_type;
+
+    if(!ctx->dtree->is_dag)
+        return diff_tree_node_cmp_children_(ctx, a, b);
+
+    int sign = 1;
+    if((uintptr_t) a > (uintptr_t) b) {
+        const DiffTreeNode* tmp = a;
+        a = b;
+        b = tmp;
+        sign = -1;
+    }
+
+    DiffTreeNormCmpEntry* found = diff_tree_cmp_memo_find_(ctx, a, b);
+    if(found)
+        return sign * found->cmp;
+
+    int cmp = diff_tree_node_cmp_children_(ctx, a, b);
+    diff_tree_cmp_memo_insert_(ctx, a, b, cmp);
+
+    return sign * cmp;
+}
+
+/// @brief operators of the same type are ordered by their children
+static int diff_tree_node_cmp_children_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b)
+{
+    if(!a->left != !b->left)
+        return a->left ? 1 : -1;
+
+    int cmp = a->left ? diff_tree_node_cmp_(ctx, a->left, b->left) : 0;
+    if(cmp)
+        return cmp;
+
+    if(!a->right != !b->right)
+        return a->right ? 1 : -1;
+
+    return a->right ? diff_tree_node_cmp_(ctx, a->right, b->right) : 0;
+}
+
+static DiffTreeNormCmpEntry* diff_tree_cmp_memo_find_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b)
+{
+    if(!ctx->cmp_memo.capacity)
+        return NULL;
+
+    size_t mask = ctx->cmp_memo.capacity - 1;
+
+    for(size_t ind = diff_tree_cmp_memo_ind_(a, b, mask); ctx->cmp_memo.buffer[ind].a; ind = (ind + 1) & mask) {
+        DiffTreeNormCmpEntry* entry = &ctx->cmp_memo.buffer[ind];
+
+        if(entry->a == a && entry->b == b)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/// @brief an order that does not fit is only not remembered
+static void diff_tree_cmp_memo_insert_(DiffTreeNormCtx* ctx, const DiffTreeNode* a, const DiffTreeNode* b, int cmp)
+{
+    if((ctx->cmp_memo.size + 1) * 2 > ctx->cmp_memo.capacity) {
+        size_t capacity = ctx->cmp_memo.capacity ? ctx->cmp_memo.capacity * 2 : CMP_MEMO_CAPACITY_MIN;
+
+        DiffTreeNormCmpEntry* buffer = TYPED_CALLOC(capacity, DiffTreeNormCmpEntry);
+        if(!buffer)
+            return;
+
+        for(size_t i = 0; i < ctx->cmp_memo.capacity; ++i) {
+            DiffTreeNormCmpEntry* entry = &ctx->cmp_memo.buffer[i];
+            if(!entry->a) continue;
+
+            size_t ind = diff_tree_cmp_memo_ind_(entry->a, entry->b, capacity - 1);
+            while(buffer[ind].a)
+                ind = (ind + 1) & (capacity - 1);
+
+            buffer[ind] = *entry;
+        }
+
+        NFREE(ctx->cmp_memo.buffer);
+        ctx->cmp_memo.buffer   = buffer;
+        ctx->cmp_memo.capacity = capacity;
+    }
+
+    size_t mask = ctx->cmp_memo.capacity - 1;
+    size_t ind  = diff_tree_cmp_memo_ind_(a, b, mask);
+
+    while(ctx->cmp_memo.buffer[ind].a)
+        ind = (ind + 1) & mask;
+
+    ctx->cmp_memo.buffer[ind] = DiffTreeNormCmpEntry { .a = a, .b = b, .cmp = cmp };
+    ctx->cmp_memo.size++;
+}
+
+static size_t diff_tree_cmp_memo_ind_(const DiffTreeNode* a, const DiffTreeNode* b, size_t mask)
+{
+    uint64_t hash = ((uintptr_t) a * CMP_MEMO_HASH_PRIME) ^ (uintptr_t) b;
+    hash *= CMP_MEMO_HASH_PRIME;
+
+    return (hash ^ (hash >> 29)) & mask;
+}
+
+static int diff_tree_sum_term_cmp_(const void* a, const void* b, void* ctx)
+{
+    const DiffTreeNormTerm* ta = (const DiffTreeNormTerm*) a;
+    const DiffTreeNormTerm* tb = (const DiffTreeNormTerm*) b;
+
+    if(ta->degree > tb->degree) return -1;
+    if(ta->degree < tb->degree) return  1;
+
+    if(ta->inverse != tb->inverse)
+        return ta->inverse ? 1 : -1;
+
+    return diff_tree_node_cmp_((DiffTreeNormCtx*) ctx, ta->node, tb->node);
+}
+
+static int diff_tree_product_term_cmp_(const void* a, const void* b, void* ctx)
+{
+    return diff_tree_node_cmp_((DiffTreeNormCtx*) ctx, ((const DiffTreeNormTerm*) a)->node, ((const DiffTreeNormTerm*) b)->node);
+}
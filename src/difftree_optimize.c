@@ -1,182 +1,479 @@
 #include "difftree_optimize.h"
 
+#include <math.h>
+
 #include "difftree_math.h"
+#include "difftree_normalize.h"
 #include "assertutils.h"
 #include "difftree.h"
 #include "floatutils.h"
+#include "logutils.h"
+#include "operators.h"
 #include "types.h"
 #include "utils.h"
 
 ATTR_UNUSED static const char* LOG_CTG_DIFF_OPT = "DIFFTREE OPTIMIZE";
 
-static bool treeChanged = false;
+#define DEFAULT_WORKLIST_CAPACITY 64
+
+/// @brief pattern and replacement are written in prefix order,
+///        operands of an operator follow it, PAT_END terminates
+typedef enum DiffTreePatKind
+{
+    PAT_END,
+    /// any subtree, captured into slot
+    PAT_ANY,
+    /// subtree structurally equal to the one captured into slot
+    PAT_SAME,
+    /// number equal to num
+    PAT_NUM,
+    /// any number, captured into slot
+    PAT_CONST,
+    /// integer number, captured into slot
+    PAT_INT,
+    /// operator op
+    PAT_OP,
+
+} DiffTreePatKind;
+
+typedef struct DiffTreePatTok
+{
+    DiffTreePatKind kind;
+    OperatorType op;
+    double num;
+    size_t slot;
+
+} DiffTreePatTok;
 
-static DiffTreeNode* diff_tree_const_fold_(DiffTree* dtree, DiffTreeNode* node, Variable* var);
+static const size_t RULE_MAX_TOKENS   = 8;
+static const size_t RULE_MAX_CAPTURES = 4;
 
-static DiffTreeNode* diff_tree_eliminate_neutral_(DiffTree* dtree, DiffTreeNode* node);
+typedef struct DiffTreeRule
+{
+    const char* name;
+    DiffTreePatTok pattern[RULE_MAX_TOKENS];
+    DiffTreePatTok replacement[RULE_MAX_TOKENS];
+
+} DiffTreeRule;
+
+#define OP_(op_)   { PAT_OP,    OPERATOR_TYPE_##op_, 0,    0 }
+#define ANY_(s_)   { PAT_ANY,   OPERATOR_TYPE_NONE,  0,    s_ }
+#define SAME_(s_)  { PAT_SAME,  OPERATOR_TYPE_NONE,  0,    s_ }
+#define NUM_(n_)   { PAT_NUM,   OPERATOR_TYPE_NONE,  n_,   0 }
+#define CONST_(s_) { PAT_CONST, OPERATOR_TYPE_NONE,  0,    s_ }
+#define INT_(s_)   { PAT_INT,   OPERATOR_TYPE_NONE,  0,    s_ }
+
+/// in replacement ANY_, CONST_ and INT_ move the capture, so each is used once,
+/// NUM_ makes a number; new operators are simplified as well, so (a + b) of two
+/// numbers is folded
+static const DiffTreeRule RULES[] =
+{
+    { "0 + u = u",             { OP_(ADD), NUM_(0), ANY_(0) },                                 { ANY_(0) } },
+    { "u + 0 = u",             { OP_(ADD), ANY_(0), NUM_(0) },                                 { ANY_(0) } },
+    { "a*u + b*u = (a + b)*u", { OP_(ADD), OP_(MUL), CONST_(0), ANY_(2), OP_(MUL), CONST_(1), SAME_(2) },
+                               { OP_(MUL), OP_(ADD), CONST_(0), CONST_(1), ANY_(2) } },
+
+    { "u - 0 = u",             { OP_(SUB), ANY_(0), NUM_(0) },                                 { ANY_(0) } },
+    { "u - u = 0",             { OP_(SUB), ANY_(0), SAME_(0) },                                { NUM_(0) } },
+    { "a*u - b*u = (a - b)*u", { OP_(SUB), OP_(MUL), CONST_(0), ANY_(2), OP_(MUL), CONST_(1), SAME_(2) },
+                               { OP_(MUL), OP_(SUB), CONST_(0), CONST_(1), ANY_(2) } },
+
+    { "0 * u = 0",             { OP_(MUL), NUM_(0), ANY_(0) },                                 { NUM_(0) } },
+    { "1 * u = u",             { OP_(MUL), NUM_(1), ANY_(0) },                                 { ANY_(0) } },
+    { "u * 0 = 0",             { OP_(MUL), ANY_(0), NUM_(0) },                                 { NUM_(0) } },
+    { "u * 1 = u",             { OP_(MUL), ANY_(0), NUM_(1) },                                 { ANY_(0) } },
+    { "a*(b*u) = (a*b)*u",     { OP_(MUL), CONST_(0), OP_(MUL), CONST_(1), ANY_(2) },
+                               { OP_(MUL), OP_(MUL), CONST_(0), CONST_(1), ANY_(2) } },
+
+    { "0 / u = 0",             { OP_(DIV), NUM_(0), ANY_(0) },                                 { NUM_(0) } },
+    { "u / 1 = u",             { OP_(DIV), ANY_(0), NUM_(1) },                                 { ANY_(0) } },
+    { "u / u = 1",             { OP_(DIV), ANY_(0), SAME_(0) },                                { NUM_(1) } },
+
+    // no 0 ^ u = 0: it is 1 or inf for u <= 0, and a constant u is folded before rules
+    { "1 ^ u = 1",             { OP_(POW), NUM_(1), ANY_(0) },                                 { NUM_(1) } },
+    { "u ^ 0 = 1",             { OP_(POW), ANY_(0), NUM_(0) },                                 { NUM_(1) } },
+    { "u ^ 1 = u",             { OP_(POW), ANY_(0), NUM_(1) },                                 { ANY_(0) } },
+    // only for integer n, (x^2)^0.5 is |x|
+    { "(u^a)^n = u^(a*n)",     { OP_(POW), OP_(POW), ANY_(0), CONST_(1), INT_(2) },
+                               { OP_(POW), ANY_(0), OP_(MUL), CONST_(1), CONST_(2) } },
+
+    { "ln(exp(u)) = u",        { OP_(LOG), OP_(EXP), ANY_(0) },                                { ANY_(0) } },
+};
+
+#undef OP_
+#undef ANY_
+#undef SAME_
+#undef NUM_
+#undef CONST_
+#undef INT_
 
-static DiffTreeNode* diff_tree_eliminate_neutral_mul_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right);
+typedef uint64_t DiffTreeRuleSet;
 
-static DiffTreeNode* diff_tree_eliminate_neutral_add_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right);
+static_assert(SIZEOF(RULES) <= sizeof(DiffTreeRuleSet) * 8, "rule set does not fit in mask");
 
-static DiffTreeNode* diff_tree_eliminate_neutral_pow_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right);
+/// @brief symbol of a node for the rule index: number, variable or operator
+static const size_t RULE_SYMBOLS = 2 + OPERATOR_TYPE_NONE;
 
-void diff_tree_optimize(DiffTree *dtree, Variable* var)
+/// @brief discrimination index: rules that may match a node,
+///        keyed by its operator and the symbol of its left operand
+typedef struct DiffTreeRuleIndex
 {
-    do {
+    DiffTreeRuleSet rules[OPERATOR_TYPE_NONE][RULE_SYMBOLS];
 
-        treeChanged = false;
-        diff_tree_const_fold_(dtree, dtree->root->left, var);
-        diff_tree_eliminate_neutral_(dtree, dtree->root->left);
+} DiffTreeRuleIndex;
 
-    } while(treeChanged);
-}
+static bool diff_tree_collect_postorder_(Vector* worklist, DiffTreeNode* node);
+
+static DiffTreeNode* diff_tree_simplify_(DiffTree* dtree, DiffTreeNode* node);
+
+static DiffTreeNode* diff_tree_rewrite_node_(DiffTree* dtree, DiffTreeNode* node);
+
+static void diff_tree_refresh_var_mask_(DiffTreeNode* node);
 
-#define CONST_(num_) \
-    diff_tree_new_node(NODE_TYPE_NUM, NodeValue { .num = num_ }, NULL, NULL, node->parent)
+static const DiffTreeRuleIndex* diff_tree_rule_index_(void);
 
-static DiffTreeNode* diff_tree_const_fold_(DiffTree* dtree, DiffTreeNode* node, Variable* var)
+static DiffTreeRuleIndex diff_tree_rule_index_build_(void);
+
+static size_t diff_tree_rule_symbol_(const DiffTreeNode* node);
+
+static bool diff_tree_rule_match_(DiffTree* dtree, const DiffTreePatTok** tok, DiffTreeNode* node, DiffTreeNode** caps);
+
+static DiffTreeNode* diff_tree_rule_build_(DiffTree* dtree, const DiffTreePatTok** tok, DiffTreeNode** caps);
+
+static DiffTreeNode* diff_tree_rule_take_(DiffTree* dtree, DiffTreeNode* cap);
+
+static DiffTreeNode* diff_tree_optimize_dag_(DiffTree* dtree, DiffTreeNode* node);
+
+/* Operators are examined in post-order, so every child is final before
+ * its parent is looked at and a rewrite never has to be propagated
+ * upwards: the parent is still ahead in the worklist. A replacement is
+ * examined again in place, every node costs one visit plus one per rewrite. */
+void diff_tree_optimize(DiffTree *dtree)
 {
-    DiffTreeNode *left = NULL, *right = NULL;
+    utils_assert(dtree);
 
-    if(node->left)
-        left = diff_tree_const_fold_(dtree, node->left, var);
+    if(dtree->is_dag) {
+        dtree->root->left = diff_tree_optimize_dag_(dtree, dtree->root->left);
+        diff_tree_normalize(dtree);
+        return;
+    }
 
-    if(node->right)
-        right = diff_tree_const_fold_(dtree, node->right, var);
+    Vector worklist = VECTOR_INITLIST;
+    if(vector_ctor(&worklist, DEFAULT_WORKLIST_CAPACITY, sizeof(DiffTreeNode*)) != VECTOR_ERR_NONE
+       || !diff_tree_collect_postorder_(&worklist, dtree->root->left)) {
+        UTILS_LOGE(LOG_CTG_DIFF_OPT, "failed to allocate worklist, tree is left as is");
+        vector_dtor(&worklist);
+        return;
+    }
 
-    bool left_has_var = true, right_has_val = true; 
-    if(left)  left_has_var  = diff_tree_subtree_holds_var(left, var);
-    if(right) right_has_val = diff_tree_subtree_holds_var(right, var);
+    for(size_t i = 0; i < worklist.size; ++i) {
+        DiffTreeNode* node     = *(DiffTreeNode**) vector_at(&worklist, i);
+        DiffTreeNode* parent   = node->parent;
+        DiffTreeNode* new_node = diff_tree_simplify_(dtree, node);
 
-    if(!left_has_var && !right_has_val) {
-        DiffTreeNode* new_node 
-            = CONST_(diff_tree_evaluate_op(dtree, node));
-        
-        if(node->parent->left == node)
-            node->parent->left = new_node;
+        if(new_node == node)
+            continue;
 
-        if(node->parent->right == node)
-            node->parent->right = new_node;
+        new_node->parent = parent;
 
+        if(parent->left == node)
+            parent->left = new_node;
+        else if(parent->right == node)
+            parent->right = new_node;
+    }
+
+    vector_dtor(&worklist);
+
+    diff_tree_release_marked(dtree);
+
+    diff_tree_normalize(dtree);
+}
+
+/// @brief leaves are never rewritten and are not collected
+static bool diff_tree_collect_postorder_(Vector* worklist, DiffTreeNode* node)
+{
+    if(node->type != NODE_TYPE_OP)
+        return true;
+
+    if(node->left  && !diff_tree_collect_postorder_(worklist, node->left))
+        return false;
+
+    if(node->right && !diff_tree_collect_postorder_(worklist, node->right))
+        return false;
+
+    return vector_push(worklist, &node) == VECTOR_ERR_NONE;
+}
+
+/// @brief rewrites node until no rule applies, replaced nodes are marked to delete
+/// @return replacement without parent or node itself
+static DiffTreeNode* diff_tree_simplify_(DiffTree* dtree, DiffTreeNode* node)
+{
+    DiffTreeNode* new_node = NULL;
+
+    dtree->stats.opt_visits++;
+
+    while((new_node = diff_tree_rewrite_node_(dtree, node)) != node) {
         diff_tree_mark_to_delete(dtree, node);
 
-        treeChanged = true;
+        dtree->stats.opt_rewrites++;
+        dtree->stats.opt_visits++;
 
-        return new_node;
+        node = new_node;
     }
 
     return node;
 }
 
-#define IS_VALUE_(node, val) \
-    ((node->type == NODE_TYPE_NUM) && (utils_equal_with_precision(node->value.num, val)))
-
-#define cL diff_tree_copy_subtree(dtree, node->left, node)
-#define cR diff_tree_copy_subtree(dtree, node->right, node)
-
-static DiffTreeNode* diff_tree_eliminate_neutral_(DiffTree* dtree, DiffTreeNode* node)
+/// @return replacement for node or node itself if no rule applies
+static DiffTreeNode* diff_tree_rewrite_node_(DiffTree* dtree, DiffTreeNode* node)
 {
     utils_assert(dtree);
     utils_assert(node);
 
-    DiffTreeNode *left = NULL, *right = NULL, *new_node = node;
-    
     if(node->type != NODE_TYPE_OP)
         return node;
 
-    if(node->left)
-        left = diff_tree_eliminate_neutral_(dtree, node->left);
+    DiffTreeNode *left = node->left, *right = node->right;
 
-    if(node->right)
-        right = diff_tree_eliminate_neutral_(dtree, node->right);
+    if(!dtree->is_dag)
+        diff_tree_refresh_var_mask_(node);
 
+    if(left && right && !left->var_mask && !right->var_mask)
+        return diff_tree_new_node(dtree, NODE_TYPE_NUM, NodeValue { .num = diff_tree_evaluate_op(dtree, node) }, NULL, NULL, NULL);
 
-    if(node->value.op_type == OPERATOR_TYPE_MUL)
-        new_node = diff_tree_eliminate_neutral_mul_(dtree, node, left, right);
+    DiffTreeRuleSet candidates = diff_tree_rule_index_()->rules[node->value.op_type][diff_tree_rule_symbol_(left)];
 
-    else if(node->value.op_type== OPERATOR_TYPE_ADD)
-        new_node = diff_tree_eliminate_neutral_add_(dtree, node, left, right);
+    for(size_t i = 0; candidates; ++i, candidates >>= 1) {
+        if(!(candidates & 1))
+            continue;
 
-    else if(node->value.op_type== OPERATOR_TYPE_POW)
-        new_node = diff_tree_eliminate_neutral_pow_(dtree, node, left, right);
+        DiffTreeNode* caps[RULE_MAX_CAPTURES] = {};
+        const DiffTreePatTok* tok = RULES[i].pattern;
 
+        if(diff_tree_rule_match_(dtree, &tok, node, caps)) {
+            tok = RULES[i].replacement;
+            return diff_tree_rule_build_(dtree, &tok, caps);
+        }
+    }
 
-    if(new_node != node) {
-        if(node->parent->left == node)
-            node->parent->left = new_node;
+    return node;
+}
 
-        else if(node->parent->right == node)
-            node->parent->right = new_node;
+/// @brief children may have been relinked by a rewrite, leaves never change
+static void diff_tree_refresh_var_mask_(DiffTreeNode* node)
+{
+    if(node->type != NODE_TYPE_OP)
+        return;
 
-        treeChanged = true;
+    node->var_mask = (node->left  ? node->left->var_mask  : 0)
+                   | (node->right ? node->right->var_mask : 0);
+}
 
-        diff_tree_mark_to_delete(dtree, node);
+static const DiffTreeRuleIndex* diff_tree_rule_index_(void)
+{
+    static const DiffTreeRuleIndex index = diff_tree_rule_index_build_();
+
+    return &index;
+}
+
+/// @brief a rule goes to every symbol its left operand pattern accepts
+static DiffTreeRuleIndex diff_tree_rule_index_build_(void)
+{
+    DiffTreeRuleIndex index = {};
+
+    for(size_t i = 0; i < SIZEOF(RULES); ++i) {
+        const DiffTreePatTok* root = &RULES[i].pattern[0];
+        const DiffTreePatTok* left = &RULES[i].pattern[1];
+
+        utils_assert(root->kind == PAT_OP);
+
+        for(size_t sym = 0; sym < RULE_SYMBOLS; ++sym) {
+            bool accepts = false;
+
+            switch(left->kind) {
+                case PAT_ANY:
+                    accepts = true;
+                    break;
+                case PAT_NUM:
+                case PAT_CONST:
+                case PAT_INT:
+                    accepts = sym == 0;
+                    break;
+                case PAT_OP:
+                    accepts = sym == 2 + (size_t) left->op;
+                    break;
+                case PAT_SAME:
+                case PAT_END:
+                default:
+                    utils_assert(0 && "left operand pattern can not refer to a capture");
+                    break;
+            }
+
+            if(accepts)
+                index.rules[root->op][sym] |= (DiffTreeRuleSet) 1 << i;
+        }
+
+        size_t uses[RULE_MAX_CAPTURES] = {};
+
+        for(size_t j = 0; j < RULE_MAX_TOKENS; ++j) {
+            const DiffTreePatTok* tok = &RULES[i].replacement[j];
+
+            if(tok->kind == PAT_ANY || tok->kind == PAT_CONST || tok->kind == PAT_INT) {
+                ++uses[tok->slot];
+                utils_assert(uses[tok->slot] == 1 && "a moved capture can not be used twice");
+            }
+        }
     }
 
-    return new_node;
+    return index;
 }
 
-static DiffTreeNode* diff_tree_eliminate_neutral_mul_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right)
+static size_t diff_tree_rule_symbol_(const DiffTreeNode* node)
 {
-    utils_assert(dtree);
-    utils_assert(node);
-    utils_assert(left);
-    utils_assert(right);
+    switch(node->type) {
+        case NODE_TYPE_NUM:
+            return 0;
+        case NODE_TYPE_VAR:
+            return 1;
+        case NODE_TYPE_OP:
+            return 2 + (size_t) node->value.op_type;
+        case NODE_TYPE_FAKE:
+        default:
+            utils_assert(0 && "fake node inside expression");
+            return 1;
+    }
+}
 
-    utils_assert(node->type == NODE_TYPE_OP);
-    utils_assert(node->value.op_type == OPERATOR_TYPE_MUL);
+static bool diff_tree_rule_match_(DiffTree* dtree, const DiffTreePatTok** tok, DiffTreeNode* node, DiffTreeNode** caps)
+{
+    const DiffTreePatTok* t = (*tok)++;
+
+    switch(t->kind) {
+        case PAT_ANY:
+            caps[t->slot] = node;
+            return true;
+
+        // in DAG mode equal subtrees are the same node
+        case PAT_SAME:
+            if(caps[t->slot] == node)
+                return true;
+            return !dtree->is_dag && diff_tree_subtree_equal(dtree, caps[t->slot], node);
+
+        // exact: normalized coefficients may be tiny but are not zero
+        case PAT_NUM:
+            return node->type == NODE_TYPE_NUM && islessequal(node->value.num, t->num) && isgreaterequal(node->value.num, t->num);
+
+        case PAT_INT:
+            if(node->type != NODE_TYPE_NUM || !utils_equal_with_precision(node->value.num, round(node->value.num)))
+                return false;
+            caps[t->slot] = node;
+            return true;
+
+        case PAT_CONST:
+            if(node->type != NODE_TYPE_NUM)
+                return false;
+            caps[t->slot] = node;
+            return true;
+
+        case PAT_OP:
+            if(node->type != NODE_TYPE_OP || node->value.op_type != t->op)
+                return false;
+            if(!diff_tree_rule_match_(dtree, tok, node->left, caps))
+                return false;
+            if(get_operator(t->op)->argnum != OPERATOR_ARGNUM_2)
+                return true;
+            return node->right && diff_tree_rule_match_(dtree, tok, node->right, caps);
+
+        case PAT_END:
+        default:
+            return false;
+    }
+}
 
-    DiffTreeNode* new_node = node;
+/// @brief new operators are simplified right away, so the result is final
+static DiffTreeNode* diff_tree_rule_build_(DiffTree* dtree, const DiffTreePatTok** tok, DiffTreeNode** caps)
+{
+    const DiffTreePatTok* t = (*tok)++;
 
-    if     (IS_VALUE_(left,  0.f)) new_node = CONST_(0.f);
-    else if(IS_VALUE_(left,  1.f)) new_node = cR;
-    else if(IS_VALUE_(right, 0.f)) new_node = CONST_(0.f);
-    else if(IS_VALUE_(right, 1.f)) new_node = cL;
+    switch(t->kind) {
+        case PAT_ANY:
+        case PAT_CONST:
+        case PAT_INT:
+            return diff_tree_rule_take_(dtree, caps[t->slot]);
 
-    return new_node;
-}
+        case PAT_NUM:
+            return diff_tree_new_node(dtree, NODE_TYPE_NUM, NodeValue { .num = t->num }, NULL, NULL, NULL);
 
+        case PAT_OP:
+        {
+            DiffTreeNode *left = diff_tree_rule_build_(dtree, tok, caps), *right = NULL;
 
-static DiffTreeNode* diff_tree_eliminate_neutral_add_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right)
+            if(get_operator(t->op)->argnum == OPERATOR_ARGNUM_2)
+                right = diff_tree_rule_build_(dtree, tok, caps);
+
+            DiffTreeNode* node = diff_tree_new_node(dtree, NODE_TYPE_OP, NodeValue { .op_type = t->op }, left, right, NULL);
+
+            return diff_tree_simplify_(dtree, node);
+        }
+
+        case PAT_SAME:
+        case PAT_END:
+        default:
+            utils_assert(0 && "replacement can only copy captures");
+            return NULL;
+    }
+}
+
+/// @brief O(1): the capture is unlinked from the matched subtree, which is freed
+///        without it; in DAG mode nodes are shared and are never freed
+static DiffTreeNode* diff_tree_rule_take_(DiffTree* dtree, DiffTreeNode* cap)
 {
-    utils_assert(dtree);
-    utils_assert(node);
-    utils_assert(left);
-    utils_assert(right);
+    if(dtree->is_dag)
+        return cap;
 
-    utils_assert(node->type == NODE_TYPE_OP);
-    utils_assert(node->value.op_type == OPERATOR_TYPE_ADD);
+    DiffTreeNode* parent = cap->parent;
+    utils_assert(parent && (parent->left == cap || parent->right == cap));
 
-    DiffTreeNode* new_node = node;
+    if(parent->left == cap)
+        parent->left = NULL;
+    else if(parent->right == cap)
+        parent->right = NULL;
 
-    if     (IS_VALUE_(left, 0.f))  new_node = cR;
-    else if(IS_VALUE_(right, 0.f)) new_node = cL;
-    
-    return new_node;
+    cap->parent = NULL;
+
+    return cap;
 }
 
-static DiffTreeNode* diff_tree_eliminate_neutral_pow_(DiffTree* dtree, DiffTreeNode* node, DiffTreeNode* left, DiffTreeNode* right)
+/* In DAG mode nodes are immutable, so the tree is rebuilt bottom-up.
+ * Children are optimized before their parent and the simplified node
+ * is final, so a single memoized pass reaches the same fixpoint
+ * as the worklist above. */
+static DiffTreeNode* diff_tree_optimize_dag_(DiffTree* dtree, DiffTreeNode* node)
 {
     utils_assert(dtree);
     utils_assert(node);
-    utils_assert(left);
-    utils_assert(right);
 
-    utils_assert(node->type == NODE_TYPE_OP);
-    utils_assert(node->value.op_type == OPERATOR_TYPE_POW);
+    if(node->type != NODE_TYPE_OP)
+        return node;
+
+    PtrMapVal* found = ptr_map_find(&dtree->dag_memo.optimized, node);
+    if(found) return (DiffTreeNode*) found->ptr;
+
+    DiffTreeNode *left = NULL, *right = NULL, *new_node = node;
 
-    DiffTreeNode* new_node = node;
+    if(node->left)
+        left = diff_tree_optimize_dag_(dtree, node->left);
 
-    if      (IS_VALUE_(left,  0.f)) new_node = CONST_(0.f); // 0 ^ x = 0
-    else if (IS_VALUE_(left,  1.f)) new_node = CONST_(1.f); // 1 ^ x = 1
-    else if (IS_VALUE_(right, 0.f)) new_node = CONST_(1.f); // x ^ 0 = 1
-    else if (IS_VALUE_(right, 1.f)) new_node = cL;          // x ^ 1 = x
+    if(node->right)
+        right = diff_tree_optimize_dag_(dtree, node->right);
+
+    if(left != node->left || right != node->right)
+        new_node = diff_tree_new_node(dtree, NODE_TYPE_OP, node->value, left, right, NULL);
+
+    new_node = diff_tree_simplify_(dtree, new_node);
+
+    ptr_map_insert(&dtree->dag_memo.optimized, node, PtrMapVal { .ptr = new_node });
+    ptr_map_insert(&dtree->dag_memo.optimized, new_node, PtrMapVal { .ptr = new_node });
 
     return new_node;
 }
-
-#undef CONST_
-#undef IS_VALUE_
-#undef cL
-#undef cR
@@ -0,0 +1,239 @@
+#include "difftree_sink.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+#include "utils.h"
+
+ATTR_UNUSED static const char* LOG_CTG_SINK = "DIFFTREE SINK";
+
+/// a file sink is written out once this much text is buffered
+static const size_t SINK_BLOCK = 1 << 16;
+
+/// below it x * 10^prec is off by at most 2^-13, so digits are exact
+/// unless the fraction is close to a tie
+static const double FIXED_SCALED_MAX = 1099511627776.0; // 2^40
+static const double FIXED_TIE_EPS    = 1e-3;
+
+static const uint64_t POW10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static bool diff_tree_sink_reserve_(DiffTreeSink* sink, size_t len);
+
+void diff_tree_sink_ctor(DiffTreeSink* sink, FILE* file)
+{
+    utils_assert(sink);
+
+    *sink = {
+        .buf      = NULL,
+        .len      = 0,
+        .capacity = 0,
+        .flushed  = 0,
+        .file     = file,
+        .err      = DIFF_TREE_ERR_NONE,
+    };
+}
+
+/// @brief makes room for len more characters and the terminating \0,
+///        a file sink is flushed before it grows
+static bool diff_tree_sink_reserve_(DiffTreeSink* sink, size_t len)
+{
+    if(sink->err != DIFF_TREE_ERR_NONE)
+        return false;
+
+    if(sink->len + len < sink->capacity)
+        return true;
+
+    if(sink->file && sink->len > 0) {
+        if(diff_tree_sink_flush(sink) != DIFF_TREE_ERR_NONE)
+            return false;
+
+        if(len < sink->capacity)
+            return true;
+    }
+
+    size_t capacity = sink->capacity ? sink->capacity : SINK_BLOCK;
+    while(capacity <= sink->len + len)
+        capacity *= 2;
+
+    char* buf = (char*) realloc(sink->buf, capacity);
+    if(!buf) {
+        UTILS_LOGE(LOG_CTG_SINK, "can't grow buffer to %zu bytes", capacity);
+        sink->err = DIFF_TREE_ALLOC_FAIL;
+        return false;
+    }
+
+    sink->buf      = buf;
+    sink->capacity = capacity;
+
+    return true;
+}
+
+void diff_tree_sink_write(DiffTreeSink* sink, const char* str, size_t len)
+{
+    utils_assert(sink);
+    utils_assert(str);
+
+    if(!diff_tree_sink_reserve_(sink, len))
+        return;
+
+    memcpy(sink->buf + sink->len, str, len);
+    sink->len += len;
+
+    if(sink->file && sink->len >= SINK_BLOCK)
+        diff_tree_sink_flush(sink);
+}
+
+void diff_tree_sink_puts(DiffTreeSink* sink, const char* str)
+{
+    utils_assert(str);
+
+    diff_tree_sink_write(sink, str, strlen(str));
+}
+
+void diff_tree_sink_putc(DiffTreeSink* sink, char ch)
+{
+    utils_assert(sink);
+
+    if(sink->len + 1 < sink->capacity && sink->err == DIFF_TREE_ERR_NONE) {
+        sink->buf[sink->len++] = ch;
+        return;
+    }
+
+    diff_tree_sink_write(sink, &ch, 1);
+}
+
+void diff_tree_sink_printf(DiffTreeSink* sink, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    diff_tree_sink_vprintf(sink, fmt, args);
+    va_end(args);
+}
+
+void diff_tree_sink_vprintf(DiffTreeSink* sink, const char* fmt, va_list args)
+{
+    utils_assert(sink);
+    utils_assert(fmt);
+
+    if(sink->err != DIFF_TREE_ERR_NONE)
+        return;
+
+    va_list args_copy;
+    va_copy(args_copy, args);
+
+    // formatted in place when it fits, otherwise once more after the buffer grows
+    size_t avail = sink->capacity - sink->len;
+    int len = vsnprintf(avail ? sink->buf + sink->len : NULL, avail, fmt, args);
+
+    if(len < 0) {
+        UTILS_LOGE(LOG_CTG_SINK, "can't format \"%s\"", fmt);
+        sink->err = DIFF_TREE_IO_ERR;
+    }
+    else if((size_t) len < avail) {
+        sink->len += (size_t) len;
+    }
+    else if(diff_tree_sink_reserve_(sink, (size_t) len)) {
+        vsnprintf(sink->buf + sink->len, sink->capacity - sink->len, fmt, args_copy);
+        sink->len += (size_t) len;
+    }
+
+    va_end(args_copy);
+
+    if(sink->file && sink->len >= SINK_BLOCK)
+        diff_tree_sink_flush(sink);
+}
+
+void diff_tree_sink_fixed(DiffTreeSink* sink, double x, unsigned prec)
+{
+    utils_assert(prec < SIZEOF(POW10));
+
+    double scaled = fabs(x) * (double) POW10[prec];
+    double whole  = floor(scaled);
+    double frac   = scaled - whole;
+
+    // infinities, NaNs, huge values and near ties are left to printf
+    if(!(scaled < FIXED_SCALED_MAX) || fabs(frac - 0.5) < FIXED_TIE_EPS) {
+        diff_tree_sink_printf(sink, "%.*f", (int) prec, x);
+        return;
+    }
+
+    uint64_t digits = (uint64_t) whole + (frac > 0.5);
+
+    char str[32] = {};
+    size_t pos = sizeof(str);
+
+    for(unsigned i = 0; i < prec; ++i, digits /= 10)
+        str[--pos] = (char) ('0' + digits % 10);
+
+    if(prec > 0)
+        str[--pos] = '.';
+
+    do {
+        str[--pos] = (char) ('0' + digits % 10);
+        digits /= 10;
+    } while(digits);
+
+    if(signbit(x))
+        str[--pos] = '-';
+
+    diff_tree_sink_write(sink, str + pos, sizeof(str) - pos);
+}
+
+DiffTreeErr diff_tree_sink_flush(DiffTreeSink* sink)
+{
+    utils_assert(sink);
+
+    if(!sink->file || sink->len == 0)
+        return sink->err;
+
+    if(sink->err == DIFF_TREE_ERR_NONE && fwrite(sink->buf, 1, sink->len, sink->file) != sink->len) {
+        UTILS_LOGE(LOG_CTG_SINK, "can't write %zu bytes", sink->len);
+        sink->err = DIFF_TREE_IO_ERR;
+    }
+
+    sink->flushed += sink->len;
+    sink->len = 0;
+
+    return sink->err;
+}
+
+size_t diff_tree_sink_size(const DiffTreeSink* sink)
+{
+    utils_assert(sink);
+
+    return sink->flushed + sink->len;
+}
+
+const char* diff_tree_sink_str(DiffTreeSink* sink, size_t* len)
+{
+    utils_assert(sink);
+    utils_assert(!sink->file);
+
+    if(len)
+        *len = sink->len;
+
+    if(!sink->buf)
+        return "";
+
+    sink->buf[sink->len] = '\0';
+
+    return sink->buf;
+}
+
+void diff_tree_sink_dtor(DiffTreeSink* sink)
+{
+    utils_assert(sink);
+
+    NFREE(sink->buf);
+    sink->len      = 0;
+    sink->capacity = 0;
+    sink->flushed  = 0;
+    sink->file     = NULL;
+}
@@ -0,0 +1,237 @@
+#include "difftree_source.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assertutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+ATTR_UNUSED static const char* LOG_CTG_SOURCE = "DIFFTREE SOURCE";
+
+static const size_t WINDOW_CAPACITY_MIN = 1 << 16;
+
+/// consumed part of a mapping is dropped by steps, so madvise is rare
+static const size_t MAP_RELEASE_STEP = 1 << 22;
+
+static DiffTreeErr diff_tree_source_fill_(DiffTreeSource* src, bool* is_full);
+
+static DiffTreeErr diff_tree_source_reserve_(DiffTreeSource* src, size_t size);
+
+static DiffTreeErr diff_tree_source_tail_(DiffTreeSource* src, const char* tail, size_t len, const char** line, size_t* line_len);
+
+DiffTreeErr diff_tree_source_open(DiffTreeSource* src, const char* filename)
+{
+    utils_assert(src);
+
+    *src = {
+        .filename     = filename ? filename : "-",
+        .fd           = STDIN_FILENO,
+        .map          = NULL,
+        .map_addr     = NULL,
+        .map_len      = 0,
+        .map_released = 0,
+        .window       = NULL,
+        .window_len   = 0,
+        .window_cap   = 0,
+        .pos          = 0,
+        .kept         = 0,
+        .read_eof     = false,
+        .eof          = false,
+    };
+
+    if(filename && strcmp(filename, "-") != 0) {
+        src->fd = open(filename, O_RDONLY);
+        if(src->fd < 0) {
+            UTILS_LOGE(LOG_CTG_SOURCE, "can't open %s", filename);
+            return DIFF_TREE_IO_ERR;
+        }
+
+        struct stat st = {};
+        if(fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+
+            if(map != MAP_FAILED) {
+                madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+                src->map      = (const char*) map;
+                src->map_addr = map;
+                src->map_len  = (size_t) st.st_size;
+                src->read_eof = true;
+            }
+        }
+    }
+
+    // pipes, stdin and files that could not be mapped are read by chunks
+    if(!src->map)
+        return diff_tree_source_reserve_(src, WINDOW_CAPACITY_MIN);
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+DiffTreeErr diff_tree_source_next(DiffTreeSource* src, const char** line, size_t* len)
+{
+    utils_assert(src);
+    utils_assert(line);
+    utils_assert(len);
+
+    *line = NULL;
+    *len  = 0;
+
+    while(!src->eof) {
+        const char* data = src->map ? src->map : src->window;
+        size_t size      = src->map ? src->map_len : src->window_len;
+
+        const char* nl = (const char*) memchr(data + src->pos, '\n', size - src->pos);
+
+        if(nl) {
+            *line = data + src->pos;
+            *len  = (size_t) (nl - *line) + 1;
+            src->pos = (size_t) (nl - data) + 1;
+            return DIFF_TREE_ERR_NONE;
+        }
+
+        if(src->read_eof) {
+            src->eof = true;
+
+            if(src->pos == size)
+                return DIFF_TREE_ERR_NONE;
+
+            return diff_tree_source_tail_(src, data + src->pos, size - src->pos, line, len);
+        }
+
+        bool is_full = false;
+
+        DiffTreeErr err = diff_tree_source_fill_(src, &is_full);
+        if(err != DIFF_TREE_ERR_NONE || is_full)
+            return err;
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+void diff_tree_source_discard(DiffTreeSource* src)
+{
+    utils_assert(src);
+
+    src->kept = src->pos;
+
+    if(!src->map)
+        return;
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t release = page > 0 ? src->kept - src->kept % (size_t) page : 0;
+
+    if(release - src->map_released >= MAP_RELEASE_STEP) {
+        madvise((char*) src->map_addr + src->map_released, release - src->map_released, MADV_DONTNEED);
+        src->map_released = release;
+    }
+}
+
+bool diff_tree_source_eof(const DiffTreeSource* src)
+{
+    utils_assert(src);
+
+    return src->eof;
+}
+
+void diff_tree_source_close(DiffTreeSource* src)
+{
+    utils_assert(src);
+
+    if(src->map)
+        munmap(src->map_addr, src->map_len);
+
+    if(src->fd >= 0 && src->fd != STDIN_FILENO)
+        close(src->fd);
+
+    NFREE(src->window);
+
+    src->map      = NULL;
+    src->map_addr = NULL;
+    src->fd       = -1;
+}
+
+/// @brief lines not discarded yet are never moved, if they fill the window is_full is set
+static DiffTreeErr diff_tree_source_fill_(DiffTreeSource* src, bool* is_full)
+{
+    if(src->kept == src->pos && src->pos > 0) {
+        memmove(src->window, src->window + src->pos, src->window_len - src->pos);
+        src->window_len -= src->pos;
+        src->pos  = 0;
+        src->kept = 0;
+    }
+
+    if(src->window_len == src->window_cap) {
+        if(src->kept != src->pos) {
+            *is_full = true;
+            return DIFF_TREE_ERR_NONE;
+        }
+
+        // a line longer than the window
+        DiffTreeErr err = diff_tree_source_reserve_(src, 2 * src->window_cap);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+    }
+
+    ssize_t bytes = read(src->fd, src->window + src->window_len, src->window_cap - src->window_len);
+
+    if(bytes < 0) {
+        UTILS_LOGE(LOG_CTG_SOURCE, "%s: read failed", src->filename);
+        return DIFF_TREE_IO_ERR;
+    }
+
+    src->window_len += (size_t) bytes;
+    src->read_eof = bytes == 0;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static DiffTreeErr diff_tree_source_reserve_(DiffTreeSource* src, size_t size)
+{
+    if(size <= src->window_cap)
+        return DIFF_TREE_ERR_NONE;
+
+    char* window = (char*) realloc(src->window, size);
+    window verified(return DIFF_TREE_ALLOC_FAIL);
+
+    src->window     = window;
+    src->window_cap = size;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief the last line is not terminated, it is the only one ever copied, with \n appended
+static DiffTreeErr diff_tree_source_tail_(DiffTreeSource* src, const char* tail, size_t len, const char** line, size_t* line_len)
+{
+    size_t offset = 0;
+
+    if(!src->map) {
+        // tail is already in the window, lines before it are not moved
+        offset = (size_t) (tail - src->window);
+        if(offset + len + 1 > src->window_cap && src->kept != src->pos) {
+            src->eof = false;
+            return DIFF_TREE_ERR_NONE;
+        }
+    }
+
+    DiffTreeErr err = diff_tree_source_reserve_(src, offset + len + 1);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
+
+    if(src->map)
+        memcpy(src->window, tail, len);
+
+    src->window[offset + len] = '\n';
+
+    *line     = src->window + offset;
+    *line_len = len + 1;
+
+    src->pos = src->map ? src->map_len : offset + len + 1;
+    src->window_len = src->map ? 0 : src->pos;
+
+    return DIFF_TREE_ERR_NONE;
+}
@@ -0,0 +1,762 @@
+#include "difftree_tape.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "assertutils.h"
+#include "floatutils.h"
+#include "hashutils.h"
+#include "logutils.h"
+#include "memutils.h"
+
+#include "types.h"
+#include "variable.h"
+#include "vmath.h"
+
+#define LOG_CTG_TAPE "DIFFTREE_TAPE"
+
+#define DEFAULT_CODE_VECTOR_CAPACITY 64
+#define DEFAULT_CSE_TABLE_CAPACITY   64
+
+static const size_t CSE_NONE = (size_t) -1;
+
+static const double POWI_MAX_EXPONENT = 64;
+
+static_assert(TAPE_BATCH_BLOCK % VMATH_LANES == 0, "batch rows must consist of whole vectors");
+
+/// @brief structurally equal subtrees share one entry, keyed by
+///        node type, value and entries of children
+typedef struct DiffTreeTapeCseEntry
+{
+    NodeType type;
+    NodeValue value;
+    size_t left;
+    size_t right;
+
+    /// references from distinct parent entries, plus one for the root
+    size_t uses;
+    /// nodes in the subtree, counted as a tree
+    size_t nodes;
+    size_t temp;
+
+} DiffTreeTapeCseEntry;
+
+/// node waiting in the scan or emit walk for its children
+typedef struct DiffTreeTapeFrame
+{
+    DiffTreeNode* node;
+    /// stack depth its value is pushed at, emit only
+    size_t depth;
+    bool is_expanded;
+
+} DiffTreeTapeFrame;
+
+typedef struct DiffTreeTapeCse
+{
+    Vector entries;
+
+    /// open addressing, stores entry index + 1, 0 is empty
+    size_t* table;
+    size_t capacity;
+
+    /// node -> entry index, nodes are shared in DAG mode
+    PtrMap ids;
+
+    /// explicit stack of both walks, derivatives may be deeper than the call stack allows
+    DiffTreeTapeFrame* frames;
+    size_t frames_cnt;
+    size_t frames_capacity;
+
+    /// entries of scanned subtrees whose parents are not scanned yet
+    size_t* results;
+    size_t results_cnt;
+    size_t results_capacity;
+
+} DiffTreeTapeCse;
+
+static DiffTreeErr diff_tree_tape_cse_ctor_(DiffTreeTapeCse* cse);
+
+static void diff_tree_tape_cse_dtor_(DiffTreeTapeCse* cse);
+
+static DiffTreeErr diff_tree_tape_cse_scan_(DiffTreeTapeCse* cse, DiffTreeNode* root, size_t* id);
+
+static DiffTreeErr diff_tree_tape_cse_insert_(DiffTreeTapeCse* cse, DiffTreeNode* node, size_t* id);
+
+static DiffTreeErr diff_tree_tape_cse_realloc_(DiffTreeTapeCse* cse, size_t capacity);
+
+static size_t diff_tree_tape_cse_hash_(const DiffTreeTapeCseEntry* entry);
+
+static bool diff_tree_tape_cse_equal_(const DiffTreeTapeCseEntry* a, const DiffTreeTapeCseEntry* b);
+
+static DiffTreeErr diff_tree_tape_emit_(DiffTreeTape* tape, DiffTree* dtree, DiffTreeTapeCse* cse, DiffTreeNode* root);
+
+static DiffTreeErr diff_tree_tape_emit_node_(DiffTreeTape* tape, DiffTree* dtree, DiffTreeTapeCse* cse, DiffTreeNode* node, size_t depth);
+
+static bool diff_tree_tape_grow_(void** arr, size_t* capacity, size_t size, size_t tsize);
+
+#define GROW_(arr, size)                                                                      \
+    diff_tree_tape_grow_((void**) &cse->arr, &cse->arr##_capacity, size, sizeof(*cse->arr))
+
+static DiffTreeErr diff_tree_tape_push_(DiffTreeTape* tape, DiffTreeTapeInstr instr);
+
+static bool diff_tree_tape_is_small_int_(DiffTreeNode* node);
+
+static bool diff_tree_tape_eval_block_(DiffTreeTape* tape, const double* vars, size_t slot, const double* xs, double** top);
+
+static DiffTreeLaneErr diff_tree_tape_lane_err_(double x, double res);
+
+DiffTreeErr diff_tree_tape_ctor(DiffTreeTape* tape)
+{
+    utils_assert(tape);
+
+    tape->stack_max   = 0;
+    tape->stack       = NULL;
+    tape->temps_cnt   = 0;
+    tape->temps       = NULL;
+    tape->batch_stack = NULL;
+    tape->grad_vals   = NULL;
+    tape->grad_links  = NULL;
+    tape->vars_cnt    = 0;
+
+    if(vector_ctor(&tape->code, DEFAULT_CODE_VECTOR_CAPACITY, sizeof(DiffTreeTapeInstr)) != VECTOR_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+void diff_tree_tape_dtor(DiffTreeTape* tape)
+{
+    utils_assert(tape);
+
+    vector_dtor(&tape->code);
+    NFREE(tape->stack);
+    NFREE(tape->temps);
+    NFREE(tape->batch_stack);
+    NFREE(tape->grad_vals);
+    NFREE(tape->grad_links);
+
+    tape->stack_max = 0;
+    tape->temps_cnt = 0;
+    tape->vars_cnt  = 0;
+}
+
+DiffTreeErr diff_tree_tape_compile(DiffTreeTape* tape, DiffTree* dtree, DiffTreeNode* node)
+{
+    utils_assert(tape);
+    utils_assert(dtree);
+    utils_assert(node);
+
+    vector_free(&tape->code);
+    NFREE(tape->grad_vals);
+    NFREE(tape->grad_links);
+    tape->stack_max = 0;
+    tape->temps_cnt = 0;
+    tape->vars_cnt  = dtree->vars.size;
+
+    DiffTreeTapeCse cse = {};
+    DiffTreeErr err = diff_tree_tape_cse_ctor_(&cse);
+
+    size_t root_id = 0;
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_cse_scan_(&cse, node, &root_id);
+    if(err == DIFF_TREE_ERR_NONE) {
+        ((DiffTreeTapeCseEntry*) vector_at(&cse.entries, root_id))->uses++;
+        err = diff_tree_tape_emit_(tape, dtree, &cse, node);
+    }
+
+    diff_tree_tape_cse_dtor_(&cse);
+
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
+
+    dtree->stats.cse_temps += tape->temps_cnt;
+
+    NFREE(tape->stack);
+    tape->stack = TYPED_CALLOC(tape->stack_max, double);
+    tape->stack verified(return DIFF_TREE_ALLOC_FAIL);
+
+    NFREE(tape->temps);
+    tape->temps = TYPED_CALLOC(tape->temps_cnt + 1, double);
+    tape->temps verified(return DIFF_TREE_ALLOC_FAIL);
+
+    NFREE(tape->batch_stack);
+    tape->batch_stack = TYPED_CALLOC((tape->stack_max + tape->temps_cnt) * TAPE_BATCH_BLOCK, double);
+    tape->batch_stack verified(return DIFF_TREE_ALLOC_FAIL);
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static DiffTreeErr diff_tree_tape_cse_ctor_(DiffTreeTapeCse* cse)
+{
+    if(vector_ctor(&cse->entries, DEFAULT_CSE_TABLE_CAPACITY, sizeof(DiffTreeTapeCseEntry)) != VECTOR_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    if(ptr_map_ctor(&cse->ids, DEFAULT_CSE_TABLE_CAPACITY) != PTR_MAP_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    cse->table    = TYPED_CALLOC(DEFAULT_CSE_TABLE_CAPACITY, size_t);
+    cse->capacity = DEFAULT_CSE_TABLE_CAPACITY;
+    cse->table verified(return DIFF_TREE_ALLOC_FAIL);
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static void diff_tree_tape_cse_dtor_(DiffTreeTapeCse* cse)
+{
+    vector_dtor(&cse->entries);
+    ptr_map_dtor(&cse->ids);
+    NFREE(cse->table);
+    NFREE(cse->frames);
+    NFREE(cse->results);
+    cse->capacity         = 0;
+    cse->frames_capacity  = 0;
+    cse->results_capacity = 0;
+}
+
+/// @brief assigns entries bottom-up in post-order with an explicit stack
+static DiffTreeErr diff_tree_tape_cse_scan_(DiffTreeTapeCse* cse, DiffTreeNode* root, size_t* id)
+{
+    cse->frames_cnt  = 0;
+    cse->results_cnt = 0;
+
+    if(!GROW_(frames, 1))
+        return DIFF_TREE_ALLOC_FAIL;
+
+    cse->frames[cse->frames_cnt++] = { root, 0, false };
+
+    while(cse->frames_cnt > 0) {
+        DiffTreeTapeFrame* frame = &cse->frames[cse->frames_cnt - 1];
+        DiffTreeNode* node = frame->node;
+
+        if(!GROW_(results, cse->results_cnt + 1))
+            return DIFF_TREE_ALLOC_FAIL;
+
+        PtrMapVal* known = ptr_map_find(&cse->ids, node);
+        if(known) {
+            cse->results[cse->results_cnt++] = known->u;
+            --cse->frames_cnt;
+            continue;
+        }
+
+        if(!frame->is_expanded && (node->left || node->right)) {
+            frame->is_expanded = true;
+
+            if(!GROW_(frames, cse->frames_cnt + 2))
+                return DIFF_TREE_ALLOC_FAIL;
+
+            // left is on top, so it is scanned first
+            if(node->right)
+                cse->frames[cse->frames_cnt++] = { node->right, 0, false };
+            if(node->left)
+                cse->frames[cse->frames_cnt++] = { node->left, 0, false };
+
+            continue;
+        }
+
+        --cse->frames_cnt;
+
+        size_t node_id = 0;
+        DiffTreeErr err = diff_tree_tape_cse_insert_(cse, node, &node_id);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+
+        cse->results[cse->results_cnt++] = node_id;
+    }
+
+    *id = cse->results[0];
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief finds or adds the entry of node, entries of its children are on top of cse->results;
+///        a child use is counted once per distinct parent
+static DiffTreeErr diff_tree_tape_cse_insert_(DiffTreeTapeCse* cse, DiffTreeNode* node, size_t* id)
+{
+    DiffTreeTapeCseEntry key = {
+        .type  = node->type,
+        .value = node->value,
+        .left  = CSE_NONE,
+        .right = CSE_NONE,
+        .uses  = 0,
+        .nodes = 1,
+        .temp  = CSE_NONE,
+    };
+
+    if(node->right)
+        key.right = cse->results[--cse->results_cnt];
+    if(node->left)
+        key.left  = cse->results[--cse->results_cnt];
+
+    DiffTreeErr err = DIFF_TREE_ERR_NONE;
+    if(2 * (cse->entries.size + 1) > cse->capacity &&
+       (err = diff_tree_tape_cse_realloc_(cse, cse->capacity * 2)) != DIFF_TREE_ERR_NONE)
+        return err;
+
+    size_t mask = cse->capacity - 1;
+    size_t ind  = diff_tree_tape_cse_hash_(&key) & mask;
+
+    for(; cse->table[ind]; ind = (ind + 1) & mask) {
+        if(diff_tree_tape_cse_equal_((DiffTreeTapeCseEntry*) vector_at(&cse->entries, cse->table[ind] - 1), &key))
+            break;
+    }
+
+    if(cse->table[ind])
+        *id = cse->table[ind] - 1;
+    else {
+        if(key.left != CSE_NONE) {
+            DiffTreeTapeCseEntry* left = (DiffTreeTapeCseEntry*) vector_at(&cse->entries, key.left);
+            left->uses++;
+            key.nodes += left->nodes;
+        }
+        if(key.right != CSE_NONE) {
+            DiffTreeTapeCseEntry* right = (DiffTreeTapeCseEntry*) vector_at(&cse->entries, key.right);
+            right->uses++;
+            key.nodes += right->nodes;
+        }
+
+        if(vector_push(&cse->entries, &key) != VECTOR_ERR_NONE)
+            return DIFF_TREE_ALLOC_FAIL;
+
+        *id = cse->entries.size - 1;
+        cse->table[ind] = cse->entries.size;
+    }
+
+    if(ptr_map_insert(&cse->ids, node, PtrMapVal { .u = *id }) != PTR_MAP_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static DiffTreeErr diff_tree_tape_cse_realloc_(DiffTreeTapeCse* cse, size_t capacity)
+{
+    size_t* table = TYPED_CALLOC(capacity, size_t);
+    table verified(return DIFF_TREE_ALLOC_FAIL);
+
+    size_t mask = capacity - 1;
+    for(size_t i = 0; i < cse->entries.size; ++i) {
+        size_t ind = diff_tree_tape_cse_hash_((DiffTreeTapeCseEntry*) vector_at(&cse->entries, i)) & mask;
+        while(table[ind])
+            ind = (ind + 1) & mask;
+        table[ind] = i + 1;
+    }
+
+    NFREE(cse->table);
+    cse->table    = table;
+    cse->capacity = capacity;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static size_t diff_tree_tape_cse_hash_(const DiffTreeTapeCseEntry* entry)
+{
+    size_t hash = (size_t) entry->type;
+
+    switch(entry->type) {
+        case NODE_TYPE_OP:
+            hash = hash * 31 + (size_t) entry->value.op_type;
+            break;
+        case NODE_TYPE_VAR:
+            hash = hash * 31 + entry->value.var;
+            break;
+        case NODE_TYPE_NUM:
+            hash = hash * 31 + utils_djb2_hash(&entry->value.num, sizeof(entry->value.num));
+            break;
+        case NODE_TYPE_FAKE:
+        default:
+            break;
+    }
+
+    hash = hash * 31 + entry->left;
+    hash = hash * 31 + entry->right;
+
+    return hash ^ (hash >> 29);
+}
+
+static bool diff_tree_tape_cse_equal_(const DiffTreeTapeCseEntry* a, const DiffTreeTapeCseEntry* b)
+{
+    if(a->type != b->type || a->left != b->left || a->right != b->right)
+        return false;
+
+    switch(a->type) {
+        case NODE_TYPE_OP:
+            return a->value.op_type == b->value.op_type;
+        case NODE_TYPE_VAR:
+            return a->value.var == b->value.var;
+        case NODE_TYPE_NUM:
+            return !memcmp(&a->value.num, &b->value.num, sizeof(a->value.num));
+        case NODE_TYPE_FAKE:
+        default:
+            return false;
+    }
+}
+
+/// @brief post-order walk with an explicit stack, the left operand is pushed
+///        at the depth of its parent and the right one above it
+static DiffTreeErr diff_tree_tape_emit_(DiffTreeTape* tape, DiffTree* dtree, DiffTreeTapeCse* cse, DiffTreeNode* root)
+{
+    cse->frames_cnt = 0;
+
+    if(!GROW_(frames, 1))
+        return DIFF_TREE_ALLOC_FAIL;
+
+    cse->frames[cse->frames_cnt++] = { root, 0, false };
+
+    while(cse->frames_cnt > 0) {
+        DiffTreeTapeFrame* frame = &cse->frames[cse->frames_cnt - 1];
+        DiffTreeNode* node = frame->node;
+        size_t depth = frame->depth;
+
+        size_t id = ptr_map_find(&cse->ids, node)->u;
+        DiffTreeTapeCseEntry* entry = (DiffTreeTapeCseEntry*) vector_at(&cse->entries, id);
+
+        // a subtree stored by an earlier occurrence is loaded
+        if(!frame->is_expanded && entry->temp == CSE_NONE && node->type == NODE_TYPE_OP) {
+            frame->is_expanded = true;
+
+            if(!GROW_(frames, cse->frames_cnt + 2))
+                return DIFF_TREE_ALLOC_FAIL;
+
+            // left is on top, so it is emitted first
+            if(node->value.op_type == OPERATOR_TYPE_POW && diff_tree_tape_is_small_int_(node->right))
+                cse->frames[cse->frames_cnt++] = { node->left, depth, false };
+            else {
+                if(node->right)
+                    cse->frames[cse->frames_cnt++] = { node->right, depth + 1, false };
+                if(node->left)
+                    cse->frames[cse->frames_cnt++] = { node->left, depth, false };
+            }
+
+            continue;
+        }
+
+        --cse->frames_cnt;
+
+        DiffTreeErr err = diff_tree_tape_emit_node_(tape, dtree, cse, node, depth);
+        if(err != DIFF_TREE_ERR_NONE)
+            return err;
+    }
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+/// @brief pushes node whose operands are already emitted, or a load of its temporary
+static DiffTreeErr diff_tree_tape_emit_node_(DiffTreeTape* tape, DiffTree* dtree, DiffTreeTapeCse* cse, DiffTreeNode* node, size_t depth)
+{
+    DiffTreeTapeInstr instr = {};
+
+    size_t id = ptr_map_find(&cse->ids, node)->u;
+    DiffTreeTapeCseEntry* entry = (DiffTreeTapeCseEntry*) vector_at(&cse->entries, id);
+
+    if(depth + 1 > tape->stack_max)
+        tape->stack_max = depth + 1;
+
+    if(entry->temp != CSE_NONE) {
+        instr.opcode   = TAPE_OPCODE_LOAD;
+        instr.arg.slot = entry->temp;
+
+        dtree->stats.cse_nodes_eliminated += entry->nodes;
+
+        return diff_tree_tape_push_(tape, instr);
+    }
+
+    switch(node->type) {
+        case NODE_TYPE_NUM:
+            instr.opcode  = TAPE_OPCODE_NUM;
+            instr.arg.num = node->value.num;
+            break;
+
+        case NODE_TYPE_VAR:
+            instr.opcode   = TAPE_OPCODE_VAR;
+            instr.arg.slot = node->value.var;
+            if(instr.arg.slot >= dtree->vars.size) {
+                UTILS_LOGE(LOG_CTG_TAPE, "unknown variable");
+                return DIFF_TREE_NULLPTR;
+            }
+            break;
+
+        case NODE_TYPE_OP:
+            if(node->value.op_type == OPERATOR_TYPE_POW && diff_tree_tape_is_small_int_(node->right)) {
+                instr.opcode    = TAPE_OPCODE_POWI;
+                instr.arg.power = (long) node->right->value.num;
+                break;
+            }
+            instr.opcode = (DiffTreeTapeOpcode)(TAPE_OPCODE_ADD + node->value.op_type);
+            break;
+
+        case NODE_TYPE_FAKE:
+            UTILS_LOGE(LOG_CTG_TAPE, "fake node occured");
+            return DIFF_TREE_NULLPTR;
+
+        default:
+            UTILS_LOGE(LOG_CTG_TAPE, "unknown node type %d", node->type);
+            return DIFF_TREE_NULLPTR;
+    }
+
+    DiffTreeErr err = diff_tree_tape_push_(tape, instr);
+    if(err != DIFF_TREE_ERR_NONE)
+        return err;
+
+    // leaves are as cheap to push again as to load
+    if(entry->uses > 1 && node->type == NODE_TYPE_OP) {
+        entry->temp = tape->temps_cnt++;
+
+        instr.opcode   = TAPE_OPCODE_STORE;
+        instr.arg.slot = entry->temp;
+        err = diff_tree_tape_push_(tape, instr);
+    }
+
+    return err;
+}
+
+static DiffTreeErr diff_tree_tape_push_(DiffTreeTape* tape, DiffTreeTapeInstr instr)
+{
+    if(vector_push(&tape->code, &instr) != VECTOR_ERR_NONE)
+        return DIFF_TREE_ALLOC_FAIL;
+
+    return DIFF_TREE_ERR_NONE;
+}
+
+static bool diff_tree_tape_is_small_int_(DiffTreeNode* node)
+{
+    return node->type == NODE_TYPE_NUM
+        && fabs(node->value.num) <= POWI_MAX_EXPONENT
+        && utils_equal_with_precision(trunc(node->value.num), node->value.num);
+}
+
+static bool diff_tree_tape_grow_(void** arr, size_t* capacity, size_t size, size_t tsize)
+{
+    if(size <= *capacity)
+        return true;
+
+    size_t new_capacity = *capacity ? *capacity : DEFAULT_CSE_TABLE_CAPACITY;
+    while(new_capacity < size)
+        new_capacity *= 2;
+
+    void* new_arr = realloc(*arr, new_capacity * tsize);
+    new_arr verified(return false);
+
+    *arr      = new_arr;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+double diff_tree_tape_powi(double base, long power)
+{
+    unsigned long n = (unsigned long)(power < 0 ? -power : power);
+    double res = 1;
+
+    while(n) {
+        if(n & 1) res *= base;
+        base *= base;
+        n >>= 1;
+    }
+
+    return power < 0 ? 1 / res : res;
+}
+
+void diff_tree_tape_load_vars(DiffTree* dtree, double* vals)
+{
+    utils_assert(dtree);
+    utils_assert(vals);
+
+    for(size_t i = 0; i < dtree->vars.size; ++i)
+        vals[i] = ((Variable*)vector_at(&dtree->vars, i))->val;
+}
+
+#define BINARY_(expr)            \
+    sp[-2] = (expr);             \
+    --sp;                        \
+    break;
+
+#define UNARY_(expr)             \
+    sp[-1] = (expr);             \
+    break;
+
+double diff_tree_tape_eval(DiffTreeTape* tape, const double* vars)
+{
+    utils_assert(tape);
+    utils_assert(tape->stack);
+
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) tape->code.buffer;
+    const DiffTreeTapeInstr* end  = code + tape->code.size;
+
+    double* sp = tape->stack;
+
+    for(const DiffTreeTapeInstr* ip = code; ip < end; ++ip) {
+        switch(ip->opcode) {
+            case TAPE_OPCODE_NUM:  *sp++ = ip->arg.num;         break;
+            case TAPE_OPCODE_VAR:  *sp++ = vars[ip->arg.slot];  break;
+
+            case TAPE_OPCODE_ADD:  BINARY_(sp[-2] + sp[-1]);
+            case TAPE_OPCODE_SUB:  BINARY_(sp[-2] - sp[-1]);
+            case TAPE_OPCODE_MUL:  BINARY_(sp[-2] * sp[-1]);
+            case TAPE_OPCODE_DIV:  BINARY_(sp[-2] / sp[-1]);
+            case TAPE_OPCODE_POW:  BINARY_(pow(sp[-2], sp[-1]));
+
+            case TAPE_OPCODE_EXP:  UNARY_(exp(sp[-1]));
+            case TAPE_OPCODE_SQRT: UNARY_(sqrt(sp[-1]));
+            case TAPE_OPCODE_LOG:  UNARY_(log(sp[-1]));
+            case TAPE_OPCODE_SIN:  UNARY_(sin(sp[-1]));
+            case TAPE_OPCODE_COS:  UNARY_(cos(sp[-1]));
+            case TAPE_OPCODE_TAN:  UNARY_(tan(sp[-1]));
+            case TAPE_OPCODE_CTG:  UNARY_(1.f / tan(sp[-1]));
+            case TAPE_OPCODE_SH:   UNARY_(sinh(sp[-1]));
+            case TAPE_OPCODE_CH:   UNARY_(cosh(sp[-1]));
+            case TAPE_OPCODE_TH:   UNARY_(tanh(sp[-1]));
+            case TAPE_OPCODE_ASIN: UNARY_(asin(sp[-1]));
+            case TAPE_OPCODE_ACOS: UNARY_(acos(sp[-1]));
+            case TAPE_OPCODE_ATAN: UNARY_(atan(sp[-1]));
+            case TAPE_OPCODE_ACTG: UNARY_(1.f / atan(sp[-1]));
+
+            case TAPE_OPCODE_POWI: UNARY_(diff_tree_tape_powi(sp[-1], ip->arg.power));
+
+            case TAPE_OPCODE_STORE: tape->temps[ip->arg.slot] = sp[-1];  break;
+            case TAPE_OPCODE_LOAD:  *sp++ = tape->temps[ip->arg.slot];   break;
+
+            default:
+                UTILS_LOGE(LOG_CTG_TAPE, "unknown opcode %d", ip->opcode);
+                return NAN;
+        }
+    }
+
+    return sp[-1];
+}
+
+#undef BINARY_
+#undef UNARY_
+
+void diff_tree_tape_eval_batch(DiffTreeTape* tape, const double* vars, size_t slot,
+                               const double* xs, double* res, DiffTreeLaneErr* errs, size_t n)
+{
+    utils_assert(tape);
+    utils_assert(tape->batch_stack);
+
+    if(n == 0)
+        return;
+
+    utils_assert(xs);
+    utils_assert(res);
+
+    double padded[TAPE_BATCH_BLOCK] = {};
+
+    for(size_t i = 0; i < n; i += TAPE_BATCH_BLOCK) {
+        size_t cnt = n - i < TAPE_BATCH_BLOCK ? n - i : TAPE_BATCH_BLOCK;
+        const double* block_xs = xs + i;
+
+        // tail block is padded with the last point so that padding lanes stay in domain
+        if(cnt < TAPE_BATCH_BLOCK) {
+            memcpy(padded, block_xs, cnt * sizeof(double));
+            for(size_t j = cnt; j < TAPE_BATCH_BLOCK; ++j)
+                padded[j] = block_xs[cnt - 1];
+            block_xs = padded;
+        }
+
+        double* top = NULL;
+        if(!diff_tree_tape_eval_block_(tape, vars, slot, block_xs, &top)) {
+            for(size_t j = i; j < n; ++j) res[j] = NAN;
+            if(errs)
+                for(size_t j = i; j < n; ++j) errs[j] = DIFF_TREE_LANE_DOMAIN;
+            return;
+        }
+
+        memcpy(res + i, top, cnt * sizeof(double));
+
+        if(errs)
+            for(size_t j = 0; j < cnt; ++j)
+                errs[i + j] = diff_tree_tape_lane_err_(block_xs[j], top[j]);
+    }
+}
+
+static DiffTreeLaneErr diff_tree_tape_lane_err_(double x, double res)
+{
+    if(isnan(res) && !isnan(x))
+        return DIFF_TREE_LANE_DOMAIN;
+
+    if(isinf(res) && isfinite(x))
+        return DIFF_TREE_LANE_RANGE;
+
+    return DIFF_TREE_LANE_OK;
+}
+
+#define BINARY_(kernel)                                         \
+    kernel(sp - 2 * TAPE_BATCH_BLOCK, sp - TAPE_BATCH_BLOCK,    \
+           sp - 2 * TAPE_BATCH_BLOCK, TAPE_BATCH_BLOCK);        \
+    sp -= TAPE_BATCH_BLOCK;                                     \
+    break;
+
+#define UNARY_(kernel)                                          \
+    kernel(sp - TAPE_BATCH_BLOCK, sp - TAPE_BATCH_BLOCK,        \
+           TAPE_BATCH_BLOCK);                                   \
+    break;
+
+/// @brief runs the tape over one block, stack rows are TAPE_BATCH_BLOCK wide
+static bool diff_tree_tape_eval_block_(DiffTreeTape* tape, const double* vars, size_t slot, const double* xs, double** top)
+{
+    const DiffTreeTapeInstr* code = (const DiffTreeTapeInstr*) tape->code.buffer;
+    const DiffTreeTapeInstr* end  = code + tape->code.size;
+
+    double* sp    = tape->batch_stack;
+    double* temps = tape->batch_stack + tape->stack_max * TAPE_BATCH_BLOCK;
+
+    for(const DiffTreeTapeInstr* ip = code; ip < end; ++ip) {
+        switch(ip->opcode) {
+            case TAPE_OPCODE_NUM:
+                for(size_t j = 0; j < TAPE_BATCH_BLOCK; ++j) sp[j] = ip->arg.num;
+                sp += TAPE_BATCH_BLOCK;
+                break;
+
+            case TAPE_OPCODE_VAR:
+                if(ip->arg.slot == slot)
+                    memcpy(sp, xs, TAPE_BATCH_BLOCK * sizeof(double));
+                else
+                    for(size_t j = 0; j < TAPE_BATCH_BLOCK; ++j) sp[j] = vars[ip->arg.slot];
+                sp += TAPE_BATCH_BLOCK;
+                break;
+
+            case TAPE_OPCODE_ADD:  BINARY_(vmath_add);
+            case TAPE_OPCODE_SUB:  BINARY_(vmath_sub);
+            case TAPE_OPCODE_MUL:  BINARY_(vmath_mul);
+            case TAPE_OPCODE_DIV:  BINARY_(vmath_div);
+            case TAPE_OPCODE_POW:  BINARY_(vmath_pow);
+
+            case TAPE_OPCODE_EXP:  UNARY_(vmath_exp);
+            case TAPE_OPCODE_SQRT: UNARY_(vmath_sqrt);
+            case TAPE_OPCODE_LOG:  UNARY_(vmath_log);
+            case TAPE_OPCODE_SIN:  UNARY_(vmath_sin);
+            case TAPE_OPCODE_COS:  UNARY_(vmath_cos);
+            case TAPE_OPCODE_TAN:  UNARY_(vmath_tan);
+            case TAPE_OPCODE_CTG:  UNARY_(vmath_ctg);
+            case TAPE_OPCODE_SH:   UNARY_(vmath_sh);
+            case TAPE_OPCODE_CH:   UNARY_(vmath_ch);
+            case TAPE_OPCODE_TH:   UNARY_(vmath_th);
+            case TAPE_OPCODE_ASIN: UNARY_(vmath_asin);
+            case TAPE_OPCODE_ACOS: UNARY_(vmath_acos);
+            case TAPE_OPCODE_ATAN: UNARY_(vmath_atan);
+            case TAPE_OPCODE_ACTG: UNARY_(vmath_actg);
+
+            case TAPE_OPCODE_POWI:
+                vmath_powi(sp - TAPE_BATCH_BLOCK, ip->arg.power, sp - TAPE_BATCH_BLOCK, TAPE_BATCH_BLOCK);
+                break;
+
+            case TAPE_OPCODE_STORE:
+                memcpy(temps + ip->arg.slot * TAPE_BATCH_BLOCK, sp - TAPE_BATCH_BLOCK, TAPE_BATCH_BLOCK * sizeof(double));
+                break;
+
+            case TAPE_OPCODE_LOAD:
+                memcpy(sp, temps + ip->arg.slot * TAPE_BATCH_BLOCK, TAPE_BATCH_BLOCK * sizeof(double));
+                sp += TAPE_BATCH_BLOCK;
+                break;
+
+            default:
+                UTILS_LOGE(LOG_CTG_TAPE, "unknown opcode %d", ip->opcode);
+                return false;
+        }
+    }
+
+    *top = sp - TAPE_BATCH_BLOCK;
+    return true;
+}
+
+#undef BINARY_
+#undef UNARY_
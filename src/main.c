@@ -1,11 +1,21 @@
 #include <cstdlib>
+#include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "difftree.h"
+#include "difftree_batch.h"
+#include "difftree_cache.h"
+#include "difftree_codegen.h"
+#include "difftree_grad.h"
 #include "difftree_math.h"
+#include "difftree_optimize.h"
+#include "difftree_tape.h"
 #include "optutils.h"
 #include "utils.h"
 #include "logutils.h"
+#include "memutils.h"
 
 #define LOG_CATEGORY_OPT "OPTIONS"
 #define LOG_CATEGORY_APP "APP"
@@ -19,6 +29,20 @@ static utils_long_opt_t long_opts[] =
     { OPT_ARG_OPTIONAL, "x0",     NULL, 0, 0 },
     { OPT_ARG_OPTIONAL, "ymin",   NULL, 0, 0 },
     { OPT_ARG_OPTIONAL, "ymax",   NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "dag",    NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "symbolic", NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "grad",   NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "stats",  NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "batch",  NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "jit",    NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "cc",     NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "emit-c", NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "steps",  NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "max-steps", NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "steps-budget", NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "save-tree", NULL, 0, 0 },
+    { OPT_ARG_REQUIRED, "in-tree", NULL, 0, 0 },
+    { OPT_ARG_OPTIONAL, "cache",  NULL, 0, 0 },
 };
 
 static const size_t POWER_DEFAULT = 4;
@@ -28,6 +52,22 @@ static const double YMAX_DEFAULT  = 3.f;
 static const double DELTA         = 2.f;
 static const double STEP          = 0.005f;
 
+/// keep the report small enough for latexmk whatever the expression size
+static const size_t STEPS_BUDGET_DEFAULT = 8 << 20;
+static const size_t LATEX_MAX_NODES      = 5000;
+
+static bool set_variables_(DiffTree* dtree, const char* point);
+
+static bool set_steps_();
+
+static int print_gradient_(DiffTree* dtree, const char* point);
+
+static int emit_kernel_(DiffTree* dtree, const char* filename);
+
+static void print_stats_(const DiffTree* dtree, const DiffTree* dtree_taylor);
+
+static void print_memo_stats_(const char* pass, const DiffTreeStats* stats);
+
 int main(int argc, char* argv[])
 {
     size_t power = POWER_DEFAULT;
@@ -48,6 +88,22 @@ int main(int argc, char* argv[])
 
     utils_init_log_file(long_opts[0].arg, LOG_DIR);
 
+    if(!set_steps_()) {
+        utils_end_log();
+        return EXIT_FAILURE;
+    }
+
+    if(long_opts[11].is_set) {
+        size_t threads_cnt = long_opts[11].arg ? (size_t) atol(long_opts[11].arg) : 0;
+
+        DiffTreeErr err = diff_tree_batch(long_opts[1].arg, long_opts[2].arg, threads_cnt, long_opts[7].is_set);
+        if(err != DIFF_TREE_ERR_NONE)
+            UTILS_LOGE(LOG_CATEGORY_APP, "batch: %s", diff_tree_strerr(err));
+
+        utils_end_log();
+        return err == DIFF_TREE_ERR_NONE ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     DiffTree dtree = DIFF_TREE_INIT_LIST;
     DiffTreeErr err = DIFF_TREE_ERR_NONE;
 
@@ -57,14 +113,55 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    if(long_opts[7].is_set) {
+        err = diff_tree_enable_dag(&dtree);
+        if(err != DIFF_TREE_ERR_NONE) {
+            diff_tree_dtor(&dtree);
+            return EXIT_FAILURE;
+        }
+    }
+
+    dtree.use_jit    = long_opts[12].is_set;
+    dtree.use_kernel = long_opts[13].is_set;
+    dtree.kernel_dir = long_opts[13].arg;
+
     diff_tree_init_latex_file(long_opts[2].arg);
     
-    err = diff_tree_fread(&dtree, long_opts[1].arg); 
+    if(long_opts[19].is_set)
+        err = diff_tree_fread_image(&dtree, long_opts[19].arg);
+    else
+        err = diff_tree_fread(&dtree, long_opts[1].arg); 
+
     if(err != DIFF_TREE_ERR_NONE) {
         diff_tree_dtor(&dtree);
         return EXIT_FAILURE;
     }
 
+    if(long_opts[9].is_set) {
+        int status = print_gradient_(&dtree, long_opts[9].arg);
+        diff_tree_end_latex_file();
+        diff_tree_dtor(&dtree);
+        utils_end_log();
+        return status;
+    }
+
+    if(long_opts[14].is_set) {
+        int status = emit_kernel_(&dtree, long_opts[14].arg);
+        diff_tree_end_latex_file();
+        diff_tree_dtor(&dtree);
+        utils_end_log();
+        return status;
+    }
+
+    // the report differentiates by the first variable
+    if(dtree.vars.size == 0) {
+        UTILS_LOGE(LOG_CATEGORY_APP, "expression has no variables, nothing to differentiate by");
+        diff_tree_end_latex_file();
+        diff_tree_dtor(&dtree);
+        utils_end_log();
+        return EXIT_FAILURE;
+    }
+
     DiffTree dtree_taylor = DIFF_TREE_INIT_LIST;
     diff_tree_copy_tree(&dtree, &dtree_taylor);
 
@@ -75,15 +172,49 @@ int main(int argc, char* argv[])
 
     DIFF_TREE_DUMP(&dtree_taylor, DIFF_TREE_ERR_NONE);
 
+    // the copy is only plotted, so it is the one optimized for the key
+    char cache_dir[DIFF_TREE_CACHE_DIR_LEN_MAX] = "";
+    bool use_cache = long_opts[20].is_set && diff_tree_cache_dir(long_opts[20].arg, cache_dir) == DIFF_TREE_ERR_NONE;
+
+    DiffTreeCacheKey cache_key = {};
+    DiffTreeCacheEntry cached = {};
+
+    if(use_cache) {
+        diff_tree_optimize(&dtree_copy);
+
+        cache_key = {
+            .expr_hash = diff_tree_subtree_hash(&dtree_copy, dtree_copy.root->left),
+            .slot      = 0,
+            .order     = 1,
+            .power     = power,
+            .x0        = x0,
+            .symbolic  = long_opts[8].is_set,
+        };
+    }
+
+    bool is_cached = use_cache && diff_tree_cache_load(cache_dir, &cache_key, &dtree, dtree_copy.root->left, &cached);
+
     diff_tree_dump_latex("\\section{Производная}\n");
 
-    diff_tree_differentiate_tree_n(&dtree, (Variable*)vector_at(&dtree.vars, 0), 1);
+    if(is_cached) {
+        diff_tree_dump_derivative_latex(&dtree, dtree.root->left, cached.deriv);
+
+        diff_tree_mark_to_delete(&dtree, dtree.root->left);
+        dtree.root->left = cached.deriv;
+        if(!dtree.is_dag)
+            cached.deriv->parent = dtree.root;
+    }
+    else
+        diff_tree_differentiate_tree_n(&dtree, (Variable*)vector_at(&dtree.vars, 0), 1);
 
     DIFF_TREE_DUMP(&dtree, DIFF_TREE_ERR_NONE);
+
+    if(long_opts[18].is_set && diff_tree_fwrite(&dtree, long_opts[18].arg) != DIFF_TREE_ERR_NONE)
+        UTILS_LOGE(LOG_CATEGORY_APP, "can't save derivative to %s", long_opts[18].arg);
     
     // for(size_t i = 0; i < dtree.vars.size; ++i) {
     //     Variable* var = (Variable*)vector_at(&dtree.vars, i);
-    //     printf("Enter variable %c value: ", var->c);
+    //     printf("Enter variable %s value: ", var->name);
     //
     //     if(input_double_until_correct(&var->val) != IO_ERR_NONE)
     //         return EXIT_FAILURE;
@@ -94,7 +225,33 @@ int main(int argc, char* argv[])
         "Разложим данную функцию в ряд Тейлора до $o((x-x_0)^%lu)$ в точке $x_0 = %g$\n",
         power, x0);
 
-    DiffTreeNode* polynom = diff_tree_taylor_expansion(&dtree_taylor, (Variable*)vector_at(&dtree.vars, 0), x0, power);
+    DiffTreeNode* polynom = NULL;
+    if(is_cached) {
+        polynom = cached.taylor;
+        diff_tree_dump_taylor_latex(&dtree, polynom, (Variable*)vector_at(&dtree.vars, 0), x0, power);
+    }
+    else if(long_opts[8].is_set)
+        polynom = diff_tree_taylor_expansion_symbolic(&dtree_taylor, (Variable*)vector_at(&dtree.vars, 0), x0, power);
+    else {
+        polynom = diff_tree_taylor_expansion(&dtree_taylor, (Variable*)vector_at(&dtree.vars, 0), x0, power);
+        if(polynom)
+            diff_tree_dump_taylor_latex(&dtree_taylor, polynom, (Variable*)vector_at(&dtree.vars, 0), x0, power);
+    }
+
+    if(!polynom) {
+        diff_tree_dtor(&dtree);
+        diff_tree_dtor(&dtree_copy);
+        diff_tree_dtor(&dtree_taylor);
+        return EXIT_FAILURE;
+    }
+
+    // nodes of the copies share variables of dtree
+    if(use_cache && !is_cached) {
+        cached = { .expr = dtree_copy.root->left, .deriv = dtree.root->left, .taylor = polynom };
+
+        if(diff_tree_cache_store(cache_dir, &cache_key, &dtree, &cached) != DIFF_TREE_ERR_NONE)
+            UTILS_LOGW(LOG_CATEGORY_APP, "derivative is not cached");
+    }
 
     diff_tree_dump_latex("\\section{График в окрестности $x_0$}\n");
 
@@ -105,7 +262,8 @@ int main(int argc, char* argv[])
 
     diff_tree_dump_taylor_graph_latex(&dtree_copy, polynom, x0 - 1.f, x0 + 1.f, STEP, ymin, ymax);
 
-    diff_tree_mark_to_delete(&dtree, polynom);
+    if(long_opts[10].is_set)
+        print_stats_(&dtree, &dtree_taylor);
 
     diff_tree_end_latex_file();
 
@@ -119,3 +277,167 @@ int main(int argc, char* argv[])
 
     return EXIT_SUCCESS;
 }
+
+/// @brief applies --steps, --max-steps and --steps-budget
+static bool set_steps_()
+{
+    DiffTreeSteps steps = DIFF_TREE_STEPS_ALL;
+
+    if(long_opts[15].is_set) {
+        const char* mode = long_opts[15].arg;
+
+        if(strcmp(mode, "none") == 0)
+            steps = DIFF_TREE_STEPS_NONE;
+        else if(strcmp(mode, "top") == 0)
+            steps = DIFF_TREE_STEPS_TOP;
+        else if(strcmp(mode, "all") == 0)
+            steps = DIFF_TREE_STEPS_ALL;
+        else {
+            UTILS_LOGE(LOG_CATEGORY_OPT, "--steps must be none, top or all, not \"%s\"", mode);
+            return false;
+        }
+    }
+
+    size_t max_steps = long_opts[16].is_set ? (size_t) atol(long_opts[16].arg) : 0;
+    size_t max_bytes = long_opts[17].is_set ? (size_t) atol(long_opts[17].arg) : STEPS_BUDGET_DEFAULT;
+
+    diff_tree_set_latex_steps(steps, max_steps, max_bytes);
+    diff_tree_set_latex_max_nodes(LATEX_MAX_NODES);
+
+    return true;
+}
+
+/// @brief point is a comma separated list like "x=1,y=-2.5", unlisted variables keep their values
+static bool set_variables_(DiffTree* dtree, const char* point)
+{
+    while(point && *point) {
+        while(*point == ' ')
+            ++point;
+
+        const char* name = point;
+        size_t len = 0;
+        while(isalnum((unsigned char) name[len]) || name[len] == '_')
+            ++len;
+
+        double val = 0;
+        int read = 0;
+
+        if(len == 0 || sscanf(name + len, " = %lf%n", &val, &read) != 1) {
+            UTILS_LOGE(LOG_CATEGORY_OPT, "expected <var>=<value> in \"%s\"", point);
+            return false;
+        }
+
+        Variable* var = diff_tree_find_variable(dtree, name, len);
+
+        if(var)
+            var->val = val;
+        else
+            UTILS_LOGW(LOG_CATEGORY_OPT, "variable '%.*s' does not occur in expression", (int) len, name);
+
+        point = name + len + read;
+        while(*point == ' ' || *point == ',')
+            ++point;
+    }
+
+    return true;
+}
+
+static int print_gradient_(DiffTree* dtree, const char* point)
+{
+    if(!set_variables_(dtree, point))
+        return EXIT_FAILURE;
+
+    size_t vars_cnt = dtree->vars.size;
+
+    DiffTreeTape tape = {};
+    double* vals = TYPED_CALLOC(vars_cnt + 1, double);
+    double* grad = TYPED_CALLOC(vars_cnt + 1, double);
+    double value = 0;
+
+    DiffTreeErr err = vals && grad ? diff_tree_tape_ctor(&tape) : DIFF_TREE_ALLOC_FAIL;
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, dtree, dtree->root->left);
+    if(err == DIFF_TREE_ERR_NONE) {
+        diff_tree_tape_load_vars(dtree, vals);
+        err = diff_tree_grad_eval(&tape, vals, &value, grad);
+    }
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        printf("f(");
+        for(size_t i = 0; i < vars_cnt; ++i)
+            printf("%s%s = %g", i ? ", " : "", diff_tree_variable(dtree, i)->name, vals[i]);
+        printf(") = %g\n", value);
+
+        for(size_t i = 0; i < vars_cnt; ++i)
+            printf("df/d%s = %g\n", diff_tree_variable(dtree, i)->name, grad[i]);
+    }
+    else
+        UTILS_LOGE(LOG_CATEGORY_APP, "gradient: %s", diff_tree_strerr(err));
+
+    diff_tree_tape_dtor(&tape);
+    NFREE(vals);
+    NFREE(grad);
+
+    return err == DIFF_TREE_ERR_NONE ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// @brief writes C source of f and of its derivative over the first variable
+static int emit_kernel_(DiffTree* dtree, const char* filename)
+{
+    DiffTree deriv = DIFF_TREE_INIT_LIST;
+    DiffTreeErr err = diff_tree_copy_tree(dtree, &deriv);
+
+    DiffTreeCodegenFn fns[] = {
+        { .name = "difftree_f",  .node = dtree->root->left },
+        { .name = "difftree_df", .node = NULL },
+    };
+    size_t fns_cnt = 1;
+
+    if(err == DIFF_TREE_ERR_NONE && deriv.vars.size > 0) {
+        diff_tree_set_latex_dump_enabled(false);
+        err = diff_tree_differentiate_tree_n(&deriv, diff_tree_variable(&deriv, 0), 1);
+        diff_tree_set_latex_dump_enabled(true);
+
+        fns[1].node = deriv.root->left;
+        fns_cnt = 2;
+    }
+
+    FILE* file = NULL;
+    if(err == DIFF_TREE_ERR_NONE) {
+        file = fopen(filename, "w");
+        err = file ? diff_tree_codegen_fwrite(dtree, fns, fns_cnt, file) : DIFF_TREE_IO_ERR;
+    }
+
+    if(file && fclose(file) != 0)
+        err = DIFF_TREE_IO_ERR;
+
+    if(err != DIFF_TREE_ERR_NONE)
+        UTILS_LOGE(LOG_CATEGORY_APP, "emit-c: %s", diff_tree_strerr(err));
+
+    diff_tree_dtor(&deriv);
+
+    return err == DIFF_TREE_ERR_NONE ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// @param dtree_taylor differentiated only by the symbolic expansion
+static void print_stats_(const DiffTree* dtree, const DiffTree* dtree_taylor)
+{
+    printf("optimize: %zu node visits, %zu rewrites\n",
+           dtree->stats.opt_visits, dtree->stats.opt_rewrites);
+    printf("normalize: %zu terms merged\n", dtree->stats.norm_merged);
+    printf("cse: %zu temporaries, %zu nodes eliminated\n",
+           dtree->stats.cse_temps, dtree->stats.cse_nodes_eliminated);
+
+    print_memo_stats_("differentiate", &dtree->stats);
+
+    if(dtree_taylor->stats.diff_lookups)
+        print_memo_stats_("taylor", &dtree_taylor->stats);
+}
+
+static void print_memo_stats_(const char* pass, const DiffTreeStats* stats)
+{
+    double rate = stats->diff_lookups ? 100.0 * (double) stats->diff_hits / (double) stats->diff_lookups : 0;
+
+    printf("%s: %zu of %zu subtree derivatives found in memo (%.1f%%)\n",
+           pass, stats->diff_hits, stats->diff_lookups, rate);
+}
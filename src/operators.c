@@ -1,38 +1,31 @@
 #include "operators.h"
 
+#include <pthread.h>
 #include <string.h>
 
 #include "assertutils.h"
 #include "logutils.h"
 
-int operators_prepare_op_arr()
-{                                                                                       
-    // size_t tbl_size_tmp = SIZEOF(op_arr);                                                  
-    //
-    // for(ssize_t ind_i = 0; (unsigned) ind_i < SIZEOF(op_arr); ++ind_i) {                      
-    //     if(ind_i < 1) continue;                                                          
-    //
-    //     ssize_t ind_j = ind_i - 1;                                                        
-    //     Operator key = op_arr[ind_i];                                   
-    //     while(key.hash < op_arr[ind_i].hash) {                                          
-    //         op_arr[cmdj + 1] = tbl_tmp[cmdj];                                          
-    //
-    //         --ind_j;                                                                     
-    //         if(ind_j < 0) break;                                                         
-    //     }                                                                               
-    //
-    //     if(cmdj >= 0 && tbl_tmp[cmdj].hash == key.hash) {                               
-    //         NFREE(tbl_tmp);                                                             
-    //         return ASSEMBLER_ERR_HASH_COLLISION;                                        
-    //     }                                                                               
-    //     tbl_tmp[cmdj + 1] = key;                                                        
-    // }                                                                                   
-    //
-    // asmblr->pref##_tbl      = tbl_tmp;                                                  
-    // asmblr->pref##_tbl_size = tbl_size_tmp;                                             
-    //
-    // return ASSEMBLER_ERR_NONE;                                                          
-}
+ATTR_UNUSED static const char* LOG_CATEGORY_OPERATORS = "OPERATORS";
+
+/// a few times the number of functions, so a seed is found quickly
+static const size_t FUNC_TBL_BITS = 6;
+static const size_t FUNC_TBL_SIZE = 1 << FUNC_TBL_BITS;
+
+static const utils_hash_t FUNC_TBL_SEED_MAX = 1 << 16;
+
+/// perfect hash of function names: every name of op_arr gets its own slot
+static struct {
+    const Operator* ops[FUNC_TBL_SIZE];
+    size_t lens[FUNC_TBL_SIZE];
+    utils_hash_t seed;
+} func_tbl = {};
+
+static pthread_once_t func_tbl_once = PTHREAD_ONCE_INIT;
+
+static size_t operators_func_slot_(const char* str, size_t len, utils_hash_t seed);
+
+static void operators_prepare_func_tbl_();
 
 const Operator* get_operator(OperatorType op_type)
 {
@@ -42,18 +35,57 @@ const Operator* get_operator(OperatorType op_type)
 }
 
 
-const Operator* match_function(char* str)
+const Operator* match_function(const char* str, size_t len)
 {
     utils_assert(str);
 
-    // FIXME make hash comparasion
-    for(size_t i = 0; i < SIZEOF(op_arr); ++i) {
-        if(!strcmp(str, op_arr[i].str) 
-            && op_arr[i].argnum == OPERATOR_ARGNUM_1) {
+    pthread_once(&func_tbl_once, operators_prepare_func_tbl_);
+
+    size_t slot = operators_func_slot_(str, len, func_tbl.seed);
+
+    if(func_tbl.lens[slot] != len || memcmp(func_tbl.ops[slot]->str, str, len) != 0)
+        return NULL;
 
-            return op_arr + i;
+    return func_tbl.ops[slot];
+}
+
+static size_t operators_func_slot_(const char* str, size_t len, utils_hash_t seed)
+{
+    utils_hash_t hash = seed;
+
+    for(size_t i = 0; i < len; ++i)
+        hash = (hash * 33) ^ (unsigned char) str[i];
+
+    // high bits of the product depend on all bits of the hash
+    return (hash * 0x9E3779B97F4A7C15ul) >> (sizeof(utils_hash_t) * 8 - FUNC_TBL_BITS);
+}
+
+/// @brief tries seeds until no two names of op_arr share a slot
+static void operators_prepare_func_tbl_()
+{
+    for(utils_hash_t seed = 0; seed < FUNC_TBL_SEED_MAX; ++seed) {
+        memset(&func_tbl, 0, sizeof(func_tbl));
+        func_tbl.seed = seed;
+
+        bool collided = false;
+
+        for(size_t i = 0; i < SIZEOF(op_arr) && !collided; ++i) {
+            if(op_arr[i].argnum != OPERATOR_ARGNUM_1)
+                continue;
+
+            size_t len  = strlen(op_arr[i].str);
+            size_t slot = operators_func_slot_(op_arr[i].str, len, seed);
+
+            collided = func_tbl.lens[slot] != 0;
+
+            func_tbl.ops[slot]  = &op_arr[i];
+            func_tbl.lens[slot] = len;
         }
+
+        if(!collided)
+            return;
     }
 
-    return NULL;
+    UTILS_LOGE(LOG_CATEGORY_OPERATORS, "no perfect hash seed for function names");
+    utils_assert(false);
 }
@@ -0,0 +1,162 @@
+#include "ptr_map.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "logutils.h"
+#include "assertutils.h"
+
+static const size_t CAPACITY_MIN = 16;
+static const size_t CAPACITY_EXP = 2;
+static const char*  LOG_CATEGORY_PTR_MAP = "PTR_MAP";
+
+static PtrMapErr ptr_map_realloc_(PtrMap* map, size_t capacity);
+
+static size_t ptr_map_hash_(const void* key)
+{
+    uintptr_t h = (uintptr_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#define ENTRY_IS_LIVE_(map, entry) \
+    ((entry)->key && (entry)->gen == (map)->gen)
+
+PtrMapErr ptr_map_ctor(PtrMap* map, size_t capacity)
+{
+    if(!map)
+        return PTR_MAP_ERR_NULL;
+
+    map->buffer   = NULL;
+    map->size     = 0;
+    map->capacity = 0;
+    map->gen      = 1;
+
+    size_t pow2 = CAPACITY_MIN;
+    while(pow2 < capacity) pow2 *= CAPACITY_EXP;
+
+    return ptr_map_realloc_(map, pow2);
+}
+
+PtrMapVal* ptr_map_find(PtrMap* map, const void* key)
+{
+    utils_assert(map);
+    utils_assert(key);
+
+    if(!map->capacity) return NULL;
+
+    size_t mask = map->capacity - 1;
+    for(size_t i = ptr_map_hash_(key) & mask; ; i = (i + 1) & mask) {
+        PtrMapEntry* entry = map->buffer + i;
+
+        if(!ENTRY_IS_LIVE_(map, entry))
+            return NULL;
+
+        if(entry->key == key)
+            return &entry->val;
+    }
+}
+
+PtrMapErr ptr_map_insert(PtrMap* map, const void* key, PtrMapVal val)
+{
+    utils_assert(map);
+    utils_assert(key);
+
+    if((map->size + 1) * 4 > map->capacity * 3) {
+        size_t capacity = map->capacity ? map->capacity * CAPACITY_EXP : CAPACITY_MIN;
+        PtrMapErr err = ptr_map_realloc_(map, capacity);
+        if(err != PTR_MAP_ERR_NONE) {
+            UTILS_LOGE(LOG_CATEGORY_PTR_MAP, "%s", ptr_map_strerr(err));
+            return err;
+        }
+    }
+
+    size_t mask = map->capacity - 1;
+    for(size_t i = ptr_map_hash_(key) & mask; ; i = (i + 1) & mask) {
+        PtrMapEntry* entry = map->buffer + i;
+
+        if(!ENTRY_IS_LIVE_(map, entry)) {
+            *entry = { .key = key, .val = val, .gen = map->gen };
+            map->size++;
+            return PTR_MAP_ERR_NONE;
+        }
+
+        if(entry->key == key) {
+            entry->val = val;
+            return PTR_MAP_ERR_NONE;
+        }
+    }
+}
+
+void ptr_map_clear(PtrMap* map)
+{
+    utils_assert(map);
+
+    map->size = 0;
+    map->gen++;
+
+    if(map->gen == 0) {
+        if(map->buffer)
+            memset(map->buffer, 0, map->capacity * sizeof(map->buffer[0]));
+        map->gen = 1;
+    }
+}
+
+void ptr_map_dtor(PtrMap* map)
+{
+    utils_assert(map);
+
+    free(map->buffer);
+
+    map->buffer   = NULL;
+    map->size     = 0;
+    map->capacity = 0;
+    map->gen      = 1;
+}
+
+static PtrMapErr ptr_map_realloc_(PtrMap* map, size_t capacity)
+{
+    utils_assert(map);
+
+    PtrMapEntry* buffer_old   = map->buffer;
+    size_t       capacity_old = map->capacity;
+    unsigned     gen_old      = map->gen;
+
+    PtrMapEntry* buffer_new = (PtrMapEntry*) calloc(capacity, sizeof(PtrMapEntry));
+    if(!buffer_new)
+        return PTR_MAP_ERR_ALLOC_FAIL;
+
+    map->buffer   = buffer_new;
+    map->capacity = capacity;
+    map->size     = 0;
+    map->gen      = 1;
+
+    for(size_t i = 0; i < capacity_old; ++i) {
+        PtrMapEntry* entry = buffer_old + i;
+        if(entry->key && entry->gen == gen_old)
+            ptr_map_insert(map, entry->key, entry->val);
+    }
+
+    free(buffer_old);
+
+    return PTR_MAP_ERR_NONE;
+}
+
+const char* ptr_map_strerr(const PtrMapErr err)
+{
+    switch(err)
+    {
+        case PTR_MAP_ERR_NONE:
+            return "none";
+        case PTR_MAP_ERR_NULL:
+            return "map pointer is null";
+        case PTR_MAP_ERR_ALLOC_FAIL:
+            return "memory allocation failed";
+        default:
+            return "unknown";
+    }
+}
+
+#undef ENTRY_IS_LIVE_
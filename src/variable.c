@@ -10,9 +10,10 @@ void variable_print_callback(FILE* stream, void* var)
 
     Variable* var_ = (Variable*)var;
     fprintf(stream, 
-            "[str: %c; hash: %lu; val: %f]", 
-            var_->c,
+            "[name: %s; hash: %lu; slot: %zu; val: %f]", 
+            var_->name,
             var_->hash,
+            var_->slot,
             var_->val
            );
 }
@@ -0,0 +1,537 @@
+#include "vmath.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "assertutils.h"
+
+/* Kernels are written with GCC vector extensions, so they compile to AVX2
+ * with -march=native and to pairs of SSE2 instructions otherwise.
+ * Transcendental functions use Cody-Waite range reduction and polynomials
+ * accurate to a few ulp; pow is computed as exp(b * ln|a|), so its relative
+ * error grows with |b * ln a|, integer exponents up to POWI_MAX are exact. */
+
+// all vector helpers are internal, their calling convention never leaves this file
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef double  v4d __attribute__((vector_size(VMATH_LANES * sizeof(double))));
+typedef int64_t v4i __attribute__((vector_size(VMATH_LANES * sizeof(int64_t))));
+
+static const double MAGIC_ROUND  = 0x1.8p52;
+static const double LOG2E        = 1.44269504088896338700e+00;
+static const double LN2_HI       = 6.93147180369123816490e-01;
+static const double LN2_LO       = 1.90821492927058770002e-10;
+static const double EXP_MAX      = 709.782712893383973096;
+static const double EXP_MIN      = -745.133219101941108420;
+static const double SQRT2        = 1.41421356237309504880;
+static const double TWO_OVER_PI  = 6.36619772367581382433e-01;
+static const double PIO2_1       = 1.57079632673412561417e+00;
+static const double PIO2_2       = 6.07710050630396597660e-11;
+static const double PIO2_3       = 2.02226624871116645580e-21;
+static const double TRIG_MAX     = 1e5;
+static const double HYPERB_BIG   = 20;
+static const double POWI_MAX     = 64;
+
+static const int64_t EXP_BIAS    = 1023;
+static const int     MANT_BITS   = 52;
+static const int64_t MANT_MASK   = 0x000fffffffffffffLL;
+
+static inline v4d load_(const double* ptr)
+{
+    v4d vec;
+    memcpy(&vec, ptr, sizeof(vec));
+    return vec;
+}
+
+static inline void store_(double* ptr, v4d vec)
+{
+    memcpy(ptr, &vec, sizeof(vec));
+}
+
+static inline v4d splat_(double val)
+{
+    return v4d{} + val;
+}
+
+static inline v4d select_(v4i mask, v4d a, v4d b)
+{
+    return mask ? a : b;
+}
+
+static inline v4d abs_(v4d x)
+{
+    return (v4d)((v4i)x & ~(v4i{} + INT64_MIN));
+}
+
+static inline v4d copysign_(v4d mag, v4d sign)
+{
+    return (v4d)(((v4i)abs_(mag)) | ((v4i)sign & (v4i{} + INT64_MIN)));
+}
+
+/// round to nearest, valid for |x| < 2^51
+static inline v4d round_(v4d x)
+{
+    return (x + MAGIC_ROUND) - MAGIC_ROUND;
+}
+
+static inline bool any_(v4i mask)
+{
+    for(size_t i = 0; i < VMATH_LANES; ++i)
+        if(mask[i]) return true;
+
+    return false;
+}
+
+static inline v4d sqrt_(v4d x)
+{
+#if defined(__AVX__)
+    return _mm256_sqrt_pd(x);
+#else
+    v4d res;
+    for(size_t i = 0; i < VMATH_LANES; ++i)
+        res[i] = sqrt(x[i]);
+    return res;
+#endif
+}
+
+/// x * 2^k for integer k in [-1076, 1025], scaled in two steps so that
+/// neither factor over- or underflows on its own
+static inline v4d ldexp_(v4d x, v4i k)
+{
+    v4i k1 = k >> 1;
+    v4i k2 = k - k1;
+
+    v4d s1 = (v4d)((k1 + EXP_BIAS) << MANT_BITS);
+    v4d s2 = (v4d)((k2 + EXP_BIAS) << MANT_BITS);
+
+    return (x * s1) * s2;
+}
+
+static v4d exp_(v4d x)
+{
+    v4d xc = select_(x > EXP_MAX, splat_(EXP_MAX), x);
+    xc = select_(xc < EXP_MIN, splat_(EXP_MIN), xc);
+    xc = select_(xc != xc, splat_(0), xc);
+
+    v4d k = round_(xc * LOG2E);
+    v4d r = (xc - k * LN2_HI) - k * LN2_LO;
+
+    v4d p = splat_(1.0 / 479001600);
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+
+    v4d res = ldexp_(p, __builtin_convertvector(k, v4i));
+
+    res = select_(x > EXP_MAX, splat_(INFINITY), res);
+    res = select_(x < EXP_MIN, splat_(0), res);
+    res = select_(x != x, x, res);
+
+    return res;
+}
+
+static v4d log_(v4d x)
+{
+    v4i tiny = x < 0x1p-1022;
+    v4d xs = select_(tiny, x * 0x1p54, x);
+
+    v4i bits = (v4i) xs;
+    v4d e = __builtin_convertvector((bits >> MANT_BITS) - EXP_BIAS, v4d);
+    e = select_(tiny, e - 54, e);
+
+    v4d m = (v4d)((bits & MANT_MASK) | (EXP_BIAS << MANT_BITS));
+
+    v4i big = m > SQRT2;
+    m = select_(big, m * 0.5, m);
+    e = select_(big, e + 1, e);
+
+    v4d f = m - 1;
+    v4d s = f / (f + 2);
+    v4d z = s * s;
+
+    v4d R = splat_(2.0 / 23);
+    R = R * z + 2.0 / 21;
+    R = R * z + 2.0 / 19;
+    R = R * z + 2.0 / 17;
+    R = R * z + 2.0 / 15;
+    R = R * z + 2.0 / 13;
+    R = R * z + 2.0 / 11;
+    R = R * z + 2.0 / 9;
+    R = R * z + 2.0 / 7;
+    R = R * z + 2.0 / 5;
+    R = R * z + 2.0 / 3;
+    R = R * z;
+
+    v4d res = e * LN2_HI + ((f - s * (f - R)) + e * LN2_LO);
+
+    res = select_(x == 0, splat_(-INFINITY), res);
+    res = select_(x < 0, splat_(NAN), res);
+    res = select_(x == INFINITY, x, res);
+    res = select_(x != x, x, res);
+
+    return res;
+}
+
+static inline v4d sin_poly_(v4d r)
+{
+    v4d z = r * r;
+
+    v4d p = splat_(1.0 / 355687428096000);
+    p = p * z - 1.0 / 1307674368000;
+    p = p * z + 1.0 / 6227020800;
+    p = p * z - 1.0 / 39916800;
+    p = p * z + 1.0 / 362880;
+    p = p * z - 1.0 / 5040;
+    p = p * z + 1.0 / 120;
+    p = p * z - 1.0 / 6;
+
+    return r + r * z * p;
+}
+
+static inline v4d cos_poly_(v4d r)
+{
+    v4d z = r * r;
+
+    v4d p = splat_(1.0 / 20922789888000);
+    p = p * z - 1.0 / 87178291200;
+    p = p * z + 1.0 / 479001600;
+    p = p * z - 1.0 / 3628800;
+    p = p * z + 1.0 / 40320;
+    p = p * z - 1.0 / 720;
+    p = p * z + 1.0 / 24;
+    p = p * z * z;
+
+    return (1 - 0.5 * z) + p;
+}
+
+/// reduces x to r in [-pi/4, pi/4] and quadrant q, x = q * pi/2 + r
+static inline void trig_reduce_(v4d x, v4d* r, v4i* q)
+{
+    v4d xc = select_(abs_(x) > TRIG_MAX, splat_(0), x);
+    v4d k = round_(xc * TWO_OVER_PI);
+
+    *r = ((xc - k * PIO2_1) - k * PIO2_2) - k * PIO2_3;
+    *q = __builtin_convertvector(k, v4i) & 3;
+}
+
+typedef double (*ScalarFunc)(double);
+
+/// lanes out of reduction range or not finite are computed by libm
+static inline v4d trig_fixup_(v4d x, v4d res, ScalarFunc func)
+{
+    v4i out_of_range = !(abs_(x) <= TRIG_MAX);
+    if(!any_(out_of_range))
+        return res;
+
+    for(size_t i = 0; i < VMATH_LANES; ++i)
+        if(out_of_range[i]) res[i] = func(x[i]);
+
+    return res;
+}
+
+static v4d sin_(v4d x)
+{
+    v4d r; v4i q;
+    trig_reduce_(x, &r, &q);
+
+    v4d s = sin_poly_(r), c = cos_poly_(r);
+
+    v4d res = select_((q & 1) != 0, c, s);
+    res = select_((q & 2) != 0, -res, res);
+
+    return trig_fixup_(x, res, sin);
+}
+
+static v4d cos_(v4d x)
+{
+    v4d r; v4i q;
+    trig_reduce_(x, &r, &q);
+
+    v4d s = sin_poly_(r), c = cos_poly_(r);
+
+    v4d res = select_((q & 1) != 0, -s, c);
+    res = select_((q & 2) != 0, -res, res);
+
+    return trig_fixup_(x, res, cos);
+}
+
+static v4d tan_(v4d x)
+{
+    v4d r; v4i q;
+    trig_reduce_(x, &r, &q);
+
+    v4d s = sin_poly_(r), c = cos_poly_(r);
+
+    v4d res = select_((q & 1) != 0, -c / s, s / c);
+
+    return trig_fixup_(x, res, tan);
+}
+
+static double ctg_scalar_(double x)
+{
+    return 1.f / tan(x);
+}
+
+static v4d ctg_(v4d x)
+{
+    v4d r; v4i q;
+    trig_reduce_(x, &r, &q);
+
+    v4d s = sin_poly_(r), c = cos_poly_(r);
+
+    v4d res = select_((q & 1) != 0, -s / c, c / s);
+
+    return trig_fixup_(x, res, ctg_scalar_);
+}
+
+/// sinh for |x| < 1 without cancellation
+static inline v4d sh_poly_(v4d x)
+{
+    v4d z = x * x;
+
+    v4d p = splat_(1.0 / 121645100408832000);
+    p = p * z + 1.0 / 355687428096000;
+    p = p * z + 1.0 / 1307674368000;
+    p = p * z + 1.0 / 6227020800;
+    p = p * z + 1.0 / 39916800;
+    p = p * z + 1.0 / 362880;
+    p = p * z + 1.0 / 5040;
+    p = p * z + 1.0 / 120;
+    p = p * z + 1.0 / 6;
+
+    return x + x * z * p;
+}
+
+/// e^|x| / 2 without overflowing for |x| slightly above EXP_MAX
+static inline v4d half_exp_(v4d ax)
+{
+    v4d e = exp_(select_(ax < EXP_MAX, ax, ax * 0.5));
+    return select_(ax < EXP_MAX, e * 0.5, e * (e * 0.5));
+}
+
+static v4d sh_(v4d x)
+{
+    v4d ax = abs_(x);
+
+    v4d e = exp_(ax);
+    v4d big = select_(ax < HYPERB_BIG, (e - 1 / e) * 0.5, half_exp_(ax));
+
+    v4d res = select_(ax < 1, sh_poly_(x), copysign_(big, x));
+    return select_(x != x, x, res);
+}
+
+static v4d ch_(v4d x)
+{
+    v4d ax = abs_(x);
+
+    v4d e = exp_(ax);
+    v4d res = select_(ax < HYPERB_BIG, (e + 1 / e) * 0.5, half_exp_(ax));
+
+    return select_(x != x, x, res);
+}
+
+static v4d th_(v4d x)
+{
+    v4d ax = abs_(x);
+
+    v4d t = exp_(-2 * select_(ax < HYPERB_BIG, ax, splat_(0)));
+    v4d big = (1 - t) / (1 + t);
+
+    v4d sh = sh_poly_(x);
+    v4d small = sh / sqrt_(1 + sh * sh);
+
+    v4d res = select_(ax < 1, small, copysign_(select_(ax < HYPERB_BIG, big, splat_(1)), x));
+    return select_(x != x, x, res);
+}
+
+static const double ATAN_HI[] = {
+    4.63647609000806093515e-01,
+    7.85398163397448278999e-01,
+    9.82793723247329054082e-01,
+    1.57079632679489655800e+00,
+};
+
+static const double ATAN_LO[] = {
+    2.26987774529616870924e-17,
+    3.06161699786838301793e-17,
+    1.39033110312309984516e-17,
+    6.12323399573676603587e-17,
+};
+
+static const double ATAN_T[] = {
+     3.33333333333329318027e-01,
+    -1.99999999998764832476e-01,
+     1.42857142725034663711e-01,
+    -1.11111104054623557880e-01,
+     9.09088713343650656196e-02,
+    -7.69187620504482999495e-02,
+     6.66107313738753120669e-02,
+    -5.83357013379057348645e-02,
+     4.97687799461593236017e-02,
+    -3.65315727442169155270e-02,
+     1.62858201153657823623e-02,
+};
+
+static v4d atan_(v4d x)
+{
+    v4d ax = abs_(x);
+
+    v4i r0 = ax < 0.4375;
+    v4i r1 = ~r0 & (ax < 0.6875);
+    v4i r2 = ~r0 & ~r1 & (ax < 1.1875);
+    v4i r3 = ~r0 & ~r1 & ~r2 & (ax < 2.4375);
+    v4i r4 = ~(r0 | r1 | r2 | r3);
+
+    v4d t = ax;
+    t = select_(r1, (2 * ax - 1) / (2 + ax), t);
+    t = select_(r2, (ax - 1) / (ax + 1), t);
+    t = select_(r3, (ax - 1.5) / (1 + 1.5 * ax), t);
+    t = select_(r4, -1 / ax, t);
+
+    v4d hi = splat_(0), lo = splat_(0);
+    hi = select_(r1, splat_(ATAN_HI[0]), hi); lo = select_(r1, splat_(ATAN_LO[0]), lo);
+    hi = select_(r2, splat_(ATAN_HI[1]), hi); lo = select_(r2, splat_(ATAN_LO[1]), lo);
+    hi = select_(r3, splat_(ATAN_HI[2]), hi); lo = select_(r3, splat_(ATAN_LO[2]), lo);
+    hi = select_(r4, splat_(ATAN_HI[3]), hi); lo = select_(r4, splat_(ATAN_LO[3]), lo);
+
+    v4d z = t * t;
+    v4d w = z * z;
+
+    v4d s1 = z * (ATAN_T[0] + w * (ATAN_T[2] + w * (ATAN_T[4] + w * (ATAN_T[6] + w * (ATAN_T[8] + w * ATAN_T[10])))));
+    v4d s2 = w * (ATAN_T[1] + w * (ATAN_T[3] + w * (ATAN_T[5] + w * (ATAN_T[7] + w * ATAN_T[9]))));
+
+    v4d res = select_(r0, t - t * (s1 + s2), hi - ((t * (s1 + s2) - lo) - t));
+
+    res = copysign_(res, x);
+    return select_(x != x, x, res);
+}
+
+static v4d asin_(v4d x)
+{
+    return atan_(x / sqrt_((1 - x) * (1 + x)));
+}
+
+static v4d acos_(v4d x)
+{
+    return 2 * atan_(sqrt_((1 - x) / (1 + x)));
+}
+
+static inline v4d powi_(v4d a, long power)
+{
+    unsigned long n = (unsigned long)(power < 0 ? -power : power);
+    v4d res = splat_(1);
+
+    while(n) {
+        if(n & 1) res *= a;
+        a *= a;
+        n >>= 1;
+    }
+
+    return power < 0 ? 1 / res : res;
+}
+
+/// integer exponents per lane, |b| <= POWI_MAX
+static inline v4d powi_lanes_(v4d a, v4d b)
+{
+    v4i n = __builtin_convertvector(abs_(b), v4i);
+    v4d res = splat_(1);
+
+    while(any_(n != 0)) {
+        res = select_((n & 1) != 0, res * a, res);
+        a *= a;
+        n >>= 1;
+    }
+
+    return select_(b < 0, 1 / res, res);
+}
+
+static v4d pow_(v4d a, v4d b)
+{
+    v4d bi = round_(b);
+    v4i is_int = (bi == b) & (abs_(b) < 0x1p52);
+    v4i is_odd = is_int & ((__builtin_convertvector(select_(is_int, bi, splat_(0)), v4i) & 1) != 0);
+
+    v4d res = exp_(b * log_(abs_(a)));
+    res = select_(is_odd & (a < 0), -res, res);
+    res = select_(~is_int & (a < 0), splat_(NAN), res);
+
+    v4i small_int = is_int & (abs_(b) <= POWI_MAX);
+    if(any_(small_int))
+        res = select_(small_int, powi_lanes_(a, select_(small_int, b, splat_(0))), res);
+
+    res = select_(b == 0, splat_(1), res);
+    res = select_(a == 1, splat_(1), res);
+
+    return res;
+}
+
+#define VMATH_UNARY_(name, kernel)                                  \
+    void name(const double* a, double* res, size_t n)               \
+    {                                                               \
+        utils_assert(n % VMATH_LANES == 0);                         \
+        for(size_t i = 0; i < n; i += VMATH_LANES)                  \
+            store_(res + i, kernel(load_(a + i)));                  \
+    }
+
+#define VMATH_BINARY_(name, expr)                                   \
+    void name(const double* a, const double* b, double* res, size_t n) \
+    {                                                               \
+        utils_assert(n % VMATH_LANES == 0);                         \
+        for(size_t i = 0; i < n; i += VMATH_LANES) {                \
+            v4d x = load_(a + i), y = load_(b + i);                 \
+            store_(res + i, expr);                                  \
+        }                                                           \
+    }
+
+VMATH_BINARY_(vmath_add, x + y)
+VMATH_BINARY_(vmath_sub, x - y)
+VMATH_BINARY_(vmath_mul, x * y)
+VMATH_BINARY_(vmath_div, x / y)
+VMATH_BINARY_(vmath_pow, pow_(x, y))
+
+VMATH_UNARY_(vmath_exp,  exp_)
+VMATH_UNARY_(vmath_sqrt, sqrt_)
+VMATH_UNARY_(vmath_log,  log_)
+VMATH_UNARY_(vmath_sin,  sin_)
+VMATH_UNARY_(vmath_cos,  cos_)
+VMATH_UNARY_(vmath_tan,  tan_)
+VMATH_UNARY_(vmath_ctg,  ctg_)
+VMATH_UNARY_(vmath_sh,   sh_)
+VMATH_UNARY_(vmath_ch,   ch_)
+VMATH_UNARY_(vmath_th,   th_)
+VMATH_UNARY_(vmath_asin, asin_)
+VMATH_UNARY_(vmath_acos, acos_)
+VMATH_UNARY_(vmath_atan, atan_)
+
+void vmath_actg(const double* a, double* res, size_t n)
+{
+    utils_assert(n % VMATH_LANES == 0);
+
+    for(size_t i = 0; i < n; i += VMATH_LANES)
+        store_(res + i, 1.f / atan_(load_(a + i)));
+}
+
+void vmath_powi(const double* a, long power, double* res, size_t n)
+{
+    utils_assert(n % VMATH_LANES == 0);
+
+    for(size_t i = 0; i < n; i += VMATH_LANES)
+        store_(res + i, powi_(load_(a + i), power));
+}
+
+#undef VMATH_UNARY_
+#undef VMATH_BINARY_
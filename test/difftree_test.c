@@ -0,0 +1,831 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "difftree.h"
+#include "difftree_batch.h"
+#include "difftree_cache.h"
+#include "difftree_codegen.h"
+#include "difftree_grad.h"
+#include "difftree_image.h"
+#include "difftree_interval.h"
+#include "difftree_jet.h"
+#include "difftree_jit.h"
+#include "difftree_math.h"
+#include "difftree_optimize.h"
+#include "difftree_tape.h"
+#include "logutils.h"
+#include "memutils.h"
+
+/* Every back end is checked against the tree interpreter diff_tree_evaluate_at
+ * on the lines of the input file and on the expressions below, in tree and
+ * in DAG mode. Derivatives are checked against symbolic differentiation.
+ *
+ *     difftree_test.out <expressions file> <scratch directory>
+ */
+
+#define LOG_CTG_TEST "DIFFTREE_TEST"
+
+/// variable of slot 0 is sampled, others keep their values
+static const double TEST_XS[] = { 0.3, 0.75, 1.6, 2.2 };
+static const double TEST_VAR_VAL      = 0.6;
+static const double TEST_VAR_VAL_STEP = 0.35;
+
+/// x and y, a derivative tree is kept for every one of them
+static const size_t TEST_VARS_MAX = 2;
+
+static const double TEST_TOL       = 1e-9;
+static const double TEST_DERIV_TOL = 1e-7;
+
+static const double TEST_INTERVAL_WIDTH   = 0.05;
+static const size_t TEST_INTERVAL_SAMPLES = 8;
+
+/// k! overflows a double past 170
+static const size_t TEST_TAYLOR_POWER = 200;
+/// x - x0 = 1, so high powers do not underflow in the interpreter
+static const double TEST_TAYLOR_X     = 1;
+
+/// deep enough to overflow the call stack of a recursive walk
+static const size_t TEST_DEEP_LEN = 100000;
+
+/// more lines than two windows of the batch mode, bad and blank lines fail alone
+static const size_t TEST_BATCH_LINES   = 10000;
+static const size_t TEST_BATCH_THREADS = 3;
+static const char* const TEST_BATCH_EXPRS[] = {
+    "x*y^2", "x*", "sin(x)+y", "", "42", "((x", "x^3/(1+y^2)", "cos(x)^3", "y^y*x",
+};
+
+/// cover every operator and repeated subexpressions for CSE
+static const char* const TEST_EXPRS[] = {
+    "ln(x^2+1)*sqrt(x^2+y^2)-exp(0-x/3)",
+    "tan(x/4)+ctg(x/4+1)-sh(x/2)*ch(y)+th(x*y)",
+    "arcsin(x/4)+arccos(y/4)+arctg(x*y)",
+    "sin(x)*sin(x)+cos(x)*cos(x)*(sin(x)+1)",
+    "x^3/(1+y^2)-(x+y)^2*(x-y)+x^y",
+    // powers without the variable differentiated by
+    "x*y^2",
+    "x*y^y+sqrt(y^2)",
+    // jet coefficients far below 1 are not zero
+    "10000000000*2^(x/10000000000)",
+};
+
+typedef struct TestCase
+{
+    DiffTree* dtree;
+    const char* expr;
+    bool is_dag;
+    const char* scratch;
+
+    /// values of variables by slot, slot 0 is set to every one of TEST_XS
+    double vals[TEST_VARS_MAX];
+    size_t vars_cnt;
+
+    /// first derivatives by every variable and the second one by slot 0
+    DiffTree* derivs[TEST_VARS_MAX];
+    DiffTree* deriv2;
+
+} TestCase;
+
+static size_t CHECKS_CNT   = 0;
+static size_t FAILURES_CNT = 0;
+
+#define TEST_CHECK_(test_, cond_, ...) \
+    test_check_(test_, cond_, __LINE__, __VA_ARGS__)
+
+static void test_check_(const TestCase* test, bool cond, int line, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void test_expr_(const char* expr, size_t len, bool is_dag, const char* scratch);
+
+static void test_tape_(TestCase* test);
+
+static void test_grad_(TestCase* test);
+
+static void test_jit_(TestCase* test);
+
+static void test_kernel_(TestCase* test);
+
+static void test_interval_(TestCase* test);
+
+static void test_jet_(TestCase* test);
+
+static void test_image_(TestCase* test);
+
+static void test_cache_(TestCase* test);
+
+static void test_rule_(const char* expr, double x, double expected);
+
+static void test_taylor_(void);
+
+static void test_deep_(bool is_sum, bool is_dag);
+
+static void test_batch_(const char* scratch);
+
+static bool test_batch_value_(const char* str, size_t len, bool differentiate, double* value);
+
+static bool test_close_(double expected, double got, double tol);
+
+static double test_eval_(const DiffTree* dtree, const double* vals);
+
+int main(int argc, char** argv)
+{
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <expressions file> <scratch directory>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    utils_init_log_file("test.html", LOG_DIR);
+    diff_tree_set_latex_dump_enabled(false);
+
+    FILE* file = fopen(argv[1], "r");
+    if(!file) {
+        UTILS_LOGE(LOG_CTG_TEST, "can't open %s", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    char* line = NULL;
+    size_t cap = 0;
+
+    for(ssize_t len = 0; (len = getline(&line, &cap, file)) > 0;) {
+        if(len > 1) {
+            test_expr_(line, (size_t) len, false, argv[2]);
+            test_expr_(line, (size_t) len, true,  argv[2]);
+        }
+    }
+
+    NFREE(line);
+    fclose(file);
+
+    for(size_t i = 0; i < SIZEOF(TEST_EXPRS); ++i) {
+        test_expr_(TEST_EXPRS[i], strlen(TEST_EXPRS[i]), false, argv[2]);
+        test_expr_(TEST_EXPRS[i], strlen(TEST_EXPRS[i]), true,  argv[2]);
+    }
+
+    // rewrite rules must hold where they apply, 0^u is 1 at u = 0
+    test_rule_("0^x", 0, 1);
+    test_rule_("0^x", 2, 0);
+
+    test_taylor_();
+
+    for(int is_dag = 0; is_dag < 2; ++is_dag) {
+        test_deep_(true,  is_dag);
+        test_deep_(false, is_dag);
+    }
+
+    test_batch_(argv[2]);
+
+    printf("%zu checks, %zu failed\n", CHECKS_CNT, FAILURES_CNT);
+
+    utils_end_log();
+
+    return FAILURES_CNT ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void test_check_(const TestCase* test, bool cond, int line, const char* fmt, ...)
+{
+    ++CHECKS_CNT;
+
+    if(cond)
+        return;
+
+    ++FAILURES_CNT;
+
+    fprintf(stderr, "%s:%d: %.*s%s: ", __FILE__, line, (int) strcspn(test->expr, "\n"), test->expr, test->is_dag ? " (dag)" : "");
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fputc('\n', stderr);
+}
+
+static void test_expr_(const char* expr, size_t len, bool is_dag, const char* scratch)
+{
+    DiffTree dtree   = DIFF_TREE_INIT_LIST;
+    DiffTree deriv_x = DIFF_TREE_INIT_LIST;
+    DiffTree deriv_y = DIFF_TREE_INIT_LIST;
+    DiffTree deriv2  = DIFF_TREE_INIT_LIST;
+
+    TestCase test = {
+        .dtree    = &dtree,
+        .expr     = expr,
+        .is_dag   = is_dag,
+        .scratch  = scratch,
+        .vals     = {},
+        .vars_cnt = 0,
+        .derivs   = { &deriv_x, &deriv_y },
+        .deriv2   = &deriv2,
+    };
+
+    size_t failures_cnt = FAILURES_CNT;
+
+    DiffTreeErr err = diff_tree_ctor(&dtree);
+    if(err == DIFF_TREE_ERR_NONE && is_dag)
+        err = diff_tree_enable_dag(&dtree);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_sread(&dtree, expr, len);
+
+    TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE, "parse: %s", diff_tree_strerr(err));
+    TEST_CHECK_(&test, dtree.vars.size > 0 && dtree.vars.size <= TEST_VARS_MAX, "%zu variables", dtree.vars.size);
+
+    if(err != DIFF_TREE_ERR_NONE || dtree.vars.size == 0 || dtree.vars.size > TEST_VARS_MAX) {
+        diff_tree_dtor(&dtree);
+        return;
+    }
+
+    test.vars_cnt = dtree.vars.size;
+
+    for(size_t i = 0; i < test.vars_cnt; ++i) {
+        test.vals[i] = TEST_VAR_VAL + TEST_VAR_VAL_STEP * (double) i;
+        diff_tree_variable(&dtree, i)->val = test.vals[i];
+
+        diff_tree_copy_tree(&dtree, test.derivs[i]);
+        err = diff_tree_differentiate_tree_n(test.derivs[i], diff_tree_variable(test.derivs[i], i), 1);
+        TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE && test.derivs[i]->root->left, "d/d%s: %s",
+                    diff_tree_variable(&dtree, i)->name, diff_tree_strerr(err));
+    }
+
+    diff_tree_copy_tree(&dtree, &deriv2);
+    err = diff_tree_differentiate_tree_n(&deriv2, diff_tree_variable(&deriv2, 0), 2);
+    TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE && deriv2.root->left, "second derivative: %s", diff_tree_strerr(err));
+
+    // back ends are compared with derivatives, they must be there
+    if(FAILURES_CNT == failures_cnt) {
+        test_tape_(&test);
+        test_grad_(&test);
+        test_jit_(&test);
+        test_kernel_(&test);
+        test_interval_(&test);
+        test_jet_(&test);
+        test_image_(&test);
+        test_cache_(&test);
+    }
+
+    diff_tree_dtor(&deriv_x);
+    diff_tree_dtor(&deriv_y);
+    diff_tree_dtor(&deriv2);
+    diff_tree_dtor(&dtree);
+}
+
+static void test_tape_(TestCase* test)
+{
+    DiffTreeTape tape = {};
+
+    DiffTreeErr err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, test->dtree, test->dtree->root->left);
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "tape: %s", diff_tree_strerr(err));
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        double ys[SIZEOF(TEST_XS)] = {};
+        diff_tree_tape_eval_batch(&tape, test->vals, 0, TEST_XS, ys, NULL, SIZEOF(TEST_XS));
+
+        for(size_t i = 0; i < SIZEOF(TEST_XS); ++i) {
+            test->vals[0] = TEST_XS[i];
+
+            double expected = test_eval_(test->dtree, test->vals);
+            double got      = diff_tree_tape_eval(&tape, test->vals);
+
+            TEST_CHECK_(test, test_close_(expected, got, TEST_TOL), "tape at %g: %.17g, expected %.17g", TEST_XS[i], got, expected);
+            TEST_CHECK_(test, test_close_(expected, ys[i], TEST_TOL), "tape batch at %g: %.17g, expected %.17g", TEST_XS[i], ys[i], expected);
+        }
+    }
+
+    diff_tree_tape_dtor(&tape);
+}
+
+static void test_grad_(TestCase* test)
+{
+    DiffTreeTape tape = {};
+
+    DiffTreeErr err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, test->dtree, test->dtree->root->left);
+
+    for(size_t i = 0; err == DIFF_TREE_ERR_NONE && i < SIZEOF(TEST_XS); ++i) {
+        test->vals[0] = TEST_XS[i];
+
+        double value = 0, grad[TEST_VARS_MAX] = {};
+        err = diff_tree_grad_eval(&tape, test->vals, &value, grad);
+        if(err != DIFF_TREE_ERR_NONE)
+            break;
+
+        double expected = test_eval_(test->dtree, test->vals);
+        TEST_CHECK_(test, test_close_(expected, value, TEST_TOL), "grad value at %g: %.17g, expected %.17g", TEST_XS[i], value, expected);
+
+        for(size_t slot = 0; slot < test->vars_cnt; ++slot) {
+            expected = test_eval_(test->derivs[slot], test->vals);
+
+            TEST_CHECK_(test, test_close_(expected, grad[slot], TEST_DERIV_TOL), "df/d%s at %g: %.17g, expected %.17g",
+                        diff_tree_variable(test->dtree, slot)->name, TEST_XS[i], grad[slot], expected);
+        }
+    }
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "grad: %s", diff_tree_strerr(err));
+
+    diff_tree_tape_dtor(&tape);
+}
+
+static void test_jit_(TestCase* test)
+{
+    DiffTreeTape tape = {};
+    DiffTreeJit jit = {};
+
+    DiffTreeErr err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, test->dtree, test->dtree->root->left);
+
+    diff_tree_jit_ctor(&jit, &tape, 0);
+
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_jit_compile(&jit);
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "jit: %s", diff_tree_strerr(err));
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        double ys[SIZEOF(TEST_XS)] = {};
+        diff_tree_jit_eval_batch(&jit, test->vals, TEST_XS, ys, SIZEOF(TEST_XS));
+
+        for(size_t i = 0; i < SIZEOF(TEST_XS); ++i) {
+            test->vals[0] = TEST_XS[i];
+
+            double expected = test_eval_(test->dtree, test->vals);
+            TEST_CHECK_(test, test_close_(expected, ys[i], TEST_TOL), "jit%s at %g: %.17g, expected %.17g",
+                        diff_tree_jit_is_native(&jit) ? "" : " fallback", TEST_XS[i], ys[i], expected);
+        }
+    }
+
+    diff_tree_jit_dtor(&jit);
+    diff_tree_tape_dtor(&tape);
+}
+
+static void test_kernel_(TestCase* test)
+{
+    char dir[DIFF_TREE_CACHE_DIR_LEN_MAX] = "";
+    snprintf(dir, sizeof(dir), "%s/kernels", test->scratch);
+
+    DiffTreeCodegenFn fns[] = {
+        { .name = "difftree_f",  .node = test->dtree->root->left },
+        { .name = "difftree_df", .node = test->derivs[0]->root->left },
+    };
+
+    DiffTreeKernel kernel = {};
+    DiffTreeErr err = diff_tree_kernel_load(&kernel, test->dtree, fns, SIZEOF(fns), dir);
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "kernel: %s", diff_tree_strerr(err));
+
+    DiffTreeKernelFn f = err == DIFF_TREE_ERR_NONE ? diff_tree_kernel_fn(&kernel, "difftree_f")  : NULL;
+    DiffTreeKernelFn df = err == DIFF_TREE_ERR_NONE ? diff_tree_kernel_fn(&kernel, "difftree_df") : NULL;
+    DiffTreeKernelBatchFn f_batch = err == DIFF_TREE_ERR_NONE ? diff_tree_kernel_batch_fn(&kernel, "difftree_f") : NULL;
+
+    if(err == DIFF_TREE_ERR_NONE)
+        TEST_CHECK_(test, f && df && f_batch, "kernel has no difftree_f, difftree_df or difftree_f_batch");
+
+    if(f && df && f_batch) {
+        double ys[SIZEOF(TEST_XS)] = {};
+        f_batch(test->vals, 0, TEST_XS, ys, SIZEOF(TEST_XS));
+
+        for(size_t i = 0; i < SIZEOF(TEST_XS); ++i) {
+            test->vals[0] = TEST_XS[i];
+
+            double expected = test_eval_(test->dtree, test->vals);
+            TEST_CHECK_(test, test_close_(expected, f(test->vals), TEST_TOL), "kernel at %g: %.17g, expected %.17g", TEST_XS[i], f(test->vals), expected);
+            TEST_CHECK_(test, test_close_(expected, ys[i], TEST_TOL), "kernel batch at %g: %.17g, expected %.17g", TEST_XS[i], ys[i], expected);
+
+            expected = test_eval_(test->derivs[0], test->vals);
+            TEST_CHECK_(test, test_close_(expected, df(test->vals), TEST_TOL), "kernel derivative at %g: %.17g, expected %.17g", TEST_XS[i], df(test->vals), expected);
+        }
+    }
+
+    diff_tree_kernel_unload(&kernel);
+}
+
+/// @brief an interval of a point holds the value, a narrow one holds samples inside it
+static void test_interval_(TestCase* test)
+{
+    DiffTreeTape tape = {};
+
+    DiffTreeErr err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, test->dtree, test->dtree->root->left);
+
+    DiffTreeInterval vars[TEST_VARS_MAX] = {};
+    for(size_t i = 0; i < test->vars_cnt; ++i)
+        vars[i] = { .lo = test->vals[i], .hi = test->vals[i], .partial = false };
+
+    for(size_t i = 0; err == DIFF_TREE_ERR_NONE && i < SIZEOF(TEST_XS); ++i) {
+        vars[0] = { .lo = TEST_XS[i], .hi = TEST_XS[i] + TEST_INTERVAL_WIDTH, .partial = false };
+
+        DiffTreeInterval res = {};
+        err = diff_tree_interval_eval(&tape, vars, &res);
+        if(err != DIFF_TREE_ERR_NONE || res.partial)
+            continue;
+
+        for(size_t k = 0; k <= TEST_INTERVAL_SAMPLES; ++k) {
+            test->vals[0] = TEST_XS[i] + TEST_INTERVAL_WIDTH * (double) k / (double) TEST_INTERVAL_SAMPLES;
+
+            double y = test_eval_(test->dtree, test->vals);
+            TEST_CHECK_(test, res.lo <= y && y <= res.hi, "interval [%g, %g]: %.17g out of [%.17g, %.17g]",
+                        vars[0].lo, vars[0].hi, y, res.lo, res.hi);
+        }
+    }
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "interval: %s", diff_tree_strerr(err));
+
+    diff_tree_tape_dtor(&tape);
+}
+
+/// @brief Taylor coefficients are f, f' and f''/2
+static void test_jet_(TestCase* test)
+{
+    DiffTreeTape tape = {};
+
+    DiffTreeErr err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, test->dtree, test->dtree->root->left);
+
+    for(size_t i = 0; err == DIFF_TREE_ERR_NONE && i < SIZEOF(TEST_XS); ++i) {
+        test->vals[0] = TEST_XS[i];
+
+        double coeffs[3] = {};
+        err = diff_tree_jet_eval(&tape, test->vals, 0, SIZEOF(coeffs) - 1, coeffs);
+        if(err != DIFF_TREE_ERR_NONE)
+            break;
+
+        double expected[] = {
+            test_eval_(test->dtree, test->vals),
+            test_eval_(test->derivs[0], test->vals),
+            test_eval_(test->deriv2, test->vals) / 2,
+        };
+
+        for(size_t k = 0; k < SIZEOF(coeffs); ++k)
+            TEST_CHECK_(test, test_close_(expected[k], coeffs[k], TEST_DERIV_TOL), "jet coefficient %zu at %g: %.17g, expected %.17g",
+                        k, TEST_XS[i], coeffs[k], expected[k]);
+    }
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "jet: %s", diff_tree_strerr(err));
+
+    diff_tree_tape_dtor(&tape);
+}
+
+/// @brief the image reads back as the same expression, a corrupted one is rejected
+static void test_image_(TestCase* test)
+{
+    char path[DIFF_TREE_CACHE_DIR_LEN_MAX] = "";
+    snprintf(path, sizeof(path), "%s/expr.img", test->scratch);
+
+    DiffTreeErr err = diff_tree_fwrite(test->dtree, path);
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "image write: %s", diff_tree_strerr(err));
+
+    DiffTree back = DIFF_TREE_INIT_LIST;
+
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_ctor(&back);
+    if(err == DIFF_TREE_ERR_NONE && test->is_dag)
+        err = diff_tree_enable_dag(&back);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_fread_image(&back, path);
+
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "image read: %s", diff_tree_strerr(err));
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        TEST_CHECK_(test, diff_tree_subtree_hash(test->dtree, test->dtree->root->left) == diff_tree_subtree_hash(&back, back.root->left),
+                    "image reads back as another expression");
+
+        for(size_t i = 0; i < SIZEOF(TEST_XS); ++i) {
+            test->vals[0] = TEST_XS[i];
+
+            double expected = test_eval_(test->dtree, test->vals);
+            double got      = test_eval_(&back, test->vals);
+            TEST_CHECK_(test, test_close_(expected, got, 0), "image at %g: %.17g, expected %.17g", TEST_XS[i], got, expected);
+        }
+    }
+
+    diff_tree_dtor(&back);
+
+    FILE* file = err == DIFF_TREE_ERR_NONE ? fopen(path, "r+b") : NULL;
+    if(!file)
+        return;
+
+    // a flipped byte in the middle of the nodes is caught by the checksum
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, size / 2, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, size / 2, SEEK_SET);
+    fputc(byte ^ 0x5A, file);
+    fclose(file);
+
+    DiffTree corrupted = DIFF_TREE_INIT_LIST;
+
+    err = diff_tree_ctor(&corrupted);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_fread_image(&corrupted, path);
+
+    TEST_CHECK_(test, err != DIFF_TREE_ERR_NONE, "corrupted image is read");
+
+    diff_tree_dtor(&corrupted);
+}
+
+/// @brief a stored entry is found by its key only
+static void test_cache_(TestCase* test)
+{
+    char path[DIFF_TREE_CACHE_DIR_LEN_MAX] = "", dir[DIFF_TREE_CACHE_DIR_LEN_MAX] = "";
+    snprintf(path, sizeof(path), "%s/cache", test->scratch);
+
+    DiffTreeErr err = diff_tree_cache_dir(path, dir);
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "cache directory: %s", diff_tree_strerr(err));
+    if(err != DIFF_TREE_ERR_NONE)
+        return;
+
+    DiffTreeNode* expr  = test->dtree->root->left;
+    DiffTreeNode* deriv = test->derivs[0]->root->left;
+
+    DiffTreeCacheKey key = {
+        .expr_hash = diff_tree_subtree_hash(test->dtree, expr),
+        .slot      = 0,
+        .order     = 1,
+        .power     = 2,
+        .x0        = test->vals[0],
+        .symbolic  = test->is_dag,
+    };
+
+    DiffTreeCacheEntry entry = { .expr = expr, .deriv = deriv, .taylor = deriv };
+
+    err = diff_tree_cache_store(dir, &key, test->dtree, &entry);
+    TEST_CHECK_(test, err == DIFF_TREE_ERR_NONE, "cache store: %s", diff_tree_strerr(err));
+
+    DiffTreeCacheEntry cached = {};
+    bool is_hit = diff_tree_cache_load(dir, &key, test->dtree, expr, &cached);
+
+    TEST_CHECK_(test, is_hit, "stored entry is not found");
+    if(is_hit)
+        TEST_CHECK_(test, diff_tree_subtree_hash(test->dtree, cached.deriv) == diff_tree_subtree_hash(test->derivs[0], deriv),
+                    "cache returns another derivative");
+
+    key.power++;
+    TEST_CHECK_(test, !diff_tree_cache_load(dir, &key, test->dtree, expr, &cached), "entry is found by another key");
+}
+
+/// @brief relative for large values; NaN equals NaN, infinities of one sign are equal
+/// @brief the optimized expression of one variable is evaluated at x
+static void test_rule_(const char* expr, double x, double expected)
+{
+    DiffTree dtree = DIFF_TREE_INIT_LIST;
+
+    TestCase test = {
+        .dtree    = &dtree,
+        .expr     = expr,
+        .is_dag   = false,
+        .scratch  = NULL,
+        .vals     = { x },
+        .vars_cnt = 1,
+        .derivs   = {},
+        .deriv2   = NULL,
+    };
+
+    DiffTreeErr err = diff_tree_ctor(&dtree);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_sread(&dtree, expr, strlen(expr));
+
+    TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE, "parse: %s", diff_tree_strerr(err));
+
+    if(err == DIFF_TREE_ERR_NONE) {
+        diff_tree_optimize(&dtree);
+
+        double got = test_eval_(&dtree, test.vals);
+        TEST_CHECK_(&test, test_close_(expected, got, TEST_TOL), "optimized at %g: %.17g, expected %.17g", x, got, expected);
+    }
+
+    diff_tree_dtor(&dtree);
+}
+
+/// @brief Taylor polynom of exp(x) at 0 of a high order is checked against exp
+static void test_taylor_(void)
+{
+    DiffTree dtree = DIFF_TREE_INIT_LIST;
+
+    TestCase test = {
+        .dtree    = &dtree,
+        .expr     = "taylor of exp(x)",
+        .is_dag   = false,
+        .scratch  = NULL,
+        .vals     = { TEST_TAYLOR_X },
+        .vars_cnt = 1,
+        .derivs   = {},
+        .deriv2   = NULL,
+    };
+
+    DiffTreeErr err = diff_tree_ctor(&dtree);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_sread(&dtree, "exp(x)", strlen("exp(x)"));
+
+    DiffTreeNode* polynom = NULL;
+    if(err == DIFF_TREE_ERR_NONE)
+        polynom = diff_tree_taylor_expansion(&dtree, diff_tree_variable(&dtree, 0), 0, TEST_TAYLOR_POWER);
+
+    TEST_CHECK_(&test, polynom, "no polynom: %s", diff_tree_strerr(err));
+
+    if(polynom) {
+        double got = diff_tree_evaluate_at(&dtree, polynom, test.vals);
+        TEST_CHECK_(&test, test_close_(exp(TEST_TAYLOR_X), got, TEST_TOL), "order %zu at %g: %.17g, expected %.17g",
+                    TEST_TAYLOR_POWER, TEST_TAYLOR_X, got, exp(TEST_TAYLOR_X));
+    }
+
+    diff_tree_dtor(&dtree);
+}
+
+/// @brief x+x+...+x and sin(sin(...sin(x))) are compiled to a tape and checked
+///        against closed forms, the tree interpreter is recursive
+static void test_deep_(bool is_sum, bool is_dag)
+{
+    const size_t len = is_sum ? 2 * TEST_DEEP_LEN : 5 * TEST_DEEP_LEN + 1;
+
+    char* expr = TYPED_CALLOC(len + 1, char);
+    if(!expr)
+        return;
+
+    for(size_t i = 0; i < TEST_DEEP_LEN; ++i) {
+        if(is_sum)
+            memcpy(expr + 2 * i, i ? "+x" : " x", 2);
+        else {
+            memcpy(expr + 4 * i, "sin(", 4);
+            expr[len - 1 - i] = ')';
+        }
+    }
+    if(!is_sum)
+        expr[4 * TEST_DEEP_LEN] = 'x';
+
+    DiffTree dtree = DIFF_TREE_INIT_LIST;
+    DiffTreeTape tape = {};
+
+    TestCase test = {
+        .dtree    = &dtree,
+        .expr     = is_sum ? "deep sum" : "deep sin",
+        .is_dag   = is_dag,
+        .scratch  = NULL,
+        .vals     = {},
+        .vars_cnt = 0,
+        .derivs   = {},
+        .deriv2   = NULL,
+    };
+
+    DiffTreeErr err = diff_tree_ctor(&dtree);
+    if(err == DIFF_TREE_ERR_NONE && is_dag)
+        err = diff_tree_enable_dag(&dtree);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_sread(&dtree, expr, len);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_ctor(&tape);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_tape_compile(&tape, &dtree, dtree.root->left);
+
+    TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE, "tape: %s", diff_tree_strerr(err));
+
+    for(size_t i = 0; err == DIFF_TREE_ERR_NONE && i < SIZEOF(TEST_XS); ++i) {
+        double x = TEST_XS[i];
+        double expected = is_sum ? (double) TEST_DEEP_LEN * x : x;
+        double expected_deriv = is_sum ? (double) TEST_DEEP_LEN : 1;
+
+        for(size_t j = 0; !is_sum && j < TEST_DEEP_LEN; ++j) {
+            expected_deriv *= cos(expected);
+            expected = sin(expected);
+        }
+
+        double value = 0, grad = 0;
+        err = diff_tree_grad_eval(&tape, &x, &value, &grad);
+
+        double got = diff_tree_tape_eval(&tape, &x);
+
+        TEST_CHECK_(&test, test_close_(expected, got, TEST_TOL), "tape at %g: %.17g, expected %.17g", x, got, expected);
+        TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE && test_close_(expected_deriv, grad, TEST_DERIV_TOL),
+                    "df/dx at %g: %.17g, expected %.17g", x, grad, expected_deriv);
+    }
+
+    diff_tree_tape_dtor(&tape);
+    diff_tree_dtor(&dtree);
+    NFREE(expr);
+}
+
+/// @brief batch output is compared line by line with derivatives of its input
+static void test_batch_(const char* scratch)
+{
+    TestCase test = {
+        .dtree    = NULL,
+        .expr     = "batch",
+        .is_dag   = false,
+        .scratch  = scratch,
+        .vals     = {},
+        .vars_cnt = 0,
+        .derivs   = {},
+        .deriv2   = NULL,
+    };
+
+    char in[DIFF_TREE_CACHE_DIR_LEN_MAX]  = "";
+    char out[DIFF_TREE_CACHE_DIR_LEN_MAX] = "";
+    snprintf(in,  sizeof(in),  "%s/batch.txt", scratch);
+    snprintf(out, sizeof(out), "%s/batch.out", scratch);
+
+    double expected[SIZEOF(TEST_BATCH_EXPRS)] = {};
+    bool is_valid[SIZEOF(TEST_BATCH_EXPRS)]   = {};
+
+    for(size_t i = 0; i < SIZEOF(TEST_BATCH_EXPRS); ++i)
+        is_valid[i] = test_batch_value_(TEST_BATCH_EXPRS[i], strlen(TEST_BATCH_EXPRS[i]), true, &expected[i]);
+
+    FILE* file = fopen(in, "w");
+    TEST_CHECK_(&test, file, "can't open %s", in);
+    if(!file)
+        return;
+
+    for(size_t i = 0; i < TEST_BATCH_LINES; ++i)
+        fprintf(file, "%s\n", TEST_BATCH_EXPRS[i % SIZEOF(TEST_BATCH_EXPRS)]);
+
+    fclose(file);
+
+    DiffTreeErr err = diff_tree_batch(in, out, TEST_BATCH_THREADS, false);
+    TEST_CHECK_(&test, err == DIFF_TREE_ERR_NONE, "%s", diff_tree_strerr(err));
+
+    file = fopen(out, "r");
+    TEST_CHECK_(&test, file, "can't open %s", out);
+    if(!file)
+        return;
+
+    char* line = NULL;
+    size_t cap = 0;
+
+    size_t lines_cnt  = 0;
+    size_t mismatches = 0;
+    size_t first      = 0;
+
+    for(ssize_t len = 0; (len = getline(&line, &cap, file)) > 0; ++lines_cnt) {
+        size_t ind = lines_cnt % SIZEOF(TEST_BATCH_EXPRS);
+        double got = 0;
+
+        bool is_same = false;
+        if(!*TEST_BATCH_EXPRS[ind])
+            is_same = len == 1;
+        else if(!is_valid[ind])
+            is_same = strncmp(line, "error:", strlen("error:")) == 0;
+        else
+            is_same = test_batch_value_(line, (size_t) len, false, &got) && test_close_(expected[ind], got, TEST_TOL);
+
+        if(!is_same && mismatches++ == 0)
+            first = lines_cnt;
+    }
+
+    NFREE(line);
+    fclose(file);
+
+    TEST_CHECK_(&test, lines_cnt == TEST_BATCH_LINES, "%zu lines of %zu", lines_cnt, TEST_BATCH_LINES);
+    TEST_CHECK_(&test, mismatches == 0, "%zu lines differ, first is %zu", mismatches, first + 1);
+}
+
+/// @brief value of an expression or of its derivative by the first variable,
+///        variables take values by name, as slots differ between expressions
+static bool test_batch_value_(const char* str, size_t len, bool differentiate, double* value)
+{
+    DiffTree dtree = DIFF_TREE_INIT_LIST;
+
+    DiffTreeErr err = diff_tree_ctor(&dtree);
+    if(err == DIFF_TREE_ERR_NONE)
+        err = diff_tree_sread(&dtree, str, len);
+
+    if(err == DIFF_TREE_ERR_NONE && differentiate && dtree.vars.size > 0)
+        err = diff_tree_differentiate_tree_n(&dtree, diff_tree_variable(&dtree, 0), 1);
+
+    bool is_valid = err == DIFF_TREE_ERR_NONE && dtree.vars.size <= TEST_VARS_MAX;
+
+    if(is_valid && differentiate && dtree.vars.size == 0)
+        *value = 0;
+    else if(is_valid) {
+        double vals[TEST_VARS_MAX] = {};
+        for(size_t i = 0; i < dtree.vars.size; ++i)
+            vals[i] = strcmp(diff_tree_variable(&dtree, i)->name, "y") == 0 ? TEST_VAR_VAL + TEST_VAR_VAL_STEP : TEST_VAR_VAL;
+
+        *value = test_eval_(&dtree, vals);
+    }
+
+    diff_tree_dtor(&dtree);
+
+    return is_valid;
+}
+
+static bool test_close_(double expected, double got, double tol)
+{
+    if(isnan(expected) || isnan(got))
+        return isnan(expected) && isnan(got);
+
+    if(isinf(expected) || isinf(got))
+        return isinf(expected) && isinf(got) && signbit(expected) == signbit(got);
+
+    return fabs(expected - got) <= tol * fmax(1, fabs(expected));
+}
+
+static double test_eval_(const DiffTree* dtree, const double* vals)
+{
+    return diff_tree_evaluate_at(dtree, dtree->root->left, vals);
+}